@@ -202,6 +202,36 @@ void Connection::PullFromStreamOrMapping()
         }
         else if (outmmap_file.get())
         {
+                //The previously queued data has been sent
+                if (outmmap_queuedsize)
+                {
+                        if (outmmap_sendfile)
+                        {
+                                outmmap_offset += outmmap_queuedsize;
+                                webserver->sent_zerocopy_bytes += outmmap_queuedsize;
+                        }
+                        else
+                        {
+                                webserver->sent_mapped_bytes += outmmap_queuedsize;
+                        }
+                        outmmap_queuedsize = 0;
+                }
+
+                if (outmmap_sendfile)
+                {
+                        if (outmmap_offset >= range_limit) //we're done sending
+                        {
+                                outmmap_file.reset();
+                        }
+                        else
+                        {
+                                outmmap_queuedsize = std::min<uint64_t>(range_limit - outmmap_offset, SendFileBlockSize);
+                                WS_PRINT("Sending " << outmmap_queuedsize << " bytes at offset " << outmmap_offset << " using sendfile");
+                                final_senddata.push_back(Blex::Dispatcher::SendData(outmmap_file->GetFileHandle(), outmmap_offset, outmmap_queuedsize));
+                        }
+                        return;
+                }
+
                 //Undo current mapping
                 if(outmmap_mapping)
                 {
@@ -257,6 +287,7 @@ void Connection::PullFromStreamOrMapping()
 
                         uint8_t const *bufferstart = static_cast<uint8_t const*>(outmmap_mapping) + buffer_start;
                         final_senddata.push_back(Blex::Dispatcher::SendData(bufferstart, tosend));
+                        outmmap_queuedsize = tosend;
                 }
         }
 }
@@ -254,7 +254,6 @@ void Connection::SendStream(std::unique_ptr<Blex::Stream> &to_send, Blex::FileOf
         }
 }
 
-//ADDME: Don't map everything at once, instead stream the mapping, or even better: TransmitFile/sendfile
 void Connection::SendFile(std::string const &filename)
 {
         if (GetRequestParser().GetProtocolMethod() == Methods::Head)
@@ -378,8 +377,11 @@ void Connection::SendFile(std::string const &filename)
                         range_limit = filelen;
                 }
 
-                //Round up to mapping size
-                outmmap_offset = range_start - (range_start % MmapBufferSize);
+                /* Plain connections can send the file straight from the page cache. Secure
+                   connections need the data in userspace for encryption, they get it through
+                   memory mappings which we round to the mapping size */
+                outmmap_sendfile = !IsConnectionSecure();
+                outmmap_offset = outmmap_sendfile ? range_start : range_start - (range_start % MmapBufferSize);
                 outmmap_length = filelen;
 
                 PrepareResponse(range_limit - range_start);
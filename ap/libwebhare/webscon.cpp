@@ -1269,6 +1269,8 @@ void Connection::ResetNewRequest()
                 outmmap_file.reset(0);
         }
         outmmap_mapping = NULL;
+        outmmap_sendfile = false;
+        outmmap_queuedsize = 0;
         outstream_str.reset();
         connection.config.reset();
         connection.binding=NULL;
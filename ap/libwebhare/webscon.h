@@ -12,6 +12,9 @@ const unsigned StreamBufferSize = 16384;
 
 const unsigned MmapBufferSize = 65536;
 
+/// Maximum size of a single sendfile block (the dispatcher sends it in smaller parts)
+const unsigned SendFileBlockSize = 64*1024*1024;
+
 /** A segmented buffer, useful for storing large quantities of webserver output
     data, while avoiding large resizes */
 class SegmentedBuffer
@@ -670,6 +673,10 @@ class BLEXLIB_PUBLIC Connection : public Blex::Dispatcher::Connection
         unsigned outmmap_mappedsize;
         ///Current memory mapping file length
         uint64_t outmmap_length;
+        ///Send the file with sendfile instead of through memory mappings. outmmap_offset is then the offset of the next block to send
+        bool outmmap_sendfile;
+        ///Number of bytes queued from the file, still being sent
+        unsigned outmmap_queuedsize;
         ///Range start
         uint64_t range_start;
         ///Range limit
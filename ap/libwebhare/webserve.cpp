@@ -94,6 +94,8 @@ WebSite::WebSite(std::string const &_folder)
 Server::Server (std::string const &_tmpdir,AccessLogFunction const &_accesslogfunction, ErrorLogFunction const &_errorlogfunction)
 : uploadfs(Blex::CreateTempName(Blex::MergePath(_tmpdir, "uploads-")), true)
 , boottime(Blex::DateTime::Now())
+, sent_zerocopy_bytes(0)
+, sent_mapped_bytes(0)
 , dispatcher( std::bind(&Server::CreateConnection,this,std::placeholders::_1) )
 , accesslogfunction(_accesslogfunction)
 , errorlogfunction(_errorlogfunction)
@@ -187,9 +189,9 @@ bool Server::InterruptHandler(int sig)
         return dispatcher.InterruptHandler(sig);
 }
 
-void Server::MainLoop(unsigned numworkers)
+void Server::MainLoop(unsigned numworkers, unsigned numreactors)
 {
-        dispatcher.Start(numworkers, InitialIdleGrace, false);
+        dispatcher.Start(numworkers, InitialIdleGrace, false, numreactors);
 }
 
 Blex::DateTime Server::GetBootTime() const
@@ -197,6 +199,14 @@ Blex::DateTime Server::GetBootTime() const
         return boottime;
 }
 
+FileTransmitStats Server::GetFileTransmitStats() const
+{
+        FileTransmitStats stats;
+        stats.zerocopy_bytes = sent_zerocopy_bytes;
+        stats.mapped_bytes = sent_mapped_bytes;
+        return stats;
+}
+
 StatusData::StatusData(unsigned _code, std::string const &_title, std::string const &_description)
 : code(_code)
 , title(_title)
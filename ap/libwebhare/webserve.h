@@ -9,6 +9,7 @@
 #include <blex/dispat.h>
 #include <blex/context.h>
 #include <blex/complexfs.h>
+#include <atomic>
 #include <harescript/vm/hsvm_processmgr.h>
 #include "whcore.h"
 #include "requestparser.h"
@@ -301,6 +302,15 @@ struct StatusData
         std::string description;
 };
 
+/** Statistics about files sent with SendFile */
+struct FileTransmitStats
+{
+        ///Bytes sent straight from the page cache (sendfile), without copying them through userspace
+        uint64_t zerocopy_bytes;
+        ///Bytes sent through memory mappings (secure connections)
+        uint64_t mapped_bytes;
+};
+
 typedef std::function< void(Connection&,unsigned,uint64_t) > AccessLogFunction;
 typedef std::function< void(Blex::SocketAddress const &,std::string const&) > ErrorLogFunction;
 
@@ -337,8 +347,10 @@ class BLEXLIB_PUBLIC Server
             @param newconfig Config structure that will be copied for the new configuration*/
         bool ApplyConfig(ServerConfigPtr newconfig, std::vector<Blex::Dispatcher::ListenAddress> *broken_listeners);
 
-        /** Run the webserver */
-        void MainLoop(unsigned numworkers);
+        /** Run the webserver
+            @param numworkers Number of worker threads per reactor
+            @param numreactors Number of dispatcher reactors */
+        void MainLoop(unsigned numworkers, unsigned numreactors = 1);
 
         /** Asynchronous interrupt function (called on SIGINT) */
         bool InterruptHandler(int sig);
@@ -346,6 +358,9 @@ class BLEXLIB_PUBLIC Server
         /** Get the server boot time */
         Blex::DateTime GetBootTime() const;
 
+        /** Get statistics about the files sent. Thread-safe */
+        FileTransmitStats GetFileTransmitStats() const;
+
         Blex::ContextRegistrator& GetRequestRegistrator()
         { return requestregistrator; }
 
@@ -401,6 +416,11 @@ class BLEXLIB_PUBLIC Server
         ///Webserver's boot time
         const Blex::DateTime boottime;
 
+        ///Bytes of files sent using sendfile
+        std::atomic< uint64_t > sent_zerocopy_bytes;
+        ///Bytes of files sent through memory mappings
+        std::atomic< uint64_t > sent_mapped_bytes;
+
         typedef Blex::InterlockedData<ServerConfigPtr,Blex::Mutex> ServerConfigPtrHolder;
 
         ServerConfigPtrHolder currentconfig;
@@ -371,6 +371,7 @@ int WebHareServer::Execute ()
                 Blex::OptionParser::Option::Switch("d", false),
                 Blex::OptionParser::Option::Switch("secondary", false),
                 Blex::OptionParser::Option::StringOpt("dispatchers"),
+                Blex::OptionParser::Option::StringOpt("reactors"),
                 Blex::OptionParser::Option::ListEnd()
         };
 
@@ -399,6 +400,20 @@ int WebHareServer::Execute ()
                 numdispatchers = res.first;
         }
 
+        // Number of reactors to spread the dispatchers over, each with its own listening sockets and poll loop
+        unsigned numreactors = 1; //default
+        if (optparse.Exists("reactors"))
+        {
+                std::string val = optparse.StringOpt("reactors");
+                std::pair< unsigned, std::string::iterator > res = Blex::DecodeUnsignedNumber< int32_t >(val.begin(), val.end(), 10U);
+                if(res.second != val.end() || res.first < 1)
+                {
+                        Blex::ErrStream() << "Invalid --reactors value\n";
+                        return EXIT_FAILURE;
+                }
+                numreactors = res.first;
+        }
+
         if(webhare->GetLogRoot().empty())
             throw std::runtime_error("WebHare not properly configured or environment variables not set");
 
@@ -454,7 +469,7 @@ int WebHareServer::Execute ()
 
                 webserver->RegisterConnectionCategory(1, 5000); //FIXME remove entirely, move responsibility complete to jobmgr
                 webserver->RegisterConnectionCategory(2, 500); // Category for RPCs
-                webserver->MainLoop(numdispatchers);
+                webserver->MainLoop(std::max<unsigned>(1, numdispatchers / numreactors), numreactors);
         }
 
         webhare->FlushManagerQueue();
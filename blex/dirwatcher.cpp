@@ -0,0 +1,115 @@
+#include <blex/blexlib.h>
+
+
+#include "dirwatcher.h"
+#include <unistd.h>
+
+#if defined(PLATFORM_LINUX) && !defined(__EMSCRIPTEN__)
+ #define HAVE_INOTIFY
+ #include <sys/inotify.h>
+ #include <sys/ioctl.h>
+#endif
+
+namespace Blex
+{
+
+namespace
+{
+#ifdef HAVE_INOTIFY
+///Events that indicate a change of a file in a watched directory, or of the directory itself
+uint32_t const WatchedEvents = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO;
+#endif
+} //end anonymous namespace
+
+DirectoryWatcher::DirectoryWatcher()
+: fd(-1)
+, generation(1)
+{
+#ifdef HAVE_INOTIFY
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+        if (fd != -1)
+            close(fd);
+}
+
+bool DirectoryWatcher::Watch(std::string const &path)
+{
+#ifdef HAVE_INOTIFY
+        if (fd == -1 || path.empty())
+            return false;
+
+        LockedData::WriteRef lock(data);
+        if (lock->dirs.count(path))
+            return true;
+
+        int wd = inotify_add_watch(fd, path.c_str(), WatchedEvents | IN_ONLYDIR);
+        if (wd == -1)
+            return false;
+
+        //inotify returns the existing descriptor when a directory is watched through another path
+        auto itr = lock->watches.find(wd);
+        if (itr != lock->watches.end())
+            lock->dirs.erase(itr->second);
+
+        lock->dirs[path] = wd;
+        lock->watches[wd] = path;
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+}
+
+uint64_t DirectoryWatcher::Poll()
+{
+#ifdef HAVE_INOTIFY
+        if (fd == -1)
+            return generation;
+
+        alignas(inotify_event) char buffer[4096];
+        while (true)
+        {
+                /* Increase the generation before consuming the events. Another thread polling
+                   concurrently may find no events left to read, it must see the new generation */
+                int pending = 0;
+                if (ioctl(fd, FIONREAD, &pending) != 0 || pending <= 0)
+                    break;
+
+                ++generation;
+
+                ssize_t len = read(fd, buffer, sizeof(buffer));
+                if (len <= 0)
+                    break;
+
+                //Forget the watches that have been removed (eg. because the directory was deleted)
+                for (char *ptr = buffer; ptr < buffer + len;)
+                {
+                        inotify_event const *event = reinterpret_cast< inotify_event const * >(ptr);
+                        if (event->mask & IN_IGNORED)
+                        {
+                                LockedData::WriteRef lock(data);
+                                auto itr = lock->watches.find(event->wd);
+                                if (itr != lock->watches.end())
+                                {
+                                        lock->dirs.erase(itr->second);
+                                        lock->watches.erase(itr);
+                                }
+                        }
+                        ptr += sizeof(inotify_event) + event->len;
+                }
+        }
+#endif
+        return generation;
+}
+
+unsigned DirectoryWatcher::GetNumWatches() const
+{
+        LockedData::ReadRef lock(data);
+        return lock->dirs.size();
+}
+
+} //end namespace Blex
@@ -0,0 +1,81 @@
+#ifndef blex_dirwatcher
+#define blex_dirwatcher
+
+#ifndef blex_blexlib
+#include "blexlib.h"
+#endif
+#ifndef blex_threads
+#include "threads.h"
+#endif
+#include <atomic>
+#include <unordered_map>
+
+namespace Blex
+{
+
+/** DirectoryWatcher keeps track of changes to the files in a set of
+    directories, using inotify. It doesn't report which file changed, it
+    only counts changes: every batch of change notifications increases the
+    change generation. A cache can remember the generation at which it
+    last validated an entry, and skip validation as long as the generation
+    stays the same.
+
+    Watches are only placed on directories, not on subdirectories. When
+    inotify isn't available (or on other platforms than Linux) the watcher
+    is inactive and all watch requests fail.
+
+    Multithreading considerations:
+    All functions are thread-safe. Poll is lock-free when no changes are
+    pending.
+*/
+class BLEXLIB_PUBLIC DirectoryWatcher
+{
+        public:
+        DirectoryWatcher();
+        ~DirectoryWatcher();
+
+        /** Is this watcher able to watch directories? */
+        bool IsActive() const
+        {
+                return fd != -1;
+        }
+
+        /** Start watching a directory. Ignored when the directory is already watched
+            @param path Directory to watch
+            @return True if the directory is being watched, false if it doesn't
+                    exist or couldn't be watched (eg. when the watch limit was reached) */
+        bool Watch(std::string const &path);
+
+        /** Process pending change notifications
+            @return Current change generation. Changes to a watched directory
+                    that happen after this call increase the generation returned
+                    by later calls */
+        uint64_t Poll();
+
+        /** Get the number of watched directories */
+        unsigned GetNumWatches() const;
+
+        private:
+        struct Data
+        {
+                ///Watch descriptors by directory
+                std::unordered_map< std::string, int > dirs;
+                ///Directories by watch descriptor
+                std::unordered_map< int, std::string > watches;
+        };
+        typedef InterlockedData< Data, Mutex > LockedData;
+
+        ///Inotify descriptor, -1 if not available
+        int fd;
+        ///Number of processed change notification batches
+        std::atomic< uint64_t > generation;
+
+        LockedData data;
+
+        DirectoryWatcher(DirectoryWatcher const &) = delete;
+        DirectoryWatcher& operator=(DirectoryWatcher const &) = delete;
+};
+
+} //end namespace Blex
+
+#endif
@@ -23,7 +23,10 @@ unsigned DequeueOutgoingBytes(QueuedSendData &data, unsigned numbytes)
                 else
                 {
                         data.begin()->buflen-=numbytes;
-                        data.begin()->buffer=static_cast<uint8_t const*>(data.begin()->buffer) + numbytes;
+                        if (data.begin()->filehandle != -1)
+                            data.begin()->fileoffset += numbytes;
+                        else
+                            data.begin()->buffer=static_cast<uint8_t const*>(data.begin()->buffer) + numbytes;
                         numbytes=0;
                 }
         }
@@ -128,7 +131,7 @@ void Connection::SetNagle(bool newvalue)
 }
 
 Dispatcher::Dispatcher(const CreateConnectionCallback &create_connection)
-: impl (new Detail::Main(create_connection))
+: impl (new Detail::ReactorSet(create_connection))
 {
 }
 
@@ -137,9 +140,9 @@ Dispatcher::~Dispatcher()
         delete impl;
 }
 
-void Dispatcher::Start(unsigned numworkers, int idlegrace, bool signalnewconnection)
+void Dispatcher::Start(unsigned numworkers, int idlegrace, bool signalnewconnection, unsigned numreactors)
 {
-        impl->Start(numworkers, idlegrace, signalnewconnection);
+        impl->Start(numworkers, idlegrace, signalnewconnection, numreactors);
 }
 
 unsigned Dispatcher::CountListeningPorts() const
@@ -149,7 +152,7 @@ unsigned Dispatcher::CountListeningPorts() const
 
 bool Dispatcher::InterruptHandler(int sig)
 {
-        return impl->os.InterruptHandler(sig);
+        return impl->InterruptHandler(sig);
 }
 
 void Dispatcher::UpdateListenPorts(unsigned numports, ListenAddress const ports[])
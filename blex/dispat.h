@@ -34,6 +34,7 @@ namespace Detail
 {
         class Main;
         class Conn;
+        class ReactorSet;
 }
 
 class Dispatcher;
@@ -83,7 +84,18 @@ namespace TaskState
 struct SendData
 {
         SendData(void const *buffer, unsigned buflen)
-        : buffer(buffer),buflen(buflen)
+        : buffer(buffer),buflen(buflen),filehandle(-1),fileoffset(0)
+        {
+        }
+
+        /** Send a part of a file, straight from the page cache (using sendfile)
+            instead of through a buffer. Only supported on connections that aren't
+            secure, the file must remain open until the block has been sent.
+            @param filehandle File to send data from
+            @param fileoffset Offset of the first byte to send
+            @param buflen Number of bytes to send */
+        SendData(FileHandle filehandle, FileOffset fileoffset, unsigned buflen)
+        : buffer(NULL),buflen(buflen),filehandle(filehandle),fileoffset(fileoffset)
         {
         }
 
@@ -91,6 +103,10 @@ struct SendData
         void const *buffer;
         ///Length of the bufer to send
         unsigned buflen;
+        ///File to send the data from, -1 if sending from buffer
+        FileHandle filehandle;
+        ///Offset in the file of the data to send
+        FileOffset fileoffset;
 };
 
 /** List of pending outbut buffers */
@@ -330,8 +346,12 @@ class BLEXLIB_PUBLIC Dispatcher
                              After this time, a GracePeriodElapsed event will be fired for any
                              idle connection.
             @param signalnewconnection Send a signal when a new connection comes in
+            @param numreactors Number of independent reactors to run. Every reactor has its own listening
+                               sockets (sharing the port with SO_REUSEPORT), poll loop, connection table,
+                               timer and numworkers worker threads, and is pinned to a CPU. Named pipe and
+                               UNIX socket listeners are only served by the first reactor.
         */
-        void Start (unsigned numworkers, int idlegrace, bool signalnewconnection);
+        void Start (unsigned numworkers, int idlegrace, bool signalnewconnection, unsigned numreactors = 1);
 
         /** Get the number of listening ports actually open. Used to check whether we actually bound to any port */
         unsigned CountListeningPorts() const;
@@ -348,7 +368,7 @@ class BLEXLIB_PUBLIC Dispatcher
         bool RebindSockets(std::vector<ListenAddress> *broken_listeners);
 
         private:
-        Detail::Main *const impl;
+        Detail::ReactorSet *const impl;
 
         friend class Connection;
 };
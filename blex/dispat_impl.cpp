@@ -9,6 +9,11 @@
 #include <errno.h>
 #include <sys/uio.h>
 #include <climits>
+#include <algorithm>
+#ifdef PLATFORM_LINUX
+#include <sched.h>
+#include <sys/sendfile.h>
+#endif
 
 /* GLOBAL LOCK ORDERING:
 
@@ -18,6 +23,7 @@
    shareddata BEFORE statemutex
    statemutex BEFORE itcqueue
    statemutex BEFORE timerdata
+   config     BEFORE shareddata
 */
 
 ///Minimum # of free connection structures
@@ -28,10 +34,73 @@ unsigned const ConnectionAcceptBacklog = 512;
 
 namespace Blex {
 
+Poller::Poller(Backend _backend)
+: backend(Backend::Poll)
+#ifdef PLATFORM_LINUX
+, epollfd(-1)
+, epoll_numevents(0)
+#endif
+{
+#ifdef PLATFORM_LINUX
+        if (_backend == Backend::EPoll)
+        {
+                epollfd = epoll_create1(EPOLL_CLOEXEC);
+                if (epollfd >= 0)
+                {
+                        backend = Backend::EPoll;
+                        epoll_events.resize(256);
+                }
+                else
+                {
+                        DEBUGPRINT("Poller: epoll_create1 failed, falling back to poll: " << strerror(errno));
+                }
+        }
+#else
+        (void)_backend;
+#endif
+}
+
+Poller::~Poller()
+{
+#ifdef PLATFORM_LINUX
+        if (epollfd >= 0)
+            close(epollfd);
+#endif
+}
+
+Poller::Backend Poller::ParseBackend(std::string const &name, Backend defaultbackend)
+{
+        if (name == "poll")
+            return Backend::Poll;
+        if (name == "epoll")
+            return Backend::EPoll;
+        return defaultbackend;
+}
+
+int Poller::GetPollDelay(Blex::DateTime until)
+{
+        if (until == Blex::DateTime::Max()) //infinite wait
+            return -1;
+
+        Blex::DateTime now = Blex::DateTime::Now();
+        if (now>=until)
+            return 0; /*no timeout*/
+
+        Blex::DateTime towait = until-now;
+        return towait.GetDays() ? 86400*1000 : towait.GetMsecs();
+}
+
 /* ADDME: An efficient DISPAT_POLL implementation requires a reverse map in the FD scnaning phase */
 void Poller::UpdateFDWaitMask(int fd, bool update_read, bool want_read, bool update_write, bool want_write)
 {
         //DEBUGDISPATCHPRINT("<D:" << fd << "> Update FD wait mask: read: " << (update_read?want_read?"set":"clear":"-") << " write: " << (update_write?want_write?"set":"clear":"-"));
+#ifdef PLATFORM_LINUX
+        if (backend == Backend::EPoll)
+        {
+                EPollUpdateFDWaitMask(fd, update_read, want_read, update_write, want_write);
+                return;
+        }
+#endif
 
         std::map<int,unsigned>::iterator it = posmask.find(fd);
         unsigned pos;
@@ -80,6 +149,11 @@ void Poller::UpdateFDWaitMask(int fd, bool update_read, bool want_read, bool upd
 }
 bool Poller::IsReadable(int fd)
 {
+#ifdef PLATFORM_LINUX
+        if (backend == Backend::EPoll)
+            return EPollGetRevents(fd) & (EPOLLIN|EPOLLHUP|EPOLLERR);
+#endif
+
         std::map<int,unsigned>::iterator it = posmask.find(fd);
         if (it == posmask.end())
             return false;
@@ -93,6 +167,11 @@ bool Poller::IsReadable(int fd)
 }
 bool Poller::IsHup(int fd)
 {
+#ifdef PLATFORM_LINUX
+        if (backend == Backend::EPoll)
+            return EPollGetRevents(fd) & EPOLLHUP;
+#endif
+
         std::map<int,unsigned>::iterator it = posmask.find(fd);
         if (it == posmask.end())
             return false;
@@ -106,6 +185,11 @@ bool Poller::IsHup(int fd)
 }
 bool Poller::IsWritable(int fd)
 {
+#ifdef PLATFORM_LINUX
+        if (backend == Backend::EPoll)
+            return EPollGetRevents(fd) & (EPOLLOUT|EPOLLHUP|EPOLLERR);
+#endif
+
         std::map<int,unsigned>::iterator it = posmask.find(fd);
         if (it == posmask.end())
             return false;
@@ -124,29 +208,21 @@ bool Poller::IsWritable(int fd)
 }
 
 int Poller::DoPoll(Blex::DateTime until)
+{
+#ifdef PLATFORM_LINUX
+        if (backend == Backend::EPoll)
+            return DoPollEPoll(until);
+#endif
+        return DoPollPoll(until);
+}
+
+int Poller::DoPollPoll(Blex::DateTime until)
 {
         int retval;
 
         while(true)
         {
-                int delay;
-                if (until == Blex::DateTime::Max()) //infinite wait
-                {
-                        delay=-1;
-                }
-                else
-                {
-                        Blex::DateTime now = Blex::DateTime::Now();
-                        if (now>=until)
-                        {
-                                delay=0 /*no timeout*/;
-                        }
-                        else
-                        {
-                                Blex::DateTime towait = until-now;
-                                delay = towait.GetDays() ? 86400*1000 : towait.GetMsecs();
-                        }
-                }
+                int delay = GetPollDelay(until);
 
                 retval = poll(&poll_data[0], poll_data.size(),delay);
 #ifdef DEBUGPOLL
@@ -189,6 +265,27 @@ int Poller::DoPoll(Blex::DateTime until)
 
 void Poller::ExportSignalled(std::vector< SignalledFd > *signalled)
 {
+#ifdef PLATFORM_LINUX
+        if (backend == Backend::EPoll)
+        {
+                for (unsigned i = 0; i < epoll_numevents; ++i)
+                {
+                        uint32_t revents = EPollGetRevents(epoll_events[i].data.fd);
+                        if (!(revents & (EPOLLOUT|EPOLLIN|EPOLLHUP|EPOLLERR)))
+                            continue;
+
+                        SignalledFd sfd;
+                        sfd.fd = epoll_events[i].data.fd;
+                        sfd.is_readable = revents & (EPOLLIN|EPOLLHUP|EPOLLERR);
+                        sfd.is_writable = revents & (EPOLLOUT|EPOLLHUP|EPOLLERR);
+                        sfd.is_hup = revents & EPOLLHUP;
+
+                        signalled->push_back(sfd);
+                }
+                return;
+        }
+#endif
+
         for (std::vector< pollfd >::iterator it = poll_data.begin(), end = poll_data.end(); it != end; ++it)
         {
                 if (!(it->revents & (POLLOUT|POLLIN|POLLHUP|POLLERR)))
@@ -204,6 +301,120 @@ void Poller::ExportSignalled(std::vector< SignalledFd > *signalled)
         }
 }
 
+#ifdef PLATFORM_LINUX
+/* The epoll backend keeps the registered event mask for every descriptor in
+   epoll_fds, so mask updates that don't change anything don't cost a syscall.
+   The events returned by epoll_wait are copied into the same table, so the
+   IsReadable/IsWritable lookups stay O(1) regardless of the number of idle
+   descriptors */
+void Poller::EPollUpdateFDWaitMask(int fd, bool update_read, bool want_read, bool update_write, bool want_write)
+{
+        std::unordered_map<int, EPollFd>::iterator it = epoll_fds.find(fd);
+        uint32_t oldevents = it == epoll_fds.end() ? 0 : it->second.events;
+        uint32_t newevents = oldevents;
+
+        if (update_read)
+            newevents = want_read ? newevents | EPOLLIN : newevents & ~EPOLLIN;
+        if (update_write)
+            newevents = want_write ? newevents | EPOLLOUT : newevents & ~EPOLLOUT;
+
+        if (newevents == oldevents)
+            return;
+
+        if (newevents == 0)
+        {
+                // The descriptor may already have been closed, which removes it from the epoll set
+                if (epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL) != 0 && errno != EBADF && errno != ENOENT)
+                    DEBUGPRINT("Poller: epoll_ctl(DEL) failed for fd " << fd << ": " << strerror(errno));
+                epoll_fds.erase(it);
+                return;
+        }
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = newevents;
+        ev.data.fd = fd;
+
+        if (oldevents == 0)
+        {
+                if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+                {
+                        Blex::ErrStream() << "Poller: cannot add file descriptor " << fd << " to epoll set: " << strerror(errno);
+                        Blex::FatalAbort();
+                }
+                EPollFd &data = epoll_fds[fd];
+                data.events = newevents;
+                data.revents = 0;
+        }
+        else
+        {
+                // ENOENT: the descriptor was closed and its number reused without telling us
+                if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev) != 0
+                    && (errno != ENOENT || epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) != 0))
+                {
+                        Blex::ErrStream() << "Poller: cannot modify file descriptor " << fd << " in epoll set: " << strerror(errno);
+                        Blex::FatalAbort();
+                }
+                it->second.events = newevents;
+        }
+}
+
+uint32_t Poller::EPollGetRevents(int fd) const
+{
+        std::unordered_map<int, EPollFd>::const_iterator it = epoll_fds.find(fd);
+        if (it == epoll_fds.end())
+            return 0;
+        // Report only the events we're still interested in (plus the errors poll() would report too)
+        return it->second.revents & (it->second.events | EPOLLHUP | EPOLLERR);
+}
+
+int Poller::DoPollEPoll(Blex::DateTime until)
+{
+        // Clear the results of the previous wait
+        for (unsigned i = 0; i < epoll_numevents; ++i)
+        {
+                std::unordered_map<int, EPollFd>::iterator it = epoll_fds.find(epoll_events[i].data.fd);
+                if (it != epoll_fds.end())
+                    it->second.revents = 0;
+        }
+        epoll_numevents = 0;
+
+        // Level-triggered, so events that don't fit will be returned by the next wait. Grow the buffer so that won't happen again.
+        if (epoll_events.size() < epoll_fds.size() && epoll_events.size() < 65536)
+            epoll_events.resize(std::min< std::size_t >(std::max< std::size_t >(epoll_events.size() * 2, 256), 65536));
+
+        int retval;
+        while(true)
+        {
+                retval = epoll_wait(epollfd, &epoll_events[0], epoll_events.size(), GetPollDelay(until));
+                if(retval>=0 || errno != EINTR)
+                    break;
+        }
+
+        if (retval<0)
+        {
+#ifdef WHBUILD_DEBUG
+                int old_errno = errno;
+                DEBUGPRINT("Poll error: " << strerror(old_errno) << "\n");
+                errno = old_errno;
+#endif
+                return retval;
+        }
+
+        epoll_numevents = retval;
+        for (unsigned i = 0; i < epoll_numevents; ++i)
+        {
+                std::unordered_map<int, EPollFd>::iterator it = epoll_fds.find(epoll_events[i].data.fd);
+                if (it != epoll_fds.end())
+                    it->second.revents = epoll_events[i].events;
+#ifdef DEBUGPOLL
+                DEBUGPRINT("Poll fd: " << epoll_events[i].data.fd << " revents: " << epoll_events[i].events);
+#endif
+        }
+        return retval;
+}
+#endif
+
 
 namespace Dispatcher {
 namespace Detail {
@@ -220,6 +431,39 @@ ListenAddressList::iterator FindPort(ListenAddressList &ports,ListenAddress cons
         return ports.end();
 }
 
+/** Pin the calling thread to a CPU. Counts only the CPUs we're allowed to run on,
+    wrapping around if there are fewer of them than requested
+    @param cpu Index of the allowed CPU to pin to */
+void PinThreadToCpu(int cpu)
+{
+#ifdef PLATFORM_LINUX
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof allowed, &allowed) != 0)
+        {
+                DEBUGPRINT("Cannot get CPU affinity: " << strerror(errno));
+                return;
+        }
+
+        int numallowed = CPU_COUNT(&allowed);
+        if (numallowed <= 1)
+            return;
+
+        int skip = cpu % numallowed;
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+          if (CPU_ISSET(i, &allowed) && skip-- == 0)
+          {
+                cpu_set_t pinned;
+                CPU_ZERO(&pinned);
+                CPU_SET(i, &pinned);
+                if (sched_setaffinity(0, sizeof pinned, &pinned) != 0)
+                    DEBUGPRINT("Cannot pin thread to CPU " << i << ": " << strerror(errno));
+                return;
+          }
+#else
+        (void)cpu;
+#endif
+}
+
 //Locks: takes none
 void State::Clear()
 {
@@ -448,6 +692,8 @@ Conn::Conn(Main &disp, Connection &conn)
 , dispmain(disp)
 , callbacks(conn)
 , registered_timer(Blex::DateTime::Invalid())
+, registered_timer_fd(-1)
+, expired_timer(Blex::DateTime::Invalid())
 {
         DEBUGDISPATCHPRINT("Connection " << this << " constructing");
 
@@ -580,6 +826,11 @@ void Conn::AsyncQueueSend(unsigned numbufs, SendData const *data) //locks: state
 
                 if(ssl_conn.get())
                 {
+                        // File blocks bypass userspace, so they can't be encrypted
+                        for (unsigned i=0;i<numbufs;++i)
+                          if (data[i].filehandle != -1)
+                            throw std::runtime_error("Cannot send file blocks over a secure connection");
+
                         // Simply schedule the data, but DON'T immediately send it
                         must_wake_up = state.ssl_queueddata.empty();
                         CopyToQueuedData(numbufs, data, &state.ssl_queueddata);
@@ -1046,8 +1297,9 @@ void Conn::QueueRemoteTask(Connection *receiver, std::unique_ptr< Task > &task,
                 }
         }
 
+        // The receiver may belong to another reactor, so wake it up through its own dispatcher
         if (success)
-            dispmain.os.WakeUpConnection(receiver->conn); //locks: itcqueue
+            receiver->conn->dispmain.os.WakeUpConnection(receiver->conn); //locks: itcqueue
         else
             TryReturnTaskToSender(task, TaskState::Failed);
 }
@@ -1096,7 +1348,7 @@ void Conn::TryReturnTaskToSender(std::unique_ptr< Task > &task, TaskState::Type
         }
 
         // Always wakeup
-        dispmain.os.WakeUpConnection(sender); //locks: itcqueue
+        sender->dispmain.os.WakeUpConnection(sender); //locks: itcqueue
 }
 
 void Conn::MarkTaskFinished(Task *task, bool success)
@@ -1217,6 +1469,9 @@ void Conn::SetNagle(bool newvalue)
 
 Main::Main(Dispatcher::CreateConnectionCallback const &callback)
 : os(*this)
+, reuseport(false)
+, primaryreactor(true)
+, pincpu(-1)
 , connectioncallback(callback)
 , timerthread(std::bind(&Main::TimerThreadCode, this))
 {
@@ -1228,6 +1483,19 @@ Main::Main(Dispatcher::CreateConnectionCallback const &callback)
         LockedTimerData::WriteRef lock(timerdata);
         lock->must_abort=false;
         lock->next_checks=Blex::DateTime::Min();
+        lock->wakeup=Blex::DateTime::Invalid();
+}
+
+void Main::PinDedicatedThread()
+{
+        if (pincpu >= 0)
+            PinThreadToCpu(pincpu);
+}
+
+void Main::DedicatedWorkerThreadCode()
+{
+        PinDedicatedThread();
+        os.WorkerThreadCode();
 }
 
 Main::~Main()
@@ -1247,7 +1515,7 @@ void Main::Start(unsigned numworkers, int _idlegrace, bool _signalnewconnection)
         for (unsigned i=0;i<numworkers-1;++i)
         {
                 std::shared_ptr<Blex::Thread> worker;
-                worker.reset(new Blex::Thread(std::bind(&OSData::WorkerThreadCode,&os)));
+                worker.reset(new Blex::Thread(std::bind(&Main::DedicatedWorkerThreadCode,this)));
 
                 if (!worker->Start())
                    throw std::runtime_error("Cannot launch dispatcher worker threads");
@@ -1395,6 +1663,9 @@ void Main::UpdateListenPorts(unsigned numports, ListenAddress const ports[])
 {
         DEBUGDISPATCHPRINT("UpdateListenPorts " << numports << " ports");
         ListenAddressList create_ports(ports,ports+numports);
+        if (!primaryreactor) //only the primary reactor can serve listeners that can't be shared
+            create_ports.erase(std::remove_if(create_ports.begin(), create_ports.end(), [](ListenAddress const &addr) { return addr.sockaddr.IsPath(); }), create_ports.end());
+
         LockedSharedData::WriteRef datalock(shareddata);
 
         //ADDME: Deal with situations where port is the same, but SSL settings changed
@@ -1533,30 +1804,34 @@ void Main::RequestSignal(Blex::DateTime signal_at, int fd, Conn *receiver) //loc
 
         bool require_signal = false;
 
-        // Update the timer data
-        if (receiver->registered_timer != signal_at)
+        // Update the timer data. The timer thread resets registered_timer when the timer expires, so check it under the lock
         {
-                DEBUGDISPATCHPRINT("<D:" << receiver->socket.GetFd() << "> Requestsignal " << receiver << " from " << AnyToString(receiver->registered_timer) << " -> " << AnyToString(signal_at));
-
                 LockedTimerData::WriteRef lock(timerdata);
 
-                if (receiver->registered_timer != Blex::DateTime::Invalid())
-                    lock->warn_connections.erase(std::make_pair(receiver->registered_timer, std::make_pair(fd, receiver)));
+                // Any new request supersedes an expired timer that has not been delivered yet
+                receiver->expired_timer = Blex::DateTime::Invalid();
 
-                receiver->registered_timer = signal_at;
-                if (receiver->registered_timer != Blex::DateTime::Invalid())
+                if (receiver->registered_timer != signal_at)
                 {
-                        // Only need a signal when this will be the new first timer
-                        if (lock->warn_connections.empty())
-                            require_signal = true;
-                        else
-                            require_signal = lock->warn_connections.begin()->first > signal_at;
+                        DEBUGDISPATCHPRINT("<D:" << receiver->socket.GetFd() << "> Requestsignal " << receiver << " from " << AnyToString(receiver->registered_timer) << " -> " << AnyToString(signal_at));
+
+                        receiver->registered_timer = signal_at;
+                        if (receiver->registered_timer != Blex::DateTime::Invalid())
+                        {
+                                receiver->registered_timer_fd = fd;
+                                lock->timers.Arm(receiver, signal_at);
 
-                        lock->warn_connections.insert(std::make_pair(signal_at, std::make_pair(fd, receiver)));
+                                // Only need a signal when the timer thread would sleep past this timer
+                                require_signal = signal_at < lock->wakeup;
+                        }
+                        else
+                        {
+                                lock->timers.Cancel(receiver);
+                        }
                 }
         }
 
-        //Inform the timer thread only when we have a new head of the list
+        //Inform the timer thread only when it must wake up earlier
         if (require_signal)
             timerdata.SignalOne();
 }
@@ -1581,32 +1856,34 @@ void Main::GetNextTodo(Main::TodoItems &to_do) //locks: timerdata
                 }
                 sleep_till = std::min(sleep_till, lock->next_checks);
 
-//                DEBUGPRINT("Waits");
-//                for (std::set< std::pair< DateTime, Conn* > >::iterator it = lock->warn_connections.begin(); it != lock->warn_connections.end(); ++it)
-//                        DEBUGPRINT(" wait " << it->second << " " << AnyToString(it->first));
-
-                //See if any connection wants a signal
-                std::pair< DateTime, std::pair< int, Conn * > > searchlimit(now + DateTime::Msecs(1), std::make_pair(0, (Blex::Dispatcher::Detail::Conn*)0));
-                std::set< std::pair< DateTime, std::pair< int, Conn* > > >::iterator warnlimit = lock->warn_connections.lower_bound(searchlimit);
-
-                for (std::set< std::pair< DateTime, std::pair< int, Conn* > > >::iterator it = lock->warn_connections.begin(); it != warnlimit; ++it)
+                //See if any connection wants a signal. Expired timers are removed from the wheel in one go
+                lock->expired.clear();
+                lock->timers.Advance(now, &lock->expired);
+                for (std::vector< Blex::TimerWheel::Timer * >::iterator it = lock->expired.begin(); it != lock->expired.end(); ++it)
                 {
+                        Conn *conn = static_cast< Conn * >(*it);
+
                         Main::TodoItems::Warning warning;
-                        warning.fd = it->second.first;
-                        warning.conn = it->second.second;
-                        warning.date = it->first;
+                        warning.fd = conn->registered_timer_fd;
+                        warning.conn = conn;
+                        warning.date = conn->registered_timer;
+
+                        // The wheel has unlinked the timer, so a new request for the same date must arm it again
+                        conn->expired_timer = conn->registered_timer;
+                        conn->registered_timer = Blex::DateTime::Invalid();
 
                         to_do.to_warn.push_back(warning);
                 }
 
-                if (warnlimit != lock->warn_connections.end())
-                    sleep_till = std::min(sleep_till, warnlimit->first);
+                sleep_till = std::min(sleep_till, lock->timers.GetNextCheck());
 
                 //Should we wait?
                 if (to_do.abort || to_do.rebind_check || !to_do.to_warn.empty())
                     return;
                 //Wait!
+                lock->wakeup = sleep_till;
                 lock.TimedWait(sleep_till);
+                lock->wakeup = DateTime::Invalid();
         }
 }
 
@@ -1624,19 +1901,24 @@ void Main::TimerThreadCode()
                         RebindSockets(NULL); //locks: shareddata > itcqueue
                 }
 
+                if (todo.to_warn.empty())
+                    continue;
+
+                LockedSharedData::ReadRef lock(shareddata);
                 for (std::vector< TodoItems::Warning >::iterator it = todo.to_warn.begin(), end = todo.to_warn.end(); it != end; ++it)
                 {
                         DEBUGDISPATCHPRINT("<D:" << it->fd << "> Sending timerelapsed to " << it->conn);
 
-                        LockedSharedData::ReadRef lock(shareddata);
-
                         OpenPorts::const_iterator pit = lock->openports.find(it->fd);
                         if (pit != lock->openports.end() && pit->second.conn == it->conn)
                         {
                                 // Port still exists
                                 LockedTimerData::WriteRef lock(timerdata);
-                                if (it->conn->registered_timer == it->date)
-                                    it->conn->AsyncSignal(Signals::TimerElapsed);
+                                if (it->conn->expired_timer == it->date) //not re-armed or cancelled since it expired
+                                {
+                                        it->conn->expired_timer = Blex::DateTime::Invalid();
+                                        it->conn->AsyncSignal(Signals::TimerElapsed);
+                                }
                         }
                 }
         }
@@ -1676,6 +1958,19 @@ bool Main::RebindSockets(std::vector<ListenAddress> *broken_listeners) //locks:
         return allbound;
 }
 
+void Main::SetupAsReactor(bool primary, int cpu)
+{
+        reuseport = true;
+        primaryreactor = primary;
+        pincpu = cpu;
+
+        //Ports bound before we knew we'd share them must allow the other reactors to bind too
+        LockedSharedData::WriteRef datalock(shareddata);
+        for (unsigned i=0;i<datalock->accepts.size();++i)
+          if (datalock->accepts[i]->listening && !datalock->accepts[i]->bindaddress.sockaddr.IsPath())
+            datalock->accepts[i]->acceptsocket.SetReusePort(true);
+}
+
 void Main::AsyncBindingChange()
 {
         LockedTimerData::WriteRef(timerdata)->next_checks=Blex::DateTime::Min();
@@ -1690,6 +1985,9 @@ void Main::AsyncStopTimerThread()
 
 SocketError::Errors Main::BindPort(ListenPort &port) //locks: itcqueue, locked; shareddata
 {
+        if (reuseport)
+            port.acceptsocket.SetReusePort(true);
+
         SocketError::Errors binderror = port.acceptsocket.Bind(port.bindaddress.sockaddr);
         if(binderror != SocketError::NoError)
         {
@@ -1738,8 +2036,126 @@ void Main::AbortAllConnections() //locks: shareddata > statemutex
         }
 }
 
+ReactorSet::ReactorSet(Dispatcher::CreateConnectionCallback const &_callback)
+: callback(_callback)
+, primary(new Main(_callback))
+{
+        reactors.emplace_back(primary);
+#ifdef DISPATCHER_MUTEXCHECKING
+        config.SetupDebugging("ReactorSet::Config");
+#endif
+}
+
+ReactorSet::~ReactorSet()
+{
+}
+
+void ReactorSet::RunReactor(Main *reactor, unsigned numworkers, int idlegrace, bool signalnewconnection)
+{
+        //This thread only runs the reactor, so it can be pinned too
+        reactor->PinDedicatedThread();
+        reactor->Start(numworkers, idlegrace, signalnewconnection);
+}
+
+void ReactorSet::Start(unsigned numworkers, int idlegrace, bool signalnewconnection, unsigned numreactors) //locks: config > shareddata
+{
+        if (numreactors > 1)
+        {
+                LockedConfig::WriteRef lock(config);
+                primary->SetupAsReactor(true, 0);
+                for (unsigned i = reactors.size(); i < numreactors; ++i)
+                {
+                        reactors.emplace_back(new Main(callback));
+                        reactors.back()->SetupAsReactor(false, i);
+                        reactors.back()->UpdateListenPorts(lock->listenports.size(), lock->listenports.data());
+                        reactors.back()->RebindSockets(NULL); //failed binds are retried by the reactor's timer thread
+                }
+        }
+
+        DEBUGDISPATCHPRINT("Launching " << (reactors.size() - 1) << " extra reactors");
+        std::vector< std::unique_ptr< Blex::Thread > > threads;
+        for (unsigned i = 1; i < reactors.size(); ++i)
+        {
+                threads.emplace_back(new Blex::Thread(std::bind(&ReactorSet::RunReactor, reactors[i].get(), numworkers, idlegrace, signalnewconnection)));
+                if (!threads.back()->Start())
+                {
+                        threads.pop_back();
+                        StopReactors(&threads);
+                        throw std::runtime_error("Cannot launch dispatcher reactor threads");
+                }
+        }
+
+        //The primary reactor runs on our thread, and stops when we're interrupted
+        try
+        {
+                primary->Start(numworkers, idlegrace, signalnewconnection);
+        }
+        catch (...)
+        {
+                //The thread destructors would wait forever for reactors that are still running
+                StopReactors(&threads);
+                throw;
+        }
+
+        //Then take the other reactors down with it
+        StopReactors(&threads);
+}
+
+void ReactorSet::StopReactors(std::vector< std::unique_ptr< Blex::Thread > > *threads)
+{
+        for (unsigned i = 0; i < threads->size(); ++i)
+            reactors[i + 1]->os.CancelNextWorker();
+        for (unsigned i = 0; i < threads->size(); ++i)
+            (*threads)[i]->WaitFinish();
+        threads->clear();
+}
+
+unsigned ReactorSet::CountListeningPorts() const
+{
+        return primary->CountListeningPorts();
+}
+
+bool ReactorSet::InterruptHandler(int sig)
+{
+        //Called from a signal, so we can't lock. Stopping the primary reactor stops the others
+        return primary->os.InterruptHandler(sig);
+}
+
+void ReactorSet::UpdateListenPorts(unsigned numports, ListenAddress const ports[]) //locks: config > shareddata
+{
+        LockedConfig::WriteRef lock(config);
+        lock->listenports.assign(ports, ports + numports);
+        for (unsigned i = 0; i < reactors.size(); ++i)
+            reactors[i]->UpdateListenPorts(numports, ports);
+}
+
+bool ReactorSet::RebindSockets(std::vector<ListenAddress> *broken_listeners) //locks: config > shareddata > itcqueue
+{
+        LockedConfig::WriteRef lock(config);
+        bool allbound = primary->RebindSockets(broken_listeners);
+
+        std::vector< ListenAddress > reactor_broken;
+        for (unsigned i = 1; i < reactors.size(); ++i)
+        {
+                allbound = reactors[i]->RebindSockets(broken_listeners ? &reactor_broken : NULL) && allbound;
+                if (broken_listeners)
+                    for (std::vector< ListenAddress >::iterator itr = reactor_broken.begin(); itr != reactor_broken.end(); ++itr)
+                      if (FindPort(*broken_listeners, *itr) == broken_listeners->end())
+                        broken_listeners->push_back(*itr);
+        }
+        return allbound;
+}
+
+/** Poller backend for the dispatcher. Defaults to epoll where available,
+    set WEBHARE_DISPATCHER_POLLER=poll to use the poll() backend */
+Poller::Backend GetDispatcherPollerBackend()
+{
+        return Poller::ParseBackend(Blex::GetEnvironVariable("WEBHARE_DISPATCHER_POLLER"), Poller::Backend::EPoll);
+}
+
 PosixData::PosixData(Main &main)
-: main(main)
+: poller(GetDispatcherPollerBackend())
+, main(main)
 {
 #ifdef DISPATCHER_MUTEXCHECKING
         posixdata.SetupDebugging("Main::PosixData");
@@ -1916,8 +2332,9 @@ void PosixData::ProcessITCQueue()
                                 poller.UpdateFDWaitMask(cmd.data.fd,false,false,true,false);
                                 break;
                         case CloseSocket:
-                                close(cmd.data.fd);
+                                //Unregister before closing, the epoll set would otherwise keep the registration alive if the fd was duplicated
                                 poller.UpdateFDWaitMask(cmd.data.fd,true,false,true,false);
+                                close(cmd.data.fd);
                                 break;
                         case Wakeup:
                                 lock->waiting_conns.push(cmd.data.conn);
@@ -2075,11 +2492,21 @@ void Conn::OS_CancelRequests(StateMutex::ScopedLock */*mylock*/) //locks: itcque
 
 unsigned Conn::OS_TryOutgoingSend() //locks: itcqueue
 {
+        if (!state.queueddata.empty() && state.queueddata[0].filehandle != -1)
+            return OS_TryOutgoingSendFile();
+
         Blex::SemiStaticPodVector< struct iovec, 256 > out_buffers;
         ssize_t totalsize=0;
         bool skippedbuffers = false;
         for (std::vector<SendData>::const_iterator itr=state.queueddata.begin();itr!=state.queueddata.end();++itr)
         {
+                // File blocks are sent separately
+                if (itr->filehandle != -1)
+                {
+                        skippedbuffers = true;
+                        break;
+                }
+
                 //FIXME: Portability: itr->buffer must be unsigned char* on linux, char* on BSD???
                 struct iovec newbuf = { (char*)itr->buffer, itr->buflen };
                 out_buffers.push_back(newbuf);
@@ -2122,6 +2549,44 @@ unsigned Conn::OS_TryOutgoingSend() //locks: itcqueue
         }
 }
 
+unsigned Conn::OS_TryOutgoingSendFile() //locks: itcqueue
+{
+        SendData &block = state.queueddata[0];
+
+        // Don't send too much in one go, so other connections get their turn
+        std::size_t tosend = std::min<std::size_t>(block.buflen, 1024 * 1024);
+#if defined(PLATFORM_LINUX)
+        off_t offset = block.fileoffset;
+        ssize_t bytessent = sendfile(socket.GetFd(), block.filehandle, &offset, tosend);
+#else
+        //No sendfile with Linux semantics, so copy through a buffer. Data read but not sent is read again next time
+        uint8_t buffer[16384];
+        ssize_t bytessent = pread(block.filehandle, buffer, std::min(tosend, sizeof(buffer)), block.fileoffset);
+        if (bytessent > 0)
+            bytessent = send(socket.GetFd(), buffer, bytessent, 0);
+#endif
+        if (bytessent == -1 && errno == EAGAIN)
+        {
+                //blocked, retry later
+                dispmain.os.POSIX_SendCommand(PosixData::IntraThreadCommand(PosixData::AddWriter,socket.GetFd())); //locks: itcqueue
+                DEBUGDISPATCHPRINT("<D:" << socket.GetFd() << "> Sendfile blocked");
+                return 0;
+        }
+        if (bytessent <= 0) //an error, or the file was truncated
+        {
+                DEBUGDISPATCHPRINT("<D:" << socket.GetFd() << "> Write error (from sendfile(), errno: " << errno << ")");
+                GotDisconnection(false); //locks:none
+                return 0;
+        }
+
+        DEBUGDISPATCHPRINT("<D:" << socket.GetFd() << "> Sendfile completed (" << bytessent << " of " << block.buflen << " bytes sent)");
+        bool moreblocks = std::size_t(bytessent) < block.buflen || state.queueddata.size() > 1;
+        unsigned blocks = DequeueOutgoingBytes(state.queueddata,bytessent); //locks:none
+        if (moreblocks)
+            dispmain.os.POSIX_SendCommand(PosixData::IntraThreadCommand(PosixData::AddWriter,socket.GetFd())); //locks: itcqueue
+        return blocks;
+}
+
 bool Conn::OS_HandleEvents(StateMutex::ScopedLock *mylock) //locks: itcqueue
 {
         if (state.flags & State::POSIXInputReady && state.inbuflen < sizeof(inbuf))
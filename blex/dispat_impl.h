@@ -13,6 +13,8 @@
 #include <set>
 #include <sys/poll.h>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include "datetime.h"
 
 #include "crypto.h"
@@ -21,12 +23,25 @@
 #include "threads.h"
 #include "socket.h"
 #include "pipestream.h"
+#include "timerwheel.h"
+
+#ifdef PLATFORM_LINUX
+#include <sys/epoll.h>
+#endif
 
 namespace Blex {
 
 class Poller
 {
         public:
+        /// Mechanism used to wait for file descriptor readiness
+        enum class Backend
+        {
+                /// poll(), rebuilds and scans the full descriptor list on every wait
+                Poll,
+                /// epoll (level-triggered), cost scales with the number of signalled descriptors. Linux only, falls back to Poll elsewhere
+                EPoll
+        };
 
         struct SignalledFd
         {
@@ -36,6 +51,16 @@ class Poller
                 bool is_hup;
         };
 
+        explicit Poller(Backend backend = Backend::Poll);
+        ~Poller();
+
+        /** Parse a backend name ('poll' or 'epoll')
+            @param name Name of the backend
+            @param defaultbackend Backend to return when the name is empty or not recognized */
+        static Backend ParseBackend(std::string const &name, Backend defaultbackend);
+
+        Backend GetBackend() const { return backend; }
+
         void UpdateFDWaitMask(int fd, bool update_read, bool want_read, bool update_write, bool want_write);
         bool IsReadable(int fd);
         bool IsWritable(int fd);
@@ -45,8 +70,36 @@ class Poller
         void ExportSignalled(std::vector< SignalledFd > *signalled);
 
         private:
+        static int GetPollDelay(Blex::DateTime until);
+
+        int DoPollPoll(Blex::DateTime until);
+
+        Backend backend;
+
         std::vector<pollfd> poll_data;
         std::map<int,unsigned> posmask;
+
+#ifdef PLATFORM_LINUX
+        struct EPollFd
+        {
+                /// Events we are registered for
+                uint32_t events;
+                /// Events returned by the last DoPoll
+                uint32_t revents;
+        };
+
+        void EPollUpdateFDWaitMask(int fd, bool update_read, bool want_read, bool update_write, bool want_write);
+        uint32_t EPollGetRevents(int fd) const;
+        int DoPollEPoll(Blex::DateTime until);
+
+        int epollfd;
+        std::unordered_map<int, EPollFd> epoll_fds;
+        std::vector<epoll_event> epoll_events;
+        unsigned epoll_numevents;
+#endif
+
+        Poller(Poller const &) = delete;
+        Poller& operator=(Poller const &) = delete;
 };
 
 
@@ -257,7 +310,7 @@ struct State
 };
 std::ostream& operator <<(std::ostream &out,State const &rhs);
 
-class Conn : public Blex::Detail::EventWaiterBase
+class Conn : public Blex::Detail::EventWaiterBase, private Blex::TimerWheel::Timer
 {
         public:
         ~Conn();
@@ -380,6 +433,10 @@ class Conn : public Blex::Detail::EventWaiterBase
             @return Number of blocks actually sent (remainder may be async scheduled) */
         unsigned OS_TryOutgoingSend();
 
+        /** Try to send the file block at the head of the outgoing data, using sendfile
+            @return Number of blocks actually sent (remainder may be async scheduled) */
+        unsigned OS_TryOutgoingSendFile();
+
         /** Do outgoing send, with a statelock already active */
         bool LockedDoSend();
 
@@ -465,9 +522,15 @@ class Conn : public Blex::Detail::EventWaiterBase
 
         std::vector< Event * > waitevents;
 
-        /// Time this connections has a signal pending (in Main::TimerData::warn_connections list)
+        /// Time this connections has a signal pending (in Main::TimerData::timers wheel)
         Blex::DateTime registered_timer;
 
+        /// Fd of this connection when its timer was set
+        int registered_timer_fd;
+
+        /// Time of the expired timer whose TimerElapsed signal is still to be delivered by the timer thread
+        Blex::DateTime expired_timer;
+
         friend class Main;
         friend class PosixData;
         friend class NTData;
@@ -527,6 +590,17 @@ class Main
             @return True if all sockets are succesfully bound */
         bool RebindSockets(std::vector<ListenAddress> *broken_listeners);
 
+        /** Configure this dispatcher as one of multiple reactors sharing the same listening ports.
+            Must be called before Start
+            @param primary Whether this is the first reactor. Only the first reactor serves listeners
+                           that can't be shared (named pipes, UNIX sockets)
+            @param cpu CPU to pin the worker threads to, -1 to not pin them */
+        void SetupAsReactor(bool primary, int cpu);
+
+        /** Pin the calling thread to the CPU of this reactor, if it has one. Only for threads that do
+            nothing but run this reactor */
+        void PinDedicatedThread();
+
 #if defined(DISPAT_POLL)
         typedef PosixData OSData;
 #endif
@@ -579,6 +653,19 @@ class Main
         /** Initial grace period for idle connections */
         int idlegrace;
 
+        /** Bind listening ports with SO_REUSEPORT (set when running multiple reactors) */
+        bool reuseport;
+
+        /** Serve listening ports that can't be shared between reactors */
+        bool primaryreactor;
+
+        /** CPU to pin the dedicated worker threads to, -1 if not pinned. Start doesn't pin its calling
+            thread, that may be the main thread, and every thread it creates later would inherit the affinity */
+        int pincpu;
+
+        /** Main function of the worker threads started by Start */
+        void DedicatedWorkerThreadCode();
+
         /** Signal new connections? */
         bool signalnewconnection;
 
@@ -616,8 +703,12 @@ class Main
                 bool must_abort;
                 ///When to do our next round of checking?
                 DateTime next_checks;
-                ///A list of connections which require a warning at a specific time
-                std::set< std::pair< DateTime, std::pair< int, Conn* > > > warn_connections;
+                ///Time the timer thread is waiting for, Invalid if it isn't waiting
+                DateTime wakeup;
+                ///Connections which require a warning at a specific time
+                Blex::TimerWheel timers;
+                ///Expired timers, kept to reuse the storage
+                std::vector< Blex::TimerWheel::Timer * > expired;
         };
 
         /** Attempt to bind the accepter to the specified address
@@ -657,6 +748,58 @@ class Main
         Main& operator=(Main const &) = delete;
 };
 
+/** The reactors of a dispatcher. Every reactor is a complete Main, with its
+    own listening sockets, poller, connection table, timer and workers, so
+    reactors don't share any locks. The first reactor runs on the thread calling
+    Start(), the others get their own thread. */
+class ReactorSet
+{
+        public:
+        ReactorSet(Dispatcher::CreateConnectionCallback const &callback);
+        ~ReactorSet();
+
+        void Start(unsigned numworkers, int idlegrace, bool signalnewconnection, unsigned numreactors);
+
+        unsigned CountListeningPorts() const;
+
+        /** Asynchronous interrupt call - intended to be called form SIGINT handler */
+        bool InterruptHandler(int sig);
+
+        void UpdateListenPorts(unsigned numports, ListenAddress const ports[]);
+
+        bool RebindSockets(std::vector<ListenAddress> *broken_listeners);
+
+        private:
+        /** Run a secondary reactor */
+        static void RunReactor(Main *reactor, unsigned numworkers, int idlegrace, bool signalnewconnection);
+
+        /** Stop the secondary reactors and wait for their threads to finish
+            @param threads Threads running the secondary reactors, in reactor order. Cleared on return */
+        void StopReactors(std::vector< std::unique_ptr< Blex::Thread > > *threads);
+
+        Dispatcher::CreateConnectionCallback const callback;
+
+        /** The reactors. The first one is the primary reactor */
+        std::vector< std::unique_ptr< Main > > reactors;
+
+        /** The primary reactor. Never changes, so InterruptHandler can use it
+            without taking a lock. Stopping it stops the other reactors too */
+        Main *const primary;
+
+        struct Config
+        {
+                /// Current listen ports, used to configure reactors created by Start
+                std::vector< ListenAddress > listenports;
+        };
+        typedef InterlockedData< Config, DispatchMutex > LockedConfig;
+
+        /** Serializes listen port updates with reactor creation */
+        LockedConfig config;
+
+        ReactorSet(ReactorSet const &) = delete;
+        ReactorSet& operator=(ReactorSet const &) = delete;
+};
+
 } //end namespace Blex::Dispatcher::Detail
 } //end namespace Blex::Dispatcher
 } //end namespace Blex
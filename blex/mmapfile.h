@@ -80,6 +80,10 @@ class BLEXLIB_PUBLIC MmapFile
         /** Get the current length of this file */
         FileOffset GetFilelength();// throw();
 
+        /** Get the OS's file handle of the file, necessary to use native APIs */
+        FileHandle GetFileHandle()
+        { return filehandle; }
+
         protected:
         bool InternalOpen(std::string const &filename,
                                    bool writeacces,
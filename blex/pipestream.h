@@ -4,6 +4,7 @@
 #include "stream.h"
 #include "threads.h"
 #include "socket.h"
+#include <unordered_map>
 
 namespace Blex
 {
@@ -328,7 +329,7 @@ class BLEXLIB_PUBLIC PipeWaiter : public Detail::EventWaiterBase
 
         struct EventData
         {
-                EventData() : signalled(0), waiting(false), pipe_signalled(false) {}
+                EventData() : signalled(0), waiting(false), pipe_signalled(false), reactor(0) {}
 
                 std::unique_ptr< PipeReadStream > comm_read;
                 std::unique_ptr< PipeWriteStream > comm_write;
@@ -336,12 +337,109 @@ class BLEXLIB_PUBLIC PipeWaiter : public Detail::EventWaiterBase
                 std::vector< Event * > signalled;
                 bool waiting;
                 bool pipe_signalled;
+
+                /// Reactor this waiter is registered with, notified of signalled events
+                PipeReactor *reactor;
         };
 
         typedef Blex::InterlockedData< EventData, Blex::Mutex > LockedEventData;
         LockedEventData eventdata;
 
         friend class Event;
+        friend class PipeReactor;
+};
+
+class Poller;
+
+/** A reactor waits for the pipes, sockets and events of many pipewaiters at
+    once. Waiters stay registered until they are removed, and their file
+    descriptors stay registered with the poller (epoll where available), so a
+    wait only costs time for the waiters that have been signalled.
+
+    The contents of a waiter may not be modified while it is registered, and the
+    pipes, sockets and events it waits for must stay valid until it has been
+    removed. AddWaiter, RemoveWaiter and Wake may be called from any thread, but
+    only one thread may wait at a time. */
+class BLEXLIB_PUBLIC PipeReactor
+{
+        public:
+        PipeReactor();
+        ~PipeReactor();
+
+        /** Register a waiter. If its wait is already satisfied, it will be returned
+            by the next wait.
+            @param waiter Waiter to register */
+        void AddWaiter(PipeWaiter &waiter);
+
+        /** Unregister a waiter. It won't be returned by waits that start after this
+            function has returned.
+            @param waiter Waiter to unregister */
+        void RemoveWaiter(PipeWaiter &waiter);
+
+        /// Interrupt the current wait (or the next one, if no thread is waiting)
+        void Wake();
+
+        /** Wait until any of the registered waiters is signalled. The Got* functions
+            of the returned waiters report what they have been signalled for.
+            @param until Time to wait until
+            @param signalled Filled with the signalled waiters
+            @return True if a waiter was signalled or the wait was interrupted, false if we had a time out */
+        inline bool Wait(Blex::DateTime until, std::vector< PipeWaiter * > *signalled) { return WaitInternal(0, until, signalled); }
+
+        /** Wait simultaneously on a signal in a conditionmutex and on the registered waiters.
+            @param until Time to wait until
+            @param signalled Filled with the signalled waiters
+            @return True if a waiter or the conditionmutex was signalled, false if we had a time out */
+        inline bool ConditionMutexWait(ConditionMutex::AutoLock &lock, Blex::DateTime until, std::vector< PipeWaiter * > *signalled) { return WaitInternal(&lock.conmutex.corecv, until, signalled); }
+        bool ConditionMutexWait(DebugConditionMutex::AutoLock &lock, Blex::DateTime until, std::vector< PipeWaiter * > *signalled);
+
+        private:
+        struct FdUser
+        {
+                PipeWaiter *waiter;
+                bool want_read;
+                bool want_write;
+        };
+
+        struct Data
+        {
+                Data() : woken(false) {}
+
+                /// File descriptors of every registered waiter
+                std::unordered_map< PipeWaiter *, std::vector< int > > waiters;
+
+                /// Registered waiters for every file descriptor
+                std::unordered_map< int, std::vector< FdUser > > fds;
+
+                /// File descriptors whose waiters have changed since the last wait
+                std::vector< int > changedfds;
+
+                /// Waiters signalled by their events, or already satisfied when they were registered
+                std::vector< PipeWaiter * > pending;
+
+                /// Whether the wake pipe has been written to since the last wait
+                bool woken;
+        };
+
+        typedef Blex::InterlockedData< Data, Blex::Mutex > LockedData;
+
+        bool WaitInternal(CoreConditionMutex *conditionmutex, Blex::DateTime until, std::vector< PipeWaiter * > *signalled);
+        void AddFdUser(Data &data, int fd, PipeWaiter &waiter, bool want_read, bool want_write);
+        void RemoveFdUser(Data &data, int fd, PipeWaiter &waiter);
+        /// Update the poller with the changed file descriptors (waiting thread only)
+        void ApplyChanges(Data &data);
+        /// Queue a waiter as signalled and wake the waiting thread
+        void SetWaiterSignalled(PipeWaiter &waiter);
+        void WakeLocked(Data &data);
+
+        LockedData data;
+        std::unique_ptr< PipeSet > wakepipe;
+        std::unique_ptr< Poller > poller;
+
+        PipeReactor(PipeReactor const &) = delete;
+        PipeReactor& operator=(PipeReactor const &) = delete;
+
+        friend class PipeWaiter;
 };
 
 } //end of namespace Blex
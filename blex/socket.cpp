@@ -902,6 +902,7 @@ Socket::Socket(Protocols prot)
 , sock(-1)
 //, sock(socket(AF_INET,prot==Stream ? SOCK_STREAM : SOCK_DGRAM,0)) //FIXME Prevent early allocation of socket for named pipes
 , is_blocking(true)
+, reuse_port(false)
 {
 //        if (sock == INVALID_SOCKET)
 //            throw std::runtime_error("Cannot allocate new socket");
@@ -1074,6 +1075,13 @@ SocketError::Errors Socket::Bind(SocketAddress const &newlocaladdress)
                 DEBUGPRINT("Failed to enable reuse address");
                 return SocketError::UnknownError;
         }
+#ifdef SO_REUSEPORT
+        if (reuse_port && !newlocaladdress.IsPath() && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (SETSOCKOPTCAST)&i, sizeof(int)) == -1)
+        {
+                DEBUGPRINT("Failed to enable reuse port");
+                return SocketError::UnknownError;
+        }
+#endif
 
 #ifdef IPV6_V6ONLY
         i=1;
@@ -1251,6 +1259,23 @@ SocketError::Errors Socket::SetNagle(bool enable)
         return SocketError::NoError;
 }
 
+SocketError::Errors Socket::SetReusePort(bool enable)
+{
+#ifdef SO_REUSEPORT
+        reuse_port = enable;
+        if (sockstate == SClosed || localaddress.IsPath())
+            return SocketError::NoError;
+
+        int val = enable;
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (SETSOCKOPTCAST)&val, sizeof(val)) != 0)
+            return GetLastSocketError();
+
+        return SocketError::NoError;
+#else
+        return enable ? SocketError::InvalidArgument : SocketError::NoError;
+#endif
+}
+
 SocketError::Errors Socket::SetSendBufferSize(uint32_t sendbuffersize)
 {
         if (protocol != Stream)
@@ -1804,6 +1829,18 @@ SocketError::Errors DebugSocket::SetNagle(bool enable)
 
         return retval;
 }
+SocketError::Errors DebugSocket::SetReusePort(bool enable)
+{
+        if (mode>=Calls)
+            SOCKETPRINT("SetReusePort(" << enable << ")");
+
+        SocketError::Errors retval=debuggedsocket.SetReusePort(enable);
+
+        if (mode>=Calls || (mode>=Errors && retval!=SocketError::NoError))
+            SOCKETPRINT("SetReusePort returned " << SocketError::GetErrorText(retval));
+
+        return retval;
+}
 SocketError::Errors DebugSocket::SetSendBufferSize(uint32_t sendbuffersize)
 {
         if (mode>=Calls)
@@ -266,6 +266,10 @@ class BLEXLIB_PUBLIC Socket : public Blex::Stream
         SocketError::Errors TimedConnect(SocketAddress const &remoteaddress, Blex::DateTime maxwait);
 
         SocketError::Errors SetNagle(bool enable);
+        /** Allow multiple sockets to bind to the same address and port (SO_REUSEPORT), the
+            kernel then distributes incoming connections over the listening sockets. Applied
+            at the next Bind, or immediately if the socket is already bound. */
+        SocketError::Errors SetReusePort(bool enable);
         SocketError::Errors SetSendBufferSize(uint32_t sendbuffersize);
         SocketError::Errors SetReceiveBufferSize(uint32_t receivebuffersize);
         SocketError::Errors GetSendBufferSize(uint32_t *buffersize);
@@ -361,6 +365,7 @@ class BLEXLIB_PUBLIC Socket : public Blex::Stream
         std::unique_ptr<SSLConnection> sslconn;
         std::string sni_hostname;
         bool is_blocking;
+        bool reuse_port;
 
         friend class DebugSocket;
 };
@@ -409,6 +414,7 @@ class BLEXLIB_PUBLIC DebugSocket : public Blex::Stream
         SocketError::Errors Bind(SocketAddress const &remoteaddress);
         SocketError::Errors Listen(unsigned backlog=25);
         SocketError::Errors SetNagle(bool enable);
+        SocketError::Errors SetReusePort(bool enable);
         SocketError::Errors SetSendBufferSize(uint32_t sendbuffersize);
         SocketError::Errors SetReceiveBufferSize(uint32_t receivebuffersize);
         SocketError::Errors GetSendBufferSize(uint32_t *buffersize);
@@ -15,6 +15,7 @@
 
 std::string self_app;
 std::string dll_path;
+bool run_benchmarks = false;
 
 bool OnInterrupt(int)
 {
@@ -75,7 +76,7 @@ int UTF8Main(std::vector<std::string> const &args)
                 {
                         if (args.size()<5)
                         {
-                                std::cerr << "Syntax: blextest test <path_to_exe> <path_to_dll> <path_to_testdata> [ <options> [ <testnamemask> ] ]\n";
+                                std::cerr << "Syntax: blextest test <path_to_exe> <path_to_dll> <path_to_testdata> [ <options> [ <testnamemask> [ --benchmarks ] ] ]\n";
                                 return EXIT_FAILURE;
                         }
                         self_app=args[2];
@@ -89,6 +90,8 @@ int UTF8Main(std::vector<std::string> const &args)
                                 options = std::atol(args[5].c_str());
                         if (args.size()>6)
                                 mask = args[6].c_str();
+                        if (args.size()>7)
+                                run_benchmarks = args[7] == "--benchmarks";
 
                         if(!Blex::Test::Run(options, mask))
                                 return EXIT_FAILURE; //testrunner expects this exact returncode to detect no-op binaries
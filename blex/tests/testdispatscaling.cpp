@@ -0,0 +1,406 @@
+//---------------------------------------------------------------------------
+#include <blex/blexlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../testing.h"
+
+//---------------------------------------------------------------------------
+
+#include "../socket.h"
+#include "../dispat.h"
+#include "../threads.h"
+#include "../utils.h"
+#include "../path.h"
+#include <atomic>
+#include <set>
+#include <sys/resource.h>
+
+/// Whether to run the benchmarks (blextest test ... --benchmarks)
+extern bool run_benchmarks;
+
+namespace
+{
+
+/// Number of idle connections to keep open during the benchmark
+unsigned const NumIdleConnections = 10000;
+/// Number of echo roundtrips to time over the active connection
+unsigned const NumRoundtrips = 1000;
+
+/// Number of connections currently open on the dispatcher side
+std::atomic< unsigned > openconnections;
+
+/// Reactors that have accepted a connection
+Blex::Mutex reactorslock;
+std::set< void * > acceptingreactors;
+
+class EchoConn : public Blex::Dispatcher::Connection
+{
+        uint8_t outbuf[64];
+
+        void *reactor;
+
+    public:
+        EchoConn(void *dispatcher)
+        : Blex::Dispatcher::Connection(dispatcher)
+        , reactor(dispatcher)
+        {
+        }
+
+        void HookIncomingData(uint8_t const *start, unsigned bufferlen)
+        {
+                unsigned tocopy = std::min< unsigned >(bufferlen, sizeof outbuf);
+                std::copy(start, start + tocopy, outbuf);
+
+                Blex::Dispatcher::SendData out(outbuf, tocopy);
+                AsyncQueueSend(1, &out);
+                ClearIncomingData(tocopy);
+        }
+
+        void HookSignal(Blex::Dispatcher::Signals::SignalType signal)
+        {
+                if (signal == Blex::Dispatcher::Signals::NewConnection)
+                {
+                        ++openconnections;
+                        Blex::Mutex::AutoLock lock(reactorslock);
+                        acceptingreactors.insert(reactor);
+                }
+                else if (signal == Blex::Dispatcher::Signals::GotEOF)
+                    AsyncCloseConnection();
+                else if (signal == Blex::Dispatcher::Signals::ConnectionClosed)
+                    --openconnections;
+        }
+
+        void HookDataBlocksSent(unsigned)
+        {
+        }
+
+        bool HookExecuteTask(Blex::Dispatcher::Task *)
+        {
+                return true;
+        }
+
+        void HookEventSignalled(Blex::Event *)
+        {
+        }
+};
+
+EchoConn* CreateEchoConn(void *disp)
+{
+        return new EchoConn(disp);
+}
+
+/// File sent by FileConn
+Blex::FileStream *sendfile_file;
+/// Offset and length of the part of the file to send
+Blex::FileOffset sendfile_offset;
+unsigned sendfile_length;
+
+/// Sends a part of a file to every new connection using file blocks
+class FileConn : public Blex::Dispatcher::Connection
+{
+    public:
+        FileConn(void *dispatcher)
+        : Blex::Dispatcher::Connection(dispatcher)
+        {
+        }
+
+        void HookIncomingData(uint8_t const *, unsigned bufferlen)
+        {
+                ClearIncomingData(bufferlen);
+        }
+
+        void HookSignal(Blex::Dispatcher::Signals::SignalType signal)
+        {
+                if (signal == Blex::Dispatcher::Signals::NewConnection)
+                {
+                        ++openconnections;
+
+                        // Send the file in two blocks, to test continuing after a block boundary
+                        unsigned firstpart = sendfile_length / 3;
+                        Blex::Dispatcher::SendData out[2] = { Blex::Dispatcher::SendData(sendfile_file->GetFileHandle(), sendfile_offset, firstpart)
+                                                            , Blex::Dispatcher::SendData(sendfile_file->GetFileHandle(), sendfile_offset + firstpart, sendfile_length - firstpart) };
+                        AsyncQueueSend(2, out);
+                }
+                else if (signal == Blex::Dispatcher::Signals::GotEOF)
+                    AsyncCloseConnection();
+                else if (signal == Blex::Dispatcher::Signals::ConnectionClosed)
+                    --openconnections;
+        }
+
+        void HookDataBlocksSent(unsigned)
+        {
+        }
+
+        bool HookExecuteTask(Blex::Dispatcher::Task *)
+        {
+                return true;
+        }
+
+        void HookEventSignalled(Blex::Event *)
+        {
+        }
+};
+
+FileConn* CreateFileConn(void *disp)
+{
+        return new FileConn(disp);
+}
+
+void RunDispatcher(Blex::Dispatcher::Dispatcher *dispatcher, unsigned numreactors)
+{
+        dispatcher->Start(2, -1, true, numreactors);
+}
+
+bool Roundtrip(Blex::Socket &sock)
+{
+        char sendbuf[] = "ping";
+        char recvbuf[sizeof sendbuf];
+
+        if (sock.Send(sendbuf, sizeof sendbuf) != sizeof sendbuf)
+            return false;
+
+        unsigned received = 0;
+        while (received < sizeof recvbuf)
+        {
+                int bytesread = sock.Receive(recvbuf + received, sizeof recvbuf - received);
+                if (bytesread <= 0)
+                    return false;
+                received += bytesread;
+        }
+        return std::equal(sendbuf, sendbuf + sizeof sendbuf, recvbuf);
+}
+
+/** Wait until the dispatcher reports the expected number of open connections
+    @return False if that didn't happen within a minute */
+bool WaitForOpenConnections(unsigned expect)
+{
+        for (unsigned i = 0; i < 6000 && openconnections != expect; ++i)
+            Blex::SleepThread(10);
+        return openconnections == expect;
+}
+
+/** Measure the roundtrip latency of a single active connection while a number
+    of idle connections is kept open, using the specified poller backend
+    @param backend Poller backend ('poll' or 'epoll')
+    @param numidle Number of idle connections */
+void RunScalingBenchmark(std::string const &backend, unsigned numidle)
+{
+        Blex::SetEnvironVariable("WEBHARE_DISPATCHER_POLLER", backend);
+
+        /* Listen on a UNIX socket, thousands of TCP connections would leave
+           TIME_WAITs on ephemeral ports that the other network tests bind to */
+        Blex::SocketAddress listenaddr(Blex::CreateTempName("/tmp/dispatscaling"));
+        Blex::Dispatcher::ListenAddress addr;
+        addr.sockaddr = listenaddr;
+
+        Blex::Dispatcher::Dispatcher dispatcher(&CreateEchoConn);
+        dispatcher.UpdateListenPorts(1, &addr);
+        BLEX_TEST_CHECK(dispatcher.RebindSockets(NULL));
+
+        openconnections = 0;
+        Blex::Thread dispatcherthread(std::bind(&RunDispatcher, &dispatcher, 1));
+        dispatcherthread.Start();
+
+        // Don't throw until the dispatcher has been stopped, the thread destructor would wait for it forever
+        bool success = true;
+        std::vector< std::unique_ptr< Blex::Socket > > sockets;
+        uint64_t start = Blex::GetSystemCurrentTicks();
+        for (unsigned i = 0; success && i <= numidle; ++i)
+        {
+                sockets.emplace_back(new Blex::Socket(Blex::Socket::Stream));
+                success = false;
+                for (unsigned attempt = 0; attempt < 30 && !success; ++attempt)
+                {
+                        success = sockets.back()->Connect(listenaddr) == Blex::SocketError::NoError;
+                        if (!success)
+                            Blex::SleepThread(100);
+                }
+        }
+        success = success && WaitForOpenConnections(numidle + 1);
+        uint64_t connecttime = Blex::GetSystemCurrentTicks() - start;
+
+        if (success)
+        {
+                Blex::Socket &active = *sockets.back();
+                start = Blex::GetSystemCurrentTicks();
+                for (unsigned i = 0; success && i < NumRoundtrips; ++i)
+                    success = Roundtrip(active);
+                uint64_t roundtriptime = Blex::GetSystemCurrentTicks() - start;
+
+                double freq = Blex::GetSystemTickFrequency();
+                std::cout << "Dispatcher " << backend << ": " << numidle << " idle connections set up in " << connecttime / freq << " s, "
+                          << NumRoundtrips << " roundtrips in " << roundtriptime / freq << " s ("
+                          << (roundtriptime / freq) * 1e6 / NumRoundtrips << " us/roundtrip)" << std::endl;
+        }
+
+        // Let the dispatcher close its side of the connections before stopping it, so the next run has enough descriptors
+        sockets.clear();
+        success = WaitForOpenConnections(0) && success;
+
+        dispatcher.InterruptHandler(1);
+        dispatcherthread.WaitFinish();
+        Blex::RemoveFile(listenaddr.GetIPAddress());
+
+        BLEX_TEST_CHECK(success);
+}
+
+/** Connect a number of clients to a dispatcher running multiple reactors
+    @param numreactors Number of reactors
+    @param numclients Number of clients
+    @param listenaddr Address to connect to
+    @return Number of distinct reactors that accepted connections, 0 if not all clients were echoed */
+unsigned RunReactorClients(unsigned numreactors, unsigned numclients, Blex::SocketAddress const &listenaddr)
+{
+        Blex::Dispatcher::ListenAddress addr;
+        addr.sockaddr = listenaddr;
+
+        Blex::Dispatcher::Dispatcher dispatcher(&CreateEchoConn);
+        dispatcher.UpdateListenPorts(1, &addr);
+        bool success = dispatcher.RebindSockets(NULL);
+
+        openconnections = 0;
+        acceptingreactors.clear();
+        Blex::Thread dispatcherthread(std::bind(&RunDispatcher, &dispatcher, numreactors));
+        dispatcherthread.Start();
+
+        /* The reactors are set up before the dispatcher starts serving connections, so
+           once the first client is served, all reactors are listening */
+        std::vector< std::unique_ptr< Blex::Socket > > sockets;
+        for (unsigned i = 0; success && i <= numclients; ++i)
+        {
+                sockets.emplace_back(new Blex::Socket(Blex::Socket::Stream));
+                success = false;
+                for (unsigned attempt = 0; attempt < 30 && !success; ++attempt)
+                {
+                        success = sockets.back()->Connect(listenaddr) == Blex::SocketError::NoError;
+                        if (!success)
+                            Blex::SleepThread(100);
+                }
+                if (success && i == 0)
+                    success = Roundtrip(*sockets[0]);
+        }
+        for (unsigned i = 1; success && i < sockets.size(); ++i)
+            success = Roundtrip(*sockets[i]);
+
+        sockets.clear();
+        success = WaitForOpenConnections(0) && success;
+
+        dispatcher.InterruptHandler(1);
+        dispatcherthread.WaitFinish();
+
+        Blex::Mutex::AutoLock lock(reactorslock);
+        return success ? acceptingreactors.size() : 0;
+}
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(DispatReactors)
+{
+        // Let the system pick a free port. Every reactor binds its own listener to it
+        Blex::SocketAddress tcpaddr;
+        {
+                Blex::Socket probe(Blex::Socket::Stream);
+                BLEX_TEST_CHECKEQUAL(Blex::SocketError::NoError, probe.Bind(Blex::SocketAddress("127.0.0.1", 0)));
+                tcpaddr = probe.GetLocalAddress();
+        }
+
+        // TCP listeners are shared by all reactors, the kernel spreads the connections over them
+        BLEX_TEST_CHECK(RunReactorClients(4, 64, tcpaddr) > 1);
+
+        // UNIX socket listeners can't be shared, and are only served by the first reactor
+        Blex::SocketAddress pathaddr(Blex::CreateTempName("/tmp/dispatreactors"));
+        BLEX_TEST_CHECKEQUAL(1u, RunReactorClients(4, 16, pathaddr));
+        Blex::RemoveFile(pathaddr.GetIPAddress());
+}
+
+BLEX_TEST_FUNCTION(DispatSendFile)
+{
+        // Create a file that is larger than the socket buffers, so the sends will be partial
+        std::string filename = Blex::CreateTempName("/tmp/dispatsendfile");
+        std::unique_ptr< Blex::FileStream > file(Blex::FileStream::OpenRW(filename, true, true, Blex::FilePermissions::PrivateRead));
+        BLEX_TEST_CHECK(file.get());
+
+        std::vector< uint8_t > data(4 * 1024 * 1024);
+        for (unsigned i = 0; i < data.size(); ++i)
+            data[i] = uint8_t(i * 7 + (i >> 13));
+        BLEX_TEST_CHECKEQUAL(data.size(), file->Write(&data[0], data.size()));
+
+        sendfile_file = file.get();
+        sendfile_offset = 12345;
+        sendfile_length = data.size() - sendfile_offset - 6789;
+
+        Blex::SocketAddress listenaddr(Blex::CreateTempName("/tmp/dispatsendfilesock"));
+        Blex::Dispatcher::ListenAddress addr;
+        addr.sockaddr = listenaddr;
+
+        Blex::Dispatcher::Dispatcher dispatcher(&CreateFileConn);
+        dispatcher.UpdateListenPorts(1, &addr);
+        BLEX_TEST_CHECK(dispatcher.RebindSockets(NULL));
+
+        openconnections = 0;
+        Blex::Thread dispatcherthread(std::bind(&RunDispatcher, &dispatcher, 1));
+        dispatcherthread.Start();
+
+        // Don't throw until the dispatcher has been stopped, the thread destructor would wait for it forever
+        std::vector< uint8_t > received;
+        {
+                Blex::Socket sock(Blex::Socket::Stream);
+                bool connected = false;
+                for (unsigned attempt = 0; attempt < 30 && !connected; ++attempt)
+                {
+                        connected = sock.Connect(listenaddr) == Blex::SocketError::NoError;
+                        if (!connected)
+                            Blex::SleepThread(100);
+                }
+
+                uint8_t buf[16384];
+                while (connected && received.size() < sendfile_length)
+                {
+                        int bytesread = sock.Receive(buf, sizeof buf);
+                        if (bytesread <= 0)
+                            break;
+                        received.insert(received.end(), buf, buf + bytesread);
+                }
+        }
+        bool closed = WaitForOpenConnections(0);
+
+        dispatcher.InterruptHandler(1);
+        dispatcherthread.WaitFinish();
+        file.reset();
+        Blex::RemoveFile(filename);
+        Blex::RemoveFile(listenaddr.GetIPAddress());
+
+        BLEX_TEST_CHECK(closed);
+        BLEX_TEST_CHECKEQUAL(sendfile_length, received.size());
+        BLEX_TEST_CHECK(std::equal(received.begin(), received.end(), data.begin() + sendfile_offset));
+}
+
+BLEX_TEST_FUNCTION(DispatConnectionScaling)
+{
+        // Only prints timings, and is slow. Run it with --benchmarks
+        if (!run_benchmarks)
+            return;
+
+        /* Every idle connection needs a descriptor on both sides. Raise the
+           soft limit as far as we can, and scale down if that isn't enough */
+        rlimit limit;
+        getrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < limit.rlim_max)
+        {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+                getrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        unsigned numidle = NumIdleConnections;
+        if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < 2 * numidle + 256)
+        {
+                numidle = limit.rlim_cur > 512 ? (limit.rlim_cur - 256) / 2 : 128;
+                std::cout << "File descriptor limit is " << limit.rlim_cur << ", using " << numidle << " idle connections\n";
+        }
+
+        RunScalingBenchmark("poll", numidle);
+        RunScalingBenchmark("epoll", numidle);
+        Blex::SetEnvironVariable("WEBHARE_DISPATCHER_POLLER", "");
+}
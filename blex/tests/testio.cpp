@@ -13,6 +13,7 @@
 #include "../zstream.h"
 #include "../threads.h"
 #include "../path.h"
+#include "../dirwatcher.h"
 #include <set>
 
 extern std::string self_app;
@@ -172,6 +173,54 @@ BLEX_TEST_FUNCTION(TestFileModDate)
         BLEX_TEST_CHECKEQUAL(toset, Blex::PathStatus(filename).ModTime());
 }
 
+#if defined(PLATFORM_LINUX) && !defined(__EMSCRIPTEN__)
+
+BLEX_TEST_FUNCTION(TestDirectoryWatcher)
+{
+        Blex::DirectoryWatcher watcher;
+        BLEX_TEST_CHECK(watcher.IsActive());
+
+        std::string dirname = Blex::CreateTempName(Blex::MergePath(Blex::Test::GetTempDir(),"dirwatchtest"));
+        BLEX_TEST_CHECK(Blex::CreateDir(dirname, false));
+        std::string filename = Blex::MergePath(dirname, "file");
+        delete Blex::FileStream::OpenWrite(filename,true,false,Blex::FilePermissions::PublicRead);
+
+        BLEX_TEST_CHECK(!watcher.Watch(Blex::MergePath(dirname, "nonexisting")));
+        BLEX_TEST_CHECK(!watcher.Watch(filename)); //not a directory
+        BLEX_TEST_CHECK(watcher.Watch(dirname));
+        BLEX_TEST_CHECK(watcher.Watch(dirname));
+        BLEX_TEST_CHECKEQUAL(1u, watcher.GetNumWatches());
+
+        //Nothing changed yet
+        uint64_t generation = watcher.Poll();
+        BLEX_TEST_CHECKEQUAL(generation, watcher.Poll());
+
+        //Modify the file
+        {
+                std::unique_ptr< Blex::FileStream > str(Blex::FileStream::OpenWrite(filename,false,false,Blex::FilePermissions::PublicRead));
+                BLEX_TEST_CHECK(str.get());
+                str->WriteString("changed");
+        }
+        uint64_t newgeneration = watcher.Poll();
+        BLEX_TEST_CHECK(newgeneration > generation);
+        BLEX_TEST_CHECKEQUAL(newgeneration, watcher.Poll());
+
+        //Touch it
+        generation = newgeneration;
+        BLEX_TEST_CHECK(SetFileModificationDate(filename, Blex::DateTime::Now() - Blex::DateTime::Minutes(5)));
+        newgeneration = watcher.Poll();
+        BLEX_TEST_CHECK(newgeneration > generation);
+
+        //Removing the directory removes the watch
+        generation = newgeneration;
+        BLEX_TEST_CHECK(Blex::RemoveFile(filename));
+        BLEX_TEST_CHECK(Blex::RemoveDir(dirname));
+        BLEX_TEST_CHECK(watcher.Poll() > generation);
+        BLEX_TEST_CHECKEQUAL(0u, watcher.GetNumWatches());
+}
+
+#endif
+
 #if !defined(__EMSCRIPTEN__)
 
 BLEX_TEST_FUNCTION(TestMmap)
@@ -977,4 +977,74 @@ BLEX_TEST_FUNCTION(PipeWaiterManyWaits)
                 BLEX_TEST_CHECKEQUAL(socketpairs[socknr].second->ReadLsb<uint8_t>(), uint8_t(i));
         }
 }
+
+BLEX_TEST_FUNCTION(PipeReactorManyWaiters)
+{
+        std::vector< std::pair< std::shared_ptr< Blex::Socket >, std::shared_ptr< Blex::Socket > > > socketpairs;
+
+        unsigned wait_count = 150;
+
+        // Every waiter waits for its own socket, the last one for an event too
+        Blex::StatefulEvent event;
+        std::vector< std::unique_ptr< Blex::PipeWaiter > > waiters;
+        for (unsigned i = 0; i < wait_count; ++i)
+        {
+                Blex::SocketSet sockets(Blex::Socket::Stream, false);
+                socketpairs.push_back(std::make_pair(std::shared_ptr< Blex::Socket >(sockets.ReleaseLeftEnd()), std::shared_ptr< Blex::Socket >(sockets.ReleaseRightEnd())));
+                socketpairs.back().second->SetBlocking(false);
+                waiters.emplace_back(new Blex::PipeWaiter);
+                waiters.back()->AddSocket(*socketpairs.back().second, true, false);
+        }
+        waiters.back()->AddEvent(event);
+
+        Blex::PipeReactor reactor;
+        for (unsigned i = 0; i < wait_count; ++i)
+            reactor.AddWaiter(*waiters[i]);
+
+        std::vector< Blex::PipeWaiter * > signalled;
+        BLEX_TEST_CHECKEQUAL(false, reactor.Wait(Blex::DateTime::Now(), &signalled));
+        BLEX_TEST_CHECKEQUAL(0u, signalled.size());
+
+        // Only the waiter of the written socket may be returned
+        for (unsigned i = 0; i < wait_count * 2; ++i)
+        {
+                unsigned socknr = (i * 17) % wait_count;
+                socketpairs[socknr].first->WriteLsb(uint8_t(i));
+                BLEX_TEST_CHECKEQUAL(true, reactor.Wait(Blex::DateTime::Now()+Blex::DateTime::Seconds(60), &signalled));
+                BLEX_TEST_CHECKEQUAL(1u, signalled.size());
+                BLEX_TEST_CHECK(signalled[0] == waiters[socknr].get());
+                BLEX_TEST_CHECKEQUAL(true, waiters[socknr]->GotRead(*socketpairs[socknr].second));
+                BLEX_TEST_CHECKEQUAL(socketpairs[socknr].second->ReadLsb<uint8_t>(), uint8_t(i));
+        }
+
+        // Signalled events return their waiter too
+        event.SetSignalled(true);
+        BLEX_TEST_CHECKEQUAL(true, reactor.Wait(Blex::DateTime::Now()+Blex::DateTime::Seconds(60), &signalled));
+        BLEX_TEST_CHECKEQUAL(1u, signalled.size());
+        BLEX_TEST_CHECK(signalled[0] == waiters.back().get());
+        BLEX_TEST_CHECKEQUAL(true, waiters.back()->GotSignalled(event));
+        BLEX_TEST_CHECKEQUAL(false, waiters.back()->GotRead(*socketpairs.back().second));
+        event.SetSignalled(false);
+
+        // Removed waiters aren't returned anymore
+        reactor.RemoveWaiter(*waiters[0]);
+        socketpairs[0].first->WriteLsb(uint8_t(1));
+        BLEX_TEST_CHECKEQUAL(false, reactor.Wait(Blex::DateTime::Now()+Blex::DateTime::Msecs(50), &signalled));
+        BLEX_TEST_CHECKEQUAL(0u, signalled.size());
+
+        // Registering a waiter that is already signalled returns it right away
+        reactor.AddWaiter(*waiters[0]);
+        BLEX_TEST_CHECKEQUAL(true, reactor.Wait(Blex::DateTime::Now()+Blex::DateTime::Seconds(60), &signalled));
+        BLEX_TEST_CHECKEQUAL(1u, signalled.size());
+        BLEX_TEST_CHECK(signalled[0] == waiters[0].get());
+        BLEX_TEST_CHECKEQUAL(socketpairs[0].second->ReadLsb<uint8_t>(), uint8_t(1));
+
+        // Wake interrupts a wait without returning waiters
+        reactor.Wake();
+        BLEX_TEST_CHECKEQUAL(true, reactor.Wait(Blex::DateTime::Now()+Blex::DateTime::Seconds(60), &signalled));
+        BLEX_TEST_CHECKEQUAL(0u, signalled.size());
+
+        for (unsigned i = 0; i < wait_count; ++i)
+            reactor.RemoveWaiter(*waiters[i]);
+}
 #endif //!defined(__EMSCRIPTEN__)
@@ -9,6 +9,7 @@
 
 #include "../utils.h"
 #include "../mapvector.h"
+#include "../timerwheel.h"
 #include "../testing.h"
 #include "../xml.h"
 
@@ -197,3 +198,89 @@ BLEX_TEST_FUNCTION(TestSearchUncontained)
         BLEX_TEST_CHECKEQUAL(Blex::SearchUncontained(sin.begin(),sin.end(),sfor4.begin(),sfor4.end()) - sin.begin(), 18);
         BLEX_TEST_CHECKEQUAL(Blex::SearchUncontained(sin.begin(),sin.end(),sfor5.begin(),sfor5.end()) - sin.begin(), 21);
 }
+
+namespace
+{
+
+struct TestTimer : public Blex::TimerWheel::Timer
+{
+        bool expired;
+};
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(TestTimerWheel)
+{
+        Blex::DateTime start = Blex::DateTime::FromDateTime(2020, 1, 1, 0, 0, 0);
+        Blex::TimerWheel wheel(start, 10);
+        std::vector< Blex::TimerWheel::Timer * > expired;
+
+        // Simple expiry, never early
+        TestTimer timers[1000];
+        wheel.Arm(&timers[0], start + Blex::DateTime::Msecs(25));
+        BLEX_TEST_CHECKEQUAL(1u, wheel.Size());
+        BLEX_TEST_CHECK(wheel.GetNextCheck() <= start + Blex::DateTime::Msecs(30));
+        wheel.Advance(start + Blex::DateTime::Msecs(24), &expired);
+        BLEX_TEST_CHECKEQUAL(0u, expired.size());
+        wheel.Advance(start + Blex::DateTime::Msecs(30), &expired);
+        BLEX_TEST_CHECKEQUAL(1u, expired.size());
+        BLEX_TEST_CHECK(expired[0] == &timers[0]);
+        BLEX_TEST_CHECKEQUAL(false, timers[0].IsArmed());
+        BLEX_TEST_CHECKEQUAL(0u, wheel.Size());
+        BLEX_TEST_CHECK(wheel.GetNextCheck() == Blex::DateTime::Max());
+
+        // Cancel and re-arm
+        expired.clear();
+        wheel.Arm(&timers[0], start + Blex::DateTime::Seconds(10));
+        wheel.Arm(&timers[1], start + Blex::DateTime::Seconds(10));
+        wheel.Arm(&timers[0], start + Blex::DateTime::Seconds(20));
+        wheel.Cancel(&timers[1]);
+        wheel.Cancel(&timers[1]);
+        BLEX_TEST_CHECKEQUAL(1u, wheel.Size());
+        wheel.Advance(start + Blex::DateTime::Seconds(15), &expired);
+        BLEX_TEST_CHECKEQUAL(0u, expired.size());
+        wheel.Advance(start + Blex::DateTime::Seconds(20), &expired);
+        BLEX_TEST_CHECKEQUAL(1u, expired.size());
+
+        // Random timers over all levels, including beyond the range of the wheel
+        expired.clear();
+        Blex::DateTime now = start + Blex::DateTime::Seconds(20);
+        uint32_t seed = 12345;
+        for (unsigned i = 0; i < 1000; ++i)
+        {
+                seed = seed * 1103515245 + 12345;
+                Blex::DateTime expiry = now + Blex::DateTime::Msecs(seed % (i % 4 == 0 ? 1000000000u : 100000u));
+                if (i % 100 == 0)
+                    expiry = now + Blex::DateTime::Days(200);
+                timers[i].expired = false;
+                wheel.Arm(&timers[i], expiry);
+        }
+        BLEX_TEST_CHECKEQUAL(1000u, wheel.Size());
+
+        unsigned numexpired = 0;
+        while (numexpired < 1000)
+        {
+                // Step like a timer thread would, or jump ahead
+                seed = seed * 1103515245 + 12345;
+                Blex::DateTime next = std::min(wheel.GetNextCheck(), now + Blex::DateTime::Seconds(seed % 3600));
+                BLEX_TEST_CHECK(next >= now);
+                now = std::max(next, now + Blex::DateTime::Msecs(1));
+
+                expired.clear();
+                wheel.Advance(now, &expired);
+                for (unsigned i = 0; i < expired.size(); ++i)
+                {
+                        TestTimer *timer = static_cast< TestTimer * >(expired[i]);
+                        BLEX_TEST_CHECK(timer->GetExpiry() <= now);
+                        BLEX_TEST_CHECKEQUAL(false, timer->expired);
+                        timer->expired = true;
+                }
+                numexpired += expired.size();
+
+                // Nothing may be left behind that should have expired
+                for (unsigned i = 0; i < 1000; ++i)
+                  if (!timers[i].expired)
+                    BLEX_TEST_CHECK(timers[i].GetExpiry() + Blex::DateTime::Msecs(10) > now);
+        }
+        BLEX_TEST_CHECKEQUAL(0u, wheel.Size());
+}
@@ -1204,6 +1204,8 @@ void PipeWaiter::SetEventSignalled(Event &event, bool signalled)
                             lock->comm_write->Write(buf, 1);
                             lock->pipe_signalled = true;
                     }
+                    if (lock->reactor)
+                        lock->reactor->SetWaiterSignalled(*this);
                 }
         }
         else
@@ -1438,6 +1440,323 @@ bool PipeWaiter::WaitInternal(CoreConditionMutex *conditionmutex, Blex::DateTime
         return true;
 }
 
+/* The reactor keeps the file descriptors of the registered waiters in a
+   persistent poller. Only the waiting thread touches the poller: AddWaiter and
+   RemoveWaiter only update the registration tables, and the changed descriptors
+   are applied to the poller at the start of the next wait. Events notify the
+   reactor directly through the pending list and the wake pipe.
+
+   Lock order: Event data > PipeWaiter event data > PipeReactor data */
+
+PipeReactor::PipeReactor()
+: wakepipe(new PipeSet)
+, poller(new Poller(Poller::Backend::EPoll))
+{
+        wakepipe->GetReadEnd().SetBlocking(false);
+        wakepipe->GetWriteEnd().SetBlocking(false);
+        poller->UpdateFDWaitMask(wakepipe->GetReadEnd().GetPosixFd(), true, true, false, false);
+}
+
+PipeReactor::~PipeReactor()
+{
+        LockedData::ReadRef lock(data);
+        if (!lock->waiters.empty())
+        {
+                ErrStream() << "PipeReactor " << this << " destroyed with " << lock->waiters.size() << " registered waiters";
+                FatalAbort();
+        }
+}
+
+void PipeReactor::AddWaiter(PipeWaiter &waiter)
+{
+        bool satisfied = false;
+        {
+                LockedData::WriteRef lock(data);
+                if (!lock->waiters.insert(std::make_pair(&waiter, std::vector< int >())).second)
+                    throw std::runtime_error("PipeReactor::AddWaiter: waiter has already been registered");
+
+                for (std::map<Socket::SocketFd, PipeWaiter::SocketInfo>::iterator itr=waiter.waitsockets.begin();itr!=waiter.waitsockets.end();++itr)
+                {
+                        // Same SSL considerations as in PipeWaiter::WaitInternal
+                        PipeWaiter::SocketInfo &info = itr->second;
+                        bool real_want_read = info.want_read || info.socket->SSLNeedsRead();
+                        bool real_want_write = (info.want_write || info.socket->SSLNeedsWrite()) && !info.socket->SSLBlockedUntilRead();
+
+                        info.got_read = info.want_read && info.socket->SSLHaveRead();
+                        info.got_write = info.want_write && info.socket->SSLHaveWriteRoom() && !info.socket->SSLBlockedUntilRead();
+                        if (info.got_read || info.got_write)
+                            satisfied = true;
+
+                        AddFdUser(*lock, info.socket->GetFd(), waiter, real_want_read, real_want_write);
+                }
+                for (std::vector<PipeWaiter::PipeReadInfo>::iterator itr=waiter.waitreadpipes.begin(); itr!=waiter.waitreadpipes.end(); ++itr)
+                {
+                        itr->got_read = false;
+                        AddFdUser(*lock, itr->read_stream->GetPosixFd(), waiter, true, false);
+                }
+                for (std::vector<PipeWaiter::PipeWriteInfo>::iterator itr=waiter.waitwritepipes.begin(); itr!=waiter.waitwritepipes.end(); ++itr)
+                {
+                        itr->got_write = false;
+                        AddFdUser(*lock, itr->write_stream->GetPosixFd(), waiter, false, true);
+                }
+                if (waiter.want_console_read)
+                {
+                        waiter.got_console_read = false;
+                        AddFdUser(*lock, 0, waiter, true, false);
+                }
+        }
+
+        if (!waiter.waitevents.empty())
+        {
+                // From here on, signalled events notify the reactor. Check the events signalled before that
+                {
+                        PipeWaiter::LockedEventData::WriteRef lock(waiter.eventdata);
+                        lock->reactor = this;
+                        if (!lock->signalled.empty())
+                            satisfied = true;
+                }
+                for (std::vector< PipeWaiter::EventInfo >::iterator itr = waiter.waitevents.begin(); itr != waiter.waitevents.end(); ++itr)
+                {
+                        itr->got_signalled = false;
+                        if (itr->event->IsSignalled())
+                            satisfied = true;
+                }
+        }
+
+        if (satisfied)
+            SetWaiterSignalled(waiter);
+}
+
+void PipeReactor::RemoveWaiter(PipeWaiter &waiter)
+{
+        // Stop the event notifications first, they take the reactor lock
+        if (!waiter.waitevents.empty())
+        {
+                PipeWaiter::LockedEventData::WriteRef lock(waiter.eventdata);
+                lock->reactor = 0;
+        }
+
+        LockedData::WriteRef lock(data);
+        std::unordered_map< PipeWaiter *, std::vector< int > >::iterator itr = lock->waiters.find(&waiter);
+        if (itr == lock->waiters.end())
+            return;
+
+        for (std::vector< int >::const_iterator fdit = itr->second.begin(); fdit != itr->second.end(); ++fdit)
+            RemoveFdUser(*lock, *fdit, waiter);
+        lock->waiters.erase(itr);
+        lock->pending.erase(std::remove(lock->pending.begin(), lock->pending.end(), &waiter), lock->pending.end());
+}
+
+void PipeReactor::Wake()
+{
+        LockedData::WriteRef lock(data);
+        WakeLocked(*lock);
+}
+
+void PipeReactor::WakeLocked(Data &data)
+{
+        if (data.woken)
+            return;
+
+        uint8_t buf[1] = { 1 };
+        wakepipe->GetWriteEnd().Write(buf, 1);
+        data.woken = true;
+}
+
+void PipeReactor::SetWaiterSignalled(PipeWaiter &waiter)
+{
+        LockedData::WriteRef lock(data);
+        if (!lock->waiters.count(&waiter))
+            return;
+
+        lock->pending.push_back(&waiter);
+        WakeLocked(*lock);
+}
+
+void PipeReactor::AddFdUser(Data &data, int fd, PipeWaiter &waiter, bool want_read, bool want_write)
+{
+        FdUser user;
+        user.waiter = &waiter;
+        user.want_read = want_read;
+        user.want_write = want_write;
+
+        data.fds[fd].push_back(user);
+        data.waiters[&waiter].push_back(fd);
+        data.changedfds.push_back(fd);
+}
+
+void PipeReactor::RemoveFdUser(Data &data, int fd, PipeWaiter &waiter)
+{
+        std::unordered_map< int, std::vector< FdUser > >::iterator itr = data.fds.find(fd);
+        if (itr == data.fds.end())
+            return;
+
+        std::vector< FdUser > &users = itr->second;
+        for (std::vector< FdUser >::iterator uit = users.begin(); uit != users.end();)
+        {
+                if (uit->waiter == &waiter)
+                    uit = users.erase(uit);
+                else
+                    ++uit;
+        }
+        if (users.empty())
+            data.fds.erase(itr);
+        data.changedfds.push_back(fd);
+}
+
+void PipeReactor::ApplyChanges(Data &data)
+{
+        std::sort(data.changedfds.begin(), data.changedfds.end());
+        data.changedfds.erase(std::unique(data.changedfds.begin(), data.changedfds.end()), data.changedfds.end());
+
+        for (std::vector< int >::const_iterator fdit = data.changedfds.begin(); fdit != data.changedfds.end(); ++fdit)
+        {
+                // Remove the old registration first, the descriptor may have been closed and its number reused since
+                poller->UpdateFDWaitMask(*fdit, true, false, true, false);
+
+                std::unordered_map< int, std::vector< FdUser > >::const_iterator itr = data.fds.find(*fdit);
+                if (itr == data.fds.end())
+                    continue;
+
+                bool want_read = false, want_write = false;
+                for (std::vector< FdUser >::const_iterator uit = itr->second.begin(); uit != itr->second.end(); ++uit)
+                {
+                        want_read = want_read || uit->want_read;
+                        want_write = want_write || uit->want_write;
+                }
+                if (want_read || want_write)
+                    poller->UpdateFDWaitMask(*fdit, true, want_read, true, want_write);
+        }
+        data.changedfds.clear();
+}
+
+bool PipeReactor::ConditionMutexWait(DebugConditionMutex::AutoLock &lock, Blex::DateTime until, std::vector< PipeWaiter * > *signalled)
+{
+        bool retval = WaitInternal(&lock.conmutex.corecv, until, signalled);
+        lock.conmutex.ownerthread=CurrentThread();
+        return retval;
+}
+
+bool PipeReactor::WaitInternal(CoreConditionMutex *conditionmutex, Blex::DateTime until, std::vector< PipeWaiter * > *signalled)
+{
+        signalled->clear();
+        {
+                LockedData::WriteRef lock(data);
+                ApplyChanges(*lock);
+                if (!lock->pending.empty())
+                    until = Blex::DateTime::Min();
+        }
+
+        int retval;
+        if (conditionmutex)
+        {
+                conditionmutex->cmdata->EnterPipeWait();
+                conditionmutex->associated_mutex.Unlock();
+
+                // Only wait for the conditionmutex pipe during this wait
+                int cmfd = conditionmutex->cmdata->pipe->GetReadEnd().GetPosixFd();
+                poller->UpdateFDWaitMask(cmfd, true, true, false, false);
+                retval = poller->DoPoll(until);
+                poller->UpdateFDWaitMask(cmfd, true, false, false, false);
+
+                conditionmutex->associated_mutex.Lock();
+                conditionmutex->cmdata->LeavePipeWait();
+        }
+        else
+        {
+                retval = poller->DoPoll(until);
+        }
+
+        std::vector< Poller::SignalledFd > fds;
+        if (retval > 0)
+            poller->ExportSignalled(&fds);
+
+        {
+                LockedData::WriteRef lock(data);
+                if (lock->woken)
+                {
+                        uint8_t buf[16];
+                        wakepipe->GetReadEnd().Read(buf, sizeof(buf));
+                        lock->woken = false;
+                }
+
+                signalled->swap(lock->pending);
+                for (std::vector< Poller::SignalledFd >::const_iterator sit = fds.begin(); sit != fds.end(); ++sit)
+                {
+                        std::unordered_map< int, std::vector< FdUser > >::const_iterator itr = lock->fds.find(sit->fd);
+                        if (itr != lock->fds.end())
+                            for (std::vector< FdUser >::const_iterator uit = itr->second.begin(); uit != itr->second.end(); ++uit)
+                                signalled->push_back(uit->waiter);
+                }
+                std::sort(signalled->begin(), signalled->end());
+                signalled->erase(std::unique(signalled->begin(), signalled->end()), signalled->end());
+
+                // Reset the results of the signalled waiters, SSL sockets may already have data or room in their buffers
+                for (std::vector< PipeWaiter * >::const_iterator wit = signalled->begin(); wit != signalled->end(); ++wit)
+                {
+                        PipeWaiter &waiter = **wit;
+                        for (std::map<Socket::SocketFd, PipeWaiter::SocketInfo>::iterator itr=waiter.waitsockets.begin();itr!=waiter.waitsockets.end();++itr)
+                        {
+                                PipeWaiter::SocketInfo &info = itr->second;
+                                info.got_read = info.want_read && info.socket->SSLHaveRead();
+                                info.got_write = info.want_write && info.socket->SSLHaveWriteRoom() && !info.socket->SSLBlockedUntilRead();
+                        }
+                        for (std::vector<PipeWaiter::PipeReadInfo>::iterator itr=waiter.waitreadpipes.begin(); itr!=waiter.waitreadpipes.end(); ++itr)
+                            itr->got_read = false;
+                        for (std::vector<PipeWaiter::PipeWriteInfo>::iterator itr=waiter.waitwritepipes.begin(); itr!=waiter.waitwritepipes.end(); ++itr)
+                            itr->got_write = false;
+                        waiter.got_console_read = false;
+                }
+
+                for (std::vector< Poller::SignalledFd >::const_iterator sit = fds.begin(); sit != fds.end(); ++sit)
+                {
+                        std::unordered_map< int, std::vector< FdUser > >::const_iterator itr = lock->fds.find(sit->fd);
+                        if (itr == lock->fds.end())
+                            continue;
+
+                        for (std::vector< FdUser >::const_iterator uit = itr->second.begin(); uit != itr->second.end(); ++uit)
+                        {
+                                PipeWaiter &waiter = *uit->waiter;
+                                std::map< Socket::SocketFd, PipeWaiter::SocketInfo >::iterator sockit = waiter.waitsockets.find(sit->fd);
+                                if (sockit != waiter.waitsockets.end())
+                                {
+                                        // Update the 'reversed' status too, if SSL needs to go the other way for progress
+                                        PipeWaiter::SocketInfo &info = sockit->second;
+                                        info.got_read = info.got_read || sit->is_readable || (info.socket->SSLNeedsWrite() && sit->is_writable);
+                                        info.got_write = info.got_write || sit->is_writable || (info.socket->SSLNeedsRead() && sit->is_readable);
+                                }
+                                for (std::vector<PipeWaiter::PipeReadInfo>::iterator pit=waiter.waitreadpipes.begin(); pit!=waiter.waitreadpipes.end(); ++pit)
+                                  if (pit->read_stream->GetPosixFd() == sit->fd && sit->is_readable)
+                                    pit->got_read = true;
+                                for (std::vector<PipeWaiter::PipeWriteInfo>::iterator pit=waiter.waitwritepipes.begin(); pit!=waiter.waitwritepipes.end(); ++pit)
+                                  if (pit->write_stream->GetPosixFd() == sit->fd && sit->is_writable)
+                                    pit->got_write = true;
+                                if (waiter.want_console_read && sit->fd == 0 && sit->is_readable)
+                                    waiter.got_console_read = true;
+                        }
+                }
+        }
+
+        // The event results need the event lock of the waiters, which must be taken before the reactor lock
+        for (std::vector< PipeWaiter * >::const_iterator wit = signalled->begin(); wit != signalled->end(); ++wit)
+        {
+                PipeWaiter &waiter = **wit;
+                if (waiter.waitevents.empty())
+                    continue;
+
+                for (std::vector< PipeWaiter::EventInfo >::iterator itr = waiter.waitevents.begin(); itr != waiter.waitevents.end(); ++itr)
+                    itr->got_signalled = itr->event->IsSignalled();
+
+                PipeWaiter::LockedEventData::WriteRef lock(waiter.eventdata);
+                for (std::vector< Event * >::const_iterator it = lock->signalled.begin(); it != lock->signalled.end(); ++it)
+                    for (std::vector< PipeWaiter::EventInfo >::iterator itr = waiter.waitevents.begin(); itr != waiter.waitevents.end(); ++itr)
+                      if (itr->event == *it)
+                        itr->got_signalled = true;
+        }
+
+        return retval > 0 || !signalled->empty();
+}
+
 Process::Process()
   : separate_processgroup(false)
   , share_stdin(false)
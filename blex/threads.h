@@ -42,6 +42,7 @@ class TriggerableSingleSocketWaiter;
 class PipeReadStream;
 class PipeWriteStream;
 class PipeWaiter;
+class PipeReactor;
 
 namespace Detail
 {
@@ -137,6 +138,7 @@ class BLEXLIB_PUBLIC CoreConditionMutex
         CoreMutex &associated_mutex;
 
         friend class PipeWaiter;
+        friend class PipeReactor;
 };
 
 
@@ -326,6 +328,7 @@ class BLEXLIB_PUBLIC ConditionMutex : public Mutex
                 }
 
                 friend class PipeWaiter;
+                friend class PipeReactor;
         };
         friend class ScopedLock;
         friend class AutoLock;
@@ -356,6 +359,7 @@ class BLEXLIB_PUBLIC ConditionMutex : public Mutex
         }
 
         friend class PipeWaiter;
+        friend class PipeReactor;
 };
 
 /** A ReadWriteMutex implements a lock that can be used for objects that
@@ -549,6 +553,7 @@ class BLEXLIB_PUBLIC DebugConditionMutex : public DebugMutex
                 { return conmutex.TimedWait(until); }
 
                 friend class PipeWaiter;
+                friend class PipeReactor;
         };
         friend class ScopedLock;
         friend class AutoLock;
@@ -571,6 +576,7 @@ class BLEXLIB_PUBLIC DebugConditionMutex : public DebugMutex
         }
 
         friend class PipeWaiter;
+        friend class PipeReactor;
 };
 
 /** A template class that can be wrapped around a structure to ensure
@@ -0,0 +1,187 @@
+#include <blex/blexlib.h>
+
+
+#include "timerwheel.h"
+#include <algorithm>
+
+namespace Blex
+{
+
+namespace
+{
+uint64_t const MsecsPerDay = 24*60*60*1000;
+} //end anonymous namespace
+
+TimerWheel::Timer::Timer()
+: prev(0)
+, next(0)
+, tick(0)
+, expires(DateTime::Invalid())
+, level(0)
+{
+}
+
+TimerWheel::TimerWheel(DateTime start, unsigned resolution_msecs)
+: resolution(std::max(resolution_msecs, 1u))
+, current(0)
+, count(0)
+{
+        current = GetTick(start);
+        for (unsigned level = 0; level < NumLevels; ++level)
+        {
+                levelcount[level] = 0;
+                for (unsigned slot = 0; slot < NumSlots; ++slot)
+                    slots[level][slot].prev = slots[level][slot].next = &slots[level][slot];
+        }
+}
+
+uint64_t TimerWheel::GetTick(DateTime time) const
+{
+        return (time.GetDays() * MsecsPerDay + time.GetMsecs()) / resolution;
+}
+
+uint64_t TimerWheel::GetTickCeil(DateTime time) const
+{
+        return (time.GetDays() * MsecsPerDay + time.GetMsecs() + resolution - 1) / resolution;
+}
+
+DateTime TimerWheel::GetTickTime(uint64_t tick) const
+{
+        uint64_t msecs = tick * resolution;
+        if (msecs / MsecsPerDay > 0x7FFFFFFF)
+            return DateTime::Max();
+        return DateTime(msecs / MsecsPerDay, msecs % MsecsPerDay);
+}
+
+void TimerWheel::Insert(Timer *timer)
+{
+        //Expired timers go into the current slot, timers beyond our range are parked in the last level
+        uint64_t delta = timer->tick > current ? timer->tick - current : 0;
+        if (delta >= Range)
+            delta = Range - 1;
+        uint64_t tick = current + delta;
+
+        unsigned level = 0;
+        while (delta >= (uint64_t(1) << (SlotBits * (level + 1))))
+            ++level;
+
+        Timer &head = slots[level][(tick >> (SlotBits * level)) & SlotMask];
+        timer->level = level;
+        timer->prev = head.prev;
+        timer->next = &head;
+        head.prev->next = timer;
+        head.prev = timer;
+
+        ++levelcount[level];
+        ++count;
+}
+
+void TimerWheel::Unlink(Timer *timer)
+{
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = 0;
+        timer->next = 0;
+
+        --levelcount[timer->level];
+        --count;
+}
+
+void TimerWheel::Arm(Timer *timer, DateTime expires)
+{
+        if (timer->IsArmed())
+            Unlink(timer);
+
+        timer->expires = expires;
+        timer->tick = GetTickCeil(expires);
+        Insert(timer);
+}
+
+void TimerWheel::Cancel(Timer *timer)
+{
+        if (timer->IsArmed())
+            Unlink(timer);
+}
+
+void TimerWheel::Cascade()
+{
+        //Called when the first level wraps. Every level wraps when the level below it wraps to slot 0
+        for (unsigned level = 1; level < NumLevels; ++level)
+        {
+                unsigned slot = (current >> (SlotBits * level)) & SlotMask;
+                Timer &head = slots[level][slot];
+                while (head.next != &head)
+                {
+                        Timer *timer = head.next;
+                        Unlink(timer);
+                        Insert(timer);
+                }
+                if (slot != 0)
+                    break;
+        }
+}
+
+void TimerWheel::Advance(DateTime now, std::vector< Timer * > *expired)
+{
+        uint64_t target = GetTick(now);
+        while (current <= target)
+        {
+                if (count == 0)
+                {
+                        current = target + 1;
+                        break;
+                }
+
+                if ((current & SlotMask) == 0)
+                    Cascade();
+
+                if (levelcount[0] == 0)
+                {
+                        //Nothing can expire until the next slot of the lowest used level comes up, skip to it
+                        unsigned level = 1;
+                        while (level < NumLevels - 1 && levelcount[level] == 0)
+                            ++level;
+
+                        uint64_t nextslot = (current | ((uint64_t(1) << (SlotBits * level)) - 1)) + 1;
+                        current = std::min(nextslot, target + 1);
+                        continue;
+                }
+
+                Timer &head = slots[0][current & SlotMask];
+                while (head.next != &head)
+                {
+                        Timer *timer = head.next;
+                        Unlink(timer);
+
+                        //Timers that were parked beyond our range are re-inserted
+                        if (timer->tick > current)
+                            Insert(timer);
+                        else
+                            expired->push_back(timer);
+                }
+                ++current;
+        }
+}
+
+DateTime TimerWheel::GetNextCheck() const
+{
+        if (count == 0)
+            return DateTime::Max();
+
+        if (levelcount[0] != 0)
+        {
+                for (uint64_t tick = current; tick < current + NumSlots; ++tick)
+                  if (slots[0][tick & SlotMask].next != &slots[0][tick & SlotMask])
+                    return GetTickTime(tick);
+        }
+
+        //The first level is empty, so wait until the next slot of the lowest used level comes up
+        unsigned level = 1;
+        while (level < NumLevels - 1 && levelcount[level] == 0)
+            ++level;
+
+        uint64_t slotmask = (uint64_t(1) << (SlotBits * level)) - 1;
+        return GetTickTime((current + slotmask) & ~slotmask);
+}
+
+} //end namespace Blex
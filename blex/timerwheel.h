@@ -0,0 +1,142 @@
+#ifndef blex_timerwheel
+#define blex_timerwheel
+
+#ifndef blex_blexlib
+#include "blexlib.h"
+#endif
+#ifndef blex_datetime
+#include "datetime.h"
+#endif
+#include <vector>
+
+namespace Blex
+{
+
+/** TimerWheel is a hierarchical timing wheel, for keeping track of large
+    numbers of timers that are frequently set, moved or cancelled (eg.
+    connection timeouts).
+
+    Timers are intrusive: objects that need a timer derive from
+    TimerWheel::Timer, and are linked directly into the wheel. Arming,
+    re-arming and cancelling a timer are O(1) and never allocate. Timers are
+    kept with a fixed resolution, and never expire before their expiry time.
+
+    The wheel has multiple levels of slots. The first level has a slot per
+    tick, every next level has a slot per 64 slots of the previous level.
+    Timers in higher levels are moved down when their slot comes up.
+
+    Multithreading considerations:
+    TimerWheel is not thread-safe, callers must serialize access.
+*/
+class BLEXLIB_PUBLIC TimerWheel
+{
+        public:
+        /** A timer. Derive from this class to make an object schedulable.
+            A timer must be cancelled before it is destroyed, or the wheel must
+            not be used anymore */
+        class BLEXLIB_PUBLIC Timer
+        {
+                public:
+                Timer();
+
+                /** Is this timer currently armed? A timer is unarmed when it
+                    is returned as expired by Advance */
+                bool IsArmed() const
+                {
+                        return prev != 0;
+                }
+
+                /** Get the time this timer was last armed for */
+                DateTime GetExpiry() const
+                {
+                        return expires;
+                }
+
+                private:
+                Timer *prev;
+                Timer *next;
+                ///Expiry tick
+                uint64_t tick;
+                ///Requested expiry time
+                DateTime expires;
+                ///Level of the slot this timer is linked into
+                unsigned level;
+
+                Timer(Timer const &) = delete;
+                Timer& operator=(Timer const &) = delete;
+
+                friend class TimerWheel;
+        };
+
+        /** Construct a timer wheel
+            @param start Time to start the wheel at
+            @param resolution_msecs Resolution of the timers, in milliseconds */
+        explicit TimerWheel(DateTime start = DateTime::Now(), unsigned resolution_msecs = 10);
+
+        /** Arm a timer. If the timer is already armed, it is moved
+            @param timer Timer to arm
+            @param expires Time at which the timer must expire. Timers that
+                   have already expired will be returned by the next Advance */
+        void Arm(Timer *timer, DateTime expires);
+
+        /** Cancel a timer. Ignored if the timer isn't armed
+            @param timer Timer to cancel */
+        void Cancel(Timer *timer);
+
+        /** Advance the wheel, expiring all timers that expire up to a specified time
+            @param now Current time
+            @param expired Vector to which all expired timers are added. These
+                   timers are no longer armed */
+        void Advance(DateTime now, std::vector< Timer * > *expired);
+
+        /** Get the time at which Advance must be called next. This may be earlier
+            than the first expiry, when timers in the higher levels must be moved down
+            @return Next time to call Advance, DateTime::Max() if no timers are armed */
+        DateTime GetNextCheck() const;
+
+        /** Get the number of armed timers */
+        unsigned Size() const
+        {
+                return count;
+        }
+
+        private:
+        static const unsigned SlotBits = 6;
+        static const unsigned NumSlots = 1 << SlotBits;
+        static const uint64_t SlotMask = NumSlots - 1;
+        static const unsigned NumLevels = 5;
+        ///Number of ticks the wheel spans, timers expiring later are parked in the last level
+        static const uint64_t Range = uint64_t(1) << (SlotBits * NumLevels);
+
+        ///Get the last tick that has started at a specific time
+        uint64_t GetTick(DateTime time) const;
+        ///Get the first tick starting at or after a specific time
+        uint64_t GetTickCeil(DateTime time) const;
+        ///Get the time a tick starts
+        DateTime GetTickTime(uint64_t tick) const;
+
+        ///Link a timer into the slot for its expiry tick
+        void Insert(Timer *timer);
+        ///Unlink a timer from its slot
+        void Unlink(Timer *timer);
+        ///Move the timers of the higher level slots that come up at the current tick down
+        void Cascade();
+
+        ///Milliseconds per tick
+        unsigned const resolution;
+        ///Next tick to process
+        uint64_t current;
+        ///Number of armed timers
+        unsigned count;
+        ///Number of armed timers per level
+        unsigned levelcount[NumLevels];
+        ///List heads of the slots
+        Timer slots[NumLevels][NumSlots];
+
+        TimerWheel(TimerWheel const &) = delete;
+        TimerWheel& operator=(TimerWheel const &) = delete;
+};
+
+} //end namespace Blex
+
+#endif
@@ -0,0 +1,278 @@
+#include <drawlib/drawlibv2/allincludes.h>
+
+
+#include "bandscheduler.h"
+#include <blex/utils.h>
+
+namespace DrawLib
+{
+
+/*******************************************************************************
+  BandScheduler
+*******************************************************************************/
+
+BandScheduler::BandScheduler(unsigned numworkers)
+{
+        for (unsigned i = 0; i < numworkers; ++i)
+        {
+                std::unique_ptr< Blex::Thread > worker(new Blex::Thread(std::bind(&BandScheduler::WorkerThread, this)));
+                if (worker->Start())
+                    workers.push_back(std::move(worker));
+        }
+}
+
+BandScheduler::~BandScheduler()
+{
+        {
+                LockedData::WriteRef lock(data);
+                lock->abort = true;
+        }
+        data.SignalAll();
+        workers.clear();
+}
+
+unsigned BandScheduler::SuggestBandHeight(unsigned numlines, unsigned minbandheight) const
+{
+        unsigned numbands = GetNumThreads() * 4;
+        return std::max(minbandheight, (numlines + numbands - 1) / numbands);
+}
+
+void BandScheduler::Run(unsigned numlines, unsigned bandheight, BandFunction const &func)
+{
+        if (numlines == 0)
+            return;
+        if (bandheight == 0)
+            throw std::runtime_error("BandScheduler::Run was called with bandheight = 0.");
+
+        Job job;
+        job.func = &func;
+        job.numlines = numlines;
+        job.bandheight = bandheight;
+        job.numbands = (numlines + bandheight - 1) / bandheight;
+        job.nextband = 0;
+        job.busybands = 0;
+
+        if (!workers.empty())
+        {
+                {
+                        LockedData::WriteRef lock(data);
+                        lock->queue.push_back(&job);
+                }
+                data.SignalAll();
+        }
+
+        // Process bands ourselves until all have been handed out, then wait for the workers to finish theirs
+        while (true)
+        {
+                unsigned band;
+                {
+                        LockedData::WriteRef lock(data);
+                        if (job.nextband == job.numbands)
+                        {
+                                while (job.busybands != 0)
+                                    lock.Wait();
+                                break;
+                        }
+                        band = TakeBand(*lock, job);
+                }
+                ProcessBand(job, band);
+        }
+
+        if (job.error)
+            std::rethrow_exception(job.error);
+}
+
+unsigned BandScheduler::TakeBand(Data &data, Job &job)
+{
+        unsigned band = job.nextband++;
+        ++job.busybands;
+        if (job.nextband == job.numbands)
+            Dequeue(data, job);
+        return band;
+}
+
+void BandScheduler::Dequeue(Data &data, Job &job)
+{
+        auto itr = std::find(data.queue.begin(), data.queue.end(), &job);
+        if (itr != data.queue.end())
+            data.queue.erase(itr);
+}
+
+void BandScheduler::ProcessBand(Job &job, unsigned band)
+{
+        std::exception_ptr error;
+        try
+        {
+                unsigned firstline = band * job.bandheight;
+                (*job.func)(firstline, std::min(job.numlines, firstline + job.bandheight));
+        }
+        catch (...)
+        {
+                error = std::current_exception();
+        }
+
+        bool finished;
+        {
+                LockedData::WriteRef lock(data);
+                if (error && !job.error)
+                {
+                        // Don't start the remaining bands
+                        job.error = error;
+                        if (job.nextband != job.numbands)
+                        {
+                                job.nextband = job.numbands;
+                                Dequeue(*lock, job);
+                        }
+                }
+                --job.busybands;
+                finished = job.nextband == job.numbands && job.busybands == 0;
+        }
+        // The job may be destroyed as soon as the lock is released, only use the scheduler from here
+        if (finished)
+            data.SignalAll();
+}
+
+void BandScheduler::WorkerThread()
+{
+        while (true)
+        {
+                Job *job;
+                unsigned band;
+                {
+                        LockedData::WriteRef lock(data);
+                        while (!lock->abort && lock->queue.empty())
+                            lock.Wait();
+                        if (lock->abort)
+                            return;
+
+                        job = lock->queue.front();
+                        band = TakeBand(*lock, *job);
+                }
+                ProcessBand(*job, band);
+        }
+}
+
+BandScheduler& GetGlobalBandScheduler()
+{
+        static BandScheduler scheduler(std::max(Blex::GetSystemCPUs(false), 1u) - 1);
+        return scheduler;
+}
+
+/*******************************************************************************
+  BandedFilter
+*******************************************************************************/
+
+BandedFilter::BandedFilter(BitmapIOFilter *_source, BandScheduler &_scheduler, uint32_t _outwidth, uint32_t _outheight, unsigned _bandheight)
+: BitmapIOFilter(_source)
+, scheduler(_scheduler)
+, outwidth(_outwidth)
+, outheight(_outheight)
+, bandheight(_bandheight)
+, calculated(false)
+, outputlines_produced(0)
+{
+        if (_source == NULL)
+                throw std::runtime_error("BandedFilter was called with _source = NULL.");
+        if (bandheight == 0)
+                throw std::runtime_error("BandedFilter was called with bandheight = 0.");
+
+        LockedSourceData::WriteRef lock(sourcedata);
+        lock->lines.resize(_source->GetHeight());
+        lock->finished.resize((outheight + bandheight - 1) / bandheight);
+}
+
+BandedFilter::~BandedFilter()
+{
+}
+
+uint32_t BandedFilter::GetWidth() const
+{
+        return outwidth;
+}
+
+uint32_t BandedFilter::GetHeight() const
+{
+        return outheight;
+}
+
+void BandedFilter::GetScanline32(Scanline32& output_scanline)
+{
+        if (outputlines_produced == outheight)
+                throw std::runtime_error("BandedFilter::GetScanline32 was called too many times.");
+
+        if (output_scanline.GetWidth() != outwidth)
+                throw std::runtime_error("BandedFilter::GetScanline32 was called with invalid scanline argument.");
+
+        if (!calculated)
+        {
+                outputpixels.resize(static_cast< size_t >(outwidth) * outheight);
+                scheduler.Run(outheight, bandheight, [this](unsigned firstline, unsigned limitline)
+                {
+                        CalculateBand(firstline, limitline);
+                        FinishBand(firstline);
+                });
+                calculated = true;
+        }
+
+        Pixel32 const *outputline = GetOutputLine(outputlines_produced);
+        std::copy(outputline, outputline + outwidth, output_scanline.GetRawPixels());
+        ++outputlines_produced;
+}
+
+Pixel32 const * BandedFilter::GetSourceLine(unsigned line)
+{
+        {
+                LockedSourceData::WriteRef lock(sourcedata);
+                if (line >= lock->lines.size())
+                    throw std::runtime_error("BandedFilter::GetSourceLine was called with an invalid line.");
+                if (line < lock->decodedlines)
+                {
+                        if (!lock->lines[line])
+                            throw std::runtime_error("BandedFilter::GetSourceLine was called for a line that has already been released.");
+                        return lock->lines[line]->GetRawPixels();
+                }
+        }
+
+        // Decode up to the requested line. Other bands can still get the decoded lines meanwhile
+        Blex::Mutex::AutoLock decodelock(decodemutex);
+        while (true)
+        {
+                unsigned nextline;
+                std::unique_ptr< Scanline32 > scanline;
+                {
+                        LockedSourceData::WriteRef lock(sourcedata);
+                        if (line < lock->decodedlines)
+                            return lock->lines[line]->GetRawPixels();
+                        nextline = lock->decodedlines;
+
+                        if (!lock->sparelines.empty())
+                        {
+                                scanline = std::move(lock->sparelines.back());
+                                lock->sparelines.pop_back();
+                        }
+                }
+
+                if (!scanline)
+                    scanline.reset(new Scanline32(source->GetWidth(), true));
+                source->GetScanline32(*scanline);
+
+                LockedSourceData::WriteRef lock(sourcedata);
+                lock->lines[nextline] = std::move(scanline);
+                ++lock->decodedlines;
+        }
+}
+
+void BandedFilter::FinishBand(unsigned firstline)
+{
+        LockedSourceData::WriteRef lock(sourcedata);
+        lock->finished[firstline / bandheight] = true;
+        while (lock->finishedbands < lock->finished.size() && lock->finished[lock->finishedbands])
+            ++lock->finishedbands;
+
+        // The unfinished bands only need the lines from the first line of the first unfinished band on
+        unsigned neededline = lock->finishedbands < lock->finished.size() ? GetFirstSourceLine(lock->finishedbands * bandheight) : lock->lines.size();
+        for (unsigned limit = std::min(neededline, lock->decodedlines); lock->releasedlines < limit; ++lock->releasedlines)
+            lock->sparelines.push_back(std::move(lock->lines[lock->releasedlines]));
+}
+
+} //end namespace DrawLib
@@ -0,0 +1,181 @@
+#ifndef blex_drawlib_bandscheduler
+#define blex_drawlib_bandscheduler
+
+#ifndef blex_drawlib_bitmapiofilters
+#include "bitmapiofilters.h"
+#endif
+#include <blex/threads.h>
+#include <deque>
+#include <exception>
+#include <functional>
+
+namespace DrawLib
+{
+
+/** BandScheduler processes images in horizontal bands, concurrently on a pool
+    of worker threads. The thread calling Run processes bands too, so a
+    scheduler without workers simply processes all bands itself.
+
+    Multithreading considerations:
+    Run may be called by multiple threads at the same time. The workers process
+    the bands of the running jobs in order of submission.
+*/
+class BLEXLIB_PUBLIC BandScheduler
+{
+        public:
+        /** Band processing function
+            @param firstline First line of the band
+            @param limitline Limit (last+1) line of the band */
+        typedef std::function< void(unsigned firstline, unsigned limitline) > BandFunction;
+
+        /** Construct a scheduler
+            @param numworkers Number of worker threads to start */
+        explicit BandScheduler(unsigned numworkers);
+        ~BandScheduler();
+
+        /** Process lines 0..numlines in bands, and wait for all bands to finish.
+            When a band throws, no new bands of this job are started and the first
+            exception is rethrown.
+            @param numlines Total number of lines
+            @param bandheight Number of lines per band (the last band may be smaller)
+            @param func Function to call for every band */
+        void Run(unsigned numlines, unsigned bandheight, BandFunction const &func);
+
+        /** Get the number of threads processing bands, including the calling thread */
+        unsigned GetNumThreads() const
+        {
+                return workers.size() + 1;
+        }
+
+        /** Get a band height that gives every thread a few bands, to balance the load
+            @param numlines Total number of lines
+            @param minbandheight Minimum band height, to limit the overhead per band */
+        unsigned SuggestBandHeight(unsigned numlines, unsigned minbandheight) const;
+
+        private:
+        struct Job
+        {
+                BandFunction const *func;
+                unsigned numlines;
+                unsigned bandheight;
+                unsigned numbands;
+                ///Next band to hand out
+                unsigned nextband;
+                ///Number of bands being processed
+                unsigned busybands;
+                ///First exception thrown by a band
+                std::exception_ptr error;
+        };
+        struct Data
+        {
+                Data() : abort(false) {}
+
+                ///Jobs with bands that haven't been handed out yet
+                std::deque< Job * > queue;
+                bool abort;
+        };
+        typedef Blex::InterlockedData< Data, Blex::ConditionMutex > LockedData;
+
+        void WorkerThread();
+        /// Hand out the next band of a job
+        static unsigned TakeBand(Data &data, Job &job);
+        /// Remove a job from the queue, when all its bands have been handed out
+        static void Dequeue(Data &data, Job &job);
+        /// Process a band handed out by TakeBand
+        void ProcessBand(Job &job, unsigned band);
+
+        LockedData data;
+        std::vector< std::unique_ptr< Blex::Thread > > workers;
+
+        BandScheduler(BandScheduler const &) = delete;
+        BandScheduler& operator=(BandScheduler const &) = delete;
+};
+
+/** Get the scheduler shared by the whole process. It has a worker thread for
+    every processor but the first, and is created on first use */
+BLEXLIB_PUBLIC BandScheduler& GetGlobalBandScheduler();
+
+/** BandedFilter is the base class for filters that calculate their output in
+    bands, concurrently on a BandScheduler.
+
+    The source scanlines are decoded into a shared buffer by the first band that
+    needs them, and are released when all bands that may need them have finished.
+    The whole output is calculated at the first GetScanline32 call and kept in
+    memory, so streaming filters are better when memory is constrained.
+*/
+class BLEXLIB_PUBLIC BandedFilter : public BitmapIOFilter
+{
+        public:
+        ~BandedFilter();
+
+        virtual void GetScanline32(Scanline32& output_scanline);
+        virtual uint32_t GetWidth() const;
+        virtual uint32_t GetHeight() const;
+
+        protected:
+        /** BandedFilter constructor
+            @param _source Source filter
+            @param scheduler Scheduler to calculate the bands on
+            @param outwidth Width of the output image
+            @param outheight Height of the output image
+            @param bandheight Number of output lines per band */
+        BandedFilter(BitmapIOFilter *_source, BandScheduler &scheduler, uint32_t outwidth, uint32_t outheight, unsigned bandheight);
+
+        /** Get the first source line needed to calculate an output line. May not
+            decrease for increasing output lines */
+        virtual unsigned GetFirstSourceLine(unsigned outputline) const = 0;
+
+        /** Calculate the output lines of a band. Called concurrently for different bands */
+        virtual void CalculateBand(unsigned firstline, unsigned limitline) = 0;
+
+        /** Get the pixels of a source line, decoding the source up to that line if
+            needed. Only the lines from the first source line of the calling band on
+            are available */
+        Pixel32 const * GetSourceLine(unsigned line);
+
+        /** Get the pixels of an output line */
+        Pixel32 * GetOutputLine(unsigned line)
+        {
+                return &outputpixels[static_cast< size_t >(line) * outwidth];
+        }
+
+        private:
+        struct SourceData
+        {
+                SourceData() : decodedlines(0), releasedlines(0), finishedbands(0) {}
+
+                ///Decoded source lines, NULL if not decoded yet or released
+                std::vector< std::unique_ptr< Scanline32 > > lines;
+                ///Number of lines decoded from the source
+                unsigned decodedlines;
+                ///Number of lines released after decoding
+                unsigned releasedlines;
+                ///Released scanlines, reused to decode the next lines
+                std::vector< std::unique_ptr< Scanline32 > > sparelines;
+                ///Bands that have finished
+                std::vector< bool > finished;
+                ///Number of bands, counting from the first, that have finished
+                unsigned finishedbands;
+        };
+        typedef Blex::InterlockedData< SourceData, Blex::Mutex > LockedSourceData;
+
+        /// Release the source lines the unfinished bands don't need anymore
+        void FinishBand(unsigned firstline);
+
+        BandScheduler &scheduler;
+        uint32_t const outwidth;
+        uint32_t const outheight;
+        unsigned const bandheight;
+
+        ///Serializes reading from the source
+        Blex::Mutex decodemutex;
+        LockedSourceData sourcedata;
+
+        std::vector< Pixel32 > outputpixels;
+        bool calculated;
+        unsigned outputlines_produced;
+};
+
+} //end namespace DrawLib
+
+#endif
@@ -445,11 +445,16 @@ Bitmap32* CreateResizedBitmapFromReader(GraphicsReader &reader, DrawLib::ISize o
         DEBUGPRINT(" Resizer input size = ( " << filtersource->GetWidth() << " x " <<
                 filtersource->GetHeight() << " )");
 
-        // create the streaming resizer filter..
-        std::unique_ptr<ResizeFilter> resizefilter;
+        // create the resizer filter. We're building the whole bitmap anyway, so resize in parallel bands when
+        // we have multiple processors, and fall back to the streaming resizer otherwise.
+        std::unique_ptr<BitmapIOFilter> resizefilter;
         if (filtersource->GetWidth() != unsigned(outsize.width) || filtersource->GetHeight() != unsigned(outsize.height))
         {
-                resizefilter.reset(new ResizeFilter(filtersource, outsize.width, outsize.height));
+                BandScheduler &scheduler = GetGlobalBandScheduler();
+                if (scheduler.GetNumThreads() > 1)
+                    resizefilter.reset(new ParallelResizeFilter(filtersource, outsize.width, outsize.height, scheduler));
+                else
+                    resizefilter.reset(new ResizeFilter(filtersource, outsize.width, outsize.height));
                 filtersource=resizefilter.get();
         }
 
@@ -1,9 +1,21 @@
 #include <drawlib/drawlibv2/allincludes.h>
 
-#ifdef RESIZER_SSE
+#include "streamingresizer.h"
+#include <blex/utils.h>
+
+#if defined(IMUL_VERSION) && defined(__SSE2__)
+ #define RESIZER_SSE2 //integer SSE2 kernels, always available when the compiler targets SSE2
+ #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define RESIZER_AVX2 //integer AVX2 kernels, only used when the cpu supports them
+ #endif
+#endif
+
+#ifdef RESIZER_SSE2
 #include <emmintrin.h>
 #endif
-#include "streamingresizer.h"
+#ifdef RESIZER_AVX2
+#include <immintrin.h>
+#endif
 
 namespace DrawLib
 {
@@ -50,13 +62,6 @@ unsigned inline ColorValue(ResizeFilter::WideKernelUnit in)
 
 #endif
 
-unsigned inline ColorValueFlt(float in)
-{
-        // add 0x07FF to round, not truncate! clamp the pixels
-        int val = RoundFloat(in);
-        return val>255 ? 255 : val <0 ? 0 : val;
-}
-
 void ResizeFilter::CalcKernel(KernelUnit *kernel, double dilation_factor)
 {
         double temp_kernel[KernelSize];
@@ -129,17 +134,376 @@ void ResizeFilter::CalcFloatKernel(float *kernel, double dilation_factor)
         }
 }
 
+namespace
+{
+
+/* The filter kernels. The horizontal kernels produce 'outwidth' pixels from an
+   extended scanline, the vertical kernels combine one scanline per kernel tap.
+
+   The simd kernels calculate exactly the same as the scalar kernels: the pixels
+   are widened to 16 bit and multiplied with pairs of 16 bit taps using pmaddwd,
+   which adds the two products of a pair into a 32 bit sum per channel. Packing
+   with signed and then unsigned saturation clamps like ColorValue does.
+*/
+
+void ResizeRowScalar(ResizeFilter::KernelUnit const *kernel, Pixel32 const *inpixels, Pixel32 *outpixels, unsigned outwidth, uint32_t xstep)
+{
+        uint32_t source_xpos = 0;
+        for(unsigned int xout=0; xout<outwidth; xout++)
+        {
+                ResizeFilter::WideKernelUnit r=0,g=0,b=0,a=0;
+                uint32_t kernel_offset = ((source_xpos >> (16-ResizeFilter::KernelShift)) & (ResizeFilter::KernelShiftSize-1)) * ResizeFilter::KernelWidth;
+                Pixel32 const *srcpixels = inpixels + (source_xpos >> 16);
+                for(unsigned int k=0; k<ResizeFilter::KernelWidth; k++)
+                {
+                        ResizeFilter::KernelUnit kmul = kernel[kernel_offset+k];
+                        if (kmul!=0)
+                        {
+                                r+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixels->GetR());
+                                g+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixels->GetG());
+                                b+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixels->GetB());
+                                a+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixels->GetA());
+                        }
+                        srcpixels++;
+                }
+                outpixels[xout].SetRGBA(ColorValue(r),ColorValue(g),ColorValue(b),ColorValue(a));
+                source_xpos += xstep;
+        }
+}
+
+void FilterColumnsScalar(ResizeFilter::KernelUnit const *taps, Pixel32 const * const *rows, Pixel32 *outpixels, unsigned start, unsigned width)
+{
+        for(unsigned int x=start; x<width; x++)
+        {
+                ResizeFilter::WideKernelUnit r=0,g=0,b=0,a=0;
+                for(unsigned k=0; k<ResizeFilter::KernelWidth; k++)
+                {
+                        ResizeFilter::KernelUnit kmul = taps[k];
+                        if (kmul!=0)
+                        {
+                                Pixel32 srcpixel = rows[k][x];
+                                r+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixel.GetR());
+                                g+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixel.GetG());
+                                b+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixel.GetB());
+                                a+=kmul * static_cast<ResizeFilter::KernelUnit>(srcpixel.GetA());
+                        }
+                }
+                outpixels[x].SetRGBA(ColorValue(r),ColorValue(g),ColorValue(b),ColorValue(a));
+        }
+}
+
+/** Store pairs of taps in the low and high word of an uint32_t, as pmaddwd expects them */
+void CalcKernelPairs(uint32_t *pairs, ResizeFilter::KernelUnit const *kernel)
+{
+        for(unsigned i=0; i<ResizeFilter::KernelSize/2; ++i)
+            pairs[i] = static_cast<uint16_t>(kernel[2*i]) | (static_cast<uint32_t>(static_cast<uint16_t>(kernel[2*i+1])) << 16);
+}
+
+#ifdef RESIZER_SSE2
+static_assert(ResizeFilter::KernelWidth == 8, "The simd kernels assume 8 taps");
+
+/** Convert the channel sums of 4 pixels to pixels */
+inline __m128i PackPixelsSSE2(__m128i sums0, __m128i sums1, __m128i sums2, __m128i sums3)
+{
+        __m128i const rounding = _mm_set1_epi32(0x7FF);
+        sums0 = _mm_srai_epi32(_mm_add_epi32(sums0, rounding), 12);
+        sums1 = _mm_srai_epi32(_mm_add_epi32(sums1, rounding), 12);
+        sums2 = _mm_srai_epi32(_mm_add_epi32(sums2, rounding), 12);
+        sums3 = _mm_srai_epi32(_mm_add_epi32(sums3, rounding), 12);
+        return _mm_packus_epi16(_mm_packs_epi32(sums0, sums1), _mm_packs_epi32(sums2, sums3));
+}
+
+/** Calculate the channel sums of a horizontally filtered pixel
+    @param srcpixels The 8 source pixels
+    @param pairs The 4 tap pairs */
+inline __m128i HorizontalSumsSSE2(Pixel32 const *srcpixels, uint32_t const *pairs)
+{
+        __m128i const zero = _mm_setzero_si128();
+        __m128i taps = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pairs));
+        __m128i p0123 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(srcpixels));
+        __m128i p4567 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(srcpixels + 4));
+
+        // interleave the channels of neighbouring pixels: p0123 with p123_ gives p0 with p1 in the low, p2 with p3 in the high half
+        __m128i p0112 = _mm_unpacklo_epi8(p0123, _mm_srli_si128(p0123, 4));
+        __m128i p233_ = _mm_unpackhi_epi8(p0123, _mm_srli_si128(p0123, 4));
+        __m128i p4556 = _mm_unpacklo_epi8(p4567, _mm_srli_si128(p4567, 4));
+        __m128i p677_ = _mm_unpackhi_epi8(p4567, _mm_srli_si128(p4567, 4));
+
+        __m128i sums = _mm_madd_epi16(_mm_unpacklo_epi8(p0112, zero), _mm_shuffle_epi32(taps, 0x00));
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(_mm_unpacklo_epi8(p233_, zero), _mm_shuffle_epi32(taps, 0x55)));
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(_mm_unpacklo_epi8(p4556, zero), _mm_shuffle_epi32(taps, 0xAA)));
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(_mm_unpacklo_epi8(p677_, zero), _mm_shuffle_epi32(taps, 0xFF)));
+        return sums;
+}
+
+inline uint32_t HorizontalPairsOffset(uint32_t source_xpos)
+{
+        return ((source_xpos >> (16-ResizeFilter::KernelShift)) & (ResizeFilter::KernelShiftSize-1)) * (ResizeFilter::KernelWidth/2);
+}
+
+void ResizeRowSSE2(uint32_t const *kernelpairs, Pixel32 const *inpixels, Pixel32 *outpixels, unsigned outwidth, uint32_t xstep, unsigned start)
+{
+        uint32_t source_xpos = start * xstep;
+        unsigned xout = start;
+        for(; xout+4<=outwidth; xout+=4)
+        {
+                __m128i sums[4];
+                for(unsigned i=0; i<4; ++i, source_xpos += xstep)
+                    sums[i] = HorizontalSumsSSE2(inpixels + (source_xpos >> 16), kernelpairs + HorizontalPairsOffset(source_xpos));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(outpixels + xout), PackPixelsSSE2(sums[0], sums[1], sums[2], sums[3]));
+        }
+        for(; xout<outwidth; ++xout, source_xpos += xstep)
+        {
+                __m128i sums = HorizontalSumsSSE2(inpixels + (source_xpos >> 16), kernelpairs + HorizontalPairsOffset(source_xpos));
+                outpixels[xout] = Pixel32::FromPixelValue(_mm_cvtsi128_si32(PackPixelsSSE2(sums, sums, sums, sums)));
+        }
+}
+
+void FilterColumnsSSE2(uint32_t const *pairs, ResizeFilter::KernelUnit const *taps, Pixel32 const * const *rows, Pixel32 *outpixels, unsigned start, unsigned width)
+{
+        __m128i const zero = _mm_setzero_si128();
+        __m128i tappairs[ResizeFilter::KernelWidth/2];
+        for(unsigned k=0; k<ResizeFilter::KernelWidth/2; ++k)
+            tappairs[k] = _mm_set1_epi32(pairs[k]);
+
+        unsigned x = start;
+        for(; x+4<=width; x+=4)
+        {
+                __m128i sums0 = zero, sums1 = zero, sums2 = zero, sums3 = zero;
+                for(unsigned k=0; k<ResizeFilter::KernelWidth/2; ++k)
+                {
+                        __m128i row0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(rows[2*k] + x));
+                        __m128i row1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(rows[2*k+1] + x));
+
+                        // interleave the channels of the pixels in both rows, then widen them to 16 bit
+                        __m128i lo = _mm_unpacklo_epi8(row0, row1);
+                        __m128i hi = _mm_unpackhi_epi8(row0, row1);
+                        sums0 = _mm_add_epi32(sums0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), tappairs[k]));
+                        sums1 = _mm_add_epi32(sums1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), tappairs[k]));
+                        sums2 = _mm_add_epi32(sums2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), tappairs[k]));
+                        sums3 = _mm_add_epi32(sums3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), tappairs[k]));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(outpixels + x), PackPixelsSSE2(sums0, sums1, sums2, sums3));
+        }
+        FilterColumnsScalar(taps, rows, outpixels, x, width);
+}
+#endif
+
+#ifdef RESIZER_AVX2
+/* The AVX2 kernels do the same as the SSE2 kernels, but on two 128 bit lanes at
+   once. They are compiled for AVX2 regardless of the compiler flags, and may
+   only be called when the cpu supports AVX2.
+*/
+
+__attribute__((target("avx2"))) inline __m256i LoadLanesAVX2(void const *lane0, void const *lane1)
+{
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(static_cast<__m128i const *>(lane0))), _mm_loadu_si128(static_cast<__m128i const *>(lane1)), 1);
+}
+
+__attribute__((target("avx2"))) inline __m256i PackPixelsAVX2(__m256i sums0, __m256i sums1, __m256i sums2, __m256i sums3)
+{
+        __m256i const rounding = _mm256_set1_epi32(0x7FF);
+        sums0 = _mm256_srai_epi32(_mm256_add_epi32(sums0, rounding), 12);
+        sums1 = _mm256_srai_epi32(_mm256_add_epi32(sums1, rounding), 12);
+        sums2 = _mm256_srai_epi32(_mm256_add_epi32(sums2, rounding), 12);
+        sums3 = _mm256_srai_epi32(_mm256_add_epi32(sums3, rounding), 12);
+        return _mm256_packus_epi16(_mm256_packs_epi32(sums0, sums1), _mm256_packs_epi32(sums2, sums3));
+}
+
+/** Calculate the channel sums of two horizontally filtered pixels, one per lane */
+__attribute__((target("avx2"))) inline __m256i HorizontalSumsAVX2(Pixel32 const *srcpixels0, uint32_t const *pairs0, Pixel32 const *srcpixels1, uint32_t const *pairs1)
+{
+        __m256i const zero = _mm256_setzero_si256();
+        __m256i taps = LoadLanesAVX2(pairs0, pairs1);
+        __m256i p0123 = LoadLanesAVX2(srcpixels0, srcpixels1);
+        __m256i p4567 = LoadLanesAVX2(srcpixels0 + 4, srcpixels1 + 4);
+
+        __m256i p0112 = _mm256_unpacklo_epi8(p0123, _mm256_srli_si256(p0123, 4));
+        __m256i p233_ = _mm256_unpackhi_epi8(p0123, _mm256_srli_si256(p0123, 4));
+        __m256i p4556 = _mm256_unpacklo_epi8(p4567, _mm256_srli_si256(p4567, 4));
+        __m256i p677_ = _mm256_unpackhi_epi8(p4567, _mm256_srli_si256(p4567, 4));
+
+        __m256i sums = _mm256_madd_epi16(_mm256_unpacklo_epi8(p0112, zero), _mm256_shuffle_epi32(taps, 0x00));
+        sums = _mm256_add_epi32(sums, _mm256_madd_epi16(_mm256_unpacklo_epi8(p233_, zero), _mm256_shuffle_epi32(taps, 0x55)));
+        sums = _mm256_add_epi32(sums, _mm256_madd_epi16(_mm256_unpacklo_epi8(p4556, zero), _mm256_shuffle_epi32(taps, 0xAA)));
+        sums = _mm256_add_epi32(sums, _mm256_madd_epi16(_mm256_unpacklo_epi8(p677_, zero), _mm256_shuffle_epi32(taps, 0xFF)));
+        return sums;
+}
+
+__attribute__((target("avx2"))) void ResizeRowAVX2(uint32_t const *kernelpairs, Pixel32 const *inpixels, Pixel32 *outpixels, unsigned outwidth, uint32_t xstep)
+{
+        // the lanes hold pixels 0,1 / 2,3 / 4,5 / 6,7, packing orders them 0,2,4,6 | 1,3,5,7
+        __m256i const order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        uint32_t source_xpos = 0;
+        unsigned xout = 0;
+        for(; xout+8<=outwidth; xout+=8)
+        {
+                __m256i sums[4];
+                for(unsigned i=0; i<4; ++i, source_xpos += 2*xstep)
+                {
+                        uint32_t next_xpos = source_xpos + xstep;
+                        sums[i] = HorizontalSumsAVX2(inpixels + (source_xpos >> 16), kernelpairs + HorizontalPairsOffset(source_xpos),
+                                                     inpixels + (next_xpos >> 16), kernelpairs + HorizontalPairsOffset(next_xpos));
+                }
+                __m256i pixels = _mm256_permutevar8x32_epi32(PackPixelsAVX2(sums[0], sums[1], sums[2], sums[3]), order);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(outpixels + xout), pixels);
+        }
+        ResizeRowSSE2(kernelpairs, inpixels, outpixels, outwidth, xstep, xout);
+}
+
+__attribute__((target("avx2"))) void FilterColumnsAVX2(uint32_t const *pairs, ResizeFilter::KernelUnit const *taps, Pixel32 const * const *rows, Pixel32 *outpixels, unsigned width)
+{
+        __m256i const zero = _mm256_setzero_si256();
+        __m256i tappairs[ResizeFilter::KernelWidth/2];
+        for(unsigned k=0; k<ResizeFilter::KernelWidth/2; ++k)
+            tappairs[k] = _mm256_set1_epi32(pairs[k]);
+
+        unsigned x = 0;
+        for(; x+8<=width; x+=8)
+        {
+                // the lanes hold pixels 0,4 / 1,5 / 2,6 / 3,7, which packing puts back in order
+                __m256i sums04 = zero, sums15 = zero, sums26 = zero, sums37 = zero;
+                for(unsigned k=0; k<ResizeFilter::KernelWidth/2; ++k)
+                {
+                        __m256i row0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(rows[2*k] + x));
+                        __m256i row1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(rows[2*k+1] + x));
+
+                        __m256i lo = _mm256_unpacklo_epi8(row0, row1);
+                        __m256i hi = _mm256_unpackhi_epi8(row0, row1);
+                        sums04 = _mm256_add_epi32(sums04, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), tappairs[k]));
+                        sums15 = _mm256_add_epi32(sums15, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), tappairs[k]));
+                        sums26 = _mm256_add_epi32(sums26, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), tappairs[k]));
+                        sums37 = _mm256_add_epi32(sums37, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), tappairs[k]));
+                }
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(outpixels + x), PackPixelsAVX2(sums04, sums15, sums26, sums37));
+        }
+        FilterColumnsSSE2(pairs, taps, rows, outpixels, x, width);
+}
+#endif
+
+/** Calculate the source advance per output pixel or line (16.16 fixedpoint), and the dilation factor of the kernel */
+uint32_t CalcStep(uint32_t insize, uint32_t outsize, double *dilation_factor)
+{
+        double scale_factor = 1.0;
+        uint32_t step = 0;
+        if ((insize>1) && (outsize>1))
+        {
+                scale_factor = static_cast<double>(insize-1) / static_cast<double>(outsize-1);
+                step = static_cast<uint32_t>(scale_factor * 65536.0);
+        }
+        *dilation_factor = std::min<double>(1.0, 1.0/scale_factor);
+        return step;
+}
+
+/** Copy a scanline into an extended scanline of width+7 pixels for the horizontal pass */
+void ExtendScanline(Pixel32 const *inpixels, unsigned width, Pixel32 *extended)
+{
+        // copy pixels 0..n-1 from input buffer to
+        // pixels 3..n+2 in the extended scanline
+        // and make pixels 0..2 equal to pixel 3
+        // and make pixels n+3..n+6 equal to pixel n+2! The last output pixel
+        // may start at pixel n-1, so all 8 taps can be read without checks
+        std::copy(inpixels, inpixels + width, extended + 3);
+        std::fill_n(extended, 3, inpixels[0]);
+        std::fill_n(extended + width + 3, ResizeFilter::KernelWidth - 4, inpixels[width-1]);
+}
+
+void HorizontalPass(ResizeFilter::Kernels kernels, ResizeFilter::KernelUnit const *kernel, uint32_t const *kernelpairs, Pixel32 const *inpixels, Pixel32 *outpixels, unsigned outwidth, uint32_t xstep)
+{
+        switch (kernels)
+        {
+#ifdef RESIZER_AVX2
+        case ResizeFilter::KernelsAVX2:
+                ResizeRowAVX2(kernelpairs, inpixels, outpixels, outwidth, xstep);
+                break;
+#endif
+#ifdef RESIZER_SSE2
+        case ResizeFilter::KernelsSSE2:
+                ResizeRowSSE2(kernelpairs, inpixels, outpixels, outwidth, xstep, 0);
+                break;
+#endif
+        default:
+                (void)kernelpairs;
+                ResizeRowScalar(kernel, inpixels, outpixels, outwidth, xstep);
+        }
+}
+
+/** Filter one output line
+    @param ypos Source position of the output line (16.16 fixedpoint)
+    @param rows Source lines for every tap */
+void VerticalPass(ResizeFilter::Kernels kernels, ResizeFilter::KernelUnit const *kernel, uint32_t const *kernelpairs, uint32_t ypos, Pixel32 const * const *rows, Pixel32 *outpixels, unsigned width)
+{
+        uint32_t phase = (ypos >> (16-ResizeFilter::KernelShift)) & (ResizeFilter::KernelShiftSize-1);
+        switch (kernels)
+        {
+#ifdef RESIZER_AVX2
+        case ResizeFilter::KernelsAVX2:
+                FilterColumnsAVX2(kernelpairs + phase*(ResizeFilter::KernelWidth/2), kernel + phase*ResizeFilter::KernelWidth, rows, outpixels, width);
+                break;
+#endif
+#ifdef RESIZER_SSE2
+        case ResizeFilter::KernelsSSE2:
+                FilterColumnsSSE2(kernelpairs + phase*(ResizeFilter::KernelWidth/2), kernel + phase*ResizeFilter::KernelWidth, rows, outpixels, 0, width);
+                break;
+#endif
+        default:
+                (void)kernelpairs;
+                FilterColumnsScalar(kernel + phase*ResizeFilter::KernelWidth, rows, outpixels, 0, width);
+        }
+}
+
+} // end anonymous namespace
+
+bool ResizeFilter::IsSupported(Kernels kernels)
+{
+        switch (kernels)
+        {
+        case KernelsAuto:
+        case KernelsScalar:
+                return true;
+        case KernelsSSE2:
+#ifdef RESIZER_SSE2
+                return true;
+#else
+                return false;
+#endif
+        case KernelsAVX2:
+#ifdef RESIZER_AVX2
+                return __builtin_cpu_supports("avx2");
+#else
+                return false;
+#endif
+        }
+        return false;
+}
+
+ResizeFilter::Kernels ResizeFilter::GetBestKernels()
+{
+        if (IsSupported(KernelsAVX2))
+            return KernelsAVX2;
+        if (IsSupported(KernelsSSE2))
+            return KernelsSSE2;
+        return KernelsScalar;
+}
+
 } // end NAMESPACE DrawLib...
 
 using namespace DrawLib;
 
-ResizeFilter::ResizeFilter(BitmapIOFilter *_source, uint32_t _newwidth, uint32_t _newheight)
+ResizeFilter::ResizeFilter(BitmapIOFilter *_source, uint32_t _newwidth, uint32_t _newheight, Kernels kernels)
         : BitmapIOFilter(_source), newwidth(_newwidth), newheight(_newheight), outputlines_produced(0)
 {
         ValidateDimensions(newwidth, newheight);
 
-        hresizer.reset(new HorizontalResizer(_source, _source->GetWidth(), _newwidth));
-        vresizer.reset(new VerticalResizer(hresizer.get(), _source->GetHeight(), _newheight, _newwidth));
+        if (!IsSupported(kernels))
+                throw std::runtime_error("ResizeFilter was called with an unsupported kernel implementation.");
+        if (kernels == KernelsAuto)
+                kernels = GetBestKernels();
+
+        hresizer.reset(new HorizontalResizer(_source, _source->GetWidth(), _newwidth, kernels));
+        vresizer.reset(new VerticalResizer(hresizer.get(), _source->GetHeight(), _newheight, _newwidth, kernels));
 }
 
 ResizeFilter::~ResizeFilter()
@@ -173,9 +537,9 @@ void ResizeFilter::GetScanline32(Scanline32& output_scanline)
 // -----------------------------------------------------------------------------
 
 ResizeFilter::VerticalResizer::VerticalResizer(
-        HorizontalResizer *_source,  uint32_t inheight, uint32_t outheight, uint32_t _inwidth)
+        HorizontalResizer *_source,  uint32_t inheight, uint32_t outheight, uint32_t _inwidth, Kernels _kernels)
         : mysource(_source), inputscanline(_inwidth, true),
-          inbuffer(_inwidth*KernelWidth, true), inwidth(_inwidth)
+          inbuffer(_inwidth*KernelWidth, true), inwidth(_inwidth), kernels(_kernels)
 {
         if (inheight==0)
                 throw(std::runtime_error("ResizeFilter::VerticalResizer was called with inheight = 0."));
@@ -183,16 +547,12 @@ ResizeFilter::VerticalResizer::VerticalResizer(
         if (_source == NULL)
                 throw(std::runtime_error("ResizeFilter::VerticalResizer was called with _source = NULL."));
 
-        double scale_factor = 1.0;
-        ystep = 0;
-        if ((inheight>1) && (outheight>1))
-        {
-                scale_factor = static_cast<double>(inheight-1) / static_cast<double>(outheight-1);
-                ystep = static_cast<uint32_t>(scale_factor * 65536.0);
-        }
+        double dilation_factor;
+        ystep = CalcStep(inheight, outheight, &dilation_factor);
 
         // calculate the polyphase filtering kernel.
-        CalcKernel(kernel, std::min<double>(1.0, 1.0/scale_factor));
+        CalcKernel(kernel, dilation_factor);
+        CalcKernelPairs(kernelpairs, kernel);
         ypos = 0;
 
         ylinesleft = inheight;
@@ -231,10 +591,6 @@ ResizeFilter::VerticalResizer::VerticalResizer(
         inbuffer.CopyWithOffset(inwidth*7, inwidth, inputscanline);
         ypos = 0;
         ypos_last_update = 0;
-        r.resize(inwidth);
-        g.resize(inwidth);
-        b.resize(inwidth);
-        a.resize(inwidth);
 }
 
 ResizeFilter::VerticalResizer::~VerticalResizer()
@@ -243,35 +599,16 @@ ResizeFilter::VerticalResizer::~VerticalResizer()
 
 void ResizeFilter::VerticalResizer::GetScanline32(Scanline32 &output_scanline)
 {
-        std::fill_n(&r[0], inwidth, 0);
-        std::fill_n(&g[0], inwidth, 0);
-        std::fill_n(&b[0], inwidth, 0);
-        std::fill_n(&a[0], inwidth, 0);
-
         Pixel32 const *inbufferptr = inbuffer.GetRawPixels();
-        uint32_t kernel_offset = ((ypos >> (16-KernelShift)) & (KernelShiftSize-1)) * KernelWidth;
         uint32_t yline = ypos >> 16;
+
+        // calculate the right inbuffer pixel offset to start at for every tap..
+        Pixel32 const *rows[KernelWidth];
         for(unsigned k=0; k<KernelWidth; k++)
-        {
-                KernelUnit kmul = kernel[kernel_offset+k];
-                // calculate the right inbuffer pixel offset to start at..
-                Pixel32 const *srcpixels = inbufferptr + inwidth* ((yline+k) & (KernelWidth-1));
-                if (kmul!=0)
-                {
-                        for(unsigned int x=0; x<inwidth; x++)
-                        {
-                                r[x]+=kmul * static_cast<KernelUnit>(srcpixels->GetR());
-                                g[x]+=kmul * static_cast<KernelUnit>(srcpixels->GetG());
-                                b[x]+=kmul * static_cast<KernelUnit>(srcpixels->GetB());
-                                a[x]+=kmul * static_cast<KernelUnit>(srcpixels->GetA());
-                                srcpixels++;
-                        }
-                }
-        }
-        for(unsigned int x=0; x<inwidth; x++)
-        {
-                output_scanline.Pixel(x).SetRGBA(ColorValue(r[x]),ColorValue(g[x]),ColorValue(b[x]),ColorValue(a[x]));
-        }
+            rows[k] = inbufferptr + inwidth* ((yline+k) & (KernelWidth-1));
+
+        VerticalPass(kernels, kernel, kernelpairs, ypos, rows, output_scanline.GetRawPixels(), inwidth);
+
         ypos += ystep;
         uint32_t ypos_last_update_int = ypos_last_update >> 16;
         uint32_t newlines = (ypos >> 16) - ypos_last_update_int;
@@ -295,177 +632,106 @@ void ResizeFilter::VerticalResizer::GetScanline32(Scanline32 &output_scanline)
 // -----------------------------------------------------------------------------
 // ResizeFilter::HorizontalResizer
 // -----------------------------------------------------------------------------
-ResizeFilter::HorizontalResizer::HorizontalResizer(BitmapIOFilter *_source, uint32_t inwidth, uint32_t outwidth)
-        : mysource(_source), inputscanline(inwidth, true), extendedscanline(inwidth+6, true)
+ResizeFilter::HorizontalResizer::HorizontalResizer(BitmapIOFilter *_source, uint32_t inwidth, uint32_t outwidth, Kernels _kernels)
+        : mysource(_source), inputscanline(inwidth, true), extendedscanline(inwidth+KernelWidth-1, true), kernels(_kernels)
 {
         if (inwidth==0)
                 throw(std::runtime_error("HorizontalResizer called with inwidth == 0"));
         if (outwidth==0)
                 throw(std::runtime_error("HorizontalResizer called with outwidth == 0"));
 
-        double scale_factor = 1.0;
-        xstep = 0;
-        if ((inwidth>1) && (outwidth>1))
-        {
-                scale_factor = static_cast<double>(inwidth-1) / static_cast<double>(outwidth-1);
-                xstep = static_cast<uint32_t>(scale_factor * 65536.0);
-        }
+        double dilation_factor;
+        xstep = CalcStep(inwidth, outwidth, &dilation_factor);
 
         // calculate the polyphase filtering kernel.
-        #ifdef RESIZER_SSE
-        CalcFloatKernel(kernel_sse, std::min<double>(1.0, 1.0/scale_factor));
-        #else
-        CalcKernel(kernel, std::min<double>(1.0, 1.0/scale_factor));
-        #endif
+        CalcKernel(kernel, dilation_factor);
+        CalcKernelPairs(kernelpairs, kernel);
 }
 
 ResizeFilter::HorizontalResizer::~HorizontalResizer()
 {
 }
 
-#ifdef RESIZER_SSE
-
-/*
-    sse_kernel layout should be: 0,k,0,k,0,k,0,k,0,0,0,0,0,0,0,0 (bytes)
-*/
-void inline SSE_kernel_mul(const Pixel32 *inpixel, __m128i sse_kernel)
-{
-        __m128i sse_pixels = _mm_set_epi32(inpixel->GetPixelValue(), 0, 0, 0); // r,g,b,a | 0,0,0,0 | 0,0,0,0 | 0,0,0,0
-        __m128i tmp = _mm_set_epi32(0,0,0,0);
-        tmp = _mm_unpacklo_epi8(sse_pixels, tmp); // unpack: r,0,g,0 | b,0,a,0 | 0,0,0,0 | 0,0,0,0
-}
-
 void ResizeFilter::HorizontalResizer::GetScanline32(Scanline32 &output_scanline)
 {
         // get source scanline
         mysource->GetScanline32(inputscanline);
         uint32_t src_width = inputscanline.GetWidth();
 
-        if (extendedscanline_sse.size() != src_width+6)
-            extendedscanline_sse.resize(4*(src_width+6));
-
-        // copy pixels 0..n from input buffer to
-        // pixels 3..n+3 in the extended scanline
-        // and make pixels 0..2 equal to pixel 3
-        // and make pixels n+4..n+7 equal to pixel n+3!
-
-        //for(unsigned int i=0; i<src_width; i++)
-        //{
-        //        Pixel32 p = inputscanline.Pixel(3+i);
-        //        extendedscanline_sse[(i+3)*4] = (float)p.GetR();
-        //        extendedscanline_sse[(i+3)*4+1] = (float)p.GetG();
-        //        extendedscanline_sse[(i+3)*4+2] = (float)p.GetB();
-        //        extendedscanline_sse[(i+3)*4+3] = (float)p.GetA();
-        //}
-
-        inputscanline.ConvertToFloat(&(extendedscanline_sse[0])+12);
-
-        Pixel32 left = inputscanline.Pixel(0);
-        extendedscanline_sse[0] = (float)left.GetR();
-        extendedscanline_sse[1] = (float)left.GetG();
-        extendedscanline_sse[2] = (float)left.GetB();
-        extendedscanline_sse[3] = (float)left.GetA();
-
-        extendedscanline_sse[4] = (float)left.GetR();
-        extendedscanline_sse[5] = (float)left.GetG();
-        extendedscanline_sse[6] = (float)left.GetB();
-        extendedscanline_sse[7] = (float)left.GetA();
-
-        extendedscanline_sse[8] = (float)left.GetR();
-        extendedscanline_sse[9] = (float)left.GetG();
-        extendedscanline_sse[10] = (float)left.GetB();
-        extendedscanline_sse[11] = (float)left.GetA();
-
-        Pixel32 right = inputscanline.Pixel(src_width-1);
-        extendedscanline_sse[4*src_width] = (float)right.GetR();
-        extendedscanline_sse[4*src_width+1] = (float)right.GetG();
-        extendedscanline_sse[4*src_width+2] = (float)right.GetB();
-        extendedscanline_sse[4*src_width+3] = (float)right.GetA();
-
-        extendedscanline_sse[4*src_width+4] = (float)right.GetR();
-        extendedscanline_sse[4*src_width+5] = (float)right.GetG();
-        extendedscanline_sse[4*src_width+6] = (float)right.GetB();
-        extendedscanline_sse[4*src_width+7] = (float)right.GetA();
-
-        extendedscanline_sse[4*src_width+8] = (float)right.GetR();
-        extendedscanline_sse[4*src_width+9] = (float)right.GetG();
-        extendedscanline_sse[4*src_width+10] = (float)right.GetB();
-        extendedscanline_sse[4*src_width+11] = (float)right.GetA();
+        ExtendScanline(inputscanline.GetRawPixels(), src_width, extendedscanline.GetRawPixels());
 
         // resize it... and output it...
-        uint32_t source_xpos = 0;
-        //Pixel32 const *inpixels = extendedscanline.GetRawPixels();
-        // FIXME: make 'nasm' assembler implementation (MMX/SSE??)
-        for(unsigned int xout=0; xout<output_scanline.GetWidth(); xout++)
-        {
-                float sse_result[4];
-                uint32_t kernel_offset = ((source_xpos >> (16-KernelShift)) & (KernelShiftSize-1)) * KernelWidth;
+        HorizontalPass(kernels, kernel, kernelpairs, extendedscanline.GetRawPixels(), output_scanline.GetRawPixels(), output_scanline.GetWidth(), xstep);
+}
 
-                float *srcpixels = &(extendedscanline_sse[0]) + ((source_xpos >> 16)<<2);
-                __m128 adder = _mm_setzero_ps();    // zero.
-                for(unsigned int k=0; k<KernelWidth; k++)
-                {
-                        __m128 src  = _mm_loadu_ps(srcpixels);
-                        __m128 kmul = _mm_set_ps1(kernel_sse[kernel_offset+k]);
-                        __m128 mulresult = _mm_mul_ps(src, kmul);
-                        adder = _mm_add_ps(mulresult, adder);
+// -----------------------------------------------------------------------------
+// ParallelResizeFilter
+// -----------------------------------------------------------------------------
 
-                        srcpixels+=4;
-                }
-                _mm_storeu_ps(sse_result, adder);
-                //printf("%f %f %f %f\n", sse_result[0],sse_result[1],sse_result[2],sse_result[3]);
-                output_scanline.Pixel(xout).SetRGBA(ColorValueFlt(sse_result[0]),ColorValueFlt(sse_result[1]),
-                        ColorValueFlt(sse_result[2]),ColorValueFlt(sse_result[3]));
-                source_xpos += xstep;
-        }
+ParallelResizeFilter::ParallelResizeFilter(BitmapIOFilter *_source, uint32_t _newwidth, uint32_t _newheight, BandScheduler &scheduler, ResizeFilter::Kernels _kernels, unsigned bandheight)
+        : BandedFilter(_source, scheduler, _newwidth, _newheight, bandheight ? bandheight : scheduler.SuggestBandHeight(_newheight, MinBandHeight))
+        , inwidth(_source->GetWidth()), inheight(_source->GetHeight()), newwidth(_newwidth), kernels(_kernels)
+{
+        ValidateDimensions(_newwidth, _newheight);
+        if (inwidth==0 || inheight==0)
+                throw std::runtime_error("ParallelResizeFilter was called with an empty source.");
+
+        if (!ResizeFilter::IsSupported(kernels))
+                throw std::runtime_error("ParallelResizeFilter was called with an unsupported kernel implementation.");
+        if (kernels == ResizeFilter::KernelsAuto)
+                kernels = ResizeFilter::GetBestKernels();
+
+        // calculate the polyphase filtering kernels.
+        double dilation_factor;
+        xstep = CalcStep(inwidth, _newwidth, &dilation_factor);
+        ResizeFilter::CalcKernel(hkernel, dilation_factor);
+        CalcKernelPairs(hkernelpairs, hkernel);
+
+        ystep = CalcStep(inheight, _newheight, &dilation_factor);
+        ResizeFilter::CalcKernel(vkernel, dilation_factor);
+        CalcKernelPairs(vkernelpairs, vkernel);
 }
 
-#else
+ParallelResizeFilter::~ParallelResizeFilter()
+{
+}
 
-void ResizeFilter::HorizontalResizer::GetScanline32(Scanline32 &output_scanline)
+unsigned ParallelResizeFilter::GetFirstSourceLine(unsigned outputline) const
 {
-        // get source scanline
-        mysource->GetScanline32(inputscanline);
-        uint32_t src_width = inputscanline.GetWidth();
+        int yline = (outputline * ystep) >> 16;
+        return std::max(0, yline - int(ResizeFilter::KernelWidth/2 - 1));
+}
 
-        // copy pixels 0..n from input buffer to
-        // pixels 3..n+3 in the extended scanline
-        // and make pixels 0..2 equal to pixel 3
-        // and make pixels n+4..n+7 equal to pixel n+3!
-        extendedscanline.CopyWithOffset(3, src_width, inputscanline);
-        Pixel32 leftpixel = inputscanline.Pixel(0);
-        extendedscanline.Pixel(0) = leftpixel;
-        extendedscanline.Pixel(1) = leftpixel;
-        extendedscanline.Pixel(2) = leftpixel;
-        Pixel32 rightpixel = inputscanline.Pixel(src_width-1);
-        extendedscanline.Pixel(src_width+3) = rightpixel;
-        extendedscanline.Pixel(src_width+4) = rightpixel;
-        extendedscanline.Pixel(src_width+5) = rightpixel;
+void ParallelResizeFilter::CalculateBand(unsigned firstline, unsigned limitline)
+{
+        unsigned const KernelWidth = ResizeFilter::KernelWidth;
 
-        // resize it... and output it...
-        uint32_t source_xpos = 0;
-        Pixel32 const *inpixels = extendedscanline.GetRawPixels();
-        // FIXME: make 'nasm' assembler implementation (MMX/SSE??)
-        for(unsigned int xout=0; xout<output_scanline.GetWidth(); xout++)
+        std::vector<Pixel32> extendedline(inwidth + KernelWidth - 1);
+        // the horizontally resized source lines, stored by their line number modulo the kernel width
+        std::vector<Pixel32> resizedlines(static_cast<size_t>(newwidth) * KernelWidth);
+        unsigned resizedlinenumbers[KernelWidth];
+        std::fill_n(resizedlinenumbers, KernelWidth, inheight);
+
+        for(unsigned y=firstline; y<limitline; ++y)
         {
-                WideKernelUnit r=0,g=0,b=0,a=0;
-                uint32_t kernel_offset = ((source_xpos >> (16-KernelShift)) & (KernelShiftSize-1)) * KernelWidth;
-                Pixel32 const *srcpixels = inpixels + (source_xpos >> 16);
-                for(unsigned int k=0; k<KernelWidth; k++)
+                // the same position the streaming resizer reaches by adding ystep for every line
+                uint32_t ypos = y * ystep;
+                int yline = ypos >> 16;
+
+                Pixel32 const *rows[KernelWidth];
+                for(unsigned k=0; k<KernelWidth; k++)
                 {
-                        KernelUnit kmul = kernel[kernel_offset+k];
-                        if (kmul!=0)
+                        // tap k uses line yline+k-3, the first and last lines are repeated at the edges
+                        unsigned line = Blex::Bound<int>(0, inheight-1, yline + k - (KernelWidth/2 - 1));
+                        Pixel32 *resizedline = &resizedlines[(line % KernelWidth) * newwidth];
+                        if (resizedlinenumbers[line % KernelWidth] != line)
                         {
-                                r+=kmul * static_cast<KernelUnit>(srcpixels->GetR());
-                                g+=kmul * static_cast<KernelUnit>(srcpixels->GetG());
-                                b+=kmul * static_cast<KernelUnit>(srcpixels->GetB());
-                                a+=kmul * static_cast<KernelUnit>(srcpixels->GetA());
+                                ExtendScanline(GetSourceLine(line), inwidth, &extendedline[0]);
+                                HorizontalPass(kernels, hkernel, hkernelpairs, &extendedline[0], resizedline, newwidth, xstep);
+                                resizedlinenumbers[line % KernelWidth] = line;
                         }
-                        srcpixels++;
+                        rows[k] = resizedline;
                 }
-                output_scanline.Pixel(xout).SetRGBA(ColorValue(r),ColorValue(g),ColorValue(b),ColorValue(a));
-                source_xpos += xstep;
+                VerticalPass(kernels, vkernel, vkernelpairs, ypos, rows, GetOutputLine(y), newwidth);
         }
 }
-
-#endif
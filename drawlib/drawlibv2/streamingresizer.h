@@ -2,9 +2,9 @@
 #define streamingresizer_h
 
 #include "bitmapiofilters.h"
+#include "bandscheduler.h"
 #include "scanline.h"
 
-//#define RESIZER_SSE
 #define IMUL_VERSION //ADDME: Did an attempt to create a FMUL version to do performance testing, but it doesn't work yet!
 
 namespace DrawLib
@@ -32,12 +32,27 @@ public:
         static const unsigned KernelShiftSize=1<<KernelShift;
         static const unsigned KernelSize=KernelShiftSize*KernelWidth;
 
+        /** Implementations of the filter kernels. All implementations produce exactly the
+            same pixels, the scalar implementation is the reference for the others */
+        enum Kernels
+        {
+                ///Use the fastest implementation supported by this cpu
+                KernelsAuto,
+                ///Portable implementation
+                KernelsScalar,
+                ///SSE2 implementation
+                KernelsSSE2,
+                ///AVX2 implementation
+                KernelsAVX2
+        };
+
         /** ResizeFilter constructor
                 @param _source - a pointer to a BitmapIOFilter source object (e.g. graphics reader)
                 @param newwidth - the width of the output image
                 @param newheight - the height of the output image
+                @param kernels - the kernel implementation to use. Throws if it isn't supported
         */
-        ResizeFilter(BitmapIOFilter *_source, uint32_t newwidth, uint32_t newheight);
+        ResizeFilter(BitmapIOFilter *_source, uint32_t newwidth, uint32_t newheight, Kernels kernels = KernelsAuto);
         ~ResizeFilter();
 
         /** GetScanline32 - fill a user supplied scanline with pixels.
@@ -53,6 +68,11 @@ public:
         static void CalcKernel(ResizeFilter::KernelUnit *kernel, double dilation_factor);
         static void CalcFloatKernel(float *kernel, double dilation_factor);
 
+        /** Is a kernel implementation supported by this build and cpu? */
+        static bool IsSupported(Kernels kernels);
+        /** Get the fastest kernel implementation supported by this build and cpu */
+        static Kernels GetBestKernels();
+
         private:
 
         /** HorizontalResizer - a ResizeFilter helper object that resizes scanlines
@@ -60,7 +80,7 @@ public:
         class HorizontalResizer
         {
         public:
-                HorizontalResizer(BitmapIOFilter *_source, uint32_t inwidth, uint32_t outwidth);
+                HorizontalResizer(BitmapIOFilter *_source, uint32_t inwidth, uint32_t outwidth, Kernels kernels);
                 ~HorizontalResizer();
 
                 void GetScanline32(Scanline32 &output_scanline);
@@ -71,12 +91,8 @@ public:
                 Scanline32 extendedscanline;
                 KernelUnit kernel[KernelSize];     // 32 shifted lanczos3 kernels.
                 uint32_t        xstep;                  // 16.16 fixedpoint
-
-                                // SSE data structures
-                                std::vector<float> extendedscanline_sse;
-                                #ifdef RESIZER_SSE
-                                float      kernel_sse[KernelSize];
-                                #endif
+                Kernels         kernels;
+                uint32_t        kernelpairs[KernelSize/2]; // the kernels as pairs of taps, for the simd implementations
         };
 
         /** VerticalResizer - a ResizeFilter helper object that resizes scanlines
@@ -84,7 +100,7 @@ public:
         class VerticalResizer
         {
         public:
-                VerticalResizer(HorizontalResizer *_source, uint32_t inheight, uint32_t outheight, uint32_t outwidth);
+                VerticalResizer(HorizontalResizer *_source, uint32_t inheight, uint32_t outheight, uint32_t outwidth, Kernels kernels);
                 ~VerticalResizer();
 
                 void GetScanline32(Scanline32 &output_scanline);
@@ -99,10 +115,8 @@ public:
                 uint32_t             ypos;
                 uint32_t             ypos_last_update;
                 uint32_t             inwidth;
-                std::vector<WideKernelUnit> r;
-                std::vector<WideKernelUnit> g;
-                std::vector<WideKernelUnit> b;
-                std::vector<WideKernelUnit> a;
+                Kernels              kernels;
+                uint32_t             kernelpairs[KernelSize/2]; // the kernels as pairs of taps, for the simd implementations
         };
 
         //----------------------------------------------------------------------
@@ -114,6 +128,44 @@ public:
         uint32_t                     outputlines_produced;
 };
 
+/** ParallelResizeFilter - a resizer that produces exactly the same output as
+    ResizeFilter, but calculates it in bands on multiple threads. Every band
+    resizes the source lines it needs itself, so neighbouring bands resize a
+    few lines twice. Unlike ResizeFilter it keeps the resized image in memory.
+*/
+class BLEXLIB_PUBLIC ParallelResizeFilter : public BandedFilter
+{
+public:
+        ///Minimum number of output lines per band
+        static const unsigned MinBandHeight = 16;
+
+        /** ParallelResizeFilter constructor
+                @param _source - a pointer to a BitmapIOFilter source object (e.g. graphics reader)
+                @param newwidth - the width of the output image
+                @param newheight - the height of the output image
+                @param scheduler - the scheduler to calculate the bands on
+                @param kernels - the kernel implementation to use. Throws if it isn't supported
+                @param bandheight - the number of output lines per band, 0 to let the scheduler decide
+        */
+        ParallelResizeFilter(BitmapIOFilter *_source, uint32_t newwidth, uint32_t newheight, BandScheduler &scheduler, ResizeFilter::Kernels kernels = ResizeFilter::KernelsAuto, unsigned bandheight = 0);
+        ~ParallelResizeFilter();
+
+private:
+        virtual unsigned GetFirstSourceLine(unsigned outputline) const;
+        virtual void CalculateBand(unsigned firstline, unsigned limitline);
+
+        uint32_t                     inwidth;
+        uint32_t                     inheight;
+        uint32_t                     newwidth;
+        ResizeFilter::Kernels        kernels;
+        uint32_t                     xstep;          // 16.16 fixedpoint
+        uint32_t                     ystep;          // 16.16 fixedpoint
+        ResizeFilter::KernelUnit     hkernel[ResizeFilter::KernelSize];
+        uint32_t                     hkernelpairs[ResizeFilter::KernelSize/2];
+        ResizeFilter::KernelUnit     vkernel[ResizeFilter::KernelSize];
+        uint32_t                     vkernelpairs[ResizeFilter::KernelSize/2];
+};
+
 } // end namespace
 
 #endif
@@ -5,6 +5,7 @@
 #include "helperfuncs.h"
 #include <blex/testing.h>
 #include <blex/utils.h>
+#include <atomic>
 #include "../drawlibv2/streamingresizer.h"
 #include "../drawlibv2/bitmapio.h"
 #include "../drawlibv2/graphicsrw_jpeg.h"
@@ -534,6 +535,267 @@ BLEX_TEST_FUNCTION(StreamingResizerTest)
 
 }
 
+namespace
+{
+
+/** Streams the scanlines of a bitmap through the BitmapIOFilters */
+class BitmapStreamer : public DrawLib::BitmapIOFilter
+{
+        public:
+        BitmapStreamer(DrawLib::Bitmap32 const &bitmap) : DrawLib::BitmapIOFilter(NULL), bitmap(bitmap), line(0) {}
+
+        void GetScanline32(DrawLib::Scanline32 &output_scanline)
+        {
+                output_scanline.CopyWithOffset(0, bitmap.GetWidth(), bitmap.GetScanline32(line++));
+        }
+        uint32_t GetWidth() const { return bitmap.GetWidth(); }
+        uint32_t GetHeight() const { return bitmap.GetHeight(); }
+
+        private:
+        DrawLib::Bitmap32 const &bitmap;
+        unsigned line;
+};
+
+/** Create a bitmap with noise and sharp edges, which overshoot the 0..255 range when resized */
+std::unique_ptr<DrawLib::Bitmap32> CreateNoiseBitmap(unsigned width, unsigned height, uint32_t seed)
+{
+        std::unique_ptr<DrawLib::Bitmap32> bitmap(new DrawLib::Bitmap32(width, height));
+        for (unsigned y=0; y<height; ++y)
+        {
+                DrawLib::Scanline32 scanline(width, true);
+                for (unsigned x=0; x<width; ++x)
+                {
+                        seed = seed * 1103515245 + 12345;
+                        if ((y / 8 + x / 8) % 3 == 0)
+                            scanline.Pixel(x) = DrawLib::Pixel32::FromPixelValue((x + y) % 2 ? 0xFFFFFFFF : 0);
+                        else
+                            scanline.Pixel(x) = DrawLib::Pixel32::FromPixelValue(seed ^ (seed >> 16));
+                }
+                bitmap->SetScanline32(y, scanline);
+        }
+        return bitmap;
+}
+
+std::unique_ptr<DrawLib::Bitmap32> ReadFromFilter(DrawLib::BitmapIOFilter &filter)
+{
+        std::unique_ptr<DrawLib::Bitmap32> result(new DrawLib::Bitmap32(filter.GetWidth(), filter.GetHeight()));
+        DrawLib::Scanline32 tempscanline(filter.GetWidth(), true);
+        for (unsigned y=0; y<filter.GetHeight(); ++y)
+        {
+                filter.GetScanline32(tempscanline);
+                result->SetScanline32(y, tempscanline);
+        }
+        return result;
+}
+
+std::unique_ptr<DrawLib::Bitmap32> ResizeWithKernels(DrawLib::Bitmap32 const &source, unsigned width, unsigned height, DrawLib::ResizeFilter::Kernels kernels)
+{
+        BitmapStreamer streamer(source);
+        DrawLib::ResizeFilter resizer(&streamer, width, height, kernels);
+        return ReadFromFilter(resizer);
+}
+
+std::unique_ptr<DrawLib::Bitmap32> ResizeInBands(DrawLib::Bitmap32 const &source, unsigned width, unsigned height, DrawLib::BandScheduler &scheduler, DrawLib::ResizeFilter::Kernels kernels, unsigned bandheight)
+{
+        BitmapStreamer streamer(source);
+        DrawLib::ParallelResizeFilter resizer(&streamer, width, height, scheduler, kernels, bandheight);
+        return ReadFromFilter(resizer);
+}
+
+unsigned CountDifferences(DrawLib::Bitmap32 const &lhs, DrawLib::Bitmap32 const &rhs)
+{
+        unsigned differences = 0;
+        for (unsigned y=0; y<lhs.GetHeight(); ++y)
+        {
+                DrawLib::Scanline32 lhsline = lhs.GetScanline32(y);
+                DrawLib::Scanline32 rhsline = rhs.GetScanline32(y);
+                for (unsigned x=0; x<lhs.GetWidth(); ++x)
+                    if (lhsline.Pixel(x).GetPixelValue() != rhsline.Pixel(x).GetPixelValue())
+                        ++differences;
+        }
+        return differences;
+}
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(StreamingResizerKernelsTest)
+{
+        /* The simd kernels must produce exactly the same pixels as the scalar kernels.
+           Odd sizes test the handling of the pixels that don't fill a vector */
+        static const unsigned sizes[][4] = { { 640, 480, 320, 240 }
+                                           , { 333, 217, 97, 61 }
+                                           , { 61, 43, 250, 171 }
+                                           , { 17, 9, 17, 9 }
+                                           , { 1, 1, 13, 5 }
+                                           , { 50, 40, 1, 1 }
+                                           , { 1000, 3, 7, 300 }
+                                           };
+        static const DrawLib::ResizeFilter::Kernels kernels[] = { DrawLib::ResizeFilter::KernelsSSE2, DrawLib::ResizeFilter::KernelsAVX2 };
+
+        for (unsigned i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i)
+        {
+                std::unique_ptr<DrawLib::Bitmap32> source = CreateNoiseBitmap(sizes[i][0], sizes[i][1], i);
+                std::unique_ptr<DrawLib::Bitmap32> reference = ResizeWithKernels(*source, sizes[i][2], sizes[i][3], DrawLib::ResizeFilter::KernelsScalar);
+
+                for (unsigned k=0; k<sizeof(kernels)/sizeof(kernels[0]); ++k)
+                {
+                        if (!DrawLib::ResizeFilter::IsSupported(kernels[k]))
+                            continue;
+
+                        std::unique_ptr<DrawLib::Bitmap32> result = ResizeWithKernels(*source, sizes[i][2], sizes[i][3], kernels[k]);
+                        BLEX_TEST_CHECKEQUAL(0u, CountDifferences(*reference, *result));
+                }
+        }
+
+        BLEX_TEST_CHECK(DrawLib::ResizeFilter::IsSupported(DrawLib::ResizeFilter::GetBestKernels()));
+}
+
+BLEX_TEST_FUNCTION(StreamingResizerBenchmark)
+{
+        /* Measures the throughput of the kernel implementations, in source megapixels
+           per second, when creating a thumbnail of a photo */
+        if (!run_benchmarks)
+            return;
+
+        static const DrawLib::ResizeFilter::Kernels kernels[] = { DrawLib::ResizeFilter::KernelsScalar, DrawLib::ResizeFilter::KernelsSSE2, DrawLib::ResizeFilter::KernelsAVX2 };
+        static const char * const kernelnames[] = { "scalar", "SSE2", "AVX2" };
+        const unsigned runs = 5;
+
+        std::unique_ptr<DrawLib::Bitmap32> source = CreateNoiseBitmap(2048, 1536, 0);
+        for (unsigned k=0; k<sizeof(kernels)/sizeof(kernels[0]); ++k)
+        {
+                if (!DrawLib::ResizeFilter::IsSupported(kernels[k]))
+                    continue;
+
+                uint64_t start = Blex::GetSystemCurrentTicks();
+                for (unsigned i=0; i<runs; ++i)
+                    ResizeWithKernels(*source, 320, 240, kernels[k]);
+                double seconds = static_cast<double>(Blex::GetSystemCurrentTicks() - start) / Blex::GetSystemTickFrequency();
+
+                std::cerr << kernelnames[k] << ": ";
+                if (seconds > 0)
+                    std::cerr << (runs * 2048.0 * 1536.0 / 1000000.0) / seconds << " Mpixel/sec";
+                std::cerr << "\n";
+        }
+}
+
+BLEX_TEST_FUNCTION(BandSchedulerTest)
+{
+        DrawLib::BandScheduler scheduler(3);
+        BLEX_TEST_CHECKEQUAL(4u, scheduler.GetNumThreads());
+
+        // Every line must be processed exactly once
+        std::vector<unsigned> processed(1000);
+        scheduler.Run(processed.size(), 7, [&processed](unsigned firstline, unsigned limitline)
+        {
+                for (unsigned line=firstline; line<limitline; ++line)
+                    ++processed[line];
+        });
+        BLEX_TEST_CHECKEQUAL(1000, std::count(processed.begin(), processed.end(), 1u));
+
+        // The exception thrown by a band is rethrown by Run, and the scheduler stays usable
+        bool caught = false;
+        try
+        {
+                scheduler.Run(100, 1, [](unsigned firstline, unsigned)
+                {
+                        if (firstline == 50)
+                            throw std::runtime_error("band failed");
+                });
+        }
+        catch (std::runtime_error &e)
+        {
+                caught = std::string(e.what()) == "band failed";
+        }
+        BLEX_TEST_CHECK(caught);
+
+        // Multiple threads can run jobs at the same time
+        std::vector<unsigned> totals(4);
+        std::vector< std::unique_ptr<Blex::Thread> > threads;
+        for (unsigned i=0; i<totals.size(); ++i)
+        {
+                unsigned *total = &totals[i];
+                threads.emplace_back(new Blex::Thread([&scheduler, total]()
+                {
+                        std::atomic<unsigned> lines(0);
+                        for (unsigned run=0; run<20; ++run)
+                            scheduler.Run(500, 3, [&lines](unsigned firstline, unsigned limitline) { lines += limitline - firstline; });
+                        *total = lines;
+                }));
+                BLEX_TEST_CHECK(threads.back()->Start());
+        }
+        threads.clear();
+        for (unsigned i=0; i<totals.size(); ++i)
+            BLEX_TEST_CHECKEQUAL(20u * 500u, totals[i]);
+}
+
+BLEX_TEST_FUNCTION(ParallelResizerTest)
+{
+        /* The parallel resizer must produce exactly the same pixels as the streaming
+           resizer, whatever the band height */
+        static const unsigned sizes[][4] = { { 640, 480, 320, 240 }
+                                           , { 333, 217, 97, 61 }
+                                           , { 61, 43, 250, 171 }
+                                           , { 1, 1, 13, 5 }
+                                           , { 50, 40, 1, 1 }
+                                           , { 1000, 3, 7, 300 }
+                                           , { 7, 300, 1000, 3 }
+                                           };
+        static const unsigned bandheights[] = { 0, 1, 5 };
+        static const DrawLib::ResizeFilter::Kernels kernels[] = { DrawLib::ResizeFilter::KernelsScalar, DrawLib::ResizeFilter::KernelsAuto };
+
+        DrawLib::BandScheduler scheduler(3);
+        for (unsigned i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i)
+        {
+                std::unique_ptr<DrawLib::Bitmap32> source = CreateNoiseBitmap(sizes[i][0], sizes[i][1], i);
+                for (unsigned k=0; k<sizeof(kernels)/sizeof(kernels[0]); ++k)
+                {
+                        std::unique_ptr<DrawLib::Bitmap32> reference = ResizeWithKernels(*source, sizes[i][2], sizes[i][3], kernels[k]);
+                        for (unsigned b=0; b<sizeof(bandheights)/sizeof(bandheights[0]); ++b)
+                        {
+                                std::unique_ptr<DrawLib::Bitmap32> result = ResizeInBands(*source, sizes[i][2], sizes[i][3], scheduler, kernels[k], bandheights[b]);
+                                BLEX_TEST_CHECKEQUAL(0u, CountDifferences(*reference, *result));
+                        }
+                }
+        }
+
+        // Without worker threads, the calling thread calculates all bands
+        DrawLib::BandScheduler nothreads(0);
+        std::unique_ptr<DrawLib::Bitmap32> source = CreateNoiseBitmap(333, 217, 0);
+        std::unique_ptr<DrawLib::Bitmap32> reference = ResizeWithKernels(*source, 97, 61, DrawLib::ResizeFilter::KernelsAuto);
+        std::unique_ptr<DrawLib::Bitmap32> result = ResizeInBands(*source, 97, 61, nothreads, DrawLib::ResizeFilter::KernelsAuto, 0);
+        BLEX_TEST_CHECKEQUAL(0u, CountDifferences(*reference, *result));
+}
+
+BLEX_TEST_FUNCTION(ParallelResizerBenchmark)
+{
+        /* Measures the throughput of the streaming and the parallel resizer, in source
+           megapixels per second, when resizing a photo */
+        if (!run_benchmarks)
+            return;
+
+        const unsigned runs = 5;
+
+        std::unique_ptr<DrawLib::Bitmap32> source = CreateNoiseBitmap(2048, 1536, 0);
+        for (unsigned parallel=0; parallel<2; ++parallel)
+        {
+                uint64_t start = Blex::GetSystemCurrentTicks();
+                for (unsigned i=0; i<runs; ++i)
+                {
+                        if (parallel)
+                            ResizeInBands(*source, 1024, 768, DrawLib::GetGlobalBandScheduler(), DrawLib::ResizeFilter::KernelsAuto, 0);
+                        else
+                            ResizeWithKernels(*source, 1024, 768, DrawLib::ResizeFilter::KernelsAuto);
+                }
+                double seconds = static_cast<double>(Blex::GetSystemCurrentTicks() - start) / Blex::GetSystemTickFrequency();
+
+                std::cerr << (parallel ? "parallel (" : "streaming (") << (parallel ? DrawLib::GetGlobalBandScheduler().GetNumThreads() : 1) << " threads): ";
+                if (seconds > 0)
+                    std::cerr << (runs * 2048.0 * 1536.0 / 1000000.0) / seconds << " Mpixel/sec";
+                std::cerr << "\n";
+        }
+}
+
 BLEX_TEST_FUNCTION(ResizerTest)
 {
         std::unique_ptr<Blex::FileStream> imgfile;
@@ -9,6 +9,7 @@
 
 //------------------------------------------------------------------------------
 #include <drawlib/drawlibv2/fontmanager.h>
+#include "helperfuncs.h"
 
 //ADDME: Vraag me niet hoe, maar het control87 fiddlen wat de UTF8Main wrapper verstoort de testresultaten
 
@@ -24,10 +25,14 @@ void CreateTestFont(std::string const &fontname)
 }
 
 
+bool run_benchmarks = false;
+
 int UTF8Main(std::vector<std::string> const &args)
 {
-        if(args.size()<3)
-                throw std::runtime_error("Syntax: drawlibv2 <testdir> <fontdir>");
+        if(args.size()<3 || args.size()>4 || (args.size()==4 && args[3] != "--benchmarks"))
+                throw std::runtime_error("Syntax: drawlibv2 <testdir> <fontdir> [--benchmarks]");
+
+        run_benchmarks = args.size()>3;
 
         Blex::Test::SetTestDataDir(args[1]);
         Blex::Test::SetTestName("drawlibv2");
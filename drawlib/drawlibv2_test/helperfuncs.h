@@ -11,6 +11,9 @@ namespace BitmapChecker
 
 }
 
+/// Whether to run the benchmarks (--benchmarks). They only print timings, so they are skipped by default
+extern bool run_benchmarks;
+
 DrawLib::Bitmap32 * LoadReferenceBitmap(std::string filename);
 
 bool                DoCompare(std::string filename , const DrawLib::Bitmap32 & bitmap,
@@ -6,10 +6,97 @@
 #include <harescript/vm/outputobject.h>
 
 #include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace HareScript
 {
 
+namespace
+{
+
+/// Character classes used by the bulk tokenizer
+enum JSONCharClass : uint8_t
+{
+        JCC_Whitespace =        0x01, // ' ', '\r', '\n', '\t'
+        JCC_TokenChar =         0x02, // '{', '}', '[', ']', ':', ','
+        JCC_SpecialChar =       0x04, // '\'', '"', '-', '+', '.'
+        JCC_Slash =             0x08, // '/', starts a comment when comments are allowed
+        JCC_NonASCII =          0x10  // Part of an UTF-8 sequence, must be decoded
+};
+
+struct JSONCharClasses
+{
+        uint8_t classes[256];
+
+        constexpr JSONCharClasses() : classes()
+        {
+                for (unsigned c: { ' ', '\r', '\n', '\t' })
+                    classes[c] = JCC_Whitespace;
+                for (unsigned c: { '{', '}', '[', ']', ':', ',' })
+                    classes[c] = JCC_TokenChar;
+                for (unsigned c: { '\'', '"', '-', '+', '.' })
+                    classes[c] = JCC_SpecialChar;
+                classes[unsigned('/')] = JCC_Slash;
+                for (unsigned c = 0x80; c < 256; ++c)
+                    classes[c] = JCC_NonASCII;
+        }
+};
+
+constexpr JSONCharClasses jsoncharclasses;
+
+/** Returns the number of whitespace bytes at the start of a buffer
+*/
+inline unsigned ScanWhitespace(uint8_t const *data, unsigned len)
+{
+        unsigned pos = 0;
+#ifdef __SSE2__
+        __m128i const space = _mm_set1_epi8(' ');
+        __m128i const cr = _mm_set1_epi8('\r');
+        __m128i const lf = _mm_set1_epi8('\n');
+        __m128i const tab = _mm_set1_epi8('\t');
+        for (; pos + 16 <= len; pos += 16)
+        {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast< __m128i const * >(data + pos));
+                __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, cr)), _mm_or_si128(_mm_cmpeq_epi8(chunk, lf), _mm_cmpeq_epi8(chunk, tab)));
+                unsigned mask = ~_mm_movemask_epi8(ws) & 0xFFFF;
+                if (mask)
+                    return pos + __builtin_ctz(mask);
+        }
+#endif
+        while (pos < len && jsoncharclasses.classes[data[pos]] == JCC_Whitespace)
+            ++pos;
+        return pos;
+}
+
+/** Returns the number of bytes at the start of a buffer that can be copied into a string
+    as-is: everything but the closing quote, backslashes, control characters and non-ASCII bytes
+*/
+inline unsigned ScanPlainString(uint8_t const *data, unsigned len, uint8_t quote)
+{
+        unsigned pos = 0;
+#ifdef __SSE2__
+        __m128i const vquote = _mm_set1_epi8(static_cast< char >(quote));
+        __m128i const backslash = _mm_set1_epi8('\\');
+        __m128i const space = _mm_set1_epi8(' ');
+        for (; pos + 16 <= len; pos += 16)
+        {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast< __m128i const * >(data + pos));
+                // Signed compare, so bytes >= 0x80 also compare as less than a space
+                __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, vquote), _mm_cmpeq_epi8(chunk, backslash)), _mm_cmplt_epi8(chunk, space));
+                unsigned mask = _mm_movemask_epi8(stop);
+                if (mask)
+                    return pos + __builtin_ctz(mask);
+        }
+#endif
+        while (pos < len && data[pos] != quote && data[pos] != '\\' && data[pos] >= ' ' && data[pos] < 0x80)
+            ++pos;
+        return pos;
+}
+
+} // End of anonymous namespace
+
 class JSONParser
 {
     public:
@@ -134,6 +221,7 @@ class JSONParser
         JSONParser(HSVM *_vm, bool _hson, bool _allowcomments, bool _alltostring, bool _wrapobjects, bool _typed, bool _tosnakecase, HSVM_VariableId _translations);
 
         bool HandleByte(uint8_t byte);
+        bool HandleData(uint8_t const *data, unsigned len);
         bool Finish(HSVM_VariableId target);
         inline bool HaveError() { return state == TS_Error; }
 
@@ -486,6 +574,165 @@ bool JSONParser::HandleByte(uint8_t byte)
         return false;
 }
 
+bool JSONParser::HandleData(uint8_t const *data, unsigned len)
+{
+        /* Bulk version of HandleByte. Runs of whitespace, plain strings, numbers and tokens are
+           scanned at once and passed to HandleToken directly. Everything that needs more care
+           (escapes, comments, non-ASCII characters, number prefixes) is passed to HandleByte,
+           so the result is the same as feeding all bytes to HandleByte.
+        */
+        uint8_t const *pos = data;
+        uint8_t const *end = data + len;
+
+        while (pos != end)
+        {
+                // Let HandleByte finish UTF-8 sequences
+                if (decoder.InsideCharacter())
+                {
+                        if (!HandleByte(*pos++))
+                            return false;
+                        continue;
+                }
+
+                uint8_t byte = *pos;
+                uint8_t charclass = jsoncharclasses.classes[byte];
+
+                switch (state)
+                {
+                case TS_Default:
+                    {
+                            if (charclass == JCC_Whitespace)
+                            {
+                                    unsigned wslen = ScanWhitespace(pos, end - pos);
+                                    uint8_t const *wsend = pos + wslen;
+                                    for (uint8_t const *itr = pos; itr != wsend; ++itr)
+                                    {
+                                            if (*itr == '\n')
+                                            {
+                                                    ++line;
+                                                    column = 1;
+                                            }
+                                            else
+                                                ++column;
+                                    }
+                                    errorline = line;
+                                    errorcolumn = column - 1;
+                                    pos = wsend;
+                                    continue;
+                            }
+                            if (charclass == JCC_TokenChar)
+                            {
+                                    ++column;
+                                    errorline = line;
+                                    errorcolumn = column - 1;
+                                    ++pos;
+
+                                    currenttoken.assign(1, static_cast< char >(byte));
+                                    if (!HandleToken(currenttoken, JTT_SpecialToken))
+                                    {
+                                            state = TS_Error;
+                                            return false;
+                                    }
+                                    continue;
+                            }
+                            if (byte == '"' || (charclass == 0 && byte != 0))
+                            {
+                                    ++column;
+                                    errorline = line;
+                                    errorcolumn = column - 1;
+                                    ++pos;
+
+                                    if (byte == '"')
+                                    {
+                                            currenttoken.clear();
+                                            state = TS_DQString;
+                                    }
+                                    else
+                                    {
+                                            currenttoken.assign(1, static_cast< char >(byte));
+                                            state = byte >= '0' && byte <= '9' ? TS_Number : TS_LongToken;
+                                    }
+                                    continue;
+                            }
+                    } break;
+                case TS_Number:
+                case TS_LongToken:
+                    {
+                            // Numbers end at whitespace, tokenchars and comments, long tokens also at special characters
+                            uint8_t stopclasses = JCC_Whitespace | JCC_TokenChar | JCC_NonASCII | (allowcomments ? JCC_Slash : 0) | (state == TS_LongToken ? JCC_SpecialChar : 0);
+                            uint8_t const *tokenend = pos;
+                            while (tokenend != end && !(jsoncharclasses.classes[*tokenend] & stopclasses))
+                                ++tokenend;
+
+                            currenttoken.append(reinterpret_cast< char const * >(pos), tokenend - pos);
+                            column += tokenend - pos;
+                            pos = tokenend;
+                            if (pos == end)
+                                continue;
+                            if (jsoncharclasses.classes[*pos] & JCC_NonASCII)
+                                break;
+
+                            // The token is complete, the terminating character is processed in the default state
+                            bool success = HandleToken(currenttoken, state == TS_LongToken ? JTT_Token : JTT_Number);
+                            if (!success)
+                            {
+                                    // HandleByte has counted the terminating character when reporting the error
+                                    if (*pos == '\n')
+                                    {
+                                            ++line;
+                                            column = 1;
+                                    }
+                                    else
+                                        ++column;
+
+                                    if (state == TS_Number)
+                                        state = TS_Error;
+                                    return false;
+                            }
+                            state = TS_Default;
+                            continue;
+                    }
+                case TS_DQString:
+                case TS_QString:
+                    {
+                            uint8_t quote = state == TS_DQString ? '"' : '\'';
+                            unsigned plainlen = ScanPlainString(pos, end - pos, quote);
+
+                            currenttoken.append(reinterpret_cast< char const * >(pos), plainlen);
+                            column += plainlen;
+                            pos += plainlen;
+                            if (pos == end || *pos != quote)
+                                break;
+
+                            // End of the string
+                            ++column;
+                            ++pos;
+                            if (currenttoken.find('\\') != std::string::npos)
+                            {
+                                    std::string currentstring;
+                                    std::swap(currentstring, currenttoken);
+                                    Blex::DecodeJava(currentstring.begin(), currentstring.end(), std::back_inserter(currenttoken));
+                            }
+                            state = TS_Default;
+                            if (!HandleToken(currenttoken, JTT_String))
+                            {
+                                    state = TS_Error;
+                                    return false;
+                            }
+                            continue;
+                    }
+                case TS_Error:
+                    return false;
+                default: ;
+                }
+
+                // Not handled by the fast paths above
+                if (pos != end && !HandleByte(*pos++))
+                    return false;
+        }
+        return true;
+}
+
 bool JSONParser::Finish(HSVM_VariableId target)
 {
         if (state == TS_LongToken)
@@ -1425,15 +1672,24 @@ class JSONEncoder
 
         struct Level
         {
-                Level(HSVM_VariableId _var, LevelType _type) : var(_var), type(_type), pos(0), allocated(false) { }
+                Level(HSVM_VariableId _var, LevelType _type) : var(_var), type(_type), pos(0), columnstart(0), allocated(false) { }
                 HSVM_VariableId var;
                 LevelType type;
                 unsigned pos;
                 unsigned len;
-                Blex::PodVector< HSVM_ColumnId > columns;
+                ///Start of the sorted columns of an object in the column stack
+                unsigned columnstart;
                 bool allocated;
         };
 
+        struct ColumnMapping
+        {
+                ///Name of the column in the output, determines the column order
+                std::string name;
+                ///Encoded name, with quotes, colon and the separating space when formatting
+                std::string encoded;
+        };
+
     private:
         void PushNr(int64_t nr, int decimals, Blex::PodVector< char > *dest);
         void Indent(Blex::PodVector< char > *dest);
@@ -1447,10 +1703,20 @@ class JSONEncoder
         bool tocamelcase;
         unsigned indent;
 
-        std::unordered_map<HSVM_ColumnId, std::string> colMapping;
+        std::unordered_map<HSVM_ColumnId, ColumnMapping> colMapping;
+
+        /// Column order of the last record encoded at a depth, records with the same columns reuse it
+        struct ColumnOrder
+        {
+                Blex::PodVector< HSVM_ColumnId > unsorted;
+                Blex::PodVector< HSVM_ColumnId > sorted;
+        };
+        std::vector< ColumnOrder > columnorders;
+
+        void SortColumns(HSVM_VariableId rec, unsigned depth, unsigned len, HSVM_ColumnId *columns);
 
     public:
-        std::string_view GetColMapping(HSVM_ColumnId colid);
+        ColumnMapping const & GetColMapping(HSVM_ColumnId colid);
 
         void Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool make_blob, bool hson);
         void Close();
@@ -1504,10 +1770,75 @@ namespace
 
 bool TranslatedColumnLess(JSONEncoder *encoder, HSVM_ColumnId left, HSVM_ColumnId right)
 {
-        return encoder->GetColMapping(left) < encoder->GetColMapping(right);
+        return encoder->GetColMapping(left).name < encoder->GetColMapping(right).name;
+}
+
+/// Upper limit for the estimated size of an encoded array that is reserved up front
+const size_t MaxEncoderReservation = 64 * 1024 * 1024;
+
+/// Is this a byte that Blex::EncodeJSON and Blex::EncodeHSON copy unchanged?
+inline bool IsUnescapedChar(uint8_t c)
+{
+        return c >= 0x20 && c < 0x7F && c != '"' && c != '\\' && c != '<';
+}
+
+/** Returns the number of bytes at the start of a string that are copied unchanged by
+    Blex::EncodeJSON and Blex::EncodeHSON
+*/
+inline unsigned ScanUnescapedString(uint8_t const *data, unsigned len)
+{
+        unsigned pos = 0;
+#ifdef __SSE2__
+        __m128i const quote = _mm_set1_epi8('"');
+        __m128i const backslash = _mm_set1_epi8('\\');
+        __m128i const lt = _mm_set1_epi8('<');
+        __m128i const controls = _mm_set1_epi8(0x1F);
+        __m128i const del = _mm_set1_epi8(0x7F);
+        for (; pos + 16 <= len; pos += 16)
+        {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast< __m128i const * >(data + pos));
+                // Signed compares, so bytes >= 0x80 don't compare greater than the control characters
+                __m128i plain = _mm_and_si128(_mm_cmpgt_epi8(chunk, controls), _mm_cmplt_epi8(chunk, del));
+                __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)), _mm_cmpeq_epi8(chunk, lt));
+                unsigned mask = ~_mm_movemask_epi8(_mm_andnot_si128(special, plain)) & 0xFFFF;
+                if (mask)
+                    return pos + __builtin_ctz(mask);
+        }
+#endif
+        while (pos < len && IsUnescapedChar(data[pos]))
+            ++pos;
+        return pos;
+}
+
+/** Encodes a string with Blex::EncodeJSON or Blex::EncodeHSON, copying runs of characters that
+    need no escaping directly. The escaping encoders only get the parts in between, which are cut
+    after an ASCII character so no UTF-8 sequence (valid or not) or '</' is split up.
+*/
+void AppendEscapedString(char const *begin, char const *end, bool hson, Blex::PodVector< char > *dest)
+{
+        uint8_t const *pos = reinterpret_cast< uint8_t const * >(begin);
+        uint8_t const *limit = reinterpret_cast< uint8_t const * >(end);
+        while (pos != limit)
+        {
+                unsigned plainlen = ScanUnescapedString(pos, limit - pos);
+                dest->insert(dest->end(), pos, pos + plainlen);
+                pos += plainlen;
+                if (pos == limit)
+                    break;
+
+                uint8_t const *special = pos + 1;
+                while (special != limit && (!IsUnescapedChar(*special) || special[-1] >= 0x80 || special[-1] == '<'))
+                    ++special;
+
+                if (hson)
+                    Blex::EncodeHSON(reinterpret_cast< char const * >(pos), reinterpret_cast< char const * >(special), std::back_inserter(*dest));
+                else
+                    Blex::EncodeJSON(reinterpret_cast< char const * >(pos), reinterpret_cast< char const * >(special), std::back_inserter(*dest));
+                pos = special;
+        }
 }
 
-std::string GetErrorLocationFromLevels(HSVM *vm, std::vector< JSONEncoder::Level > const &levels)
+std::string GetErrorLocationFromLevels(HSVM *vm, std::vector< JSONEncoder::Level > const &levels, Blex::PodVector< HSVM_ColumnId > const &columnstack)
 {
         std::string errormsg = ", at DATA";
 
@@ -1519,7 +1850,7 @@ std::string GetErrorLocationFromLevels(HSVM *vm, std::vector< JSONEncoder::Level
                 {
                     errormsg += ".";
                     char colname_buffer[HSVM_MaxColumnName];
-                    unsigned colname_len = HSVM_GetColumnName(vm, itr.columns[itr.pos - 1], colname_buffer);
+                    unsigned colname_len = HSVM_GetColumnName(vm, columnstack[itr.columnstart + itr.pos - 1], colname_buffer);
                     errormsg += std::string(colname_buffer, colname_buffer + colname_len);
                 }
                 else if (itr.type == JSONEncoder::LT_UnpackedObject)
@@ -1537,12 +1868,12 @@ std::string GetErrorLocationFromLevels(HSVM *vm, std::vector< JSONEncoder::Level
         return errormsg;
 }
 
-void ThrowCannotEncodeType(HSVM *vm, HSVM_VariableType type, bool hson, std::vector< JSONEncoder::Level > const &levels, bool onlynondefault)
+void ThrowCannotEncodeType(HSVM *vm, HSVM_VariableType type, bool hson, std::vector< JSONEncoder::Level > const &levels, Blex::PodVector< HSVM_ColumnId > const &columnstack, bool onlynondefault)
 {
         std::string errormsg = std::string("Cannot encode ") + (onlynondefault ? "type " : "a non-default ")
             + GetTypeName(static_cast< VariableTypes::Type >(type))
             + " in " + std::string(hson?"HSON":"JSON")
-            + GetErrorLocationFromLevels(vm, levels);
+            + GetErrorLocationFromLevels(vm, levels, columnstack);
 
         HSVM_ThrowException(vm, errormsg.c_str());
 }
@@ -1590,28 +1921,57 @@ void JSONEncoder::FinishStdType(Blex::PodVector< char > &dest)
         dest.push_back('}');
 }
 
-std::string_view JSONEncoder::GetColMapping(HSVM_ColumnId colid)
+JSONEncoder::ColumnMapping const & JSONEncoder::GetColMapping(HSVM_ColumnId colid)
 {
         auto itr = colMapping.find(colid);
         if (itr != colMapping.end())
             return itr->second;
 
         // not found, compute it
-        if (translations)
+        ColumnMapping mapping;
+        HSVM_VariableId mapped_colid = translations ? HSVM_RecordGetRef(vm, translations, colid) : 0;
+        if (mapped_colid && HSVM_GetType(vm, mapped_colid) == HSVM_VAR_String)
+            mapping.name = HSVM_StringGetSTD(vm, mapped_colid);
+        else
         {
-                HSVM_VariableId mapped_colid = HSVM_RecordGetRef(vm, translations, colid);
-                if (mapped_colid && HSVM_GetType(vm, mapped_colid) == HSVM_VAR_String)
-                   return colMapping.insert(std::make_pair(colid, HSVM_StringGetSTD(vm, mapped_colid))).first->second;
+                char colname_buffer[HSVM_MaxColumnName];
+                unsigned colname_len = HSVM_GetColumnName(vm, colid, colname_buffer);
+                Blex::ToLowercase(colname_buffer, colname_buffer + colname_len);
+                mapping.name = tocamelcase ?
+                    Blex::NameToCamelCase(std::string_view(colname_buffer, colname_len)) :
+                    std::string(colname_buffer, colname_len);
         }
 
-        char colname_buffer[HSVM_MaxColumnName];
-        unsigned colname_len = HSVM_GetColumnName(vm, colid, colname_buffer);
-        Blex::ToLowercase(colname_buffer, colname_buffer + colname_len);
-        std::string result = tocamelcase ?
-            Blex::NameToCamelCase(std::string_view(colname_buffer, colname_len)) :
-            std::string(colname_buffer, colname_len);
+        // Column names are always encoded as JSON, also in HSON mode
+        mapping.encoded.push_back('"');
+        Blex::EncodeJSON(mapping.name.begin(), mapping.name.end(), std::back_inserter(mapping.encoded));
+        mapping.encoded.push_back('"');
+        mapping.encoded.push_back(':');
+        if (formatted)
+            mapping.encoded.push_back(' ');
+
+        return colMapping.insert(std::make_pair(colid, std::move(mapping))).first->second;
+}
+
+void JSONEncoder::SortColumns(HSVM_VariableId rec, unsigned depth, unsigned len, HSVM_ColumnId *columns)
+{
+        for (unsigned idx = 0; idx < len; ++idx)
+            columns[idx] = HSVM_RecordColumnIdAtPos(vm, rec, idx);
+
+        // Records in an array mostly have the same columns in the same order, so only sort when they differ from the previous record
+        if (columnorders.size() <= depth)
+            columnorders.resize(depth + 1);
+        ColumnOrder &order = columnorders[depth];
+
+        if (order.unsorted.size() == len && std::equal(columns, columns + len, order.unsorted.begin()))
+        {
+                std::copy(order.sorted.begin(), order.sorted.end(), columns);
+                return;
+        }
 
-        return colMapping.insert(std::make_pair(colid, std::move(result))).first->second;
+        order.unsorted.assign(columns, columns + len);
+        std::sort(columns, columns + len, std::bind(TranslatedColumnLess, this, std::placeholders::_1, std::placeholders::_2));
+        order.sorted.assign(columns, columns + len);
 }
 
 void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool make_blob, bool hson)
@@ -1619,7 +1979,11 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
         std::vector< Level > levels;
         levels.reserve(256);
 
+        // Sorted columns of all objects that are being encoded
+        Blex::PodVector< HSVM_ColumnId > columnstack;
+
         Blex::PodVector< char > dest;
+        bool reserved = make_blob;
         Level root_level(source, LT_Root);
         root_level.len = 1;
         levels.push_back(root_level);
@@ -1644,6 +2008,14 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
 
                 Level &current = levels.back();
 
+                // Once the first element of a root array has been encoded, estimate the size of the whole result from it
+                if (!reserved && levels.size() == 2 && current.pos == 1)
+                {
+                        if (current.type == LT_Array && current.len > 1)
+                            dest.reserve(std::min< size_t >(size_t(dest.size()) * current.len, MaxEncoderReservation));
+                        reserved = true;
+                }
+
                 if (current.pos == current.len)
                 {
                         switch (current.type)
@@ -1668,6 +2040,8 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                                     dest.push_back('}');
                                     if (current.allocated)
                                         HSVM_DeallocateVariable(vm, current.var);
+                                    if (current.type == LT_Object)
+                                        columnstack.resize(current.columnstart);
                                     levels.pop_back();
                                     continue;
                             }
@@ -1692,16 +2066,9 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                             if (current.pos != 0)
                                 dest.push_back(',');
                             Indent(&dest);
-                            HSVM_ColumnId colid = current.columns[current.pos];
-                            dest.push_back('"');
-
-                            auto mapping = GetColMapping(colid);
-                            Blex::EncodeJSON(mapping.begin(), mapping.end(), std::back_inserter(dest));
-
-                            dest.push_back('"');
-                            dest.push_back(':');
-                            if (formatted)
-                                dest.push_back(' ');
+                            HSVM_ColumnId colid = columnstack[current.columnstart + current.pos];
+                            std::string const &encoded = GetColMapping(colid).encoded;
+                            dest.insert(dest.end(), encoded.data(), encoded.data() + encoded.size());
 
                             to_encode = HSVM_RecordGetRef(vm, current.var, colid);
                     } break;
@@ -1790,15 +2157,11 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                             {
                                     Level new_level(to_encode, LT_Object);
                                     new_level.len = HSVM_RecordLength(vm, to_encode);
+                                    new_level.columnstart = columnstack.size();
+                                    columnstack.resize(new_level.columnstart + new_level.len);
+                                    SortColumns(to_encode, levels.size(), new_level.len, columnstack.begin() + new_level.columnstart);
                                     levels.push_back(new_level);
 
-                                    Level &level = levels.back();
-                                    level.columns.resize(level.len);
-
-                                    for (unsigned idx = 0; idx < level.len; ++idx)
-                                        level.columns[idx] = HSVM_RecordColumnIdAtPos(vm, to_encode, idx);
-
-                                    std::sort(level.columns.begin(), level.columns.end(), std::bind(TranslatedColumnLess, this, std::placeholders::_1, std::placeholders::_2));
                                     dest.push_back('{');
                                     indent += 2;
                                     continue;
@@ -1825,10 +2188,7 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                             Blex::StringPair str;
                             HSVM_StringGet(vm, to_encode, &str.begin, &str.end);
                             dest.push_back('"');
-                            if (hson)
-                                Blex::EncodeHSON(str.begin, str.end, std::back_inserter(dest));
-                            else
-                                Blex::EncodeJSON(str.begin, str.end, std::back_inserter(dest));
+                            AppendEscapedString(str.begin, str.end, hson, &dest);
                             dest.push_back('"');
                     } break;
                 case HSVM_VAR_Boolean:
@@ -1996,7 +2356,7 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                                             break;
                                     }
 
-                                    ThrowCannotEncodeType(vm, type, hson, levels, true);
+                                    ThrowCannotEncodeType(vm, type, hson, levels, columnstack, true);
                                     return;
                             }
 
@@ -2059,7 +2419,7 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                             else
                                 HSVM_DeallocateVariable(vm, var);
 
-                            ThrowCannotEncodeType(vm, type, hson, levels, false);
+                            ThrowCannotEncodeType(vm, type, hson, levels, columnstack, false);
                             return;
                     } break;
 
@@ -2076,11 +2436,11 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                                             break;
                                     }
 
-                                    ThrowCannotEncodeType(vm, type, hson, levels, true);
+                                    ThrowCannotEncodeType(vm, type, hson, levels, columnstack, true);
                                     return;
                             }
 
-                            ThrowCannotEncodeType(vm, type, hson, levels, false);
+                            ThrowCannotEncodeType(vm, type, hson, levels, columnstack, false);
                             return;
                     } break;
 
@@ -2097,11 +2457,11 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
                                             break;
                                     }
 
-                                    ThrowCannotEncodeType(vm, type, hson, levels, true);
+                                    ThrowCannotEncodeType(vm, type, hson, levels, columnstack, true);
                                     return;
                             }
 
-                            ThrowCannotEncodeType(vm, type, hson, levels, false);
+                            ThrowCannotEncodeType(vm, type, hson, levels, columnstack, false);
                             return;
                     } break;
 
@@ -2142,7 +2502,7 @@ void JSONEncoder::Encode(HSVM_VariableId id_set, HSVM_VariableId source, bool ma
 
                 default:
                     {
-                            ThrowCannotEncodeType(vm, type, hson, levels, false);
+                            ThrowCannotEncodeType(vm, type, hson, levels, columnstack, false);
                             return;
                     }
                 }
@@ -2185,11 +2545,7 @@ struct JSONContextData
 std::pair< Blex::SocketError::Errors, unsigned > JSONContextData::Parser::Write(unsigned numbytes, const void *data, bool /*allow_partial*/)
 {
         if (!jsonparser.HaveError())
-        {
-                for (unsigned idx = 0; idx < numbytes; ++idx)
-                    if (!jsonparser.HandleByte(static_cast< uint8_t const * >(data)[idx]))
-                        break;
-        }
+            jsonparser.HandleData(static_cast< uint8_t const * >(data), numbytes);
         return std::make_pair(Blex::SocketError::NoError, numbytes);
 }
 
@@ -2355,13 +2711,7 @@ void JSONDecoderProcess(HSVM_VariableId id_set, VirtualMachine *vm)
         JSONContextData::ParserPtr parser = context->parsers[id];
         if (parser.get())
         {
-                success = !parser->jsonparser.HaveError();
-                for (std::string::iterator it = data.begin(); it != data.end(); ++it)
-                    if (!parser->jsonparser.HandleByte(static_cast< uint8_t >(*it)))
-                    {
-                            success = false;
-                            break;
-                    }
+                success = !parser->jsonparser.HaveError() && parser->jsonparser.HandleData(reinterpret_cast< uint8_t const * >(data.data()), data.size());
         }
 
         HSVM_BooleanSet(*vm, id_set, success);
@@ -2394,10 +2744,7 @@ void JSONDecoderQuick(HSVM_VariableId id_set, VirtualMachine *vm)
             return;
 
         JSONParser jsonparser(*vm, is_hson, !is_hson && decoderopts.allowcomments, !is_hson && decoderopts.alltostring, !is_hson && decoderopts.wrapobjects, !is_hson && decoderopts.typed, !is_hson && decoderopts.tosnakecase, HSVM_Arg(3));
-        for (std::string::iterator it = data.begin(); it != data.end(); ++it)
-            if (!jsonparser.HandleByte(static_cast< uint8_t >(*it)))
-                break;
-
+        jsonparser.HandleData(reinterpret_cast< uint8_t const * >(data.data()), data.size());
         jsonparser.Finish(id_set);
 }
 
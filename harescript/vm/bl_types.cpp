@@ -75,9 +75,6 @@ void CellInsert(VarId id_set,VirtualMachine *vm)
 
 void CellUpdate(VarId id_set,VirtualMachine *vm)
 {
-        //Copy the source record first.
-        HSVM_CopyFrom(*vm, id_set, HSVM_Arg(0));
-
         //Resolve the name to a number
         Blex::StringPair str = vm->GetStackMachine().GetString(HSVM_Arg(1));
         ColumnNameId nameid= vm->columnnamemapper.GetMapping( str.size(), str.begin);
@@ -35,6 +35,7 @@ JobManagerGroupData::JobManagerGroupData()
 , reqstate(RunningState::Startup)
 , waitingvm(0)
 , id_set(0)
+, wait_registered(false)
 , iscancellable(false)
 , iscancelled(false)
 , reporterrors(false)
@@ -44,6 +45,8 @@ JobManagerGroupData::JobManagerGroupData()
 , current_run_start(Blex::DateTime::Min())
 , total_running(Blex::DateTime::Min())
 , highpriority(false)
+, schedseq(0)
+, running_highpriority(false)
 {
 }
 
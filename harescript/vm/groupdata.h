@@ -3,6 +3,8 @@
 
 #include "hsvm_constants.h"
 #include <blex/threads.h>
+#include <blex/pipestream.h>
+#include <atomic>
 
 namespace HareScript
 {
@@ -44,8 +46,10 @@ struct JobManagerGroupData
         /// Unique group id for this group (JobManager.jobdata lock)
         std::string groupid;
 
-        /// Current running state (managed by JobManager.jobdata lock)
-        RunningState::Type state;
+        /** Current running state (managed by JobManager.jobdata lock). A worker switches a group it takes
+            from the run queue from runnable to Running holding only the claimmutex, so it may be read
+            without that lock */
+        std::atomic< RunningState::Type > state;
 
         /// Old state before vm group was locked
         RunningState::Type oldstate;
@@ -77,6 +81,12 @@ struct JobManagerGroupData
         /// List of output objects this VM is waiting for (read)
         std::vector< OutputObjectWait > waits;
 
+        /// Pipewaiter with the waits of this group, registered with the wait reactor of the job manager while waiting
+        Blex::PipeWaiter waiter;
+
+        /// Whether the waiter is registered with the wait reactor (JobManager.jobdata lock)
+        bool wait_registered;
+
         /// Whether this group is cancellable (managed by JobManager.jobdata lock)
         bool iscancellable;
 
@@ -104,6 +114,17 @@ struct JobManagerGroupData
         /// Whether the script has high priority
         bool highpriority;
 
+        /// Scheduling sequence number, changes whenever the group becomes runnable or stops being runnable (JobManager.jobdata lock and claimmutex)
+        unsigned schedseq;
+
+        /** Serializes the switch from runnable to Running by the worker that claims the group with the other
+            changes to the scheduling sequence number. Also protects reqstate and current_run_start while the
+            group is runnable. Taken after the JobManager.jobdata lock */
+        mutable Blex::Mutex claimmutex;
+
+        /// Whether the group was counted in the running high-priority groups when a worker claimed it (JobManager.jobdata lock)
+        bool running_highpriority;
+
         /// External session data
         std::string externalsessiondata;
 
@@ -132,6 +153,9 @@ class BLEXLIB_PUBLIC VMGroupRef
         inline VMGroup * operator->() { return group; }
         inline VMGroup & operator*() { return *group; }
 
+        /// Swaps the referenced groups, without touching the reference counts
+        void swap(VMGroupRef &rhs) { std::swap(group, rhs.group); }
+
         static void RemoveReference(VMGroup *group);
 
         friend class JobManager;
@@ -22,13 +22,21 @@
 */
 
 #include "hsvm_columnnamemapper.h"
+#include <atomic>
 
 namespace HareScript
 {
 namespace ColumnNames
 {
 
+namespace
+{
+/// Last id handed out to a global mapper
+std::atomic< uint64_t > last_mapper_id(0);
+} // End of anonymous namespace
+
 GlobalMapper::GlobalMapper()
+: id(++last_mapper_id)
 {
         //ADDME? DEBUGONLY(data.SetupDebugging("Global columnname mapper"));
 }
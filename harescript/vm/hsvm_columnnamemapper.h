@@ -49,11 +49,19 @@ class BLEXLIB_PUBLIC GlobalMapper
 
         LockedData data;
 
+        /// Process-unique id of this mapper, never reused
+        uint64_t const id;
+
     public:
 
         /// Constructor
         GlobalMapper();
 
+        /** Returns the id of this mapper. Unlike the address of a mapper, the id isn't reused
+            when a new mapper is created after this one has been destroyed.
+        */
+        uint64_t GetId() const { return id; }
+
         /** Retrieves a copy of all mappings of a global mapper
             @param data Mapping that will be filled with the master data
         */
@@ -478,6 +478,9 @@ class BLEXLIB_PUBLIC VarMemRefCounted
 };
 
 
+/// Number of duration classes in the collection pause histogram: < 100us, < 1ms, < 10ms, < 100ms and longer
+const unsigned GCPauseHistogramBuckets = 5;
+
 struct VMStats
 {
         ///KBs of stack used by VM
@@ -494,6 +497,32 @@ struct VMStats
         int32_t objectcount;
         //Blobstore size
         uint64_t blobstore;
+        ///Number of record cell/object member lookups resolved by an inline cache
+        uint64_t cellcache_hits;
+        ///Number of record cell/object member lookups that missed their inline cache
+        uint64_t cellcache_misses;
+        ///Number of distinct record shapes (column lists) in use
+        int32_t recordshapes;
+        ///Number of shared records that were cloned to be modified
+        uint64_t recordclones;
+        ///Number of cells allocated for record clones
+        uint64_t recordclonedcells;
+        ///Number of finished major object collections
+        uint64_t gc_cycles;
+        ///Number of minor object collections (of the nursery only)
+        uint64_t gc_minorcycles;
+        ///Time spent in minor object collections, in microseconds
+        uint64_t gc_minortime;
+        ///Time spent in major object collections, in microseconds
+        uint64_t gc_majortime;
+        ///Number of object collection pauses (full collections and incremental slices)
+        uint64_t gc_pauses;
+        ///Total time spent collecting objects, in microseconds
+        uint64_t gc_time;
+        ///Longest object collection pause, in microseconds
+        uint64_t gc_maxpause;
+        ///Number of object collection pauses per duration class (see GCPauseHistogramBuckets)
+        uint64_t gc_pausehistogram[GCPauseHistogramBuckets];
 };
 
 namespace IPCMessageState
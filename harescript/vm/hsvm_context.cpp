@@ -61,6 +61,41 @@
  #define SPP_PRINT(x) (void)0
 #endif
 
+/* Instruction dispatch. With threaded dispatch every instruction handler ends with
+   its own indirect jump to the next handler, which predicts a lot better than the
+   single indirect jump of a switch. Tracing needs the per-instruction loop head, so
+   it always uses the switch.
+*/
+#if defined(HSVM_THREADED_DISPATCH) && !defined(TRACEEXECUTION)
+ #define VM_OP(op) vm_op_##op
+ #define VM_NEXT \
+        if (true) \
+        { \
+                ++profiledata.instructions_executed; \
+                if (!debug && executionstate.codeptr != SignalCodeptr) \
+                { \
+                        code = ReadInstructionFromCode< debug >(); \
+                        goto *dispatch_table[code]; \
+                } \
+                continue; \
+        } else (void)0
+#else
+ #undef HSVM_THREADED_DISPATCH
+ #define VM_OP(op) case InstructionSet::op
+ #define VM_NEXT break
+#endif
+
+/// Check the abort flag once every YieldCheckInterval invocations, and run the incremental object collector when needed
+#define VM_YIELDCHECK_BUDGETED \
+        if (--yield_budget == 0) \
+        { \
+                yield_budget = YieldCheckInterval; \
+                if (vmgroup->TestMustYield() && HandleAbortFlag()) \
+                    return; \
+                if (is_suspendable && stackmachine.WantsObjectCollectionStep()) \
+                    stackmachine.CollectObjectsStep(GCSliceBudget); \
+        }
+
 #if defined(SHOW_GENERATORS) && defined(WHBUILD_DEBUG)
  #define GEN_PRINT(x) DEBUGPRINT(x)
  #define GEN_ONLY(a) DEBUGONLY(a)
@@ -79,6 +114,14 @@ const unsigned MaxNesting = 1024; // Maximum number of nested functions
 
 const signed SignalCodeptr = -1;
 
+/// Number of taken jumps between checks of the abort flag. Calls and returns always check it.
+const unsigned YieldCheckInterval = 256;
+
+/** Amount of work (roughly the number of visited variables) per slice of the incremental
+    object collector. Native code may keep objects in variables the collector doesn't know
+    about, so slices only run when the VM isn't called from native code. */
+const unsigned GCSliceBudget = 20000;
+
 // BCB has overhead in functions with a throw; so we put them in subfunctions
 void ThrowStackOverflow()
 {
@@ -110,7 +153,7 @@ void ProfileData::Reset()
 // -----------------------------------------------------------------------------
 VirtualMachine::VirtualMachine(VMGroup *group, Environment &librarian, Blex::ContextRegistrator &creg, ErrorHandler &vm_errorhandler, CallStack &_callstack)
 : columnnamemapper(librarian.GetColumnNameMapper())
-, cn_cache(columnnamemapper)
+, cn_cache(librarian.GetColumnNameCache())
 , contextkeeper(creg)
 //, blobhandler(librarian.GetFileSystem().GetTempDir())
 , blobmanager(librarian.GetBlobManager())
@@ -143,6 +186,7 @@ VirtualMachine::VirtualMachine(VMGroup *group, Environment &librarian, Blex::Con
         executionstate.codeptr = 0;
         executionstate.library = NULL;
         executionstate.code = NULL;
+        cellcaches.reset(new CellLookupCache[CellLookupCacheCount]());
         outobjects.SetMinimumId(256);
         throwvar = stackmachine.NewHeapVariable();
         stackmachine.InitVariable(throwvar, VariableTypes::Object);
@@ -1186,6 +1230,17 @@ template< bool debug >
         return code;
 }
 
+inline CellLookupCache * VirtualMachine::GetCellLookupCache(ColumnNameId nameid)
+{
+        // Called after the operands have been read, so the codeptr uniquely identifies the instruction
+        uint8_t const *owner = &executionstate.code[executionstate.codeptr];
+        uintptr_t addr = reinterpret_cast< uintptr_t >(owner);
+        CellLookupCache &cache = cellcaches[(addr ^ (addr >> 8)) & (CellLookupCacheCount - 1)];
+        if (cache.owner != owner || cache.nameid != nameid)
+            cache.Reset(owner, nameid);
+        return &cache;
+}
+
 inline void VirtualMachine::MoveCodePtr(signed diff)
 {
 //        std::cout << "Jump taken from " << executionstate.codeptr << " to " <<executionstate.codeptr+diff <<"\n";
@@ -1360,12 +1415,24 @@ bool VirtualMachine::HandleAbortFlag()
         return true;
 }
 
+#ifdef HSVM_THREADED_DISPATCH
+// Labels as values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#if !defined(__clang__)
+// Keep gcc from merging the identical dispatch tails of all instruction handlers back into one jump
+#pragma GCC push_options
+#pragma GCC optimize ("no-crossjumping")
+#endif
+#endif
+
 template< bool debug >
   void VirtualMachine::RunInternal(bool allow_deinit)
 {
         assert(executionstate.codeptr >= -2);
         is_suspended = false;
         bool first_item = true;
+        unsigned yield_budget = YieldCheckInterval;
 
         // When debugger stopped before unwind, re-execute
         if (is_unwinding)
@@ -1457,224 +1524,265 @@ template< bool debug >
                         }
 
                         InstructionSet::_type code = ReadInstructionFromCode< debug >();
+#ifdef HSVM_THREADED_DISPATCH
+                        static void * const dispatch_table[256] = {
+                                &&vm_op_ILLEGAL, &&vm_op_CALL, &&vm_op_JUMP, &&vm_op_JUMPC, &&vm_op_RET, &&vm_op_JUMPC2, &&vm_op_JUMPC2F, &&vm_op_NOP,
+                                &&vm_op_DUP, &&vm_op_POP, &&vm_op_SWAP, &&vm_op_ILLEGAL, &&vm_op_CMP, &&vm_op_CMP2, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_LOADC, &&vm_op_LOADCB, &&vm_op_LOADG, &&vm_op_LOADS, &&vm_op_STOREG, &&vm_op_STORES, &&vm_op_LOADSD, &&vm_op_LOADGD,
+                                &&vm_op_INITVAR, &&vm_op_DESTROYS, &&vm_op_COPYS, &&vm_op_ISDEFAULTVALUE, &&vm_op_ISVALUESET, &&vm_op_LOADCI, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_LOADTYPEID,
+                                &&vm_op_ADD, &&vm_op_SUB, &&vm_op_MUL, &&vm_op_DIV, &&vm_op_MOD, &&vm_op_NEG, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_AND, &&vm_op_OR, &&vm_op_XOR, &&vm_op_NOT, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ARRAYINDEX, &&vm_op_ARRAYSIZE, &&vm_op_ARRAYINSERT, &&vm_op_ARRAYSET, &&vm_op_ARRAYDELETE, &&vm_op_ARRAYAPPEND, &&vm_op_ARRAYDELETEALL, &&vm_op_ILLEGAL,
+                                &&vm_op_MERGE, &&vm_op_ILLEGAL, &&vm_op_CAST, &&vm_op_ISIN, &&vm_op_LIKE, &&vm_op_CONCAT, &&vm_op_CASTPARAM, &&vm_op_CASTF,
+                                &&vm_op_RECORDCELLGET, &&vm_op_RECORDCELLSET, &&vm_op_RECORDCELLDELETE, &&vm_op_ILLEGAL, &&vm_op_RECORDCELLCREATE, &&vm_op_RECORDCELLUPDATE, &&vm_op_RECORDMAKEEXISTING, &&vm_op_ILLEGAL,
+                                &&vm_op_BITAND, &&vm_op_BITOR, &&vm_op_BITXOR, &&vm_op_BITNEG, &&vm_op_BITLSHIFT, &&vm_op_BITRSHIFT, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_INITFUNCTIONPTR, &&vm_op_INVOKEFPTR, &&vm_op_INVOKEFPTRNM, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_OBJNEW, &&vm_op_OBJMEMBERGET, &&vm_op_OBJMEMBERGETTHIS, &&vm_op_OBJMEMBERSET, &&vm_op_OBJMEMBERSETTHIS, &&vm_op_OBJMEMBERINSERT, &&vm_op_OBJMETHODCALL, &&vm_op_OBJSETTYPE,
+                                &&vm_op_OBJMETHODCALLTHIS, &&vm_op_OBJMAKEREFPRIV, &&vm_op_OBJMETHODCALLNM, &&vm_op_OBJMETHODCALLTHISNM, &&vm_op_OBJMEMBERISSIMPLE, &&vm_op_OBJTESTNONSTATIC, &&vm_op_OBJMEMBERDELETE, &&vm_op_OBJMEMBERINSERTTHIS,
+                                &&vm_op_YIELD, &&vm_op_OBJMEMBERDELETETHIS, &&vm_op_OBJTESTNONSTATICTHIS, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_THROW2, &&vm_op_THROW, &&vm_op_PRINT,
+                                &&vm_op_DEEPSET, &&vm_op_DEEPSETTHIS, &&vm_op_DEEPARRAYINSERT, &&vm_op_DEEPARRAYINSERTTHIS, &&vm_op_DEEPARRAYAPPEND, &&vm_op_DEEPARRAYAPPENDTHIS, &&vm_op_DEEPARRAYDELETE, &&vm_op_DEEPARRAYDELETETHIS,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL,
+                                &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL, &&vm_op_ILLEGAL };
+
+                        goto *dispatch_table[code];
+                        {
+#else
                         switch (code)
                         {
-                        case InstructionSet::NOP:
-                                break;
-                        case InstructionSet::CALL:
+#endif
+                        VM_OP(NOP):
+                                VM_NEXT;
+                        VM_OP(CALL):
                                 PrepareCall(*executionstate.library, ReadIdFromCode());
                                 if (vmgroup->TestMustYield() && HandleAbortFlag())
                                     return;
-                                break;
+                                VM_NEXT;
 
-                        case InstructionSet::RET:
+                        VM_OP(RET):
                                 //DoRet();
                                 executionstate.codeptr = SignalCodeptr;
                                 if (vmgroup->TestMustYield() && HandleAbortFlag())
                                     return;
-                                break;
+                                VM_NEXT;
 
-                        case InstructionSet::JUMP:
+                        VM_OP(JUMP):
                                 MoveCodePtr(ReadIdFromCode());
-                                if (vmgroup->TestMustYield() && HandleAbortFlag())
-                                    return;
-                                break;
+                                VM_YIELDCHECK_BUDGETED;
+                                VM_NEXT;
 
-                        case InstructionSet::JUMPC:
+                        VM_OP(JUMPC):
                                 DoJumpC(ReadIdFromCode());
-                                if (vmgroup->TestMustYield() && HandleAbortFlag())
-                                    return;
-                                break;
+                                VM_YIELDCHECK_BUDGETED;
+                                VM_NEXT;
 
-                        case InstructionSet::JUMPC2:
+                        VM_OP(JUMPC2):
                                 DoJumpC2(ReadIdFromCode());
-                                if (vmgroup->TestMustYield() && HandleAbortFlag())
-                                    return;
-                                break;
+                                VM_YIELDCHECK_BUDGETED;
+                                VM_NEXT;
 
-                        case InstructionSet::JUMPC2F:
+                        VM_OP(JUMPC2F):
                                 DoJumpC2F(ReadIdFromCode());
-                                if (vmgroup->TestMustYield() && HandleAbortFlag())
-                                    return;
-                                break;
-
-                        case InstructionSet::DUP:               DoDup(); break;
-                        case InstructionSet::POP:               DoPop(); break;
-                        case InstructionSet::SWAP:              DoSwap(); break;
-
-                        case InstructionSet::CMP:               DoCmp(); break;
-                        case InstructionSet::CMP2:              DoCmp2(); break;
-
-                        case InstructionSet::LOADC:             DoLoadC(ReadIdFromCode()); break;
-                        case InstructionSet::LOADCB:            DoLoadCB(ReadByteFromCode()); break;
-                        case InstructionSet::LOADS:             DoLoadS(ReadIdFromCode()); break;
-                        case InstructionSet::STORES:            DoStoreS(ReadIdFromCode()); break;
-                        case InstructionSet::LOADG:             DoLoadG(ReadIdFromCode()); break;
-                        case InstructionSet::STOREG:            DoStoreG(ReadIdFromCode()); break;
-                        case InstructionSet::LOADSD:            DoLoadSD(ReadIdFromCode()); break;
-                        case InstructionSet::LOADGD:            DoLoadGD(ReadIdFromCode()); break;
-                        case InstructionSet::DESTROYS:          DoDestroyS(ReadIdFromCode()); break;
-                        case InstructionSet::COPYS:             DoCopyS(ReadIdFromCode()); break;
-
-                        case InstructionSet::ISDEFAULTVALUE:    stackmachine.Stack_TestDefault(false); break;
-                        case InstructionSet::ISVALUESET:        stackmachine.Stack_TestDefault(true); break;
-                        case InstructionSet::LOADCI:            DoLoadCI(ReadIdFromCode()); break;
-
-                        case InstructionSet::PRINT:             DoPrint(); break;
-                        case InstructionSet::THROW:             DoPrint(); throw VMRuntimeError (Error::CustomError,"THROW instruction");
-                        case InstructionSet::THROW2:            DoThrow2(); break;
-
-                        case InstructionSet::INITVAR:           DoEmptyLoad(static_cast<VariableTypes::Type>(ReadIdFromCode())); break;
-
-                        case InstructionSet::ADD:               stackmachine.Stack_Arith_Add(); break;
-                        case InstructionSet::SUB:               stackmachine.Stack_Arith_Sub(); break;
-                        case InstructionSet::MUL:               stackmachine.Stack_Arith_Mul(); break;
-                        case InstructionSet::DIV:               stackmachine.Stack_Arith_Div(); break;
-                        case InstructionSet::MOD:               stackmachine.Stack_Arith_Mod(); break;
-                        case InstructionSet::NEG:               stackmachine.Stack_Arith_Neg(); break;
-
-                        case InstructionSet::AND:               stackmachine.Stack_Bool_And(); break;
-                        case InstructionSet::OR:                stackmachine.Stack_Bool_Or(); break;
-                        case InstructionSet::XOR:               stackmachine.Stack_Bool_Xor(); break;
-                        case InstructionSet::NOT:               stackmachine.Stack_Bool_Not(); break;
-
-                        case InstructionSet::ARRAYINDEX:        DoArrayIndex(); break;
-                        case InstructionSet::ARRAYSIZE:         DoArraySize(); break;
-                        case InstructionSet::ARRAYINSERT:       DoArrayInsert(); break;
-                        case InstructionSet::ARRAYSET:          DoArraySet(); break;
-                        case InstructionSet::ARRAYDELETE:       DoArrayDelete(); break;
-                        case InstructionSet::ARRAYAPPEND:       DoArrayAppend(); break;
-                        case InstructionSet::ARRAYDELETEALL:    DoArrayDeleteAll(); break;
-
-                        case InstructionSet::BITAND:            stackmachine.Stack_Bit_And(); break;
-                        case InstructionSet::BITOR:             stackmachine.Stack_Bit_Or(); break;
-                        case InstructionSet::BITXOR:            stackmachine.Stack_Bit_Xor(); break;
-                        case InstructionSet::BITNEG:            stackmachine.Stack_Bit_Neg(); break;
-                        case InstructionSet::BITLSHIFT:         stackmachine.Stack_Bit_ShiftLeft(); break;
-                        case InstructionSet::BITRSHIFT:         stackmachine.Stack_Bit_ShiftRight(); break;
-
-                        case InstructionSet::MERGE:             stackmachine.Stack_String_Merge(); break;
-                        case InstructionSet::DEEPSET:           DoDeepOperation(DeepOperation::Set, false); break;
-                        case InstructionSet::DEEPSETTHIS:       DoDeepOperation(DeepOperation::Set, true); break;
-                        case InstructionSet::DEEPARRAYAPPEND:   DoDeepOperation(DeepOperation::Append, false); break;
-                        case InstructionSet::DEEPARRAYAPPENDTHIS: DoDeepOperation(DeepOperation::Append, true); break;
-                        case InstructionSet::DEEPARRAYINSERT:   DoDeepOperation(DeepOperation::Insert, false); break;
-                        case InstructionSet::DEEPARRAYINSERTTHIS: DoDeepOperation(DeepOperation::Insert, true); break;
-                        case InstructionSet::DEEPARRAYDELETE:   DoDeepOperation(DeepOperation::Delete, false); break;
-                        case InstructionSet::DEEPARRAYDELETETHIS: DoDeepOperation(DeepOperation::Delete, true); break;
-                        case InstructionSet::CAST:              stackmachine.Stack_CastTo(static_cast<VariableTypes::Type>(ReadIdFromCode())); break;
-                        case InstructionSet::CASTF:             stackmachine.Stack_ForcedCastTo(static_cast<VariableTypes::Type>(ReadIdFromCode())); break;
-                        case InstructionSet::CONCAT:            stackmachine.Stack_Concat(); break;
-                        case InstructionSet::ISIN:              stackmachine.Stack_In(); break;
-                        case InstructionSet::LIKE:              stackmachine.Stack_Like(); break;
-                        case InstructionSet::CASTPARAM:
+                                VM_YIELDCHECK_BUDGETED;
+                                VM_NEXT;
+
+                        VM_OP(DUP):               DoDup(); VM_NEXT;
+                        VM_OP(POP):               DoPop(); VM_NEXT;
+                        VM_OP(SWAP):              DoSwap(); VM_NEXT;
+
+                        VM_OP(CMP):               DoCmp(); VM_NEXT;
+                        VM_OP(CMP2):              DoCmp2(); VM_NEXT;
+
+                        VM_OP(LOADC):             DoLoadC(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(LOADCB):            DoLoadCB(ReadByteFromCode()); VM_NEXT;
+                        VM_OP(LOADS):             DoLoadS(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(STORES):            DoStoreS(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(LOADG):             DoLoadG(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(STOREG):            DoStoreG(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(LOADSD):            DoLoadSD(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(LOADGD):            DoLoadGD(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(DESTROYS):          DoDestroyS(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(COPYS):             DoCopyS(ReadIdFromCode()); VM_NEXT;
+
+                        VM_OP(ISDEFAULTVALUE):    stackmachine.Stack_TestDefault(false); VM_NEXT;
+                        VM_OP(ISVALUESET):        stackmachine.Stack_TestDefault(true); VM_NEXT;
+                        VM_OP(LOADCI):            DoLoadCI(ReadIdFromCode()); VM_NEXT;
+
+                        VM_OP(PRINT):             DoPrint(); VM_NEXT;
+                        VM_OP(THROW):             DoPrint(); throw VMRuntimeError (Error::CustomError,"THROW instruction");
+                        VM_OP(THROW2):            DoThrow2(); VM_NEXT;
+
+                        VM_OP(INITVAR):           DoEmptyLoad(static_cast<VariableTypes::Type>(ReadIdFromCode())); VM_NEXT;
+
+                        VM_OP(ADD):               stackmachine.Stack_Arith_Add(); VM_NEXT;
+                        VM_OP(SUB):               stackmachine.Stack_Arith_Sub(); VM_NEXT;
+                        VM_OP(MUL):               stackmachine.Stack_Arith_Mul(); VM_NEXT;
+                        VM_OP(DIV):               stackmachine.Stack_Arith_Div(); VM_NEXT;
+                        VM_OP(MOD):               stackmachine.Stack_Arith_Mod(); VM_NEXT;
+                        VM_OP(NEG):               stackmachine.Stack_Arith_Neg(); VM_NEXT;
+
+                        VM_OP(AND):               stackmachine.Stack_Bool_And(); VM_NEXT;
+                        VM_OP(OR):                stackmachine.Stack_Bool_Or(); VM_NEXT;
+                        VM_OP(XOR):               stackmachine.Stack_Bool_Xor(); VM_NEXT;
+                        VM_OP(NOT):               stackmachine.Stack_Bool_Not(); VM_NEXT;
+
+                        VM_OP(ARRAYINDEX):        DoArrayIndex(); VM_NEXT;
+                        VM_OP(ARRAYSIZE):         DoArraySize(); VM_NEXT;
+                        VM_OP(ARRAYINSERT):       DoArrayInsert(); VM_NEXT;
+                        VM_OP(ARRAYSET):          DoArraySet(); VM_NEXT;
+                        VM_OP(ARRAYDELETE):       DoArrayDelete(); VM_NEXT;
+                        VM_OP(ARRAYAPPEND):       DoArrayAppend(); VM_NEXT;
+                        VM_OP(ARRAYDELETEALL):    DoArrayDeleteAll(); VM_NEXT;
+
+                        VM_OP(BITAND):            stackmachine.Stack_Bit_And(); VM_NEXT;
+                        VM_OP(BITOR):             stackmachine.Stack_Bit_Or(); VM_NEXT;
+                        VM_OP(BITXOR):            stackmachine.Stack_Bit_Xor(); VM_NEXT;
+                        VM_OP(BITNEG):            stackmachine.Stack_Bit_Neg(); VM_NEXT;
+                        VM_OP(BITLSHIFT):         stackmachine.Stack_Bit_ShiftLeft(); VM_NEXT;
+                        VM_OP(BITRSHIFT):         stackmachine.Stack_Bit_ShiftRight(); VM_NEXT;
+
+                        VM_OP(MERGE):             stackmachine.Stack_String_Merge(); VM_NEXT;
+                        VM_OP(DEEPSET):           DoDeepOperation(DeepOperation::Set, false); VM_NEXT;
+                        VM_OP(DEEPSETTHIS):       DoDeepOperation(DeepOperation::Set, true); VM_NEXT;
+                        VM_OP(DEEPARRAYAPPEND):   DoDeepOperation(DeepOperation::Append, false); VM_NEXT;
+                        VM_OP(DEEPARRAYAPPENDTHIS): DoDeepOperation(DeepOperation::Append, true); VM_NEXT;
+                        VM_OP(DEEPARRAYINSERT):   DoDeepOperation(DeepOperation::Insert, false); VM_NEXT;
+                        VM_OP(DEEPARRAYINSERTTHIS): DoDeepOperation(DeepOperation::Insert, true); VM_NEXT;
+                        VM_OP(DEEPARRAYDELETE):   DoDeepOperation(DeepOperation::Delete, false); VM_NEXT;
+                        VM_OP(DEEPARRAYDELETETHIS): DoDeepOperation(DeepOperation::Delete, true); VM_NEXT;
+                        VM_OP(CAST):              stackmachine.Stack_CastTo(static_cast<VariableTypes::Type>(ReadIdFromCode())); VM_NEXT;
+                        VM_OP(CASTF):             stackmachine.Stack_ForcedCastTo(static_cast<VariableTypes::Type>(ReadIdFromCode())); VM_NEXT;
+                        VM_OP(CONCAT):            stackmachine.Stack_Concat(); VM_NEXT;
+                        VM_OP(ISIN):              stackmachine.Stack_In(); VM_NEXT;
+                        VM_OP(LIKE):              stackmachine.Stack_Like(); VM_NEXT;
+                        VM_OP(CASTPARAM):
                                 {
                                         VariableTypes::Type type = static_cast<VariableTypes::Type>(ReadIdFromCode()); // Keep them apart with ; (C++ sequence points!)
                                         int32_t id2 = ReadIdFromCode();
                                         DoCastParam(type, id2);
-                                } break;
-
-                        case InstructionSet::RECORDCELLGET:     DoRecordCellGet(ReadIdFromCode()); break;
-                        case InstructionSet::RECORDCELLSET:     DoRecordCellSet(ReadIdFromCode(), false, false); break;
-                        case InstructionSet::RECORDCELLCREATE:  DoRecordCellSet(ReadIdFromCode(), true, true); break;
-                        case InstructionSet::RECORDCELLUPDATE:  DoRecordCellSet(ReadIdFromCode(), true, false); break;
-                        case InstructionSet::RECORDCELLDELETE:  DoRecordCellDelete(ReadIdFromCode()); break;
-                        case InstructionSet::RECORDMAKEEXISTING:DoRecordMakeExisting(); break;
-
-                        case InstructionSet::LOADTYPEID:        DoLoadTypeId(ReadIdFromCode()); break;
-                        case InstructionSet::INITFUNCTIONPTR :  DoInitFunctionPtr(); break;
-                        case InstructionSet::INVOKEFPTR:
+                                } VM_NEXT;
+
+                        VM_OP(RECORDCELLGET):     DoRecordCellGet(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(RECORDCELLSET):     DoRecordCellSet(ReadIdFromCode(), false, false); VM_NEXT;
+                        VM_OP(RECORDCELLCREATE):  DoRecordCellSet(ReadIdFromCode(), true, true); VM_NEXT;
+                        VM_OP(RECORDCELLUPDATE):  DoRecordCellSet(ReadIdFromCode(), true, false); VM_NEXT;
+                        VM_OP(RECORDCELLDELETE):  DoRecordCellDelete(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(RECORDMAKEEXISTING):DoRecordMakeExisting(); VM_NEXT;
+
+                        VM_OP(LOADTYPEID):        DoLoadTypeId(ReadIdFromCode()); VM_NEXT;
+                        VM_OP(INITFUNCTIONPTR):  DoInitFunctionPtr(); VM_NEXT;
+                        VM_OP(INVOKEFPTR):
                                 {
                                         DoInvokeFptr(true);
-                                } break;
-                        case InstructionSet::INVOKEFPTRNM:
+                                } VM_NEXT;
+                        VM_OP(INVOKEFPTRNM):
                                 {
                                         DoInvokeFptr(false);
-                                } break;
+                                } VM_NEXT;
 
-                        case InstructionSet::YIELD:             DoYield(); break;
+                        VM_OP(YIELD):             DoYield(); VM_NEXT;
 
-                        case InstructionSet::OBJNEW:            DoObjNew(); break;
-                        case InstructionSet::OBJMEMBERGET:
+                        VM_OP(OBJNEW):            DoObjNew(); VM_NEXT;
+                        VM_OP(OBJMEMBERGET):
                                 {
                                         DoObjMemberGet(ReadIdFromCode(), false);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJMEMBERGETTHIS:
+                                } VM_NEXT;
+                        VM_OP(OBJMEMBERGETTHIS):
                                 {
                                         DoObjMemberGet(ReadIdFromCode(), true);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJMEMBERSET:
+                                } VM_NEXT;
+                        VM_OP(OBJMEMBERSET):
                                 {
                                         DoObjMemberSet(ReadIdFromCode(), false);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJMEMBERSETTHIS:
+                                } VM_NEXT;
+                        VM_OP(OBJMEMBERSETTHIS):
                                 {
                                         DoObjMemberSet(ReadIdFromCode(), true);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJMEMBERINSERT:
+                                } VM_NEXT;
+                        VM_OP(OBJMEMBERINSERT):
                                 {
                                         int32_t id1 = ReadIdFromCode(); // Keep them apart with ; (C++ sequence points!)
                                         bool bool2 = ReadByteFromCode();
                                         DoObjMemberInsert(id1, bool2, false);
-                                } break;
-                        case InstructionSet::OBJMEMBERINSERTTHIS:
+                                } VM_NEXT;
+                        VM_OP(OBJMEMBERINSERTTHIS):
                                 {
                                         int32_t id1 = ReadIdFromCode(); // Keep them apart with ; (C++ sequence points!)
                                         bool bool2 = ReadByteFromCode();
                                         DoObjMemberInsert(id1, bool2, true);
-                                } break;
-                        case InstructionSet::OBJMEMBERDELETE:       DoObjMemberDelete(ReadIdFromCode(), false); break;
-                        case InstructionSet::OBJMEMBERDELETETHIS:   DoObjMemberDelete(ReadIdFromCode(), true); break;
-                        case InstructionSet::OBJMETHODCALL:
+                                } VM_NEXT;
+                        VM_OP(OBJMEMBERDELETE):       DoObjMemberDelete(ReadIdFromCode(), false); VM_NEXT;
+                        VM_OP(OBJMEMBERDELETETHIS):   DoObjMemberDelete(ReadIdFromCode(), true); VM_NEXT;
+                        VM_OP(OBJMETHODCALL):
                                 {
                                         int32_t id1 = ReadIdFromCode(); // Keep them apart with ; (C++ sequence points!)
                                         int32_t id2 = ReadIdFromCode();
                                         DoObjMethodCall(id1, id2, false, true);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJMETHODCALLTHIS:
+                                } VM_NEXT;
+                        VM_OP(OBJMETHODCALLTHIS):
                                 {
                                         int32_t id1 = ReadIdFromCode(); // Keep them apart with ; (C++ sequence points!)
                                         int32_t id2 = ReadIdFromCode();
                                         DoObjMethodCall(id1, id2, true, true);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJMETHODCALLNM:
+                                } VM_NEXT;
+                        VM_OP(OBJMETHODCALLNM):
                                 {
                                         int32_t id1 = ReadIdFromCode(); // Keep them apart with ; (C++ sequence points!)
                                         int32_t id2 = ReadIdFromCode();
                                         DoObjMethodCall(id1, id2, false, false);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJMETHODCALLTHISNM:
+                                } VM_NEXT;
+                        VM_OP(OBJMETHODCALLTHISNM):
                                 {
                                         int32_t id1 = ReadIdFromCode(); // Keep them apart with ; (C++ sequence points!)
                                         int32_t id2 = ReadIdFromCode();
                                         DoObjMethodCall(id1, id2, true, false);
                                         if (vmgroup->TestMustYield() && HandleAbortFlag())
                                             return;
-                                } break;
-                        case InstructionSet::OBJSETTYPE:        DoObjSetType(); break;
-                        case InstructionSet::OBJMAKEREFPRIV:    DoObjMakeRefPrivileged(); break;
-                        case InstructionSet::OBJMEMBERISSIMPLE: DoObjMemberIsSimple(); break;
-                        case InstructionSet::OBJTESTNONSTATIC:  DoObjTestNonStatic(false); break;
-                        case InstructionSet::OBJTESTNONSTATICTHIS:  DoObjTestNonStatic(true); break;
-
+                                } VM_NEXT;
+                        VM_OP(OBJSETTYPE):        DoObjSetType(); VM_NEXT;
+                        VM_OP(OBJMAKEREFPRIV):    DoObjMakeRefPrivileged(); VM_NEXT;
+                        VM_OP(OBJMEMBERISSIMPLE): DoObjMemberIsSimple(); VM_NEXT;
+                        VM_OP(OBJTESTNONSTATIC):  DoObjTestNonStatic(false); VM_NEXT;
+                        VM_OP(OBJTESTNONSTATICTHIS):  DoObjTestNonStatic(true); VM_NEXT;
+
+#ifdef HSVM_THREADED_DISPATCH
+                        vm_op_ILLEGAL:
+#else
                         default:
+#endif
                             ThrowIllegalOpcode(code);
                         }
+#ifndef HSVM_THREADED_DISPATCH
                         ++profiledata.instructions_executed;
+#endif
                 }
         }
         catch (VMRuntimeError &e)
@@ -1685,6 +1793,13 @@ template< bool debug >
         }
 }
 
+#ifdef HSVM_THREADED_DISPATCH
+#if !defined(__clang__)
+#pragma GCC pop_options
+#endif
+#pragma GCC diagnostic pop
+#endif
+
 void VirtualMachine::CleanupException()
 {
         stackmachine.InitVariable(throwvar, VariableTypes::Object);
@@ -2528,7 +2643,7 @@ void VirtualMachine::DoRecordCellGet(int32_t id)
         if (stackmachine.RecordNull(arg1))
             throw VMRuntimeError (Error::RecordDoesNotExist, columnnamemapper.GetReverseMapping(nameid).stl_str());
 
-        bool found = stackmachine.RecordCellCopyByName(arg1, nameid, arg1);
+        bool found = stackmachine.RecordCellCopyByName(arg1, nameid, arg1, GetCellLookupCache(nameid));
         if (!found)
             stackmachine.RecordThrowCellNotFound(arg1, columnnamemapper.GetReverseMapping(nameid).stl_str());
 }
@@ -2546,18 +2661,20 @@ void VirtualMachine::DoRecordCellSet(int32_t id, bool with_check, bool cancreate
         if (with_check && !cancreate && stackmachine.RecordNull(rec))
             throw VMRuntimeError (Error::RecordDoesNotExist, columnnamemapper.GetReverseMapping(nameid).stl_str());
 
+        CellLookupCache *cache = GetCellLookupCache(nameid);
+
         VarId dest;
         if (!with_check)
         {
-                dest = stackmachine.RecordCellCreate(rec, nameid);
+                dest = stackmachine.RecordCellCreate(rec, nameid, cache);
         }
         else if (cancreate)
         {
-                dest = stackmachine.RecordCellCreateExclusive(rec, nameid);
+                dest = stackmachine.RecordCellCreateExclusive(rec, nameid, cache);
         }
         else
         {
-                dest = stackmachine.RecordCellRefByName(rec, nameid);
+                dest = stackmachine.RecordCellRefByName(rec, nameid, cache);
                 if (dest == 0)
                     stackmachine.RecordThrowCellNotFound(rec, columnnamemapper.GetReverseMapping(nameid).stl_str());
                     //throw VMRuntimeError (Error::UnknownColumn, columnnamemapper.GetReverseMapping(nameid).stl_str());
@@ -2605,13 +2722,14 @@ void VirtualMachine::DoObjMemberGet(int32_t id, bool this_access)
         stackmachine.CastTo(arg1, VariableTypes::Object);
 
         ColumnNameId nameid = executionstate.library->GetLinkedLibrary().resolvedcolumnnames[id];
+        CellLookupCache *cache = GetCellLookupCache(nameid);
 
-        LinkedLibrary::ObjectVTableEntry const *entry = ResolveVTableEntry(arg1, nameid);
+        LinkedLibrary::ObjectVTableEntry const *entry = ResolveVTableEntry(arg1, nameid, cache);
         bool is_hat = nameid == cn_cache.col_hat;
 
         if (!entry)
         {
-                if (stackmachine.ObjectMemberCopy(arg1, nameid, this_access, arg1))
+                if (stackmachine.ObjectMemberCopy(arg1, nameid, this_access, arg1, cache))
                     return;
 
                 auto namestr = columnnamemapper.GetReverseMapping(nameid);
@@ -2667,7 +2785,7 @@ void VirtualMachine::DoObjMemberGet(int32_t id, bool this_access)
         default: ;
         }
 
-        if (!stackmachine.ObjectMemberCopy(arg1, nameid, this_access, arg1))
+        if (!stackmachine.ObjectMemberCopy(arg1, nameid, this_access, arg1, cache))
             ObjectThrowMemberNotFound(arg1, nameid);
 }
 
@@ -2680,14 +2798,15 @@ void VirtualMachine::DoObjMemberSet(int32_t id, bool this_access)
         stackmachine.CastTo(arg1, VariableTypes::Object);
 
         ColumnNameId nameid = executionstate.library->GetLinkedLibrary().resolvedcolumnnames[id];
+        CellLookupCache *cache = GetCellLookupCache(nameid);
 
-        LinkedLibrary::ObjectVTableEntry const *entry = ResolveVTableEntry(arg1, nameid);
+        LinkedLibrary::ObjectVTableEntry const *entry = ResolveVTableEntry(arg1, nameid, cache);
         bool is_hat = nameid == cn_cache.col_hat;
 
         if (!entry)
         {
-                stackmachine.CastTo(arg2, stackmachine.ObjectMemberType(arg1, nameid));
-                if (stackmachine.ObjectMemberSet(arg1, nameid, this_access, arg2))
+                stackmachine.CastTo(arg2, stackmachine.ObjectMemberType(arg1, nameid, cache));
+                if (stackmachine.ObjectMemberSet(arg1, nameid, this_access, arg2, cache))
                 {
                         stackmachine.PopVariablesN(2);
                         return;
@@ -2754,7 +2873,7 @@ void VirtualMachine::DoObjMemberSet(int32_t id, bool this_access)
         default: ;
         }
 
-        if (!stackmachine.ObjectMemberSet(arg1, nameid, this_access, arg2))
+        if (!stackmachine.ObjectMemberSet(arg1, nameid, this_access, arg2, cache))
             ObjectThrowMemberNotFound(arg1, nameid);
 
         stackmachine.PopVariablesN(2);
@@ -2871,6 +2990,18 @@ LinkedLibrary::ObjectVTableEntry const * VirtualMachine::ResolveVTableEntry(VarI
         return &it->second;
 }
 
+LinkedLibrary::ObjectVTableEntry const * VirtualMachine::ResolveVTableEntry(VarId obj, ColumnNameId nameid, CellLookupCache *cache)
+{
+        // Type definitions are kept alive by the VM group, so their entries can be cached
+        void const *type = stackmachine.ObjectGetTypeDescriptor(obj);
+        if (type != cache->vtable_type)
+        {
+                cache->vtable_type = type;
+                cache->vtable_entry = ResolveVTableEntry(obj, nameid);
+        }
+        return static_cast< LinkedLibrary::ObjectVTableEntry const * >(cache->vtable_entry);
+}
+
 std::string VirtualMachine::GetObjectTypeName(VarId obj)
 {
         ObjectTypeDefinition const *type = static_cast< ObjectTypeDefinition const * >(stackmachine.ObjectGetTypeDescriptor(obj));
@@ -4100,6 +4231,24 @@ void VirtualMachine::EncodeVMStats(VarId id_set, VMStats const &stats)
         stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("BLOBSTORE")), stats.blobstore);
         stackmachine.SetInteger(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("OBJECTCOUNT")), stats.objectcount);
         stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("INSTRUCTIONS")), stats.instructions_executed);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("CELLCACHEHITS")), stats.cellcache_hits);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("CELLCACHEMISSES")), stats.cellcache_misses);
+        stackmachine.SetInteger(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("RECORDSHAPES")), stats.recordshapes);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("RECORDCLONES")), stats.recordclones);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("RECORDCLONEDCELLS")), stats.recordclonedcells);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCCYCLES")), stats.gc_cycles);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCMINORCYCLES")), stats.gc_minorcycles);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCMINORTIME")), stats.gc_minortime);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCMAJORTIME")), stats.gc_majortime);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCPAUSES")), stats.gc_pauses);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCTIME")), stats.gc_time);
+        stackmachine.SetInteger64(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCMAXPAUSE")), stats.gc_maxpause);
+
+        VarId var_histogram = stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("GCPAUSEHISTOGRAM"));
+        stackmachine.InitVariable(var_histogram, VariableTypes::Integer64Array);
+        for (unsigned i = 0; i < GCPauseHistogramBuckets; ++i)
+            stackmachine.SetInteger64(stackmachine.ArrayElementAppend(var_histogram), stats.gc_pausehistogram[i]);
+
         stackmachine.SetSTLString(stackmachine.RecordCellCreate(id_set, stackmachine.columnnamemapper.GetMapping("LIBRARY")), stats.executelibrary);
 }
 
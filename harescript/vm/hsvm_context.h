@@ -18,6 +18,11 @@
 #include <unordered_map>
 #include <unordered_set>
 
+/// Use direct-threaded (computed goto) instruction dispatch when the compiler supports it. Define HSVM_NO_THREADED_DISPATCH to force the switch
+#if defined(__GNUC__) && !defined(__EMSCRIPTEN__) && !defined(HSVM_NO_THREADED_DISPATCH)
+ #define HSVM_THREADED_DISPATCH
+#endif
+
 /*  The context contains the Environment and the Virtual Machine. Context is
     the wrong name for this, this has to be corrected.
 
@@ -705,6 +710,16 @@ class BLEXLIB_PUBLIC VirtualMachine
         /// List of tail calls
         std::vector< std::function< void(bool) > > tailcalls;
 
+        /// Number of inline caches for cell lookups (must be a power of 2)
+        static const unsigned CellLookupCacheCount = 256;
+
+        /// Inline caches for record cell and object member lookups, indexed by instruction address
+        std::unique_ptr< CellLookupCache[] > cellcaches;
+
+        /** Returns the inline cache for the instruction that is currently being executed
+            @param nameid Name of the cell the instruction looks up */
+        CellLookupCache * GetCellLookupCache(ColumnNameId nameid);
+
         struct ProtectedData
         {
                 /// Authentication record
@@ -905,6 +920,7 @@ class BLEXLIB_PUBLIC VirtualMachine
         void GetObjectExtendUids(VarId obj, std::vector< std::string > *objecttypelist);
         bool ObjectHasExtendUid(VarId obj, std::string const &uid);
         LinkedLibrary::ObjectVTableEntry const * ResolveVTableEntry(VarId obj, ColumnNameId nameid); // FIXME: make this internal
+        LinkedLibrary::ObjectVTableEntry const * ResolveVTableEntry(VarId obj, ColumnNameId nameid, CellLookupCache *cache);
         bool GetObjectInternalProtected(VarId obj);
 
         bool is_suspended;//FIXME: Private, of misschien de suspended flag door DLLInterface zelf laten afhandelen?
@@ -887,18 +887,28 @@ void Debugger::StoreVMStatus(JobManager::LockedJobData::WriteRef &, LockedData::
         HSVM *vm = lock->comm.vm;
         ColumnNameCache const &cn_cache = lock->comm.vm.cn_cache;
 
+        // A worker may claim a runnable group without the job lock, read its scheduling state under the claim mutex
+        Blex::DateTime current_run_start;
+        RunningState::Type state, reqstate;
+        {
+                Blex::Mutex::AutoLock claimlock(vmgroup->jmdata.claimmutex);
+                current_run_start = vmgroup->jmdata.current_run_start;
+                state = vmgroup->jmdata.state;
+                reqstate = vmgroup->jmdata.reqstate;
+        }
+
         // Calculate total running time
         Blex::DateTime total_running = vmgroup->jmdata.total_running;
-        if (vmgroup->jmdata.current_run_start != Blex::DateTime::Min())
+        if (current_run_start != Blex::DateTime::Min())
         {
                 Blex::DateTime diff = now;
-                diff -= vmgroup->jmdata.current_run_start;
+                diff -= current_run_start;
                 total_running += diff;
         }
 
-        DBG_PRINT("Store VM status state: " << vmgroup->jmdata.state << " reqstate: " << vmgroup->jmdata.reqstate << " olddebug: " << vmgroup->jmdata.oldstatedebug << " usestatereq: " << usestatereq);
+        DBG_PRINT("Store VM status state: " << state << " reqstate: " << reqstate << " olddebug: " << vmgroup->jmdata.oldstatedebug << " usestatereq: " << usestatereq);
 
-        RunningState::Type usestate = usestatereq ? vmgroup->jmdata.reqstate : vmgroup->jmdata.state;
+        RunningState::Type usestate = usestatereq ? reqstate : state;
         std::stringstream state_str, realstate_str;
 
         if (usestate == RunningState::Locked)
@@ -1366,7 +1376,13 @@ void Debugger::RPC_PauseJob()
                 JobData &jobdata = it->second;
                 jobdata.pause_reasons |= JobData::Request;
 
-                switch (jobdata.vmgroup->jmdata.state)
+                // Workers claim runnable groups without the job lock, keep them from claiming this one. If a
+                // worker got it first, the group is running now
+                RunningState::Type state = jobdata.vmgroup->jmdata.state;
+                if ((state == RunningState::Runnable || state == RunningState::InitialRunnable) && !jobmgr.HoldRunnableGroup(jobmgrlock, jobdata.vmgroup.get()))
+                    state = RunningState::Running;
+
+                switch (state)
                 {
                 case RunningState::WaitForMultiple:
                 case RunningState::Running:
@@ -1395,7 +1411,7 @@ void Debugger::RPC_PauseJob()
                 case RunningState::Terminated:
                     {
                             // Runnable & WaitForMultiple can be switched to debugstopped immediately
-                            jobdata.vmgroup->jmdata.oldstatedebug = jobdata.vmgroup->jmdata.state;
+                            jobdata.vmgroup->jmdata.oldstatedebug = state;
                             jobmgr.SetVMGroupState(jobmgrlock, jobdata.vmgroup.get(), RunningState::DebugStopped);
 
                             SendJobStatus(jobmgrlock, lock, jobdata.vmgroup.get(), "job-paused", false, &callbacks);
@@ -1416,6 +1432,7 @@ void Debugger::RPC_PauseJob()
                 jobmgr.CallUnlockCallbacks(&it->first, it->second);
         }
 
+        jobmgr.must_check_yields = true;
         jobmgr.jobdata.SignalAll();
 }
 
@@ -1823,14 +1840,22 @@ void Debugger::RPC_SetBreakpoints()
                         it->second.vmgroup->dbg_async.breakpoints.push_back(bp);
                 }
 
-                switch (it->second.vmgroup->jmdata.state)
+                // Workers claim runnable groups without the job lock, keep them from claiming this one. If a
+                // worker got it first, the group is running now
+                RunningState::Type state = it->second.vmgroup->jmdata.state;
+                if ((state == RunningState::Runnable || state == RunningState::InitialRunnable) && !jobmgr.HoldRunnableGroup(jobmgrlock, it->second.vmgroup.get()))
+                    state = RunningState::Running;
+
+                switch (state)
                 {
                 case RunningState::DebugStopped:
                 case RunningState::InitialRunnable:
                 case RunningState::Runnable:
                     {
-                            this->ApplyBreakpoints(*it->second.vmgroup); break;
-                            return;
+                            this->ApplyBreakpoints(*it->second.vmgroup);
+                            if (state != RunningState::DebugStopped)
+                                jobmgr.ReleaseRunnableGroup(jobmgrlock, it->second.vmgroup.get());
+                            break;
                     }
 
                 case RunningState::WaitForMultiple:
@@ -1846,6 +1871,7 @@ void Debugger::RPC_SetBreakpoints()
 
                 SendJobAndTypeOnlyResponse(lock, "job-setbreakpoints", groupid);
         }
+        jobmgr.must_check_yields = true;
         jobmgr.jobdata.SignalAll();
 }
 
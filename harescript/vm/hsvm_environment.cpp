@@ -40,6 +40,9 @@ namespace HareScript
 
 static const Blex::DateTime CacheDelay = Blex::DateTime::Seconds(1);
 
+/// Interval at which libraries that are watched for changes are checked anyway (catches relocations, changes the watches can't see)
+static const unsigned WatchedCheckIntervalMsecs = 60 * 1000;
+
 // -----------------------------------------------------------------------------
 //
 // Id generator
@@ -138,6 +141,9 @@ Environment::Environment(Blex::NotificationEventManager &_eventmgr, FileSystem &
 , blobmanager(_blobmanager)
 , externals(_filesystem)
 {
+        ColumnNames::LocalMapper local(externals.columnnamemapper);
+        cn_cache.reset(new ColumnNameCache(local));
+
         InvokeModuleRegistration(&DocgenEntryPoint, (void*)0);
         //ADDME? DEBUGONLY(cache.SetupDebugging("Environment lock"));
 }
@@ -146,14 +152,11 @@ Environment::~Environment()
 {
         LockedCache::WriteRef cachelock(cache);
 
-        //std::vector<std::string> names;
+        LockedLoadedIndex::WriteRef(loadedindex)->libs.clear();
 
-        for (LibraryPtrs::reverse_iterator itr=cachelock->libs.rbegin(); itr != cachelock->libs.rend(); ++itr)
-          if (*itr)
-        {
-                //names.push_back((*itr)->liburi);
-                LockedReleaseRef(*itr);
-        }
+        // Libraries stay alive while other libraries use them, so the release order doesn't matter
+        for (auto &itr: cachelock->libs)
+            LockedReleaseRef(itr.second);
 }
 
 void* Environment::LoadHarescriptModule(std::string const &name)
@@ -173,10 +176,7 @@ void Environment::EjectLibraryFromCache(std::string const &liburi) //used by the
 
         Library *lib=cachelock->FindLibrary(liburi);
         if(lib)
-        {
-                cachelock->RemoveFromCache(lib);
-                LockedReleaseRef(lib);
-        }
+            LockedEvictLibrary(*cachelock, lib);
 }
 
 void Environment::RegisterVMCreationHandler(std::function< void(HSVM *) > const &func)
@@ -198,6 +198,22 @@ void Environment::RegisterVMCreationHandler(std::function< void(HSVM *) > const
         second Wether library is loaded (and up to date) */
 std::pair<Library *, bool> Environment::GetUptodateRef(Blex::ContextKeeper &keeper, std::string const &liburi, Blex::DateTime curtime)
 {
+        // Fast path: if no watched file has changed since the library was validated, it's still up to date
+        uint64_t validationkey = GetValidationKey(curtime);
+        if (validationkey)
+        {
+                LockedLoadedIndex::ReadRef indexlock(loadedindex);
+
+                auto itr = indexlock->libs.find(liburi);
+                if (itr != indexlock->libs.end() && itr->second->validationkey == validationkey)
+                {
+                        Library *lib = itr->second;
+                        ++lib->cm_refcount;
+                        LINKREFPRINT("refcount " << lib->liburi << " incremented to " << lib->cm_refcount);
+                        return std::make_pair(lib,true);
+                }
+        }
+
         while (true) //is 'ie in de cache?
         {
                 LockedCache::WriteRef cachelock(cache);
@@ -207,32 +223,41 @@ std::pair<Library *, bool> Environment::GetUptodateRef(Blex::ContextKeeper &keep
 
                 if (lib && lib->cm_isloaded)
                 {
+                        /* Do a full check of the files if they have all been watched before the check, so we can
+                           skip checks until one of them changes. Don't bother if they have been checked recently.
+                        */
+                        bool fullcheck = lib->last_udt_check < curtime - CacheDelay && WatchLibraryFiles(lib);
+                        if (fullcheck)
+                            validationkey = GetValidationKey(curtime);
+
                         //Is it up to date? (in-memory version matches on-disk version)
-                        if (lib->IsUpTodate(filesystem, keeper, curtime, nullptr))
+                        if (lib->IsUpTodate(filesystem, keeper, curtime, nullptr, fullcheck))
                         {
+                                if (fullcheck)
+                                    lib->validationkey = validationkey;
+
                                 ++lib->cm_refcount;
                                 LINKREFPRINT("refcount " << lib->liburi << " incremented to " << lib->cm_refcount);
                                 return std::make_pair(lib,true);
                         }
                         //Not up to date, evict it from the cache and have us build a new version
-                        cachelock->RemoveFromCache(lib);
-                        LockedReleaseRef(lib);
+                        LockedEvictLibrary(*cachelock, lib);
                         lib=NULL;
                 }
 
                 // Invariant: library is not in cache, or library is in cache AND currently loading (in another thread)
                 if (!lib)
                 {
-                        //Find a location to insert the lib into the cache
-                        //Is there a NULL to replace in the cache?
-                        unsigned newlib_location = std::find(cachelock->libs.begin(), cachelock->libs.end(), (Library*)NULL) - cachelock->libs.begin();
-                        if (newlib_location == cachelock->libs.size())
+                        lib = new Library(liburi); //throwing is no problem here
+                        try
                         {
-                                cachelock->libs.push_back(NULL); //nope, add a NULL
+                                cachelock->libs.insert(std::make_pair(liburi, lib));
+                        }
+                        catch (...)
+                        {
+                                delete lib;
+                                throw;
                         }
-
-                        cachelock->libs[newlib_location] = new Library(liburi); //throwing is no problem here
-                        lib = cachelock->libs[newlib_location];
                         lib->id = idgenerator.AllocateId();
                         lib->cm_refcount+=2; //1 ref for the cache, 1 ref for the returned
                         LINKREFPRINT("refcount " << lib->liburi << " 2x incremented to " << lib->cm_refcount);
@@ -269,6 +294,7 @@ void Environment::LoadLibraryData(Blex::ContextKeeper &/*keeper*/, Library *lib,
         // Read the library into memory
         lib->wrappedlibrary.ReadLibrary(lib->liburi, &mstream);
         lib->clibpath = file->GetClibPath();
+        lib->sourcepath = file->GetSourceResourcePath();
 
         auto source_modtime = file->GetSourceModTime();
         if (lib->wrappedlibrary.resident.sourcetime == source_modtime)
@@ -313,11 +339,8 @@ void Environment::InvokeModuleRegistration(HSVM_ModuleEntryPointPtr entrypoint,
 
 Library *LibraryCache::FindLibrary(std::string const &liburi)
 {
-        for (std::vector<Library*>::iterator itr=libs.begin(); itr != libs.end(); ++itr)
-          if ( *itr && (*itr)->liburi == liburi)
-            return *itr;
-
-        return NULL;
+        auto itr = libs.find(liburi);
+        return itr != libs.end() ? itr->second : NULL;
 }
 
 
@@ -360,7 +383,7 @@ Library const * Environment::InternalGetLibRef(Blex::ContextKeeper &keeper, std:
                 // Load and link dependent libraries
                 LoadDependencies(keeper, mainlib, handler, currenttime);
                 Library const *modifiedlib = nullptr;
-                if (!mainlib->IsUpTodate(filesystem, keeper, currenttime, &modifiedlib))
+                if (!mainlib->IsUpTodate(filesystem, keeper, currenttime, &modifiedlib, false))
                     throw VMRuntimeError (Error::InvalidLibrary, mainlib->liburi, "Library out of date - used library " + (modifiedlib ? modifiedlib->liburi : "") + " modified during linking");
 
                 // Load modules and set external functions
@@ -380,10 +403,7 @@ Library const * Environment::InternalGetLibRef(Blex::ContextKeeper &keeper, std:
                 {
                         LockedCache::WriteRef cachelock(cache);
                         if (cachelock->IsInCache(mainlib))
-                        {
-                                cachelock->RemoveFromCache(mainlib);
-                                LockedReleaseRef(mainlib); //remove the cache reference
-                        }
+                            LockedEvictLibrary(*cachelock, mainlib); //remove the cache reference
 
                         // Remove the last ref to the library
                         LockedReleaseRef(mainlib); //our own reference to the not yet loaded/linked mainlib
@@ -426,20 +446,64 @@ void Environment::LockedReleaseRef(Library *lib)
         }
 }
 
+void Environment::LockedEvictLibrary(LibraryCache &cachedata, Library *lib)
+{
+        {
+                LockedLoadedIndex::WriteRef indexlock(loadedindex);
+                auto itr = indexlock->libs.find(lib->liburi);
+                if (itr != indexlock->libs.end() && itr->second == lib)
+                    indexlock->libs.erase(itr);
+        }
+
+        cachedata.RemoveFromCache(lib);
+        LockedReleaseRef(lib);
+}
+
+uint64_t Environment::GetValidationKey(Blex::DateTime currenttime)
+{
+        if (!librarywatcher.IsActive())
+            return 0;
+
+        // Combine the change generation with the current interval, so all libraries are checked at least once every interval
+        uint64_t interval = (uint64_t(currenttime.GetDays()) * 86400000 + currenttime.GetMsecs()) / WatchedCheckIntervalMsecs;
+        return (librarywatcher.Poll() << 32) | (interval & 0xFFFFFFFF);
+}
+
+bool Environment::WatchLibraryFiles(Library *lib)
+{
+        if (!librarywatcher.IsActive())
+            return false;
+
+        for (unsigned i = 0; i <= lib->usedlibraries.size(); ++i)
+        {
+                Library *curlib = i == 0 ? lib : lib->usedlibraries[i - 1];
+
+                // Only files on disk can be watched
+                if (curlib->clibpath.empty() || curlib->clibpath[0] != '/' || curlib->sourcepath.empty() || curlib->sourcepath[0] != '/')
+                    return false;
+
+                if (!librarywatcher.Watch(Blex::GetDirectoryFromPath(curlib->clibpath))
+                        || !librarywatcher.Watch(Blex::GetDirectoryFromPath(curlib->sourcepath)))
+                    return false;
+        }
+        return true;
+}
+
 bool LibraryCache::IsInCache(Library *lib)
 {
-        return std::find(libs.begin(), libs.end(), lib) != libs.end();
+        auto itr = libs.find(lib->liburi);
+        return itr != libs.end() && itr->second == lib;
 }
 
 void LibraryCache::RemoveFromCache(Library *lib)
 {
-        std::vector<Library*>::iterator itr=std::find(libs.begin(), libs.end(), lib);
-        if (itr == libs.end())
+        auto itr = libs.find(lib->liburi);
+        if (itr == libs.end() || itr->second != lib)
             throw std::runtime_error("Internal error: releasing library that was never in the cache");
         if (lib->cm_refcount==0)
             throw std::runtime_error("Internal error: releasing library from cache no references yet");
 
-        *itr=NULL;
+        libs.erase(itr);
 }
 
 void Environment::ReleaseLibRef(Library const *constlib)
@@ -579,12 +643,22 @@ void Environment::LinkLibrary(Library *lib)
 
         //Cache/library setup
         lib->initorder.push_back(lib);
+
+        //Index the initialization order, VMs starting with this library use it instead of building their own
+        lib->initorder_uris.clear();
+        for (auto itr: lib->initorder)
+            lib->initorder_uris[itr->liburi] = itr;
+
         lib->linkedlibrary.globalareastart = lib->id << 16;
 
         //We may only change the 'isloaded' flag while holding the cache lock
         {
                 LockedCache::WriteRef lock(cache);
                 lib->cm_isloaded=true;
+
+                //Index it for lookups without the cache lock, unless it has been ejected from the cache in the meantime
+                if (lock->IsInCache(lib))
+                    LockedLoadedIndex::WriteRef(loadedindex)->libs[lib->liburi] = lib;
         }
 }
 
@@ -593,6 +667,7 @@ Library::Library(const std::string &_liburi)
 , cm_refcount(0)
 , liburi(_liburi)
 , last_udt_check(Blex::DateTime::Invalid())
+, validationkey(0)
 {
 }
 
@@ -601,14 +676,14 @@ Library::~Library()
         assert(cm_refcount == 0);
 }
 
-bool Library::IsLocalUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime currenttime)
+bool Library::IsLocalUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime currenttime, bool fullcheck)
 {
         FileSystem::FilePtr file = filesystem.OpenLibrary(keeper, liburi);
         if (!file)
             return false;
 
         // The library data has already been read in.
-        if (last_udt_check >= currenttime - CacheDelay)
+        if (!fullcheck && last_udt_check >= currenttime - CacheDelay)
             return true;
 
         // Invalid: source file exists and current source time != recorded sourcetime
@@ -654,13 +729,13 @@ bool Library::IsLocalUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keepe
         return has_same_id;
 }
 
-bool Library::IsUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime currenttime, Library const **modifiedlibrary)
+bool Library::IsUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime currenttime, Library const **modifiedlibrary, bool fullcheck)
 {
         // The library data has already been read in.
-        if (last_udt_check >= currenttime - CacheDelay)
+        if (!fullcheck && last_udt_check >= currenttime - CacheDelay)
             return true;
 
-        if (!IsLocalUpTodate(filesystem, keeper, currenttime))
+        if (!IsLocalUpTodate(filesystem, keeper, currenttime, fullcheck))
         {
                 if (modifiedlibrary)
                     *modifiedlibrary = this;
@@ -669,10 +744,10 @@ bool Library::IsUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Bl
 
         for (LibraryPtrs::iterator it = usedlibraries.begin(); it != usedlibraries.end(); ++it)
         {
-                if ((*it)->last_udt_check >= currenttime - CacheDelay)
+                if (!fullcheck && (*it)->last_udt_check >= currenttime - CacheDelay)
                     continue;
 
-               if (!(*it)->IsLocalUpTodate(filesystem, keeper, currenttime))
+               if (!(*it)->IsLocalUpTodate(filesystem, keeper, currenttime, fullcheck))
                {
                         if (modifiedlibrary)
                             *modifiedlibrary = *it;
@@ -907,6 +982,7 @@ void Environment::SetDebuggingTags(HSVM *vm, std::vector< std::string > const &t
 LibraryLoader::LibraryLoader(Environment &llib, ErrorHandler &_errorhandler)
 : llib(llib)
 , errorhandler(_errorhandler)
+, startlib(NULL)
 , initcount(0)
 {
 }
@@ -948,17 +1024,26 @@ void LibraryLoader::PopDeferredInitialization()
         deferred_inits.pop_back();
 }
 
+Library const* LibraryLoader::FindMustInitLibrary(std::string const &liburi) const
+{
+        if (startlib)
+        {
+                Library const *lib = startlib->FindInInitializationOrder(liburi);
+                if (lib)
+                    return lib;
+        }
+
+        auto itr = mustinit_urimap.find(liburi);
+        return itr != mustinit_urimap.end() ? itr->second : NULL;
+}
+
 void LibraryLoader::GetWHLibraryInfo(Blex::ContextKeeper &keeper, std::string const &liburi, LibraryInfo *info)
 {
         info->uri = liburi;
         info->outofdate = true;
         info->compile_id = Blex::DateTime::Invalid();
 
-        Library const *curlib = NULL;
-
-        auto citr = mustinit_urimap.find(liburi);
-        if (citr != mustinit_urimap.end())
-             curlib = citr->second;
+        Library const *curlib = FindMustInitLibrary(liburi);
 
         info->loaded = curlib;
 
@@ -974,8 +1059,8 @@ void LibraryLoader::GetWHLibraryInfo(Blex::ContextKeeper &keeper, std::string co
 
                 for (LibraryConstPtrs::const_iterator it = to_init.begin(); it != to_init.end(); ++it)
                 {
-                        auto itr = mustinit_urimap.find((*it)->GetLibURI());
-                        if (itr != mustinit_urimap.end() && itr->second != *it)
+                        Library const *present = FindMustInitLibrary((*it)->GetLibURI());
+                        if (present && present != *it)
                             info->outofdate = true;
                 }
 
@@ -1030,6 +1115,14 @@ Library const* LibraryLoader::LoadWHLibrary(Blex::ContextKeeper &keeper, std::st
                 // Get initialization order for new library
                 LibraryConstPtrs const &to_init = new_lib->GetInitializationOrder();
 
+                // First library? Then its prelinked initialization order is the complete initialization order
+                if (mustinit.empty())
+                {
+                        mustinit = to_init;
+                        startlib = new_lib;
+                        return new_lib;
+                }
+
                 // Check if any of the libraries has another version in the current library lists (o(n^2))
                 for (LibraryConstPtrs::const_iterator it = to_init.begin(); it != to_init.end(); ++it)
                 {
@@ -1038,17 +1131,18 @@ Library const* LibraryLoader::LoadWHLibrary(Blex::ContextKeeper &keeper, std::st
                             if ( (*itr)->GetLibURI() == (*it)->GetLibURI() && *itr != *it)
                                 throw VMRuntimeError(Error::LibraryUpdatedDuringRun, liburi, (*it)->GetLibURI());
 
-                        auto itr = mustinit_urimap.find((*it)->GetLibURI());
-                        if (itr != mustinit_urimap.end() && itr->second != *it)
+                        Library const *present = FindMustInitLibrary((*it)->GetLibURI());
+                        if (present && present != *it)
                             throw VMRuntimeError(Error::LibraryUpdatedDuringRun, liburi, (*it)->GetLibURI());
                 }
 
                 // Not currently initializing at all? We are SO done!
                 if (!current_init_lib)
                 {
+                        // Libraries with the same uri are the same library (checked above), so a lookup by uri suffices
                         for (auto itr: to_init)
                         {
-                                if (std::find(mustinit.begin(), mustinit.end(), itr) == mustinit.end())
+                                if (!FindMustInitLibrary(itr->GetLibURI()))
                                 {
                                            mustinit.push_back(itr);
                                            mustinit_urimap[itr->GetLibURI()] = itr;
@@ -1082,8 +1176,8 @@ Library const* LibraryLoader::LoadWHLibrary(Blex::ContextKeeper &keeper, std::st
                         if (std::find(new_mustinit.begin(), initpos, lib) != initpos)
                             continue;
 
-                        auto itr = mustinit_urimap.find((*it)->GetLibURI());
-                        if (itr != mustinit_urimap.end() && itr->second != *it)
+                        Library const *present = FindMustInitLibrary((*it)->GetLibURI());
+                        if (present && present != *it)
                             throw VMRuntimeError(Error::LibraryUpdatedDuringRun, liburi, (*it)->GetLibURI());
 
                         LibraryConstPtrs::iterator oldpos = std::find(initpos, new_mustinit.end(), lib);
@@ -1107,19 +1201,24 @@ Library const* LibraryLoader::LoadWHLibrary(Blex::ContextKeeper &keeper, std::st
 
         // does not seem to happen often, so slow update is ok
         for (auto &itr: mustinit)
-            mustinit_urimap[itr->GetLibURI()] = itr;
+            if (!startlib->FindInInitializationOrder(itr->GetLibURI()))
+                mustinit_urimap[itr->GetLibURI()] = itr;
 
         return new_lib;
 }
 
 Library const* LibraryLoader::GetWHLibrary(std::string const &liburi) const
 {
+        Library const *lib = FindMustInitLibrary(liburi);
+        if (!lib || initcount >= mustinit.size())
+            return lib;
+
         // Also look at current initializing library, so take 'initcount + 1' as limit.
         unsigned max_libs = std::min<unsigned>(initcount + 1, mustinit.size());
 
         for (unsigned i = 0; i < max_libs; ++i)
-            if (mustinit[i]->GetLibURI() == liburi)
-                return mustinit[i];
+            if (mustinit[i] == lib)
+                return lib;
 
         return 0;
 }
@@ -6,6 +6,9 @@
 #include "hsvm_librarywrapper.h"
 #include "hsvm_marshalling.h"
 #include <blex/notificationevents.h>
+#include <blex/dirwatcher.h>
+#include <atomic>
+#include <unordered_map>
 
 namespace HareScript
 {
@@ -34,6 +37,7 @@ class LibraryFile
 
 class Environment;
 class Library;
+class ColumnNameCache;
 
 /** Library get function. Based on a sanatized path, this function must return
     a stream that contains the library, or NULL if the library could not be
@@ -180,8 +184,9 @@ class Library
         /// Has this library been completely loaded into memory? (must hold cache mutex to access this var!)
         bool cm_isloaded;
 
-        /// How many references are there to this library (must hold cache mutex to access this var!)
-        unsigned cm_refcount;
+        /** How many references are there to this library (must hold cache mutex to access this var, or a
+            read lock on the loaded library index to add a reference to a loaded library) */
+        std::atomic< unsigned > cm_refcount;
 
         /// Uri of the library
         std::string const liburi;
@@ -192,12 +197,19 @@ class Library
         /// Path for clib (to detect relocations due to module updates)
         std::string clibpath;
 
+        /// Path of the source file, as returned by the filesystem (used to watch for changes)
+        std::string sourcepath;
+
         /// Modtime of library at the time the utd check was done, Invalid if file didn't exist. Set in LoadLibraryData, updated in IsLocalUpTodate.
         Blex::DateTime clibtime;
 
         /// Last successfull up-to-date check
         Blex::DateTime last_udt_check;
 
+        /** Validation key at the last full up-to-date check, if all files of this library and its dependencies were
+            being watched at that time. 0 if not validated. While the key is current, the library is up to date */
+        std::atomic< uint64_t > validationkey;
+
         /// The wrapped library, containing the read version of the library
         WrappedLibrary wrappedlibrary;
 
@@ -213,21 +225,24 @@ class Library
         /// Initialisation order required to execute this library (includes 'this' !)
         LibraryConstPtrs initorder;
 
+        /// Libraries in the initialisation order by uri, shared by all VMs that start with this library
+        std::unordered_map< std::string, Library const * > initorder_uris;
+
         /// Link errors are stored here
         std::shared_ptr< VMRuntimeError > link_error;
 
         /** Is this library locally up to date (only comparing loadlib data, clib and source, not dependents)
             (must hold cache mutex to call this function)
             @param currenttime Current time
-            @param isjob Whether this library is being loaded as a job
+            @param fullcheck Check the files even if they have been checked recently
             @return true if the library is localy up to date */
-        bool IsLocalUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime currenttime);
+        bool IsLocalUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime currenttime, bool fullcheck);
 
         /** Are this library and its dependents up to date? (must hold cache mutex to call this function)
             @param now Current time
-            @param isjob Whether this library is being loaded as a job
+            @param fullcheck Check the files even if they have been checked recently
             @return true if the library is up to date */
-        bool IsUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime now, Library const **modifiedlibrary);
+        bool IsUpTodate(FileSystem &filesystem, Blex::ContextKeeper &keeper, Blex::DateTime now, Library const **modifiedlibrary, bool fullcheck);
 
         ~Library();  //only the cache can safely delete us and deal with our references
 
@@ -242,6 +257,14 @@ class Library
 
         LibraryConstPtrs const & GetInitializationOrder() const { return initorder; }
 
+        /** Find a library in the initialization order by uri
+            @return The library, NULL if this library doesn't depend on it */
+        Library const * FindInInitializationOrder(std::string const &uri) const
+        {
+                auto itr = initorder_uris.find(uri);
+                return itr != initorder_uris.end() ? itr->second : NULL;
+        }
+
         /** Given a name index, resolve the actual name */
         Blex::StringPair GetLinkinfoName(unsigned idx) const
         { return wrappedlibrary.linkinfo.GetName(idx); }
@@ -264,13 +287,21 @@ class Library
 
 struct LibraryCache
 {
-        std::vector<Library*> libs;
+        /// All libraries in the cache by uri, including the ones that are still being loaded
+        std::unordered_map< std::string, Library * > libs;
 
         bool IsInCache(Library *lib);
         void RemoveFromCache(Library *lib);
         Library *FindLibrary(std::string const &uri);
 };
 
+/** Index of the loaded libraries in the cache, so up-to-date libraries can be found without taking the cache
+    lock. Only modified while holding the cache lock; the cache holds a reference to all indexed libraries */
+struct LoadedLibraryIndex
+{
+        std::unordered_map< std::string, Library * > libs;
+};
+
 /** Structure describing the status of a library, seen from a particular VM
 */
 struct LibraryInfo
@@ -312,6 +343,15 @@ class BLEXLIB_PUBLIC Environment
         typedef Blex::InterlockedData<LibraryCache, Blex::ConditionMutex> LockedCache;
         LockedCache cache;
 
+        typedef Blex::InterlockedData<LoadedLibraryIndex, Blex::ReadWriteMutex> LockedLoadedIndex;
+        LockedLoadedIndex loadedindex;
+
+        /// Watches the directories of the loaded libraries and their sources
+        Blex::DirectoryWatcher librarywatcher;
+
+        /// Column ids used by the VM itself, resolved once and copied into every new VM
+        std::unique_ptr< ColumnNameCache const > cn_cache;
+
         typedef Blex::InterlockedData<DebugStatFunctions, Blex::ReadWriteMutex> LockedDebugStatFunctions;
         LockedDebugStatFunctions debugstatfunctions;
 
@@ -377,6 +417,19 @@ class BLEXLIB_PUBLIC Environment
             effect */
         void LockedReleaseRef(Library *lib);
 
+        /** Remove a library from the cache and the loaded library index, and release
+            the reference of the cache - assume a cachelock is already in effect */
+        void LockedEvictLibrary(LibraryCache &cache, Library *lib);
+
+        /** Get the current validation key for libraries. The key changes when a file
+            in a watched directory has changed, and at least every minute
+            @return Validation key, 0 if files can't be watched */
+        uint64_t GetValidationKey(Blex::DateTime currenttime);
+
+        /** Watch the directories of the files of a library and its dependencies
+            @return True if all the files are being watched */
+        bool WatchLibraryFiles(Library *lib);
+
         /** Get a reference to the requested library, loading it into memory
             if necessary. The received library must be released using ReleaseLibRef.
             This function will throw an exception if it cannot load the library.
@@ -422,6 +475,8 @@ class BLEXLIB_PUBLIC Environment
 
         ColumnNames::GlobalMapper & GetColumnNameMapper() { return externals.columnnamemapper; }
 
+        ColumnNameCache const & GetColumnNameCache() const { return *cn_cache; }
+
         FileSystem & GetFileSystem() { return filesystem; }
 
         Blex::NotificationEventManager & GetNotificationEventMgr() { return eventmgr; }
@@ -479,7 +534,11 @@ class LibraryLoader
         /// Pointers to the libraries that must be initialized (superset of loaded_libs)
         LibraryConstPtrs mustinit;
 
-        /// Map from name to library, mirrors mustinit
+        /** Library that the initialization order was started with. Its (prelinked) initialization order
+            is the first part of mustinit, lookups by uri use its index for those libraries */
+        Library const *startlib;
+
+        /// Map from name to library for the libraries in mustinit that aren't in the initialization order of startlib
         std::unordered_map< std::string, Library const * > mustinit_urimap;
 
         /// Number of libraries that have been returned for initialization
@@ -488,6 +547,9 @@ class LibraryLoader
         /// Deferrred initializations (because of calling a function in an as yet uninitialized library, usually hooks)
         LibraryConstPtrs deferred_inits;
 
+        /// Find a library in mustinit by uri, returns NULL if not present
+        Library const * FindMustInitLibrary(std::string const &liburi) const;
+
     public:
         /** Initializes the LibraryLoader */
         LibraryLoader(Environment &llib, ErrorHandler &errorhandler);
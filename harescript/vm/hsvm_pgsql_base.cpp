@@ -61,6 +61,18 @@ std::string_view max_indexed_size("264"sv); // Keep in sync with constant in dba
 // Command timeout (15 minutes)
 const unsigned default_command_timeout_secs = 15 * 60;
 
+/* Number of rows fetched by the first and later FETCHes from streaming cursors. The first fetch is small
+   to keep small queries cheap, later fetches grow to the maximum to limit the number of roundtrips */
+const unsigned cursor_first_fetch = 64;
+const unsigned cursor_max_fetch = 4096;
+
+// Amount of COPY data to collect before sending it to the server
+const unsigned copy_chunk_size = 1024 * 1024;
+
+// Header of the binary COPY format: signature, flags and header extension length
+const char copy_binary_signature[11] = { 'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0' };
+const unsigned copy_binary_headersize = 19;
+
 #define PqMsg_Bind 'B'
 #define PqMsg_Close 'C'
 #define PqMsg_Describe 'D'
@@ -1175,6 +1187,59 @@ TuplesReader::ReadResult TuplesReader::ReadSimpleTuple(VarId id_set, int row)
         return ReadResult::Value;
 }
 
+TuplesReader::ReadResult TuplesReader::ReadRecord(VarId id_set, int row, RecordTemplate const &tmpl)
+{
+        StackMachine &stackm = vm->GetStackMachine();
+
+        // Collect the values first, so the record can be built with all its cells at once. NULL values don't get a cell.
+        static const unsigned NullColumn = ~0u;
+        Blex::SemiStaticPodVector< QueryResultValue, 64 > values;
+        Blex::SemiStaticPodVector< unsigned, 64 > columns;
+        Blex::SemiStaticPodVector< ColumnNameId, 64 > names;
+
+        unsigned numcolumns = tmpl.columns.size();
+        for (unsigned idx = 0; idx < numcolumns; ++idx)
+        {
+                QueryResultValue colres = res->GetValue(row, tmpl.columns[idx]);
+                if (colres.isnull)
+                    continue;
+
+                values.push_back(colres);
+                columns.push_back(tmpl.columns[idx]);
+                names.push_back(tmpl.names[idx]);
+        }
+
+        unsigned numcells = names.size();
+        VarMemory::RecordShapeId shape = numcells == numcolumns ? tmpl.shape : stackm.GetRecordShape(numcells, names.begin());
+
+        Blex::SemiStaticPodVector< VarId, 64 > cells;
+        cells.resize(numcells);
+        stackm.RecordInitializeCells(id_set, numcells, names.begin(), shape, cells.begin());
+
+        for (unsigned idx = 0; idx < numcells; ++idx)
+        {
+                Field const &field = fields[columns[idx]];
+                if (!field.isbinary)
+                {
+                        stackm.SetSTLString(cells[idx], std::string_view(values[idx].data, values[idx].length));
+                        continue;
+                }
+
+                ReadResult readres = ReadBinaryValue(cells[idx], field.type, values[idx].length, values[idx].data, field.vartype, field.nameid);
+                if (readres == ReadResult::Exception)
+                    return readres;
+                if (readres == ReadResult::Null)
+                    columns[idx] = NullColumn;
+        }
+
+        // Some non-NULL values (eg empty arrays) are decoded as NULL, remove their cells afterwards
+        for (unsigned idx = 0; idx < numcells; ++idx)
+            if (columns[idx] == NullColumn)
+                stackm.RecordCellDelete(id_set, names[idx]);
+
+        return ReadResult::Value;
+}
+
 TuplesReader::Value TuplesReader::ReadValue(int row, int col)
 {
         auto colres = res->GetValue(row, col);
@@ -1297,9 +1362,11 @@ PGSQLTransactionDriverBase::PGSQLTransactionDriverBase(HSVM *_vm, /*PGconn *_con
 , webhare_blobarray_oid(0)
 , blobfolder(options.blobfolder)
 , allowwriteerrordelay(false)
+, streamselects(false)
 , logstacktraces(options.logstacktraces)
 , logcommands(0)
 , command_timeout_secs(default_command_timeout_secs)
+, cursor_counter(0)
 {
         assumeblobsexist = Blex::GetEnvironVariable("WEBHARE_PGSQL_ASSUMEBLOBSEXIST") == "1";
         description.supports_block_cursors = false;
@@ -1322,6 +1389,29 @@ void PGSQLTransactionDriverBase::PrepareForQuery()
 {
 }
 
+bool PGSQLTransactionDriverBase::StartCopy(Query &)
+{
+        HSVM_ThrowException(*vm, "COPY is not supported by this database driver");
+        return false;
+}
+
+bool PGSQLTransactionDriverBase::PutCopyData(char const *, unsigned)
+{
+        HSVM_ThrowException(*vm, "COPY is not supported by this database driver");
+        return false;
+}
+
+std::unique_ptr< QueryResult > PGSQLTransactionDriverBase::EndCopyIn(bool)
+{
+        return std::unique_ptr< QueryResult >();
+}
+
+int PGSQLTransactionDriverBase::GetCopyData(char const **)
+{
+        HSVM_ThrowException(*vm, "COPY is not supported by this database driver");
+        return -2;
+}
+
 std::string_view PGSQLTransactionDriverBase::ReadResultCell(std::unique_ptr< QueryResult > &resultset, unsigned row, unsigned col)
 {
         auto colres = resultset->GetValue(row, col);
@@ -1902,6 +1992,28 @@ DatabaseTransactionDriverInterface::CursorId PGSQLTransactionDriverBase::OpenCur
         if (!BuildQueryString(querydata, query, cursortype))
              return 0;
 
+        /* When requested, stream the results of selects within a transaction from a server-side
+           cursor, so we don't have to hold the entire result set in memory before returning the
+           first rows. That costs extra roundtrips and skips the prepared statement cache, so
+           ordinary selects (and selects that will only return a few rows) retrieve the entire
+           result set at once. Cursors don't survive the end of the transaction.
+        */
+        if (cursortype == DatabaseTransactionDriverInterface::Select && streamselects && this->IsWorkOpen() && (query.limit < 0 || query.limit > static_cast< signed >(cursor_first_fetch)))
+        {
+                querydata.cursorname = "hs_cursor_" + Blex::AnyToString(++cursor_counter);
+                querydata.query.querystr = "DECLARE " + querydata.cursorname + " NO SCROLL CURSOR FOR " + querydata.query.querystr;
+                querydata.fetchsize = cursor_first_fetch;
+
+                // Don't wait for the DECLARE to finish, so it can be sent together with the first FETCH
+                ExecQuery(querydata.query, true);
+                if (vm->is_unwinding || !FetchCursorRows(querydata))
+                {
+                        queries.Erase(id);
+                        return 0;
+                }
+                return id;
+        }
+
         auto resultset = ExecQuery(querydata.query, false);
         if (!resultset)
         {
@@ -1917,11 +2029,40 @@ DatabaseTransactionDriverInterface::CursorId PGSQLTransactionDriverBase::OpenCur
         return id;
 }
 
+bool PGSQLTransactionDriverBase::FetchCursorRows(QueryData &querydata)
+{
+        Query fetchquery(*this);
+        fetchquery.querystr = "FETCH FORWARD " + Blex::AnyToString(querydata.fetchsize) + " FROM " + querydata.cursorname;
+
+        auto resultset = ExecQuery(fetchquery, false);
+        if (!resultset)
+            return false;
+
+        querydata.cursordone = resultset->GetRowCount() < querydata.fetchsize;
+        querydata.fetchsize = std::min(querydata.fetchsize * 2, cursor_max_fetch);
+
+        // Blocks never span fetches, so the row numbers of a block stay valid for fase2 retrieval
+        querydata.reader.reset();
+        querydata.resultset = std::move(resultset);
+        querydata.reader.reset(new TuplesReader(vm, *this, querydata.resultset.get(), &querydata));
+
+        querydata.currow = 0;
+        querydata.blockstartrow = 0;
+        return true;
+}
+
 unsigned PGSQLTransactionDriverBase::RetrieveNextBlock(CursorId id, VarId recarr)
 {
         StackMachine &stackm = vm->GetStackMachine();
         QueryData &querydata = *queries.Get(id);
 
+        // Fetch the next rows from a streaming cursor when all fetched rows have been returned
+        if (!querydata.cursorname.empty() && !querydata.cursordone && querydata.currow >= querydata.resultset->GetRowCount())
+        {
+                if (!FetchCursorRows(querydata))
+                    return 0;
+        }
+
         querydata.blockstartrow = querydata.currow;
 
         int totaltuples = querydata.resultset->GetRowCount();
@@ -1932,10 +2073,6 @@ unsigned PGSQLTransactionDriverBase::RetrieveNextBlock(CursorId id, VarId recarr
 
         unsigned elt_count = rowcount * querydata.tablecount;
         stackm.ArrayInitialize(recarr, elt_count, VariableTypes::RecordArray);
-        for (unsigned idx = 0; idx < elt_count; ++idx)
-            stackm.RecordInitializeEmpty(stackm.ArrayElementRef(recarr, idx));
-
-        // FIXME: read per row instead of per column - works better with datarow cell position caching
 
         // Read ctids for non-select
         if (!querydata.updatedtable.empty())
@@ -1945,23 +2082,46 @@ unsigned PGSQLTransactionDriverBase::RetrieveNextBlock(CursorId id, VarId recarr
                     querydata.ctids[row] = std::get< PostgresqlTid >(querydata.reader->ReadValue(querydata.currow + row, 0));
         }
 
-        unsigned colidx = 0;
-        for (auto &resultcol: querydata.resultcolumns)
+        // Group the exported columns per table once, so every record can be built in one go
+        if (querydata.rowtemplates.empty())
         {
-                if (resultcol.tableidx >= 0) // exported column
+                querydata.rowtemplates.resize(querydata.tablecount);
+
+                unsigned colidx = 0;
+                for (auto &resultcol: querydata.resultcolumns)
                 {
-                        for (unsigned row = 0; row < rowcount; ++row)
+                        if (resultcol.tableidx >= 0) // exported column
                         {
-                                VarId rec = stackm.ArrayElementRef(recarr, row * querydata.tablecount + resultcol.tableidx);
-                                VarId cell = stackm.RecordCellCreate(rec, resultcol.nameid);
-                                TuplesReader::ReadResult readres = querydata.reader->ReadValue(cell, querydata.currow + row, colidx);
-                                if (readres == TuplesReader::ReadResult::Exception)
-                                    return 0;
-                                if (readres == TuplesReader::ReadResult::Null)
-                                    stackm.RecordCellDelete(rec, resultcol.nameid);
+                                TuplesReader::RecordTemplate &tmpl = querydata.rowtemplates[resultcol.tableidx];
+
+                                // When a column is exported twice, the last value wins
+                                auto itr = std::find(tmpl.names.begin(), tmpl.names.end(), resultcol.nameid);
+                                if (itr != tmpl.names.end())
+                                    tmpl.columns[itr - tmpl.names.begin()] = colidx;
+                                else
+                                {
+                                        tmpl.columns.push_back(colidx);
+                                        tmpl.names.push_back(resultcol.nameid);
+                                }
+                        }
+                        ++colidx;
+                }
+                for (auto &tmpl: querydata.rowtemplates)
+                    tmpl.shape = stackm.GetRecordShape(tmpl.names.size(), tmpl.names.data());
+        }
+
+        for (unsigned row = 0; row < rowcount; ++row)
+        {
+                for (unsigned tableidx = 0; tableidx < querydata.tablecount; ++tableidx)
+                {
+                        VarId rec = stackm.ArrayElementRef(recarr, row * querydata.tablecount + tableidx);
+                        if (querydata.reader->ReadRecord(rec, querydata.currow + row, querydata.rowtemplates[tableidx]) == TuplesReader::ReadResult::Exception)
+                        {
+                                // Don't leave records that haven't been initialized yet
+                                stackm.ArrayInitialize(recarr, 0, VariableTypes::RecordArray);
+                                return 0;
                         }
                 }
-                ++colidx;
         }
 
         querydata.currow += rowcount;
@@ -2117,6 +2277,18 @@ void PGSQLTransactionDriverBase::UpdateRecord(CursorId id, unsigned row, VarId n
 
 void PGSQLTransactionDriverBase::CloseCursor(CursorId id)
 {
+        /* Close streaming cursors, so the server can release them before the transaction ends.
+           The server keeps a cursor open after its last rows have been fetched, so this is needed
+           for completely read cursors too. Don't wait for the result, it's read with the next query.
+           Skip this when unwinding, the transaction will usually be rolled back anyway */
+        QueryData *querydata = queries.Get(id);
+        if (querydata && !querydata->cursorname.empty() && this->IsWorkOpen() && !vm->is_unwinding)
+        {
+                Query closequery(*this);
+                closequery.querystr = "CLOSE " + querydata->cursorname;
+                ExecQuery(closequery, true);
+        }
+
         queries.Erase(id);
 }
 
@@ -2191,6 +2363,267 @@ void PGSQLTransactionDriverBase::ExecuteSimpleQuery(VarId id_set, std::string co
         }
 }
 
+int32_t PGSQLTransactionDriverBase::ExecuteCopyIn(std::string const &table, VarId columns, VarId rows)
+{
+        StackMachine &stackm = vm->GetStackMachine();
+
+        if (!IsWorkOpen())
+        {
+                HSVM_ThrowException(*vm, "BeginWork must be called before modifying the database");
+                return 0;
+        }
+
+        unsigned colcount = stackm.ArraySize(columns);
+        unsigned rowcount = stackm.ArraySize(rows);
+        if (!colcount)
+        {
+                HSVM_ThrowException(*vm, "No columns specified");
+                return 0;
+        }
+
+        std::string tablename;
+        AddEscapedSchemaTable(&tablename, table);
+
+        std::string columnlist;
+        std::vector< ColumnNameId > nameids;
+        for (unsigned col = 0; col < colcount; ++col)
+        {
+                Blex::StringPair name = stackm.GetString(stackm.ArrayElementGet(columns, col));
+                if (col)
+                    columnlist += ", ";
+                AddEscapedName(&columnlist, std::string_view(name.begin, name.size()));
+                nameids.push_back(stackm.columnnamemapper.GetMapping(name));
+        }
+
+        /* The binary COPY format has no type information, so the values must be encoded
+           exactly like the column types. Query the column types first (this also checks
+           that the table and columns exist before starting the COPY)
+        */
+        Query typequery(*this);
+        typequery.querystr = "SELECT " + columnlist + " FROM " + tablename + " LIMIT 0";
+        auto typeresult = ExecQuery(typequery, false);
+        if (!typeresult)
+            return 0;
+        auto fields = typeresult->GetResultFields();
+
+        /* Uploading blobs registers them using a query, which can't run during the COPY.
+           Upload them first, encoding them during the COPY will use the registration cache */
+        for (unsigned col = 0; col < colcount; ++col)
+        {
+                if (webhare_blob_oid == 0 || fields[col].typeoid != static_cast< OID >(webhare_blob_oid))
+                    continue;
+
+                for (unsigned row = 0; row < rowcount; ++row)
+                {
+                        VarId cell = stackm.RecordCellRefByName(stackm.ArrayElementGet(rows, row), nameids[col]);
+                        if (cell && stackm.GetType(cell) == VariableTypes::Blob)
+                        {
+                                ParamsEncoder blobencoder(*this);
+                                if (blobencoder.AddVariableParameter(vm, cell).empty())
+                                    return 0;
+                        }
+                }
+        }
+
+        Query copyquery(*this);
+        copyquery.querystr = "COPY " + tablename + " (" + columnlist + ") FROM STDIN (FORMAT binary)";
+        if (!StartCopy(copyquery))
+            return 0;
+
+        // Encode the values like array elements (length + data), that is exactly the layout of binary COPY fields
+        ParamsEncoder &encoder = copyquery.params;
+        encoder.buildmode = ParamsEncoder::Array;
+
+        auto &buffer = encoder.alldata;
+        buffer.resize(copy_binary_headersize);
+        std::copy(copy_binary_signature, copy_binary_signature + sizeof copy_binary_signature, buffer.begin());
+        Blex::puts32msb(&buffer[11], 0); // flags
+        Blex::puts32msb(&buffer[15], 0); // header extension length
+
+        for (unsigned row = 0; row < rowcount; ++row)
+        {
+                VarId record = stackm.ArrayElementGet(rows, row);
+
+                auto pos = buffer.size();
+                buffer.resize(pos + 2);
+                Blex::puts16msb(&buffer[pos], colcount);
+
+                for (unsigned col = 0; col < colcount; ++col)
+                {
+                        VarId cell = stackm.RecordCellRefByName(record, nameids[col]);
+                        VariableTypes::Type type = cell ? stackm.GetType(cell) : VariableTypes::Uninitialized;
+
+                        // INTEGER and INTEGER64 are often used for each other's column type, encode them as the column type
+                        if (type == VariableTypes::Integer && fields[col].typeoid == OID::INT8)
+                            Blex::puts64msb(encoder.RegisterParameter(OID::INT8, 8), stackm.GetInteger(cell));
+                        else if (type == VariableTypes::Integer64 && fields[col].typeoid == OID::INT4)
+                        {
+                                int64_t value = stackm.GetInteger64(cell);
+                                if (value < std::numeric_limits< int32_t >::min() || value > std::numeric_limits< int32_t >::max())
+                                {
+                                        HSVM_ThrowException(*vm, ("Value " + Blex::AnyToString(value) + " is out of range for INTEGER column '" + std::string(fields[col].name) + "'").c_str());
+                                        EndCopyIn(true);
+                                        return 0;
+                                }
+                                Blex::puts32msb(encoder.RegisterParameter(OID::INT4, 4), static_cast< int32_t >(value));
+                        }
+                        else
+                        {
+                                std::string paramref = cell ? encoder.AddVariableParameter(vm, cell, fields[col].typeoid == OID::BYTEA ? ParamEncoding::Binary : ParamEncoding::None) : "NULL";
+                                if (paramref.empty())
+                                {
+                                        EndCopyIn(true);
+                                        return 0;
+                                }
+                                if (paramref == "NULL")
+                                    encoder.RegisterParameter(fields[col].typeoid, -1);
+                        }
+                }
+
+                if (buffer.size() >= copy_chunk_size)
+                {
+                        if (!PutCopyData(buffer.begin(), buffer.size()))
+                            return 0;
+                        buffer.clear();
+                }
+        }
+
+        auto pos = buffer.size();
+        buffer.resize(pos + 2);
+        Blex::puts16msb(&buffer[pos], -1); // trailer
+        if (!PutCopyData(buffer.begin(), buffer.size()))
+            return 0;
+
+        auto res = EndCopyIn(false);
+        return res ? res->GetCmdTuples() : 0;
+}
+
+void PGSQLTransactionDriverBase::ExecuteCopyOut(VarId id_set, std::string const &query)
+{
+        StackMachine &stackm = vm->GetStackMachine();
+        stackm.InitVariable(id_set, VariableTypes::RecordArray);
+
+        // The binary COPY format has no column names or types, get them by describing the query first
+        Query describequery(*this);
+        describequery.querystr = "SELECT * FROM (" + query + ") AS copyquery LIMIT 0";
+        auto describeresult = ExecQuery(describequery, false);
+        if (!describeresult)
+            return;
+
+        TuplesReader reader(vm, *this, describeresult.get(), nullptr);
+        unsigned colcount = reader.fields.size();
+
+        Query copyquery(*this);
+        copyquery.querystr = "COPY (" + query + ") TO STDOUT (FORMAT binary)";
+        if (!StartCopy(copyquery))
+            return;
+
+        /* The server sends a message per row, but the format doesn't require that. Parse
+           straight from the received data, and only keep incomplete tuples for the next chunk.
+           After an error, the rest of the data still has to be read to end the COPY
+        */
+        Blex::PodVector< char > pending;
+        bool gotheader = false;
+        bool failed = false;
+        while (true)
+        {
+                char const *data;
+                int len = GetCopyData(&data);
+                if (len == -2)
+                    return;
+                if (len == -1)
+                    break;
+                if (failed)
+                    continue;
+
+                char const *pos = data;
+                char const *end = data + len;
+                if (!pending.empty())
+                {
+                        pending.insert(pending.end(), data, data + len);
+                        pos = pending.begin();
+                        end = pending.end();
+                }
+
+                if (!gotheader)
+                {
+                        if (end - pos < static_cast< signed >(copy_binary_headersize) || end - pos < static_cast< signed >(copy_binary_headersize) + Blex::gets32msb(pos + 15))
+                        {
+                                if (pending.empty())
+                                    pending.assign(pos, end);
+                                continue;
+                        }
+                        if (!std::equal(copy_binary_signature, copy_binary_signature + sizeof copy_binary_signature, pos))
+                        {
+                                HSVM_ThrowException(*vm, "Unexpected COPY data format");
+                                failed = true;
+                                continue;
+                        }
+                        pos += copy_binary_headersize + Blex::gets32msb(pos + 15);
+                        gotheader = true;
+                }
+
+                while (end - pos >= 2)
+                {
+                        int16_t fieldcount = Blex::gets16msb(pos);
+                        if (fieldcount == -1) // trailer
+                        {
+                                pos = end;
+                                break;
+                        }
+                        if (fieldcount != static_cast< int16_t >(colcount))
+                        {
+                                HSVM_ThrowException(*vm, "Unexpected number of columns in COPY data");
+                                failed = true;
+                                break;
+                        }
+
+                        // Check if the tuple is complete
+                        char const *tupleend = pos + 2;
+                        unsigned col = 0;
+                        for (; col < colcount && end - tupleend >= 4; ++col)
+                        {
+                                int32_t fieldlen = Blex::gets32msb(tupleend);
+                                if (fieldlen > 0 && end - tupleend - 4 < fieldlen)
+                                    break;
+                                tupleend += 4 + (fieldlen > 0 ? fieldlen : 0);
+                        }
+                        if (col != colcount)
+                            break;
+
+                        VarId record = stackm.ArrayElementAppend(id_set);
+                        stackm.InitVariable(record, VariableTypes::Record);
+
+                        pos += 2;
+                        for (col = 0; col < colcount; ++col)
+                        {
+                                int32_t fieldlen = Blex::gets32msb(pos);
+                                pos += 4;
+
+                                TuplesReader::Field const &field = reader.fields[col];
+                                VarId cell = stackm.RecordCellCreate(record, field.nameid);
+                                if (reader.ReadBinaryValue(cell, field.type, fieldlen, pos, field.vartype, field.nameid) == TuplesReader::ReadResult::Exception)
+                                {
+                                        failed = true;
+                                        break;
+                                }
+                                pos += fieldlen > 0 ? fieldlen : 0;
+                        }
+                        if (failed)
+                            break;
+                }
+
+                if (failed)
+                    continue;
+
+                // Keep the incomplete tuple
+                if (pending.empty())
+                    pending.assign(pos, end);
+                else
+                    pending.erase(pending.begin(), pending.begin() + (pos - pending.begin()));
+        }
+}
+
 void PGSQLTransactionDriverBase::GetErrorField(VarId id_set, ColumnNameId col, QueryResult const &res, PG_DIAG_CODE fieldcode)
 {
         StackMachine &stackm = vm->GetStackMachine();
@@ -2282,6 +2715,34 @@ void PGSQL_Exec(HSVM *hsvm, HSVM_VariableId id_set)
         driver->ExecuteSimpleQuery(id_set, query, HSVM_Arg(2), HSVM_Arg(3), astext, with_cmdinfo);
 }
 
+void PGSQL_CopyIn(HSVM *hsvm, HSVM_VariableId id_set)
+{
+        int32_t transid = HSVM_IntegerGet(hsvm, HSVM_Arg(0));
+        auto driver = dynamic_cast< PGSQLTransactionDriverBase *>(GetVirtualMachine(hsvm)->GetSQLSupport().GetTransaction(transid));
+        if (!driver)
+        {
+                HSVM_ThrowException(hsvm, "The specified transaction is not a PostgreSQL transaction");
+                return;
+        }
+
+        std::string table = HSVM_StringGetSTD(hsvm, HSVM_Arg(1));
+        HSVM_IntegerSet(hsvm, id_set, driver->ExecuteCopyIn(table, HSVM_Arg(2), HSVM_Arg(3)));
+}
+
+void PGSQL_CopyOut(HSVM *hsvm, HSVM_VariableId id_set)
+{
+        int32_t transid = HSVM_IntegerGet(hsvm, HSVM_Arg(0));
+        auto driver = dynamic_cast< PGSQLTransactionDriverBase *>(GetVirtualMachine(hsvm)->GetSQLSupport().GetTransaction(transid));
+        if (!driver)
+        {
+                HSVM_ThrowException(hsvm, "The specified transaction is not a PostgreSQL transaction");
+                return;
+        }
+
+        std::string query = HSVM_StringGetSTD(hsvm, HSVM_Arg(1));
+        driver->ExecuteCopyOut(id_set, query);
+}
+
 void PGSQL_GetWorkOpen(HSVM *hsvm, HSVM_VariableId id_set)
 {
         int32_t transid = HSVM_IntegerGet(hsvm, HSVM_Arg(0));
@@ -2321,6 +2782,19 @@ void PGSQL_SetAllowWriteErrorDelay(HSVM *hsvm)
         driver->allowwriteerrordelay = HSVM_BooleanGet(hsvm, HSVM_Arg(1));
 }
 
+void PGSQL_SetStreamSelects(HSVM *hsvm)
+{
+        int32_t transid = HSVM_IntegerGet(hsvm, HSVM_Arg(0));
+        auto driver = dynamic_cast< PGSQLTransactionDriverBase *>(GetVirtualMachine(hsvm)->GetSQLSupport().GetTransaction(transid));
+        if (!driver)
+        {
+                HSVM_ThrowException(hsvm, "The specified transaction is not a PostgreSQL transaction");
+                return;
+        }
+
+        driver->streamselects = HSVM_BooleanGet(hsvm, HSVM_Arg(1));
+}
+
 void PGSQL_GetDebugSettings(HSVM *hsvm, HSVM_VariableId id_set)
 {
         int32_t transid = HSVM_IntegerGet(hsvm, HSVM_Arg(0));
@@ -2443,8 +2917,11 @@ void PGSQLRegisterSharedFunctions(HSVM_RegData *regdata) {
 
         HSVM_RegisterMacro(regdata, "__PGSQL_CLOSE:::I", PGSQL_Close);
         HSVM_RegisterFunction(regdata, "__PGSQL_EXEC::V:ISVAIABB", PGSQL_Exec);
+        HSVM_RegisterFunction(regdata, "__PGSQL_COPYIN::I:ISSARA", PGSQL_CopyIn);
+        HSVM_RegisterFunction(regdata, "__PGSQL_COPYOUT::RA:IS", PGSQL_CopyOut);
         HSVM_RegisterMacro(regdata, "__PGSQL_SETWORKOPEN:::IB", PGSQL_SetWorkOpen);
         HSVM_RegisterMacro(regdata, "__PGSQL_SETALLOWWRITEERRRORDELAY:::IB", PGSQL_SetAllowWriteErrorDelay);
+        HSVM_RegisterMacro(regdata, "__PGSQL_SETSTREAMSELECTS:::IB", PGSQL_SetStreamSelects);
         HSVM_RegisterFunction(regdata, "__PGSQL_GETWORKOPEN::B:I", PGSQL_GetWorkOpen);
         HSVM_RegisterFunction(regdata, "__PGSQL_GETDEBUGSETTINGS::R:I", PGSQL_GetDebugSettings);
         HSVM_RegisterMacro(regdata, "__PGSQL_UPDATEDEBUGSETTINGS:::IIII", PGSQL_UpdateDebugSettings);
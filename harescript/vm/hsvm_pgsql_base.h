@@ -194,12 +194,24 @@ struct TuplesReader
 
         std::vector< Field > fields;
 
+        /// Describes how to decode a row into a record with a fixed list of columns
+        struct RecordTemplate
+        {
+                /// Result columns to decode, in cell order
+                std::vector< unsigned > columns;
+                /// Names of the cells
+                std::vector< ColumnNameId > names;
+                /// Shape of the record when no column is NULL
+                VarMemory::RecordShapeId shape;
+        };
+
         typedef std::variant< std::nullptr_t, int, std::string, PostgresqlTid > Value;
 
         void ReadColumns(QueryData *querydata);
         ReadResult ReadValue(VarId id_set, int row, int col);
         ReadResult ReadBinaryValue(VarId id_set, OID oid, int len, const char *data, VariableTypes::Type wanttype, ColumnNameId colname);
         ReadResult ReadSimpleTuple(VarId id_set, int row);
+        ReadResult ReadRecord(VarId id_set, int row, RecordTemplate const &tmpl);
         void AddAsParameter(ParamsEncoder *encoder, int row, int col);
         Value ReadValue(int row, int col);
 };
@@ -227,6 +239,8 @@ class QueryData
         , tablecount(0)
         , blockstartrow(0)
         , currow(0)
+        , fetchsize(0)
+        , cursordone(false)
         {
         }
 
@@ -240,6 +254,8 @@ class QueryData
         };
 
         std::vector< ResultColumn > resultcolumns;
+        /// Templates to decode the exported columns for every table, built when the first block is retrieved
+        std::vector< TuplesReader::RecordTemplate > rowtemplates;
 
         std::string querystrfase2;
         std::vector< ResultColumn > resultcolumnsfase2;
@@ -265,6 +281,13 @@ class QueryData
         unsigned blockstartrow;
         unsigned currow;
 
+        /// Name of the server-side cursor the results are streamed from, empty if the full result set was retrieved at once
+        std::string cursorname;
+        /// Number of rows to fetch from the cursor with the next FETCH
+        unsigned fetchsize;
+        /// Whether all rows have been fetched from the cursor
+        bool cursordone;
+
         Blex::SemiStaticPodVector< PostgresqlTid, fase1_max_blocksize > ctids;
 
         std::unique_ptr< QueryResult > resultset;
@@ -326,10 +349,26 @@ class PGSQLTransactionDriverBase : public DatabaseTransactionDriverInterface
         //virtual std::unique_ptr< QueryResult > WaitForResult() = 0;
         virtual std::pair< std::unique_ptr< QueryResult >, bool > GetLastResult() = 0;
 
+        /** Start a COPY command. The default implementation throws, drivers that support COPY must override this
+            @return False if the COPY couldn't be started (an exception has been thrown) */
+        virtual bool StartCopy(Query &query);
+        /** Send data for a COPY FROM STDIN command
+            @return False if an error occurred (an exception has been thrown) */
+        virtual bool PutCopyData(char const *data, unsigned len);
+        /** End a COPY FROM STDIN command
+            @param abort If true, abort the COPY (the caller has already thrown an exception)
+            @return Result of the COPY command, nullptr if it failed or was aborted */
+        virtual std::unique_ptr< QueryResult > EndCopyIn(bool abort);
+        /** Get the next chunk of data of a COPY TO STDOUT command
+            @param data Receives a pointer to the data, which stays valid until the next call
+            @return Length of the data, -1 when all data has been read, -2 when an error occurred (an exception has been thrown) */
+        virtual int GetCopyData(char const **data);
+
         void GetErrorField(VarId id_set, ColumnNameId col, QueryResult const &res, PG_DIAG_CODE fieldcode);
         //static void NoticeReceiverCallback(void *arg, const PGresult *res);
         bool HandleMessage(QueryResult const &res);
         void ExecuteInsertInternal(DatabaseQuery const &query, VarId newrecord, bool isarray);
+        bool FetchCursorRows(QueryData &querydata);
 
     public:
         /// Initializes PG transaction. Run this->ScanTypes() after the constructor finishes1
@@ -354,6 +393,9 @@ class PGSQLTransactionDriverBase : public DatabaseTransactionDriverInterface
 
         void ExecuteSimpleQuery(VarId id_set, std::string const &query, VarId params, VarId encodings, bool astext, bool with_cmdinfo);
 
+        int32_t ExecuteCopyIn(std::string const &table, VarId columns, VarId rows);
+        void ExecuteCopyOut(VarId id_set, std::string const &query);
+
         void EscapeLiteral(VarId id_set, Blex::StringPair to_encode);
         void EscapeIdentifier(VarId id_set, Blex::StringPair to_encode);
 
@@ -369,10 +411,14 @@ class PGSQLTransactionDriverBase : public DatabaseTransactionDriverInterface
         int32_t webhare_blobarray_oid;
         std::string blobfolder;
         bool allowwriteerrordelay;
+        /// Stream the results of selects within work from server-side cursors
+        bool streamselects;
         int32_t logstacktraces;
         int32_t logcommands;
         HSVM_VariableId commandlog;
         int32_t command_timeout_secs;
+        /// Counter for cursor name generation
+        uint64_t cursor_counter;
 
         friend struct ParamsEncoder;
 };
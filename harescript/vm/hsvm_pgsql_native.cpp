@@ -52,6 +52,11 @@ namespace PGSQL
 
 using namespace std::literals::string_view_literals;
 
+/** Maximum number of queries queued in a pipeline. The server keeps sending results
+    for the queued queries, limiting their number keeps it from blocking on a full
+    socket buffer while we're still sending queries (which would deadlock us) */
+const unsigned MaxPipelineQueries = 256;
+
 
 inline std::string HSVM_GetStringCell(HSVM *hsvm, HSVM_VariableId id_get, HSVM_ColumnId colid)
 {
@@ -65,6 +70,9 @@ PGSQLNativeTransactionDriver::PGSQLNativeTransactionDriver(HSVM *_vm, PGconn *_c
 : PGSQLTransactionDriverBase(_vm, options)
 , conn(_conn)
 , prepared_statements_counter(0)
+, pipeline_queued(0)
+, pipeline_synced(false)
+, pipeline_broken(false)
 , isworkopen(false)
 {
         PQsetNoticeReceiver(conn, &NoticeReceiverCallback, this);
@@ -114,9 +122,10 @@ std::unique_ptr< QueryResult > PGSQLNativeTransactionDriver::ExecQuery(Query &qu
 
         /* We can't send a query if the previous one is still in flight, so we need to
            retrieve the results first. Return immediately if an error was returned by
-           that query
+           that query. Queries queued in a pipeline can stay in flight, unless the
+           pipeline is full.
         */
-        if (PGSQLNativeTransactionDriver::GetLastResult().second)
+        if ((!pipeline_queued || pipeline_queued >= MaxPipelineQueries) && PGSQLNativeTransactionDriver::GetLastResult().second)
             return std::unique_ptr< QueryResult >();
 
         const bool fullstacktrace = false;
@@ -147,8 +156,9 @@ std::unique_ptr< QueryResult > PGSQLNativeTransactionDriver::ExecQuery(Query &qu
             sha1.Process(&query.params.types[0], query.params.types.size() * sizeof(query.params.types[0]));
         std::string hash = sha1.FinalizeHash().stl_str();
 
+        // PQprepare waits for its result, so it can't be used when queries are queued in a pipeline
         PreparedStatement &prep = prepared_statements[hash];
-        if (prep.use < 16 && (query.querystr.compare(0, 7, "SELECT "sv) == 0 || query.querystr.compare(0, 7, "INSERT "sv) == 0) && logprefix.empty())
+        if (prep.use < 16 && !pipeline_queued && (query.querystr.compare(0, 7, "SELECT "sv) == 0 || query.querystr.compare(0, 7, "INSERT "sv) == 0) && logprefix.empty())
         {
                 if (++prep.use == 16)
                 {
@@ -198,6 +208,21 @@ std::unique_ptr< QueryResult > PGSQLNativeTransactionDriver::ExecQuery(Query &qu
                     return std::unique_ptr< QueryResult >();
         }
 
+#ifdef LIBPQ_HAS_PIPELINING
+        /* Queue queries whose results aren't needed immediately in a pipeline, so they
+           don't need a roundtrip each. When queries are queued, the next query joins the
+           pipeline too, so its results are delivered in order */
+        if ((asyncresult || pipeline_queued) && PQpipelineStatus(conn) == PQ_PIPELINE_OFF)
+        {
+                PQ_PRINT("Entering pipeline mode");
+                if (!PQenterPipelineMode(conn))
+                {
+                        HSVM_ThrowException(*vm, ("Fatal error returned: " + std::string(PQerrorMessage(conn))).c_str());
+                        return std::unique_ptr< QueryResult >();
+                }
+        }
+#endif
+
         int res = 0;
         if (!prep.name.empty() && logprefix.empty())
         {
@@ -232,6 +257,16 @@ std::unique_ptr< QueryResult > PGSQLNativeTransactionDriver::ExecQuery(Query &qu
                 return std::unique_ptr< QueryResult >();
         }
 
+#ifdef LIBPQ_HAS_PIPELINING
+        if (PQpipelineStatus(conn) != PQ_PIPELINE_OFF)
+        {
+                ++pipeline_queued;
+
+                // Buffer the results that have already arrived, so the server won't block on sending them
+                PQconsumeInput(conn);
+        }
+#endif
+
         std::unique_ptr< QueryResult > retval;
         if (!asyncresult)
             retval = GetLastResult().first;
@@ -303,7 +338,7 @@ bool PGSQLNativeTransactionDriver::CheckResultStatus(std::unique_ptr< NativeQuer
         return true;
 }
 
-bool PGSQLNativeTransactionDriver::WaitForResult()
+bool PGSQLNativeTransactionDriver::WaitForResult(bool copydata)
 {
         if (HSVM_TestMustAbort(*vm))
             return false;
@@ -316,8 +351,9 @@ bool PGSQLNativeTransactionDriver::WaitForResult()
         int32_t counter = 0;
         while (true)
         {
+                // PQisBusy doesn't report on COPY data, when waiting for that just wait for the socket to become readable
                 PQconsumeInput(conn);
-                if (!PQisBusy(conn))
+                if (!copydata && !PQisBusy(conn))
                     return true;
 
                 pollfd input_fd;
@@ -328,7 +364,11 @@ bool PGSQLNativeTransactionDriver::WaitForResult()
                 // wait max 100ms
                 int res = poll(&input_fd, 1, 100);
                 if (res != 0)
-                    return true;
+                {
+                        if (copydata)
+                            PQconsumeInput(conn);
+                        return true;
+                }
 
                 if (HSVM_TestMustAbort(*vm))
                 {
@@ -351,6 +391,14 @@ bool PGSQLNativeTransactionDriver::WaitForResult()
 
 std::pair< std::unique_ptr< QueryResult >, bool > PGSQLNativeTransactionDriver::GetLastResult()
 {
+        if (pipeline_broken)
+        {
+                HSVM_ThrowException(*vm, "The connection was lost while reading pipelined query results");
+                return std::make_pair(std::unique_ptr< NativeQueryResult >(), true);
+        }
+        if (pipeline_queued)
+            return GetPipelineResults();
+
         std::unique_ptr< NativeQueryResult > lastres;
         bool goterror = false;
 
@@ -381,6 +429,184 @@ std::pair< std::unique_ptr< QueryResult >, bool > PGSQLNativeTransactionDriver::
         return std::make_pair(std::move(lastres), goterror);
 }
 
+std::pair< std::unique_ptr< QueryResult >, bool > PGSQLNativeTransactionDriver::GetPipelineResults()
+{
+        std::unique_ptr< NativeQueryResult > lastres;
+        bool goterror = false;
+
+#ifdef LIBPQ_HAS_PIPELINING
+        if (!pipeline_synced)
+        {
+                PQ_PRINT("Syncing pipeline with " << pipeline_queued << " queued queries");
+                if (!PQpipelineSync(conn))
+                {
+                        HSVM_ThrowException(*vm, ("Fatal error returned: " + std::string(PQerrorMessage(conn))).c_str());
+                        AbandonPipeline();
+                        return std::make_pair(std::unique_ptr< NativeQueryResult >(), true);
+                }
+                pipeline_synced = true;
+        }
+
+        /* Read the results of all queued queries, up to the sync point. The results
+           of every query are terminated by a nullptr. After an error, the server skips
+           the rest of the queries up to the sync point, they return PGRES_PIPELINE_ABORTED.
+        */
+        unsigned finishedqueries = 0;
+        while (true)
+        {
+                if (!WaitForResult())
+                {
+                        AbandonPipeline();
+                        return std::make_pair(std::unique_ptr< NativeQueryResult >(), true);
+                }
+
+                PGPtr< PGresult > res(PQgetResult(conn));
+                if (!res)
+                {
+                        // Guard against the connection going bad before we get the sync
+                        if (++finishedqueries > pipeline_queued)
+                            break;
+                        continue;
+                }
+
+                auto status = PQresultStatus(res.get());
+                if (status == PGRES_PIPELINE_SYNC)
+                    break;
+                if (goterror || status == PGRES_PIPELINE_ABORTED)
+                    continue;
+
+                std::unique_ptr< NativeQueryResult > queryresult(new NativeQueryResult(std::move(res)));
+
+                if (!CheckResultStatus(queryresult))
+                {
+                        goterror = true;
+                        lastres.reset();
+                }
+                else
+                    lastres = std::move(queryresult);
+        }
+
+        pipeline_queued = 0;
+        pipeline_synced = false;
+
+        PQ_PRINT("Leaving pipeline mode");
+        if (!PQexitPipelineMode(conn) && !goterror)
+        {
+                HSVM_ThrowException(*vm, ("Fatal error returned: " + std::string(PQerrorMessage(conn))).c_str());
+                return std::make_pair(std::unique_ptr< NativeQueryResult >(), true);
+        }
+#endif
+
+        return std::make_pair(std::move(lastres), goterror);
+}
+
+void PGSQLNativeTransactionDriver::AbandonPipeline()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+        pipeline_queued = 0;
+        pipeline_synced = false;
+
+        /* Leaving pipeline mode fails when results are still pending. We can't match
+           those results with their queries anymore, so mark the connection as broken */
+        PQ_PRINT("Abandoning pipeline");
+        if (!PQexitPipelineMode(conn))
+            pipeline_broken = true;
+#endif
+}
+bool PGSQLNativeTransactionDriver::StartCopy(Query &query)
+{
+        // Retrieve the results of queries that are still in flight first
+        if (GetLastResult().second)
+            return false;
+
+        PQ_PRINT("Execute copy: " << query.querystr);
+        if (!PQsendQuery(conn, query.querystr.c_str()))
+        {
+                HSVM_ThrowException(*vm, ("Fatal error returned: " + std::string(PQerrorMessage(conn))).c_str());
+                return false;
+        }
+
+        if (!WaitForResult())
+            return false;
+
+        PGPtr< PGresult > res(PQgetResult(conn));
+        if (res && (PQresultStatus(res.get()) == PGRES_COPY_IN || PQresultStatus(res.get()) == PGRES_COPY_OUT))
+            return true;
+
+        // Report the error, and read the rest of the results
+        std::unique_ptr< NativeQueryResult > queryresult(res ? new NativeQueryResult(std::move(res)) : nullptr);
+        if (CheckResultStatus(queryresult))
+            HSVM_ThrowException(*vm, "The server did not start the COPY");
+
+        GetLastResult();
+        return false;
+}
+
+bool PGSQLNativeTransactionDriver::PutCopyData(char const *data, unsigned len)
+{
+        if (HSVM_TestMustAbort(*vm))
+        {
+                EndCopyIn(true);
+                return false;
+        }
+
+        if (PQputCopyData(conn, data, len) != 1)
+        {
+                HSVM_ThrowException(*vm, ("Fatal error returned: " + std::string(PQerrorMessage(conn))).c_str());
+                EndCopyIn(true);
+                return false;
+        }
+        return true;
+}
+
+std::unique_ptr< QueryResult > PGSQLNativeTransactionDriver::EndCopyIn(bool abort)
+{
+        if (PQputCopyEnd(conn, abort ? "Aborted by client" : nullptr) != 1)
+        {
+                if (!abort)
+                    HSVM_ThrowException(*vm, ("Fatal error returned: " + std::string(PQerrorMessage(conn))).c_str());
+                return std::unique_ptr< QueryResult >();
+        }
+
+        if (!abort)
+            return GetLastResult().first;
+
+        // The caller has already thrown an exception, ignore the error the server returns for the aborted COPY
+        while (WaitForResult())
+        {
+                PGPtr< PGresult > res(PQgetResult(conn));
+                if (!res)
+                    break;
+        }
+        return std::unique_ptr< QueryResult >();
+}
+
+int PGSQLNativeTransactionDriver::GetCopyData(char const **data)
+{
+        copybuffer.reset();
+        while (true)
+        {
+                char *buffer = nullptr;
+                int len = PQgetCopyData(conn, &buffer, 1);
+                if (len > 0)
+                {
+                        copybuffer.reset(buffer);
+                        *data = buffer;
+                        return len;
+                }
+                if (len == -1) // COPY is done, read the result of the command
+                    return GetLastResult().second ? -2 : -1;
+                if (len == -2)
+                {
+                        HSVM_ThrowException(*vm, ("Fatal error returned: " + std::string(PQerrorMessage(conn))).c_str());
+                        return -2;
+                }
+
+                // No data available yet
+                if (!WaitForResult(true))
+                    return -2;
+        }
+}
 
 void PGSQLNativeTransactionDriver::NoticeReceiverCallback(void *arg, PGresult const *res)
 {
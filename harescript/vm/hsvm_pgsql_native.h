@@ -18,6 +18,7 @@ struct PGPtrDeleter
         inline void operator()(PGconn *conn) { PQfinish(conn); }
         inline void operator()(PGresult *result) { PQclear(result); }
         inline void operator()(PGcancel *cancel) { PQfreeCancel(cancel); }
+        inline void operator()(char *buffer) { PQfreemem(buffer); }
 };
 
 template < class T > using PGPtr = std::unique_ptr< T, PGPtrDeleter >;
@@ -91,11 +92,33 @@ class PGSQLNativeTransactionDriver : public PGSQLTransactionDriverBase
         /// Counter for name generation
         uint64_t prepared_statements_counter;
 
+        /** Number of queries sent in pipeline mode whose results haven't been read yet.
+            Queries whose results aren't needed immediately are queued in a pipeline,
+            the results are read (in order) at the next sync point */
+        unsigned pipeline_queued;
+
+        /// Whether a sync point has been sent for the queued queries
+        bool pipeline_synced;
+
+        /** Set when reading the pipeline results failed and pipeline mode couldn't be left.
+            The connection is out of sync with the server and can't be used anymore */
+        bool pipeline_broken;
+
+        /// Last buffer returned by GetCopyData
+        PGPtr< char > copybuffer;
+
         static void NoticeReceiverCallback(void *arg, PGresult const *res);
         std::unique_ptr< QueryResult > ExecQuery(Query &query, bool asyncresult);
         bool CheckResultStatus(std::unique_ptr< NativeQueryResult > const &res);
-        bool WaitForResult();
+        bool WaitForResult(bool copydata = false);
         std::pair< std::unique_ptr< QueryResult >, bool > GetLastResult();
+        std::pair< std::unique_ptr< QueryResult >, bool > GetPipelineResults();
+        void AbandonPipeline();
+
+        bool StartCopy(Query &query);
+        bool PutCopyData(char const *data, unsigned len);
+        std::unique_ptr< QueryResult > EndCopyIn(bool abort);
+        int GetCopyData(char const **data);
 
     public:
         /// Initializes PG transaction
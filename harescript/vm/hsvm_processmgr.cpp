@@ -75,13 +75,16 @@ namespace HareScript
 /* Locks: (top locks: no other locks may be taken when these are locked)
    - VMGroup reference mutex (top)            Only for keeping vmgroup references
    - Job manager jobdata lock (top)   For everything, and signalling the workers
+   - VMGroup claim mutexes            Only for switching a runnable group to running, and the scheduling data of the group
+   - Run queue lane locks             Only for the entries of a single lane of the run queue
 
-   Lock order: jobdata > groupref
+   Lock order: jobdata > group claim mutex > run queue lane > groupref
 
    VM access:
      Startup: access at own risk (make sure you're the only one)
      Running: only access within VM is allowed
      InitialRunnable, Runnable, WaitMsg, SendMsg, Terminated, WaitMsgSync, SendMsgSync: only allowed with job lock
+       (workers claim InitialRunnable and Runnable groups without the job lock, use HoldRunnableGroup first)
      Locked: allowed for locking thread only
 
      More important stuff
@@ -107,6 +110,130 @@ void JobManagerContextData::InitColumnMappings(VirtualMachine *vm)
         inited_cols = true;
 }
 
+// -----------------------------------------------------------------------------
+//
+// JobScheduler
+//
+
+namespace
+{
+/// Scheduler the current thread is a worker of
+thread_local JobScheduler const *current_scheduler = 0;
+/// Worker id of the current thread within current_scheduler
+thread_local unsigned current_worker = 0;
+} // End of anonymous namespace
+
+JobScheduler::JobScheduler()
+: numqueued_high(0)
+, numqueued_low(0)
+, nextlane(0)
+{
+        // Groups can be queued before the workers are started
+        workerlanes.emplace_back(new LockedLane);
+}
+
+JobScheduler::~JobScheduler()
+{
+}
+
+void JobScheduler::SetNumWorkers(unsigned numworkers)
+{
+        while (workerlanes.size() < numworkers)
+            workerlanes.emplace_back(new LockedLane);
+}
+
+void JobScheduler::RegisterWorkerThread(unsigned worker)
+{
+        current_scheduler = this;
+        current_worker = worker;
+}
+
+void JobScheduler::Push(VMGroup *group, unsigned seq, bool highpriority)
+{
+        Entry entry;
+        entry.group.reset(group, true);
+        entry.seq = seq;
+        entry.highpriority = highpriority;
+        entry.queuedticks = Blex::GetSystemCurrentTicks();
+
+        if (highpriority)
+        {
+                LockedLane::WriteRef lock(highlane);
+                lock->entries.push_back(entry);
+                ++numqueued_high;
+                return;
+        }
+
+        unsigned lane = current_scheduler == this ? current_worker : nextlane++;
+        LockedLane::WriteRef lock(*workerlanes[lane % workerlanes.size()]);
+        lock->entries.push_back(entry);
+        ++numqueued_low;
+}
+
+void JobScheduler::Requeue(Entry const &entry, bool highpriority)
+{
+        Entry copy(entry);
+        copy.highpriority = highpriority;
+
+        LockedLane::WriteRef lock(highpriority ? highlane : *workerlanes[(current_scheduler == this ? current_worker : 0) % workerlanes.size()]);
+        lock->entries.push_front(copy);
+        ++(highpriority ? numqueued_high : numqueued_low);
+}
+
+void JobScheduler::Clear()
+{
+        // Release the references outside the lane locks
+        std::deque< Entry > entries;
+        {
+                LockedLane::WriteRef lock(highlane);
+                std::swap(entries, lock->entries);
+                numqueued_high = 0;
+        }
+        entries.clear();
+        for (auto &lane: workerlanes)
+        {
+                {
+                        LockedLane::WriteRef lock(*lane);
+                        std::swap(entries, lock->entries);
+                        numqueued_low -= entries.size();
+                }
+                entries.clear();
+        }
+}
+
+bool JobScheduler::TakeFirst(LockedLane &lane, std::atomic< unsigned > &counter, Entry *entry)
+{
+        LockedLane::WriteRef lock(lane);
+        if (lock->entries.empty())
+            return false;
+
+        Entry &first = lock->entries.front();
+        entry->group.swap(first.group);
+        entry->seq = first.seq;
+        entry->highpriority = first.highpriority;
+        entry->queuedticks = first.queuedticks;
+        lock->entries.pop_front();
+        --counter;
+        return true;
+}
+
+bool JobScheduler::Pop(unsigned worker, bool allow_lowpriority, Entry *entry)
+{
+        if (numqueued_high.load() != 0 && TakeFirst(highlane, numqueued_high, entry))
+            return true;
+
+        if (!allow_lowpriority || numqueued_low.load() == 0)
+            return false;
+
+        // Try our own deque first, then steal from the others
+        unsigned numlanes = workerlanes.size();
+        for (unsigned i = 0; i < numlanes; ++i)
+            if (TakeFirst(*workerlanes[(worker + i) % numlanes], numqueued_low, entry))
+                return true;
+
+        return false;
+}
+
 // -----------------------------------------------------------------------------
 //
 // JobManager
@@ -114,6 +241,10 @@ void JobManagerContextData::InitColumnMappings(VirtualMachine *vm)
 
 JobManager::JobManager(Environment &_env)
 : env(_env)
+, must_check_yields(false)
+, abort_workers(false)
+, any_waiting_worker(false)
+, max_running_lowp(0)
 , debugger(new Debugger(env, *this))
 {
 }
@@ -149,6 +280,16 @@ void JobManager::Shutdown()
         debugger->Shutdown();
         PM_PRINT("Shutting down job manager");
         AbortWorkerThreads();
+        scheduler.Clear();
+        {
+                // The registered pipewaiters reference objects owned by the waiting groups
+                LockedJobData::WriteRef lock(jobdata);
+                while (!lock->waiting.empty())
+                    UnregisterWaits(lock, lock->waiting.begin()->second);
+                lock->newwaits.clear();
+                lock->wait_timeouts.clear();
+                lock->running_timeouts.clear();
+        }
         ClearAllJobs();
 }
 
@@ -159,7 +300,7 @@ unsigned JobManager::GetNumRunningJobs()
 
 bool JobManager::IsRunning()
 {
-        return !LockedJobData::ReadRef(jobdata)->abort;
+        return !abort_workers;
 }
 
 void JobManager::ClearAllJobs()
@@ -177,6 +318,8 @@ void JobManager::ClearAllJobs()
 
 void JobManager::Start(unsigned numworkers, unsigned reserved_highpriority)
 {
+        scheduler.SetNumWorkers(numworkers);
+
         // Create the workers
         for (unsigned i = 0; i < numworkers; ++i)
         {
@@ -186,8 +329,7 @@ void JobManager::Start(unsigned numworkers, unsigned reserved_highpriority)
                 workers.push_back(worker);
         }
 
-        LockedJobData::WriteRef lock(jobdata);
-        lock->max_running_lowp = numworkers - reserved_highpriority;
+        max_running_lowp = numworkers - reserved_highpriority;
 }
 
 void JobManager::AbortWorkerThreads()
@@ -197,13 +339,15 @@ void JobManager::AbortWorkerThreads()
                 LockedJobData::WriteRef lock(jobdata);
 
                 // This will abort all workers that are not running a job
-                lock->abort = true;
+                abort_workers = true;
 
-                // This will abort all running jobs
+                // This will abort all running jobs, and the runnable ones a worker may still claim
                 for (std::vector< VMGroupRef >::iterator it = lock->jobs.begin(); it != lock->jobs.end(); ++it)
                 {
                         switch (it->group->jmdata.state)
                         {
+                        case RunningState::InitialRunnable:
+                        case RunningState::Runnable:
                         case RunningState::Running:
                         case RunningState::Suspending:
                             {
@@ -275,44 +419,46 @@ bool JobManager::DoRun(VMGroup *group)
         return retval;
 }
 
-std::pair< bool, bool > JobManager::GatherWaitFors(LockedJobData::WriteRef &lock, Blex::PipeWaiter *waiter, Blex::DateTime *timeout, std::vector< VMGroupRef > *vmgroups)
+namespace
+{
+/// Minimum interval between scans of the waiting groups for yield requests that weren't signalled
+Blex::DateTime const yield_check_interval = Blex::DateTime::Msecs(250);
+
+/// Raises an atomic maximum to at least a value
+template < class T > void RaiseMaximum(std::atomic< T > &maximum, T value)
+{
+        T current = maximum;
+        while (current < value && !maximum.compare_exchange_weak(current, value))
+            continue;
+}
+} // End of anonymous namespace
+
+bool JobManager::RegisterWaits(LockedJobData::WriteRef &lock)
 {
-        *timeout = Blex::DateTime::Max();
         bool any_signalled = false;
-        bool any_waiting = false;
-        for (std::vector< VMGroupRef >::iterator it = lock->jobs.begin(); it != lock->jobs.end(); ++it)
-        {
-                // Record the running timeout for all scripts
-                if (*timeout > it->group->jmdata.running_timeout)
-                    *timeout = it->group->jmdata.running_timeout;
 
-                if (it->group->jmdata.state != RunningState::WaitForMultiple)
+        std::vector< VMGroup * > newwaits;
+        std::swap(newwaits, lock->newwaits);
+        for (std::vector< VMGroup * >::iterator it = newwaits.begin(); it != newwaits.end(); ++it)
+        {
+                VMGroup *group = *it;
+                if (group->jmdata.state != RunningState::WaitForMultiple)
                     continue;
 
-                JobManagerGroupData &data = it->group->jmdata;
-                if (it->group->TestMustYield())
+                JobManagerGroupData &data = group->jmdata;
+                if (group->TestMustYield())
                 {
-                        PM_PRINT("Group " << it->group << " must yield in GatherWaitFors: " << *it->group->GetAbortFlag());
-
-                        it->group->jmdata.reqstate = RunningState::Runnable;
-                        if (it->group->dbg_async.inform_next_suspend || it->group->dbg_async.reset_breakpoints)
-                            debugger->OnScriptWaitEnded(lock, *it->group, true);
-
-                        PM_PRINT("Abort flag now: " << *it->group->GetAbortFlag());
-
-                        SetVMGroupState(lock, it->group, it->group->jmdata.reqstate);
+                        YieldWaitingGroup(lock, group);
                         any_signalled = true;
                         continue;
                 }
 
-                vmgroups->push_back(*it);
-
                 bool this_signalled = false;
                 for (std::vector< OutputObjectWait >::iterator it2 = data.waits.begin(); it2 != data.waits.end(); ++it2)
                 {
-                        if (it2->write ? it2->object->AddToWaiterWrite(*waiter) : it2->object->AddToWaiterRead(*waiter))
+                        if (it2->write ? it2->object->AddToWaiterWrite(data.waiter) : it2->object->AddToWaiterRead(data.waiter))
                         {
-                                PM_PRINT("Marking VM group " << it->group << " runnable due to signalled (at adding) handle " << it2->handle);
+                                PM_PRINT("Marking VM group " << group << " runnable due to signalled (at adding) handle " << it2->handle);
 
                                 HSVM_VariableId var_array = HSVM_RecordCreate(*data.waitingvm, data.id_set, it2->write ? data.waitingvm->cn_cache.col_write : data.waitingvm->cn_cache.col_read);
                                 HSVM_IntegerSet(*data.waitingvm, HSVM_ArrayAppend(*data.waitingvm, var_array), it2->handle);
@@ -320,187 +466,306 @@ std::pair< bool, bool > JobManager::GatherWaitFors(LockedJobData::WriteRef &lock
                         }
                 }
 
-                if (data.wait_timeout < *timeout)
-                    *timeout = data.wait_timeout;
-
                 if (this_signalled)
                 {
-                        it->group->jmdata.reqstate = RunningState::Runnable;
-                        if (it->group->dbg_async.inform_next_suspend || it->group->dbg_async.reset_breakpoints)
-                            debugger->OnScriptWaitEnded(lock, *it->group, false);
+                        data.waiter.Reset();
 
-                        SetVMGroupState(lock, it->group, it->group->jmdata.reqstate);
+                        data.reqstate = RunningState::Runnable;
+                        if (group->dbg_async.inform_next_suspend || group->dbg_async.reset_breakpoints)
+                            debugger->OnScriptWaitEnded(lock, *group, false);
+
+                        SetVMGroupState(lock, group, data.reqstate);
                         any_signalled = true;
+                        continue;
                 }
-                else if (!data.waits.empty() || data.wait_timeout != Blex::DateTime::Max())
-                    any_waiting = true;
+
+                PM_PRINT("Registering waits of VM group " << group);
+                data.wait_registered = true;
+                lock->waiting.insert(std::make_pair(&data.waiter, group));
+                if (data.wait_timeout != Blex::DateTime::Max())
+                    lock->wait_timeouts.insert(std::make_pair(data.wait_timeout, group));
+                waitreactor.AddWaiter(data.waiter);
         }
-        return std::make_pair(any_signalled, any_waiting);
+        return any_signalled;
 }
 
-bool JobManager::CheckWaitFors(LockedJobData::WriteRef &lock, Blex::PipeWaiter *waiter, bool got_timeout)
+void JobManager::UnregisterWaits(LockedJobData::WriteRef &lock, VMGroup *group)
 {
-        bool any_signalled = false;
-        Blex::DateTime now = got_timeout ? lock->roughnow : Blex::DateTime::Min();
-        for (std::vector< VMGroupRef >::iterator it = lock->jobs.begin(); it != lock->jobs.end(); ++it)
+        JobManagerGroupData &data = group->jmdata;
+        if (!data.wait_registered)
         {
-                // Abort all scripts that have a running timeout
-                if (got_timeout && it->group->jmdata.running_timeout < now)
-                    AbortVMGroup(it->get(), HSVM_ABORT_TIMEOUT);
+                // Waits not registered yet, just forget about them
+                lock->newwaits.erase(std::remove(lock->newwaits.begin(), lock->newwaits.end(), group), lock->newwaits.end());
+                return;
+        }
 
-                if (it->group->jmdata.state != RunningState::WaitForMultiple)
-                    continue;
+        PM_PRINT("Unregistering waits of VM group " << group);
+        waitreactor.RemoveWaiter(data.waiter);
+        lock->waiting.erase(&data.waiter);
+        lock->wait_timeouts.erase(std::make_pair(data.wait_timeout, group));
+        data.wait_registered = false;
 
-                JobManagerGroupData &data = it->group->jmdata;
-                if (got_timeout)
+        // Reset the waiter, we don't want it to have any lingering references outside the wait
+        data.waiter.Reset();
+}
+
+void JobManager::CheckSignalledWaits(LockedJobData::WriteRef &lock, VMGroup *group)
+{
+        JobManagerGroupData &data = group->jmdata;
+
+        bool this_signalled = false;
+        for (std::vector< OutputObjectWait >::iterator it2 = data.waits.begin(); it2 != data.waits.end(); ++it2)
+        {
+                if (it2->write ? it2->object->IsWriteSignalled(&data.waiter) == OutputObject::Signalled : it2->object->IsReadSignalled(&data.waiter) == OutputObject::Signalled)
                 {
-                        if (data.wait_timeout <= now)
-                        {
-                                PM_PRINT("Marking VM group " << it->group << " runnable due to timeout " << data.wait_timeout);
-                                SetVMGroupState(lock, it->group, RunningState::Runnable);
-                                any_signalled = true;
+                        PM_PRINT("Marking VM group " << group << " runnable due to signalled handle " << it2->handle);
 
-                                HSVM_BooleanSet(*data.waitingvm, HSVM_RecordCreate(*data.waitingvm, data.id_set, data.waitingvm->cn_cache.col_timeout), true);
-                        }
+                        HSVM_VariableId var_array = HSVM_RecordCreate(*data.waitingvm, data.id_set, it2->write ? data.waitingvm->cn_cache.col_write : data.waitingvm->cn_cache.col_read);
+                        HSVM_IntegerSet(*data.waitingvm, HSVM_ArrayAppend(*data.waitingvm, var_array), it2->handle);
+
+                        this_signalled = true;
                 }
-                else
-                {
-                        bool this_signalled = false;
-                        for (std::vector< OutputObjectWait >::iterator it2 = data.waits.begin(); it2 != data.waits.end(); ++it2)
-                        {
-                                if (it2->write ? it2->object->IsWriteSignalled(waiter) == OutputObject::Signalled : it2->object->IsReadSignalled(waiter) == OutputObject::Signalled)
-                                {
-                                        PM_PRINT("Marking VM group " << it->group << " runnable due to signalled handle " << it2->handle);
+        }
+        if (this_signalled)
+            SetVMGroupState(lock, group, RunningState::Runnable);
+}
 
-                                        HSVM_VariableId var_array = HSVM_RecordCreate(*data.waitingvm, data.id_set, it2->write ? data.waitingvm->cn_cache.col_write : data.waitingvm->cn_cache.col_read);
-                                        HSVM_IntegerSet(*data.waitingvm, HSVM_ArrayAppend(*data.waitingvm, var_array), it2->handle);
+bool JobManager::CheckYields(LockedJobData::WriteRef &lock)
+{
+        lock->next_yield_check = lock->roughnow + yield_check_interval;
 
-                                        this_signalled = true;
-                                }
-                        }
-                        if (this_signalled)
+        std::vector< VMGroup * > yielding;
+        for (std::unordered_map< Blex::PipeWaiter *, VMGroup * >::iterator it = lock->waiting.begin(); it != lock->waiting.end(); ++it)
+            if (it->second->TestMustYield())
+                yielding.push_back(it->second);
+
+        for (std::vector< VMGroup * >::iterator it = yielding.begin(); it != yielding.end(); ++it)
+            YieldWaitingGroup(lock, *it);
+
+        return !yielding.empty();
+}
+
+void JobManager::YieldWaitingGroup(LockedJobData::WriteRef &lock, VMGroup *group)
+{
+        PM_PRINT("Group " << group << " must yield while waiting: " << *group->GetAbortFlag());
+
+        group->jmdata.reqstate = RunningState::Runnable;
+        if (group->dbg_async.inform_next_suspend || group->dbg_async.reset_breakpoints)
+            debugger->OnScriptWaitEnded(lock, *group, true);
+
+        PM_PRINT("Abort flag now: " << *group->GetAbortFlag());
+
+        SetVMGroupState(lock, group, group->jmdata.reqstate);
+}
+
+void JobManager::HandleExpiredTimeouts(LockedJobData::WriteRef &lock)
+{
+        Blex::DateTime now = lock->roughnow;
+
+        // Abort all scripts that have exceeded their running timeout
+        while (!lock->running_timeouts.empty() && lock->running_timeouts.begin()->first < now)
+        {
+                VMGroup *group = lock->running_timeouts.begin()->second;
+                lock->running_timeouts.erase(lock->running_timeouts.begin());
+                AbortVMGroup(group, HSVM_ABORT_TIMEOUT);
+        }
+
+        while (!lock->wait_timeouts.empty() && lock->wait_timeouts.begin()->first <= now)
+        {
+                VMGroup *group = lock->wait_timeouts.begin()->second;
+                JobManagerGroupData &data = group->jmdata;
+
+                PM_PRINT("Marking VM group " << group << " runnable due to timeout " << data.wait_timeout);
+
+                // Set the result before making the group runnable, a worker may claim it right away
+                HSVM_BooleanSet(*data.waitingvm, HSVM_RecordCreate(*data.waitingvm, data.id_set, data.waitingvm->cn_cache.col_timeout), true);
+                SetVMGroupState(lock, group, RunningState::Runnable);
+        }
+}
+
+bool JobManager::PipeWait(LockedJobData::WriteRef &lock, bool only_poll)
+{
+        any_waiting_worker = true;
+
+        bool any_signalled = RegisterWaits(lock);
+
+        // Yield requests are signalled by AbortVMGroup and the debugger. Others just set the abort flag, check for those periodically
+        if (must_check_yields.exchange(false) || lock->roughnow >= lock->next_yield_check)
+            any_signalled = CheckYields(lock) || any_signalled;
+
+        if (!any_signalled)
+        {
+                // No one is signalled: go into wait if anyone is waiting, or none are runnable
+                if (!lock->waiting.empty() || !only_poll)
+                {
+                        Blex::DateTime timeout = Blex::DateTime::Max();
+                        if (!lock->wait_timeouts.empty())
+                            timeout = lock->wait_timeouts.begin()->first;
+                        if (!lock->running_timeouts.empty() && lock->running_timeouts.begin()->first < timeout)
+                            timeout = lock->running_timeouts.begin()->first;
+
+                        // If any is runnable, don't wait, just test for signals
+                        if (only_poll)
+                            timeout = Blex::DateTime::Min();
+
+                        std::vector< Blex::PipeWaiter * > signalled;
+                        waitreactor.ConditionMutexWait(lock, timeout, &signalled);
+                        PM_PRINT("Worker thread " << this << " out of pipewait, signalled waiters: " << signalled.size());
+                        lock->roughnow = Blex::DateTime::Now();
+
+                        // Only the groups whose waiter has been signalled need to be checked
+                        for (std::vector< Blex::PipeWaiter * >::iterator it = signalled.begin(); it != signalled.end(); ++it)
                         {
-                                SetVMGroupState(lock, it->group, RunningState::Runnable);
-                                any_signalled = true;
+                                std::unordered_map< Blex::PipeWaiter *, VMGroup * >::iterator wit = lock->waiting.find(*it);
+                                if (wit != lock->waiting.end())
+                                    CheckSignalledWaits(lock, wit->second);
                         }
+
+                        HandleExpiredTimeouts(lock);
                 }
         }
-        return any_signalled;
+        else
+        {
+                PM_PRINT("Worker thread " << this << " not pipewaiting, already signalled");
+        }
+
+        any_waiting_worker = false;
+        return !lock->waiting.empty();
 }
 
-void JobManager::WorkerThreadFunction(unsigned PM_ONLY(id))
+VMGroup * JobManager::ClaimRunnableGroup(JobScheduler::Entry &entry)
+{
+        VMGroup *group = entry.group.get();
+        SchedulingCounters &counters = entry.highpriority ? highpriority_scheduling : lowpriority_scheduling;
+        bool no_worker_available;
+        {
+                Blex::Mutex::AutoLock claimlock(group->jmdata.claimmutex);
+
+                // Has the group stopped being runnable (or been queued again) since the entry was queued?
+                if (entry.seq != group->jmdata.schedseq || (group->jmdata.state != RunningState::Runnable && group->jmdata.state != RunningState::InitialRunnable))
+                {
+                        PM_PRINT("Dropping outdated run queue entry for group " << group);
+                        return 0;
+                }
+
+                // Count the group as running. Keep the workers reserved for high-priority groups available
+                unsigned running = counters.running;
+                do
+                    no_worker_available = !entry.highpriority && running >= max_running_lowp;
+                while (!no_worker_available && !counters.running.compare_exchange_weak(running, running + 1));
+
+                if (!no_worker_available)
+                {
+                        RaiseMaximum(counters.maxrunning, running + 1);
+
+                        // Outdate the other run queue entries of the group, and switch it to running
+                        ++group->jmdata.schedseq;
+                        group->jmdata.reqstate = RunningState::Running;
+                        group->jmdata.current_run_start = Blex::DateTime::Now();
+                        group->jmdata.running_highpriority = entry.highpriority;
+                        group->jmdata.state = RunningState::Running;
+                }
+        }
+        if (no_worker_available)
+        {
+                scheduler.Requeue(entry, false);
+                return 0;
+        }
+        PM_PRINT("Claimed group " << group << " from the run queue");
+
+        uint64_t waited = (Blex::GetSystemCurrentTicks() - entry.queuedticks) / std::max< uint64_t >(Blex::GetSystemTickFrequency() / 1000000, 1);
+        ++counters.scheduled;
+        counters.totalwait += waited;
+        RaiseMaximum(counters.maxwait, waited);
+        return group;
+}
+
+bool JobManager::HoldRunnableGroup(LockedJobData::WriteRef &, VMGroup *group)
+{
+        Blex::Mutex::AutoLock claimlock(group->jmdata.claimmutex);
+        if (group->jmdata.state != RunningState::Runnable && group->jmdata.state != RunningState::InitialRunnable)
+            return false;
+
+        // Outdate the run queue entries of the group, the worker that takes one will drop it
+        ++group->jmdata.schedseq;
+        return true;
+}
+
+void JobManager::ReleaseRunnableGroup(LockedJobData::WriteRef &, VMGroup *group)
+{
+        Blex::Mutex::AutoLock claimlock(group->jmdata.claimmutex);
+        scheduler.Push(group, ++group->jmdata.schedseq, group->jmdata.highpriority);
+}
+
+void JobManager::WorkerThreadFunction(unsigned id)
 {
         PM_PRINT("Started worker thread " << this << ":" << id);
-        std::vector< VMGroupRef > wait_groups;
-        Blex::PipeWaiter waiter;
+        scheduler.RegisterWorkerThread(id);
+
+        bool allow_lowpriority = true; // Allow taking lowpriority jobs from the run queue, checked again when claiming them
+        bool pipewaited = false;
         while (true)
         {
-                VMGroup *group;
+                VMGroup *group = 0;
                 bool other_must_pipewait;
-                bool more_runnable = false;
-                bool allow_lowpriority = false; // Allow running lowpriority jobs
+                bool more_runnable;
+
+                // Take a runnable group from the run queue, without holding the job lock. The entry
+                // must be destroyed outside the job lock, it may hold the last reference to its group
+                JobScheduler::Entry entry;
+                bool have_entry = scheduler.Pop(id, allow_lowpriority, &entry);
+                if (have_entry && any_waiting_worker && !abort_workers)
+                {
+                        // Another worker is pipewaiting, so the group can be claimed without taking the job lock
+                        group = ClaimRunnableGroup(entry);
+                        allow_lowpriority = lowpriority_scheduling.running < max_running_lowp;
+                        if (!group)
+                            continue;
+
+                        pipewaited = false;
+                        more_runnable = scheduler.HasWork(allow_lowpriority);
+                        other_must_pipewait = false;
+                }
+                else
                 {
                         LockedJobData::WriteRef lock(jobdata);
+                        if (abort_workers)
+                            break;
 
                         // Is any group in wait mode?
-                        bool any_waiting;
+                        bool any_waiting = true; // Just assume a group is waiting
+
+                        // Is noone pipe-waiting? If se, we must do it now. If we just did, run the group we found first.
+                        bool my_pipewait = !any_waiting_worker && !(have_entry && pipewaited);
+                        if (my_pipewait)
+                        {
+                                PM_PRINT("Worker thread " << this << ":" << id << " going pipewait");
+                                any_waiting = PipeWait(lock, have_entry || scheduler.HasWork(allow_lowpriority));
+                        }
+                        pipewaited = my_pipewait;
 
-                        allow_lowpriority = lock->running_lowp < lock->max_running_lowp;
+                        if (have_entry && !abort_workers)
+                            group = ClaimRunnableGroup(entry);
 
-                        // Wait until a thread becomes runnable
-                        bool abort = false;
-                        while (true)
+                        allow_lowpriority = lowpriority_scheduling.running < max_running_lowp;
+                        if (!group)
                         {
-                                any_waiting = true; // Just assume a group is waiting
-                                if (lock->abort)
+                                // Wait for work if nothing is queued (PipeWait has already waited for signals)
+                                if (!my_pipewait && !abort_workers && !scheduler.HasWork(allow_lowpriority))
                                 {
-                                        abort = lock->abort;
-                                        break;
-                                }
-                                // Is noone pipe-waiting? If se, we must do it now.
-                                bool my_pipewait = !lock->any_waiting_worker;
-                                if (my_pipewait)
-                                {
-                                        PM_PRINT("Worker thread " << this << ":" << id << " going pipewait");
-                                        wfm_event.SetSignalled(false);
-                                        lock->any_waiting_worker = true;
-
-                                        // Gather the objects we need to wait for in out pipewaiter
-                                        Blex::DateTime timeout;
-                                        std::pair< bool, bool > res = GatherWaitFors(lock, &waiter, &timeout, &wait_groups);
-                                        if (!res.first)
-                                        {
-                                                // No one is signalled: go into wait if anyone is waiting, or none are runnable
-                                                if (res.second || lock->runnable.empty())
-                                                {
-                                                        // If any is runnable, don't wait, just test for signals
-                                                        if (!lock->runnable.empty())
-                                                            timeout = Blex::DateTime::Min();
-
-                                                        waiter.AddEvent(wfm_event);
-                                                        bool signalled = waiter.ConditionMutexWait(lock, timeout);
-                                                        PM_PRINT("Worker thread " << this << ":" << id << " out of pipewait, signalled: " << (signalled?"yes":"no") << ", now runnables: " << (lock->runnable.empty()?"no":"yes"));
-                                                        lock->roughnow = Blex::DateTime::Now();
-
-                                                        // Job the output of the waiter
-                                                        CheckWaitFors(lock, &waiter, !signalled);
-
-                                                        // Recalc allow_lowpriority after wait
-                                                        allow_lowpriority = lock->running_lowp < lock->max_running_lowp;
-                                                }
-                                        }
-                                        else
-                                        {
-                                                PM_PRINT("Worker thread " << this << ":" << id << " not pipewaiting, already signalled");
-                                                any_waiting = res.second;
-                                        }
-                                        // Reset the waiter, we don't want it to have any lingering references outside the pipewaiter
-                                        // wait_groups keeps references to waiting vms
-                                        waiter.Reset();
-                                        wait_groups.clear();
-                                        lock->any_waiting_worker = false;
-                                        if (!lock->runnable.empty() || (allow_lowpriority && !lock->runnable_lowp.empty()))
-                                            break;
-                                }
-                                else
-                                {
-                                        if (!lock->runnable.empty() || (allow_lowpriority && !lock->runnable_lowp.empty()))
-                                            break;
-
                                         PM_PRINT("Worker thread " << this << ":" << id << " in normal wait");
                                         lock.Wait();
                                         PM_PRINT("Worker thread " << this << ":" << id << " got signal");
                                         lock->roughnow = Blex::DateTime::Now();
-
-                                        // Recalc allow_lowpriority after wait
-                                        allow_lowpriority = lock->running_lowp < lock->max_running_lowp;
-                                }
-                                PM_PRINT("Jobs state");
-                                for (std::vector< VMGroupRef >::iterator it = lock->jobs.begin(); it != lock->jobs.end(); ++it)
-                                {
-                                        PM_PRINT(" " << it->group->jmdata.groupid << " " << it->group << " " << it->group->jmdata.state);
                                 }
+                                continue;
                         }
-                        if (abort)
-                            break;
-
-                        // Invariant: !lock->runnable.empty() || (allow_lowpriority && !lock->runnable_lowp.empty())
-                        // Make the first job running
-                        if (!lock->runnable.empty())
-                            group = *lock->runnable.begin();
-                        else
-                            group = *lock->runnable_lowp.begin();
-
-                        group->jmdata.reqstate = RunningState::Running;
-                        group->jmdata.current_run_start = lock->roughnow;
-                        SetVMGroupState(lock, group, RunningState::Running);
 
                         // See if more jobs are currently runnable and eligable for running
-                        allow_lowpriority = lock->running_lowp < lock->max_running_lowp;
-                        more_runnable = !lock->runnable.empty() || (allow_lowpriority && !lock->runnable_lowp.empty());
+                        more_runnable = scheduler.HasWork(allow_lowpriority);
 
                         // Record wether another worker thread must go pipewaiting,
-                        other_must_pipewait = !lock->any_waiting_worker && any_waiting;
+                        other_must_pipewait = !any_waiting_worker && any_waiting;
                 }
                 if (other_must_pipewait || more_runnable)
                 {
@@ -640,6 +905,8 @@ void JobManager::StartVMGroup(VMGroup *group)
 
                 VMGroupRef groupref(group, true);
                 lock->jobs.push_back(groupref);
+                if (group->jmdata.running_timeout != Blex::DateTime::Max())
+                    lock->running_timeouts.insert(std::make_pair(group->jmdata.running_timeout, group));
 
                 group->jmdata.reqstate = RunningState::InitialRunnable;
                 debugger->OnScriptStarted(lock, groupref);
@@ -774,6 +1041,8 @@ void JobManager::AbortVMGroup(VMGroup *group, unsigned reason)
         if (flag)
             *flag = reason;
 
+        // Let the pipewaiter check the waiting groups for yield requests
+        must_check_yields = true;
         jobdata.SignalAll();
 }
 
@@ -802,45 +1071,39 @@ void JobManager::SetVMGroupState(LockedJobData::WriteRef &lock, VMGroup *group,
 
         PM_PRINT("Going to set state of group " << group << " (vm " << group->mainvm << ") from " << group->jmdata.state << " to " << newstate << " (req: " << group->jmdata.reqstate << ")");
 
-        if (group->jmdata.state == RunningState::Runnable || group->jmdata.state == RunningState::InitialRunnable)
-        {
-                // Remove the group from the runnable queue if needed
-                if (newstate != RunningState::Runnable && newstate != RunningState::InitialRunnable)
-                {
-                        std::vector< VMGroup * > *queue = group->jmdata.highpriority ? &lock->runnable : &lock->runnable_lowp;
+        // Groups only become running when a worker claims them. They are counted as running until the worker is done with them
+        bool was_running = group->jmdata.state == RunningState::Running || group->jmdata.state == RunningState::Suspending;
+        bool is_running = newstate == RunningState::Running || newstate == RunningState::Suspending;
+        if (was_running && !is_running)
+            --(group->jmdata.running_highpriority ? highpriority_scheduling : lowpriority_scheduling).running;
 
-                        PM_PRINT("Remove group " << group << " from runnable queue");
+        if (group->jmdata.state == RunningState::WaitForMultiple)
+            UnregisterWaits(lock, group);
 
-                        for (std::vector< VMGroup * >::iterator it = queue->begin(); it != queue->end(); ++it)
-                            if (*it == group)
-                            {
-                                    queue->erase(it);
-                                    break;
-                            }
-                }
-        }
-        else if (newstate == RunningState::Runnable || newstate == RunningState::InitialRunnable)
+        PM_PRINT("Set state of group " << group << " (vm " << group->mainvm << ") from " << group->jmdata.state << " to " << newstate << " (req: " << group->jmdata.reqstate << ")");
+
+        bool was_runnable = group->jmdata.state == RunningState::Runnable || group->jmdata.state == RunningState::InitialRunnable;
+        bool is_runnable = newstate == RunningState::Runnable || newstate == RunningState::InitialRunnable;
+        if (was_runnable != is_runnable)
         {
-                // Add the group to the end of the runnable queue (removes are from the front, thus LIFO ordering)
-                std::vector< VMGroup * > *queue = group->jmdata.highpriority ? &lock->runnable : &lock->runnable_lowp;
-                queue->push_back(group);
+                // Workers claim runnable groups holding only their claim mutex. A group that stops being
+                // runnable must have been held with HoldRunnableGroup, so no worker can have claimed it
+                Blex::Mutex::AutoLock claimlock(group->jmdata.claimmutex);
+                group->jmdata.state = newstate;
 
-                PM_PRINT("Add group " << group << " to runnable queue");
-        }
+                // Outdate the run queue entry of the group, the worker that takes it will drop it
+                ++group->jmdata.schedseq;
+                if (is_runnable)
+                    scheduler.Push(group, group->jmdata.schedseq, group->jmdata.highpriority);
 
-        if (!group->jmdata.highpriority)
-        {
-                if (newstate == RunningState::Running)
-                    ++lock->running_lowp;
-                else if (group->jmdata.state == RunningState::Running)
-                    --lock->running_lowp;
+                PM_PRINT((is_runnable ? "Add group " : "Remove group ") << group << (is_runnable ? " to" : " from") << " runnable queue");
         }
-
-        PM_PRINT("Set state of group " << group << " (vm " << group->mainvm << ") from " << group->jmdata.state << " to " << newstate << " (req: " << group->jmdata.reqstate << ")");
-        group->jmdata.state = newstate;
+        else
+            group->jmdata.state = newstate;
 
         if (newstate == RunningState::Terminated)
         {
+                lock->running_timeouts.erase(std::make_pair(group->jmdata.running_timeout, group));
                 for (std::vector< VMGroupRef >::iterator it = lock->jobs.begin(); it != lock->jobs.end(); ++it)
                     if (it->group == group)
                     {
@@ -851,8 +1114,10 @@ void JobManager::SetVMGroupState(LockedJobData::WriteRef &lock, VMGroup *group,
         }
         else if (newstate == RunningState::WaitForMultiple)
         {
-                // If reentering WFM state, a new wait loop must be entered (the current script is probably not waited on)
-                wfm_event.SetSignalled(true);
+                // Register the waits at the next pipewait. Wake up the current pipewaiter, it doesn't wait for this group yet
+                lock->newwaits.push_back(group);
+                if (any_waiting_worker)
+                    waitreactor.Wake();
         }
 }
 
@@ -865,10 +1130,17 @@ bool JobManager::TryLockVMGroup(VMGroup *group, UnlockCallback const &callback)
 bool JobManager::LockedTryLockVMGroup(LockedJobData::WriteRef &lock, VMGroup *group, UnlockCallback const &callback)
 {
         PM_PRINT("Trying to locking vmgroup " << group);
-        if (group->jmdata.state != RunningState::Running
+
+        // Workers claim runnable groups without the job lock, keep them from claiming this one
+        bool lockable;
+        if (group->jmdata.state == RunningState::Runnable || group->jmdata.state == RunningState::InitialRunnable)
+            lockable = HoldRunnableGroup(lock, group);
+        else
+            lockable = group->jmdata.state != RunningState::Running
                 && group->jmdata.state != RunningState::Suspending
-                && group->jmdata.state != RunningState::Locked
-                )
+                && group->jmdata.state != RunningState::Locked;
+
+        if (lockable)
         {
                 // Group is lockable!
                 group->jmdata.oldstate = group->jmdata.state;
@@ -938,18 +1210,27 @@ void JobManager::SetRunningStatus(VMGroup *group, bool isrunning)
 {
         LockedJobData::WriteRef lock(jobdata);
         group->jmdata.is_running_for_timeout = isrunning;
-        group->jmdata.running_timeout = group->jmdata.run_timeout_seconds != 0 && group->jmdata.is_running_for_timeout
-            ? Blex::DateTime::Now() + Blex::DateTime::Seconds(group->jmdata.run_timeout_seconds)
-            : Blex::DateTime::Max();
+        UpdateRunningTimeout(lock, group);
 }
 
 void JobManager::SetRunningTimeout(VMGroup *group, unsigned secs)
 {
         LockedJobData::WriteRef lock(jobdata);
         group->jmdata.run_timeout_seconds = secs;
+        UpdateRunningTimeout(lock, group);
+}
+
+void JobManager::UpdateRunningTimeout(LockedJobData::WriteRef &lock, VMGroup *group)
+{
+        lock->running_timeouts.erase(std::make_pair(group->jmdata.running_timeout, group));
         group->jmdata.running_timeout = group->jmdata.run_timeout_seconds != 0 && group->jmdata.is_running_for_timeout
             ? Blex::DateTime::Now() + Blex::DateTime::Seconds(group->jmdata.run_timeout_seconds)
             : Blex::DateTime::Max();
+
+        // Only started groups are checked for their running timeout
+        bool started = group->jmdata.state != RunningState::Startup && group->jmdata.state != RunningState::Terminated;
+        if (started && group->jmdata.running_timeout != Blex::DateTime::Max())
+            lock->running_timeouts.insert(std::make_pair(group->jmdata.running_timeout, group));
 }
 
 bool JobManager::SetCancellable(VMGroup *group, bool newcancellable)
@@ -1165,10 +1446,13 @@ void JobManager::GetGroupInfoUnlocked(VMGroup const &group, VMGroupInfo *info)
         info->creationdate = group.jmdata.creationdate;
         info->groupid = group.jmdata.groupid;
         info->mainscript = group.mainscript;
-        info->state = group.jmdata.state;
         info->highpriority = group.jmdata.highpriority;
         info->running_timeout = group.jmdata.running_timeout;
         info->total_running = group.jmdata.total_running;
+
+        // A worker may claim a runnable group without the job lock
+        Blex::Mutex::AutoLock claimlock(group.jmdata.claimmutex);
+        info->state = group.jmdata.state;
         info->current_run_start = group.jmdata.current_run_start;
         info->externalsessiondata = group.jmdata.externalsessiondata;
 }
@@ -1322,6 +1606,7 @@ std::string JobManager::GetGroupErrorContextInfo(VMGroup *group)
 
 void JobManager::HandleAsyncAbortBySignal()
 {
+        must_check_yields = true;
         jobdata.SignalAll();
 }
 
@@ -1331,6 +1616,19 @@ GlobalBlobManager & JobManager::GetBlobManager()
         return env.GetBlobManager();
 }
 
+void JobManager::GetSchedulingStats(SchedulingStats *highpriority, SchedulingStats *lowpriority)
+{
+        SchedulingCounters const *counters[2] = { &highpriority_scheduling, &lowpriority_scheduling };
+        SchedulingStats *stats[2] = { highpriority, lowpriority };
+        for (unsigned i = 0; i < 2; ++i)
+        {
+                stats[i]->scheduled = counters[i]->scheduled;
+                stats[i]->totalwait = counters[i]->totalwait;
+                stats[i]->maxwait = counters[i]->maxwait;
+                stats[i]->maxrunning = counters[i]->maxrunning;
+        }
+}
+
 void JobManager::SetJobErrorReporter(std::function< void(std::string const &groupid, std::string const &externalsessiondata, ErrorHandler const &errorhandler, std::string const &script, std::string const &contextinfo) > func)
 {
         LockedJobData::WriteRef lock(jobdata);
@@ -2683,6 +2981,21 @@ void GetJobManagerStatusInternal(JobManager *jobmgr, VarId id_set, VirtualMachin
         uint32_t keep_finish_history;
         jobmgr->GetStatus(&jobs, &finished, &keep_finish_history);
 
+        SchedulingStats scheduling[2];
+        jobmgr->GetSchedulingStats(&scheduling[0], &scheduling[1]);
+
+        HSVM_VariableId var_scheduling = HSVM_RecordCreate(*vm, id_set, HSVM_GetColumnId(*vm, "SCHEDULING"));
+        HSVM_SetDefault(*vm, var_scheduling, HSVM_VAR_Record);
+        for (unsigned i = 0; i < 2; ++i)
+        {
+                HSVM_VariableId var_class = HSVM_RecordCreate(*vm, var_scheduling, HSVM_GetColumnId(*vm, i == 0 ? "HIGHPRIORITY" : "LOWPRIORITY"));
+                HSVM_SetDefault(*vm, var_class, HSVM_VAR_Record);
+                HSVM_Integer64Set(*vm, HSVM_RecordCreate(*vm, var_class, HSVM_GetColumnId(*vm, "SCHEDULED")), scheduling[i].scheduled);
+                HSVM_Integer64Set(*vm, HSVM_RecordCreate(*vm, var_class, HSVM_GetColumnId(*vm, "TOTALWAIT")), scheduling[i].totalwait);
+                HSVM_Integer64Set(*vm, HSVM_RecordCreate(*vm, var_class, HSVM_GetColumnId(*vm, "MAXWAIT")), scheduling[i].maxwait);
+                HSVM_IntegerSet(*vm, HSVM_RecordCreate(*vm, var_class, HSVM_GetColumnId(*vm, "MAXRUNNING")), scheduling[i].maxrunning);
+        }
+
         for (std::vector< VMGroupRef >::iterator it = jobs.begin(), end = jobs.end(); it != end; ++it)
         {
                 HSVM_VariableId var_job = HSVM_ArrayAppend(*vm, var_jobs);
@@ -8,6 +8,10 @@
 #include <blex/pipestream.h>
 #include <blex/socket.h>
 #include <blex/threads.h>
+#include <atomic>
+#include <deque>
+#include <set>
+#include <unordered_map>
 #include "hsvm_constants.h"
 #include "hsvm_marshalling.h"
 #include "outputobject.h"
@@ -191,6 +195,132 @@ struct FinishedVMGroupInfo
         std::shared_ptr< MarshalPacket > authenticationrecord;
 };
 
+/// Scheduling latency statistics of a priority class
+struct SchedulingStats
+{
+        SchedulingStats() : scheduled(0), totalwait(0), maxwait(0), maxrunning(0) {}
+
+        /// Number of times a group was taken from the run queue to run
+        uint64_t scheduled;
+
+        /// Total time groups spent in the run queue before running (in microseconds)
+        uint64_t totalwait;
+
+        /// Longest time a group spent in the run queue before running (in microseconds)
+        uint64_t maxwait;
+
+        /// Highest number of groups that were running at the same time
+        unsigned maxrunning;
+};
+
+/** Run queue of the job manager. Runnable high-priority groups are queued in a
+    shared lane, the other runnable groups in a deque per worker thread. A
+    worker takes groups from the high-priority lane first, then from its own
+    deque, and steals from the deques of the other workers when its own is
+    empty. Every lane has its own lock, so finding work doesn't need the job
+    lock.
+
+    Groups aren't removed from the queue when they stop being runnable. Every
+    entry carries the scheduling sequence number the group had when it was
+    queued, entries with an outdated number are dropped by the worker that
+    takes them.
+*/
+class JobScheduler
+{
+    public:
+        struct Entry
+        {
+                Entry() : seq(0), highpriority(false), queuedticks(0) {}
+
+                /// Queued group, keeps the group alive while it is queued
+                VMGroupRef group;
+
+                /// Scheduling sequence number of the group when it was queued
+                unsigned seq;
+
+                /// Whether the entry is queued in the high-priority lane
+                bool highpriority;
+
+                /// Time the group was queued (in system ticks)
+                uint64_t queuedticks;
+        };
+
+        JobScheduler();
+        ~JobScheduler();
+
+        /** Set the number of worker threads. Must be called before the workers are started.
+            @param numworkers Number of worker threads
+        */
+        void SetNumWorkers(unsigned numworkers);
+
+        /** Register the calling thread as a worker thread of this scheduler
+            @param worker Id of the worker
+        */
+        void RegisterWorkerThread(unsigned worker);
+
+        /** Queue a runnable group. Groups queued by a worker thread go into the deque of that
+            worker, groups queued by other threads are spread over the deques round-robin.
+            @param group Group to queue
+            @param seq Scheduling sequence number of the group
+            @param highpriority Queue the group in the high-priority lane
+        */
+        void Push(VMGroup *group, unsigned seq, bool highpriority);
+
+        /** Put an entry that can't run yet back at the front of a lane
+            @param entry Entry to queue again
+            @param highpriority Queue the entry in the high-priority lane
+        */
+        void Requeue(Entry const &entry, bool highpriority);
+
+        /** Take the next entry to run
+            @param worker Id of the calling worker
+            @param allow_lowpriority Whether entries may be taken from the deques
+            @param entry Filled with the taken entry
+            @return Whether an entry was taken
+        */
+        bool Pop(unsigned worker, bool allow_lowpriority, Entry *entry);
+
+        /** Remove all entries. Must be called without holding the job lock, it may release
+            the last references to groups
+        */
+        void Clear();
+
+        /** Returns whether any entries are queued (some of them may be outdated)
+            @param allow_lowpriority Whether to count the entries in the deques
+        */
+        bool HasWork(bool allow_lowpriority) const
+        {
+                return numqueued_high.load() != 0 || (allow_lowpriority && numqueued_low.load() != 0);
+        }
+
+    private:
+        struct Lane
+        {
+                std::deque< Entry > entries;
+        };
+        typedef Blex::InterlockedData< Lane, Blex::Mutex > LockedLane;
+
+        /** Take the first entry of a lane
+            @return Whether an entry was taken
+        */
+        static bool TakeFirst(LockedLane &lane, std::atomic< unsigned > &counter, Entry *entry);
+
+        /// Lane for high-priority groups
+        LockedLane highlane;
+
+        /// Deques for the other groups, one per worker
+        std::vector< std::unique_ptr< LockedLane > > workerlanes;
+
+        /// Number of entries in the high-priority lane
+        std::atomic< unsigned > numqueued_high;
+
+        /// Number of entries in the worker deques
+        std::atomic< unsigned > numqueued_low;
+
+        /// Next deque to queue groups from non-worker threads in
+        std::atomic< unsigned > nextlane;
+};
+
 /** The job manager manages the HareScript VM groups, runs them and handles
     the inter-job communication
 */
@@ -387,6 +517,12 @@ class BLEXLIB_PUBLIC JobManager
         */
         std::string GetGroupErrorContextInfo(VMGroup *group);
 
+        /** Get the scheduling latency statistics
+            @param highpriority Filled with the statistics of the high-priority groups
+            @param lowpriority Filled with the statistics of the other groups
+        */
+        void GetSchedulingStats(SchedulingStats *highpriority, SchedulingStats *lowpriority);
+
         /** Set the error reporter for released jobs
         */
         void SetJobErrorReporter(std::function< void(std::string const &groupid, std::string const &externalsessiondata, ErrorHandler const &errorhandler, std::string const &script, std::string const &contextinfo) > func);
@@ -402,28 +538,27 @@ class BLEXLIB_PUBLIC JobManager
         struct JobData
         {
                 inline JobData()
-                : abort(false)
-                , any_waiting_worker(false)
-                , keep_finish_history(Blex::DateTime::Minutes(5))
-                , running_lowp(0)
-                , max_running_lowp(0)
+                : keep_finish_history(Blex::DateTime::Minutes(5))
                 {
                 }
 
-                /// Flag set when all threads need to abort
-                bool abort;
+                /// Groups that have entered WaitForMultiple, their waits are registered by the next pipewait
+                std::vector< VMGroup * > newwaits;
 
-                /// Is any worker executing a wait()?
-                bool any_waiting_worker;
+                /// Groups with waits registered in the wait reactor, by their pipewaiter
+                std::unordered_map< Blex::PipeWaiter *, VMGroup * > waiting;
 
-                /// List of currently running jobs
-                std::vector< VMGroupRef > jobs;
+                /// Wait timeouts of the registered groups
+                std::set< std::pair< Blex::DateTime, VMGroup * > > wait_timeouts;
 
-                /// List of all runnable jobs, in LIFO order.
-                std::vector< VMGroup * > runnable;
+                /// Running timeouts of the started groups
+                std::set< std::pair< Blex::DateTime, VMGroup * > > running_timeouts;
 
-                /// List of all low-priority runnable jobs, in LIFO order.
-                std::vector< VMGroup * > runnable_lowp;
+                /// Time of the next scan of the waiting groups for yield requests
+                Blex::DateTime next_yield_check;
+
+                /// List of currently running jobs
+                std::vector< VMGroupRef > jobs;
 
                 std::map< std::string, IPCNamedPort * > namedports;
 
@@ -433,11 +568,6 @@ class BLEXLIB_PUBLIC JobManager
                 /// List of finished groups
                 std::list< FinishedVMGroupInfo > finished;
 
-                // Nr of low priority jobs marked as running
-                uint32_t running_lowp;
-
-                uint32_t max_running_lowp;
-
                 /// Rough estimation of current time
                 Blex::DateTime roughnow;
 
@@ -481,7 +611,38 @@ class BLEXLIB_PUBLIC JobManager
 
         bool DoRun(VMGroup *group);
 
-        /** Sets the running state of a VM group. Also manages the @a runnable queue.
+        /** Registers the waits of the groups that entered WaitForMultiple, and waits until any
+            waiting group is signalled or times out. Signalled groups are made runnable.
+            @param lock Job data lock
+            @param only_poll Only check for signalled groups, don't wait
+            @return Whether any group may be waiting for a signal or timeout
+        */
+        bool PipeWait(LockedJobData::WriteRef &lock, bool only_poll);
+
+        /** Switches a group taken from the run queue to running, if it still is runnable. Doesn't need
+            the job lock, the switch is serialized with the other changes of the group's scheduling state
+            by its claim mutex.
+            @param entry Entry taken from the run queue
+            @return The group to run, NULL if the entry was outdated or no worker is available for its priority
+        */
+        VMGroup * ClaimRunnableGroup(JobScheduler::Entry &entry);
+
+        /** Keeps the workers from claiming a runnable group, so its state can be changed. A group that
+            stays runnable must be queued again with ReleaseRunnableGroup.
+            @param lock Job data lock
+            @param group Group to hold
+            @return Whether the group was held. If not, the group isn't runnable (anymore), a worker may
+                have just claimed it.
+        */
+        bool HoldRunnableGroup(LockedJobData::WriteRef &lock, VMGroup *group);
+
+        /** Queues a group held with HoldRunnableGroup again
+            @param lock Job data lock
+            @param group Group to release
+        */
+        void ReleaseRunnableGroup(LockedJobData::WriteRef &lock, VMGroup *group);
+
+        /** Sets the running state of a VM group. Also manages the run queue.
             @param lock Lock on the job data of the jobmanager (needs to be taken to manipulate group running state)
             @param group Group to change the running state of
             @param newstate New running state for the group
@@ -518,8 +679,50 @@ class BLEXLIB_PUBLIC JobManager
         /// List of used worker threads
         std::vector< std::shared_ptr< Blex::Thread > > workers;
 
-        /// Event to get the pipewaiter out of its waiting loop (when a new WaitForMultiple has arrived)
-        Blex::StatefulEvent wfm_event;
+        /// Run queue
+        JobScheduler scheduler;
+
+        /// Reactor the waits of the groups in WaitForMultiple are registered with
+        Blex::PipeReactor waitreactor;
+
+        /// Set when the waiting groups must be checked for yield requests (aborts, debugger requests)
+        std::atomic< bool > must_check_yields;
+
+        /// Flag set when all threads need to abort (set with the job lock held)
+        std::atomic< bool > abort_workers;
+
+        /// Is any worker executing a wait()? (changed with the job lock held)
+        std::atomic< bool > any_waiting_worker;
+
+        /// Scheduling counters of a priority class, updated by the workers without the job lock
+        struct SchedulingCounters
+        {
+                SchedulingCounters() : running(0), maxrunning(0), scheduled(0), totalwait(0), maxwait(0) {}
+
+                /// Nr of groups being run by a worker
+                std::atomic< unsigned > running;
+
+                /// Highest nr of groups run by a worker at the same time
+                std::atomic< unsigned > maxrunning;
+
+                /// Number of times a group was taken from the run queue to run
+                std::atomic< uint64_t > scheduled;
+
+                /// Total time groups spent in the run queue before running (in microseconds)
+                std::atomic< uint64_t > totalwait;
+
+                /// Longest time a group spent in the run queue before running (in microseconds)
+                std::atomic< uint64_t > maxwait;
+        };
+
+        /// Scheduling counters of the high-priority groups
+        SchedulingCounters highpriority_scheduling;
+
+        /// Scheduling counters of the other groups
+        SchedulingCounters lowpriority_scheduling;
+
+        /// Max nr of low-priority groups that may run at the same time, the other workers are reserved for high-priority groups
+        std::atomic< unsigned > max_running_lowp;
 
         /** Checks wether a job is on the road to a specific state
             This means either
@@ -532,26 +735,50 @@ class BLEXLIB_PUBLIC JobManager
         */
         static bool WillReachState(LockedJobData::WriteRef &lock, VMGroup *group, RunningState::Type state);
 
-        /** Gathers all the current waits in jobs in the WaitForMultiple running state, and adds them to a pipewaiter.
-            Sets running state of signalled jobs to Runnable.
+        /** Adds the waits of the groups that entered the WaitForMultiple running state to their pipewaiters,
+            and registers those with the wait reactor. Sets running state of signalled jobs to Runnable.
+            @param lock Job data lock, needed
+            @return Returns whether a job was found to be signalled or had to yield (its running state has
+                been changed to Runnable)
+        */
+        bool RegisterWaits(LockedJobData::WriteRef &lock);
+
+        /** Removes the waits of a group from the wait reactor, when it leaves the WaitForMultiple running state
+            @param lock Job data lock, needed
+            @param group Group to remove the waits of
+        */
+        void UnregisterWaits(LockedJobData::WriteRef &lock, VMGroup *group);
+
+        /** Checks the waits of a group whose pipewaiter has been signalled. Sets running state of the job to
+            Runnable if any of its waits is signalled.
+            @param lock Job data lock, needed
+            @param group Group whose pipewaiter has been signalled
+        */
+        void CheckSignalledWaits(LockedJobData::WriteRef &lock, VMGroup *group);
+
+        /** Checks all groups in the WaitForMultiple running state for yield requests (set by aborts and the
+            debugger), and sets the running state of those jobs to Runnable.
+            @param lock Job data lock, needed
+            @return Returns whether any job had to yield
+        */
+        bool CheckYields(LockedJobData::WriteRef &lock);
+
+        /** Makes a waiting job that must yield runnable
+            @param lock Job data lock, needed
+            @param group Group that must yield
+        */
+        void YieldWaitingGroup(LockedJobData::WriteRef &lock, VMGroup *group);
+
+        /** Handles expired wait timeouts (the jobs are made runnable) and running timeouts (the jobs are aborted)
             @param lock Job data lock, needed
-            @param waiter Pipewaiter the waits must be added to
-            @param timeout Will be filled with the min. timeout that has been set (the first that will expire)
-            @param vmgroups Will be filled with all waiting vm groups
-            @return First: if any job is already signalled (output object detected signalled when added to the pipewaiter,
-                        running state has been switched to Runnable)
-                    Second: Whether currently any job is waiting on any output object or with non-max timeout
         */
-        std::pair< bool, bool > GatherWaitFors(LockedJobData::WriteRef &lock, Blex::PipeWaiter *waiter, Blex::DateTime *timeout, std::vector< VMGroupRef > *vmgroups);
+        void HandleExpiredTimeouts(LockedJobData::WriteRef &lock);
 
-        /** Checks all current waits in jobs if that are signalled after a pipe waiter has returned. Sets running state of
-            signalled jobs to Runnable.
+        /** Recalculates the running timeout of a group, after its timeout settings have changed
             @param lock Job data lock, needed
-            @param waiter Pipewaiter whose wait has finished
-            @param got_timeout Whether the pipewaiter returned timeout (if false, an object was signalled)
-            @return Returns whether a job was found to be signalled (its running state has been changed to Runnable)
+            @param group Group to update the running timeout of
         */
-        bool CheckWaitFors(LockedJobData::WriteRef &lock, Blex::PipeWaiter *waiter, bool got_timeout);
+        void UpdateRunningTimeout(LockedJobData::WriteRef &lock, VMGroup *group);
 
     public:
 
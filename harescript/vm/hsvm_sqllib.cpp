@@ -1073,7 +1073,8 @@ void Reordering2::Run(VarId inputdata)
 
                 for (unsigned order=0; order<numorders; ++order)
                 {
-                        VarId cell = varmem.RecordCellRefByName(var, orderings[order].column);
+                        // The cells are only compared, so we can use get and don't need to clone shared records
+                        VarId cell = varmem.RecordCellGetByName(var, orderings[order].column);
                         if (!cell)
                             throw VMRuntimeError(Error::UnknownColumn, varmem.columnnamemapper.GetReverseMapping(orderings[order].column).stl_str());
                         varids.push_back(cell);
@@ -52,15 +52,37 @@ struct HareScript::VarMemory::VMProf
 
 const unsigned VarMemory::VarRecord::NonExistent;
 const unsigned VarMemory::VarRecord::CountMask;
+const VarMemory::RecordShapeId VarMemory::EmptyRecordShape;
+const VarMemory::RecordShapeId VarMemory::UnsharedRecordShape;
+const unsigned VarMemory::MaxRecordShapeCells;
+const unsigned VarMemory::MaxRecordShapeNames;
+const unsigned VarMemory::OldGeneration;
+const unsigned VarMemory::GCNurseryLimit;
 
 static const VarMemory::HeapId EndOfFreeList = VarMemory::HeapId(-1);
 
+/// Minimum number of objects to create before an incremental object collection is started
+static const unsigned GCMinimumThreshold = 50000;
+
 void VarMemory::GetVMStats(VMStats *stats)
 {
         stats->stacklength = (stackstore.capacity() * sizeof(VarStore) + 1023)/1024;
         stats->heaplength = (heapstore.capacity() * sizeof(VarStore) + 1023)/1024;
         stats->backingstorelength = (backings.GetCapacity() + 1023)/1024;
         stats->objectcount = objectcount;
+        stats->cellcache_hits = cellcache_hits;
+        stats->cellcache_misses = cellcache_misses;
+        stats->recordshapes = recordshapes.size();
+        stats->recordclones = recordclones;
+        stats->recordclonedcells = recordclonedcells;
+        stats->gc_cycles = gccycles;
+        stats->gc_minorcycles = gcminorcycles;
+        stats->gc_minortime = gcminortime;
+        stats->gc_majortime = gcmajortime;
+        stats->gc_pauses = gcpauses;
+        stats->gc_time = gctime;
+        stats->gc_maxpause = gcmaxpause;
+        std::copy(gcpausehistogram, gcpausehistogram + GCPauseHistogramBuckets, stats->gc_pausehistogram);
 }
 
 inline void VarMemory::Dereference_Externals(VarStore &store)
@@ -113,6 +135,28 @@ VarMemory::VarMemory(ColumnNames::LocalMapper &_columnnamemapper)
         memset(prof,0,sizeof(*prof));
 #endif
         objectcount = 0;
+        cellcache_hits = 0;
+        cellcache_misses = 0;
+        recordclones = 0;
+        recordclonedcells = 0;
+        gcphase = GCIdle;
+        gccycle = 1;
+        gcsweeppos = 0;
+        gcsweepend = 0;
+        gcpromotions = 0;
+        gcthreshold = GCMinimumThreshold;
+        gccycles = 0;
+        gcminorcycles = 0;
+        gcminortime = 0;
+        gcmajortime = 0;
+        gcpauses = 0;
+        gctime = 0;
+        gcmaxpause = 0;
+        std::fill(gcpausehistogram, gcpausehistogram + GCPauseHistogramBuckets, 0);
+
+        // Shape 0 is the shape of the empty record
+        recordshapes.emplace_back();
+        recordshapenames = 0;
 }
 
 VarMemory::~VarMemory()
@@ -153,6 +197,12 @@ void VarMemory::Reset()
         stacksize = 0;
         stackstore.clear();
         heapstore.clear();
+
+        gcphase = GCIdle;
+        gcqueue.clear();
+        gcscanlist.clear();
+        gcdirtycells.clear();
+        nursery.clear();
 }
 
 //Copies the variable is_src to id_dest, regardless of the id_dest type.
@@ -627,20 +677,106 @@ void VarMemory::Clear(VarId id)
 //
 //---------------------------------------------------------------------------
 
-void VarMemory::InternalSetRecord (VarId id, unsigned length, VariableTypes::Type type)
+template < class Cell >
+  unsigned VarMemory::LookupCellPos(Cell const *cells, unsigned numcells, ColumnNameId nameid, uintptr_t key, CellLookupCache *cache)
+{
+        if (cache)
+        {
+                for (unsigned i = 0; i < CellLookupCache::Ways; ++i)
+                {
+                        CellLookupCache::Way const &way = cache->ways[i];
+                        if (way.key == key && way.pos < numcells && GetCellNameId(cells[way.pos]) == nameid)
+                        {
+                                ++cellcache_hits;
+                                return way.pos;
+                        }
+                }
+                ++cellcache_misses;
+        }
+
+        for (unsigned pos = 0; pos != numcells; ++pos)
+            if (GetCellNameId(cells[pos]) == nameid)
+            {
+                    if (cache)
+                    {
+                            CellLookupCache::Way &way = cache->ways[cache->nextway];
+                            cache->nextway = (cache->nextway + 1) % CellLookupCache::Ways;
+                            way.key = key;
+                            way.pos = pos;
+                    }
+                    return pos;
+            }
+        return numcells;
+}
+
+unsigned VarMemory::RecordFindCell(RecordBacking const *backing, unsigned numcells, ColumnNameId nameid, CellLookupCache *cache)
 {
-        VarRecord *var = &RecycleVariable(id,type,length*sizeof(RecordColumn))->data.record;
+        // Unshared shapes don't identify a layout, don't cache lookups in them
+        if (backing->shape == UnsharedRecordShape)
+            cache = 0;
+
+        return LookupCellPos(RecordColumnNames(backing, numcells), numcells, nameid, backing->shape, cache);
+}
+
+VarMemory::RecordShapeId VarMemory::GetRecordShapeTransition(RecordShapeId shape, ColumnNameId nameid, bool remove)
+{
+        if (shape == UnsharedRecordShape)
+            return UnsharedRecordShape;
+
+        uint64_t key = (uint64_t(shape) << 33) | (uint64_t(remove) << 32) | nameid;
+        std::unordered_map< uint64_t, RecordShapeId >::const_iterator it = recordshapetransitions.find(key);
+        if (it != recordshapetransitions.end())
+            return it->second;
+
+        RecordShapeId newshape;
+        if (remove)
+        {
+                /* Walk the append transitions from the empty shape for the remaining
+                   columns, so every column list keeps mapping to a single shape. Copy
+                   the names, the walk may add new shapes */
+                std::vector< ColumnNameId > names = recordshapes[shape].names;
+
+                newshape = EmptyRecordShape;
+                for (std::vector< ColumnNameId >::const_iterator nit = names.begin(); nit != names.end(); ++nit)
+                    if (*nit != nameid)
+                        newshape = GetRecordShapeTransition(newshape, *nit, false);
+        }
+        else
+        {
+                unsigned numcells = recordshapes[shape].names.size() + 1;
+                if (numcells > MaxRecordShapeCells || recordshapenames + numcells > MaxRecordShapeNames)
+                    return UnsharedRecordShape;
+
+                newshape = recordshapes.size();
+                recordshapes.emplace_back();
+
+                std::vector< ColumnNameId > &names = recordshapes.back().names;
+                names.reserve(numcells);
+                names.assign(recordshapes[shape].names.begin(), recordshapes[shape].names.end());
+                names.push_back(nameid);
+                recordshapenames += numcells;
+        }
+
+        recordshapetransitions.insert(std::make_pair(key, newshape));
+        return newshape;
+}
+
+void VarMemory::InternalSetRecord (VarId id, unsigned length, RecordShapeId shape, VariableTypes::Type type)
+{
+        VarRecord *var = &RecycleVariable(id,type,length ? RecordBackingSize(length, shape) : 0)->data.record;
         assert(length <= VarRecord::CountMask);
         var->numcells = length;
 
         if (length)
         {
-                RecordColumn *columns=static_cast<RecordColumn *>(backings.GetWritePtr(var->backed.bufpos));
+                RecordBacking *backing=static_cast<RecordBacking *>(backings.GetWritePtr(var->backed.bufpos));
+                backing->shape = shape;
+
+                VarId *values = RecordValues(backing);
                 for (unsigned i=0; i<length; ++i)
                 {
                         // Allocation-adres is safe on InternalNewHeapVariable()
-                        columns[i].nameid=0;
-                        columns[i].varid=InternalNewHeapVariable();
+                        values[i]=InternalNewHeapVariable();
                 }
         }
 }
@@ -657,6 +793,34 @@ void VarMemory::RecordInitializeEmpty(VarId id)
         var->numcells = 0;
 }
 
+VarMemory::RecordShapeId VarMemory::GetRecordShape(unsigned numcells, ColumnNameId const *names)
+{
+        RecordShapeId shape = EmptyRecordShape;
+        for (unsigned idx = 0; idx < numcells; ++idx)
+            shape = GetRecordShapeTransition(shape, names[idx], false);
+        return shape;
+}
+
+void VarMemory::RecordInitializeCells(VarId id, unsigned numcells, ColumnNameId const *names, RecordShapeId shape, VarId *cells)
+{
+        if (!numcells)
+        {
+                RecordInitializeEmpty(id);
+                return;
+        }
+
+        InternalSetRecord(id, numcells, shape, VariableTypes::Record);
+
+        VarRecord var = GetVarReadPtr(id)->data.record;
+        RecordBacking *backing = static_cast<RecordBacking *>(backings.GetWritePtr(var.backed.bufpos));
+        VarId const *values = RecordValues(backing);
+        std::copy(values, values + numcells, cells);
+
+        // Records with an unshared shape store their names after the values
+        if (shape == UnsharedRecordShape)
+            std::copy(names, names + numcells, reinterpret_cast<ColumnNameId *>(RecordValues(backing) + numcells));
+}
+
 void VarMemory::DestroyRecordElements(const VarRecord &todestroy)
 {
         if (todestroy.numcells & VarRecord::CountMask)
@@ -665,8 +829,8 @@ void VarMemory::DestroyRecordElements(const VarRecord &todestroy)
                 //Destroy all seperate elements
                 for (unsigned i=0;i<todestroy.numcells;++i)
                 {
-                        const RecordColumn *record=static_cast<const RecordColumn *>(backings.GetReadPtr(bufpos));
-                        InternalDeleteHeapVariable(record[i].varid);
+                        VarId const *values=RecordValues(static_cast<RecordBacking const *>(backings.GetReadPtr(bufpos)));
+                        InternalDeleteHeapVariable(values[i]);
                 }
         }
 }
@@ -678,7 +842,7 @@ bool  VarMemory::RecordNull (VarId record_id) const
         return var->numcells & VarRecord::NonExistent;
 }
 
-bool VarMemory::RecordCellCopyByName(VarId record_id, ColumnNameId nameid, VarId copy)
+bool VarMemory::RecordCellCopyByName(VarId record_id, ColumnNameId nameid, VarId copy, CellLookupCache *cache)
 {
         //DEBUGPRINT("GetRecordColumn("<<record_id<<","<<nameid<<")");
         if (GetType(record_id) != VariableTypes::Record && GetType(record_id) != VariableTypes::FunctionRecord)
@@ -692,12 +856,12 @@ bool VarMemory::RecordCellCopyByName(VarId record_id, ColumnNameId nameid, VarId
         unsigned numcells = var->numcells & VarRecord::CountMask;
         if (numcells)
         {
-                RecordColumn const *column=static_cast<const RecordColumn *>(backings.GetReadPtr(var->backed.bufpos));
+                RecordBacking const *backing=static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos));
 
-                for (unsigned idx = 0; idx != numcells; ++idx, ++column)
-                   if (column->nameid == nameid)
+                unsigned pos = RecordFindCell(backing, numcells, nameid, cache);
+                if (pos != numcells)
                 {
-                        CopyFrom(copy, column->varid);
+                        CopyFrom(copy, RecordValues(backing)[pos]);
                         return true;
                 }
         }
@@ -717,12 +881,13 @@ VarId VarMemory::RecordCellGetByName(VarId record_id, ColumnNameId nameid) const
         unsigned numcells = var->numcells & VarRecord::CountMask;
         if (numcells)
         {
-                RecordColumn const *column=static_cast<const RecordColumn *>(backings.GetReadPtr(var->backed.bufpos));
+                RecordBacking const *backing=static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos));
+                ColumnNameId const *names = RecordColumnNames(backing, numcells);
 
                 // Search all columns
-                for (unsigned idx = 0; idx != numcells; ++idx, ++column)
-                    if (column->nameid == nameid)
-                        return column->varid;
+                for (unsigned idx = 0; idx != numcells; ++idx)
+                    if (names[idx] == nameid)
+                        return RecordValues(backing)[idx];
         }
         return 0;
 }
@@ -736,10 +901,10 @@ ColumnNameId VarMemory::RecordCellNameByNr(VarId record_id, unsigned num) const
         const VarRecord *var=&GetVarReadPtr(record_id)->data.record;
         assert(!(var->numcells & VarRecord::NonExistent) && num < var->numcells);
 
-        const RecordColumn *column=static_cast<const RecordColumn *>(backings.GetReadPtr(var->backed.bufpos));
+        RecordBacking const *backing=static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos));
 
         // Search all columns
-        return column[num].nameid;
+        return RecordColumnNames(backing, var->numcells)[num];
 }
 
 bool VarMemory::RecordCellExists(VarId record_id, ColumnNameId nameid)
@@ -753,91 +918,144 @@ bool VarMemory::RecordCellExists(VarId record_id, ColumnNameId nameid)
         unsigned numcells = var->numcells & VarRecord::CountMask;
         if (numcells)
         {
-                RecordColumn const *column=static_cast<RecordColumn const *>(backings.GetReadPtr(var->backed.bufpos));
+                RecordBacking const *backing=static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos));
+                ColumnNameId const *names = RecordColumnNames(backing, numcells);
 
-                for (unsigned idx = 0; idx != numcells; ++idx, ++column)
-                  if (column->nameid == nameid)
+                for (unsigned idx = 0; idx != numcells; ++idx)
+                  if (names[idx] == nameid)
                     return true;
         }
 
         return false;
 }
 
-VarId VarMemory::RecordCellRefByNameCreate(VarId record_id, ColumnNameId nameid, bool create, bool exclusive)
+VarId VarMemory::RecordCellRefByNameCreate(VarId record_id, ColumnNameId nameid, bool create, bool exclusive, CellLookupCache *cache)
 {
-        //Obtain record itself. Write ptr, we need to write
         assert(GetType(record_id) == VariableTypes::Record || GetType(record_id) == VariableTypes::FunctionRecord);
 
-        /* Make the record writeable. Although we are not sure that the user
+        /* The record must be writeable when we return a cell. Although we are not sure that the user
            is actually going to write to the record, we lose control over
            the returned VarId and can't prevent the user from writing (and modifying other arrays
-           that share storage space with this record) */
-
-        MakeRecordWritable(record_id);
-
-        VarRecord *var=&GetVarWritePtr(record_id)->data.record;
+           that share storage space with this record). Look up the cell first, so we don't clone
+           a shared record when the cell doesn't exist */
+        VarRecord const *var=&GetVarReadPtr(record_id)->data.record;
 
         unsigned numcells = var->numcells & VarRecord::CountMask;
+        bool shared = var->backed.bufpos != SharedPool::AllocationUnused && backings.IsShared(var->backed.bufpos);
         if (numcells)
         {
-                RecordColumn *column=static_cast<RecordColumn *>(backings.GetWritePtr(var->backed.bufpos));
+                RecordBacking const *backing=static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos));
 
                 // Search all columns
-                for (unsigned idx = 0; idx != numcells; ++idx, ++column)
-                    if (column->nameid == nameid)
-                    {
-                            if (create && exclusive)
-                                ThrowVMRuntimeError(Error::ColumnNameAlreadyExists, columnnamemapper.GetReverseMapping(nameid).stl_str().c_str());
-                            return column->varid;
-                    }
+                unsigned pos = RecordFindCell(backing, numcells, nameid, cache);
+                if (pos != numcells)
+                {
+                        if (create && exclusive)
+                            ThrowVMRuntimeError(Error::ColumnNameAlreadyExists, columnnamemapper.GetReverseMapping(nameid).stl_str().c_str());
+                        if (!shared)
+                            return RecordValues(backing)[pos];
+
+                        // The clone has the same shape, so the cell is at the same position
+                        CloneSharedRecord(record_id, numcells, 0);
+                        var=&GetVarReadPtr(record_id)->data.record;
+                        return RecordValues(static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos)))[pos];
+                }
         }
 
         // Not found!
         if (!create)
             return 0;
 
-        // Expand the record
-        MakeRecordWritable(record_id, (var->numcells & VarRecord::CountMask)+1);
-        var = &GetVarWritePtr(record_id)->data.record;
-        RecordColumn *mod_column = static_cast<RecordColumn *>(backings.GetWritePtr(var->backed.bufpos));
-        mod_column[var->numcells-1].nameid = nameid;
-        return mod_column[var->numcells-1].varid;
+        if (!shared)
+            return RecordAppendCell(record_id, nameid);
+
+        // Add the new cell while cloning
+        CloneSharedRecord(record_id, numcells, nameid);
+        var=&GetVarReadPtr(record_id)->data.record;
+        return RecordValues(static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos)))[numcells];
 }
 
-bool VarMemory::RecordCellDelete (VarId record_id, ColumnNameId nameid)
+VarId VarMemory::RecordAppendCell(VarId record_id, ColumnNameId nameid)
 {
-        assert(GetType(record_id) == VariableTypes::Record || GetType(record_id) == VariableTypes::FunctionRecord);
+        // Allocate the new cell first, allocating may move the record variable itself
+        VarId cellid = InternalNewHeapVariable();
+
+        VarRecord *var = &GetVarWritePtr(record_id)->data.record;
+        unsigned numcells = var->numcells & VarRecord::CountMask;
+
+        RecordShapeId oldshape = EmptyRecordShape;
+        if (numcells)
+            oldshape = static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos))->shape;
+        RecordShapeId newshape = GetRecordShapeTransition(oldshape, nameid, false);
 
+        RecordBacking *backing = static_cast<RecordBacking *>(WriteableBuffer(&var->backed, RecordBackingSize(numcells + 1, newshape), true));
+        VarId *values = RecordValues(backing);
+        if (newshape == UnsharedRecordShape)
         {
-                // Don't want to call MakeRecordWritable on an non-existing record, it makes them empty records.
-                VarRecord const *var=&GetVarReadPtr(record_id)->data.record;
-                if (var->numcells & VarRecord::NonExistent || !var->numcells)
-                    return false;
+                // The names are stored after the values, make room for the new value
+                ColumnNameId *names = reinterpret_cast<ColumnNameId *>(values + numcells + 1);
+                if (oldshape == UnsharedRecordShape)
+                    memmove(names, values + numcells, numcells * sizeof(ColumnNameId));
+                else
+                    std::copy(recordshapes[oldshape].names.begin(), recordshapes[oldshape].names.end(), names);
+                names[numcells] = nameid;
         }
-        MakeRecordWritable(record_id);
+        backing->shape = newshape;
+        values[numcells] = cellid;
+        var->numcells = numcells + 1;
+        return cellid;
+}
+
+bool VarMemory::RecordCellDelete (VarId record_id, ColumnNameId nameid)
+{
+        assert(GetType(record_id) == VariableTypes::Record || GetType(record_id) == VariableTypes::FunctionRecord);
 
+        // Look up the cell before making the record writable, deleting a non-existing cell doesn't modify the record
         VarRecord *var=&GetVarWritePtr(record_id)->data.record;
-        RecordColumn *column=static_cast<RecordColumn *>(backings.GetWritePtr(var->backed.bufpos));
+        if (var->numcells & VarRecord::NonExistent || !var->numcells)
+            return false;
+
+        RecordBacking *backing=static_cast<RecordBacking *>(backings.GetWritePtr(var->backed.bufpos));
+        unsigned numcells = var->numcells;
 
         // Search all columns
-        int32_t killindex = -1;
-        unsigned numcells = var->numcells & VarRecord::CountMask;
-        for (unsigned idx = 0; idx != numcells; ++idx)
-            if (column[idx].nameid == nameid)
-            {
-                    killindex = idx;
-                    break;
-            }
-        if (killindex == -1)
+        ColumnNameId const *names = RecordColumnNames(backing, numcells);
+        unsigned killindex = std::find(names, names + numcells, nameid) - names;
+        if (killindex == numcells)
             return false;
 
-        // Save the id of the variable we'll kill, because that is going to be removed by the memmove
-        VarId killid = column[killindex].varid;
+        // Leave out the cell when cloning a shared record
+        if (backings.IsShared(var->backed.bufpos))
+        {
+                CloneSharedRecord(record_id, killindex, 0);
+                return true;
+        }
+
+        RecordShapeId oldshape = backing->shape;
+        RecordShapeId newshape = --numcells ? GetRecordShapeTransition(oldshape, nameid, true) : EmptyRecordShape;
 
-        memmove(&column[killindex], &column[killindex + 1], (var->numcells - killindex - 1) * sizeof(RecordColumn));
-        --var->numcells;
+        // Records with an unshared shape need to keep a copy of their remaining names
+        std::vector< ColumnNameId > newnames;
+        if (newshape == UnsharedRecordShape)
+        {
+                names = RecordColumnNames(backing, numcells + 1);
+                newnames.assign(names, names + numcells + 1);
+                newnames.erase(newnames.begin() + killindex);
+        }
+
+        // Save the id of the variable we'll kill, because that is going to be removed by the memmove
+        VarId *values = RecordValues(backing);
+        VarId killid = values[killindex];
+        memmove(&values[killindex], &values[killindex + 1], (numcells - killindex) * sizeof(VarId));
 
-        WriteableBuffer(&var->backed,var->numcells*sizeof(RecordColumn),true);
+        backing = static_cast<RecordBacking *>(WriteableBuffer(&var->backed, numcells ? RecordBackingSize(numcells, newshape) : 0, true));
+        if (numcells)
+        {
+                backing->shape = newshape;
+                if (newshape == UnsharedRecordShape)
+                    std::copy(newnames.begin(), newnames.end(), reinterpret_cast<ColumnNameId *>(RecordValues(backing) + numcells));
+        }
+        var->numcells = numcells;
 
         // Kill the heap variable we did just remove
         InternalDeleteHeapVariable(killid);
@@ -849,50 +1067,64 @@ unsigned VarMemory::RecordSize(VarId record_id) const
         return GetVarReadPtr(record_id)->data.record.numcells & VarRecord::CountMask;
 }
 
-void VarMemory::MakeRecordWritable(VarId record_id, signed newlength)
+void VarMemory::CloneSharedRecord(VarId record_id, unsigned skippos, ColumnNameId appendname)
 {
         assert(GetType(record_id) == VariableTypes::Record || GetType(record_id) == VariableTypes::FunctionRecord);
 
-        //Obtain record itself. Make it empty if non-existing.
-        VarRecord *var=&GetVarWritePtr(record_id)->data.record;
-        if (var->numcells & VarRecord::NonExistent)
-            var->numcells = 0;
+        VarRecord oldvar = GetVarReadPtr(record_id)->data.record;
+        assert(oldvar.backed.bufpos != SharedPool::AllocationUnused && backings.IsShared(oldvar.backed.bufpos));
 
-        if (newlength < 0)
-            newlength = var->numcells;
+        unsigned oldnumcells = oldvar.numcells & VarRecord::CountMask;
+        RecordShapeId oldshape = EmptyRecordShape;
+        if (oldnumcells)
+            oldshape = static_cast<RecordBacking const *>(backings.GetReadPtr(oldvar.backed.bufpos))->shape;
 
-        assert(newlength >= static_cast<int32_t>(var->numcells));
+        // Determine the shape of the clone
+        RecordShapeId newshape = oldshape;
+        unsigned newnumcells = oldnumcells;
+        if (skippos < oldnumcells)
+        {
+                ColumnNameId skipname = RecordColumnNames(static_cast<RecordBacking const *>(backings.GetReadPtr(oldvar.backed.bufpos)), oldnumcells)[skippos];
+                newshape = --newnumcells ? GetRecordShapeTransition(oldshape, skipname, true) : EmptyRecordShape;
+        }
+        if (appendname)
+        {
+                newshape = GetRecordShapeTransition(newshape, appendname, false);
+                ++newnumcells;
+        }
 
-        //If we have the only reference, then don't bother copying all elements
-        if ((var->backed.bufpos == SharedPool::AllocationUnused
-                || !backings.IsShared(var->backed.bufpos)))
+        // Records with an unshared shape need to keep a copy of their names
+        std::vector< ColumnNameId > newnames;
+        if (newshape == UnsharedRecordShape)
         {
-                if (static_cast<int32_t>(var->numcells) == newlength)
-                    return;
-                unsigned oldlen = var->numcells;
-                var->numcells = newlength;
-                RecordColumn *newcolumn=static_cast<RecordColumn *>(WriteableBuffer(&var->backed, newlength * sizeof(RecordColumn), true));
-                // Initialize new elements
-                for (signed idx = oldlen; idx != newlength; ++idx)
-                {
-                        newcolumn[idx].nameid=0;
-                        newcolumn[idx].varid=InternalNewHeapVariable();
-                }
-                return;
+                ColumnNameId const *names = RecordColumnNames(static_cast<RecordBacking const *>(backings.GetReadPtr(oldvar.backed.bufpos)), oldnumcells);
+                newnames.reserve(newnumcells);
+                for (unsigned idx = 0; idx < oldnumcells; ++idx)
+                    if (idx != skippos)
+                        newnames.push_back(names[idx]);
+                if (appendname)
+                    newnames.push_back(appendname);
         }
 
-        VarRecord oldvar = *var;
-        // Build a new record, over ourselves
-        InternalSetRecord(record_id, newlength, GetType(record_id));
+        // Build a new record over ourselves. We still hold the old backing, it was shared.
+        InternalSetRecord(record_id, newnumcells, newshape, GetType(record_id));
         VarRecord newvar = GetVarReadPtr(record_id)->data.record;
 
-        for (unsigned idx = 0; idx < oldvar.numcells; ++idx)
+        if (newshape == UnsharedRecordShape)
+            std::copy(newnames.begin(), newnames.end(), reinterpret_cast<ColumnNameId *>(RecordValues(static_cast<RecordBacking *>(backings.GetWritePtr(newvar.backed.bufpos))) + newnumcells));
+
+        for (unsigned idx = 0, newidx = 0; idx < oldnumcells; ++idx)
         {
-                RecordColumn *newcolumn=static_cast<RecordColumn *>(backings.GetWritePtr(newvar.backed.bufpos));
-                const RecordColumn *oldcolumn=static_cast<const RecordColumn *>(backings.GetReadPtr(oldvar.backed.bufpos));
-                newcolumn[idx].nameid = oldcolumn[idx].nameid;
-                CopyFrom(newcolumn[idx].varid, oldcolumn[idx].varid);
+                if (idx == skippos)
+                    continue;
+
+                VarId const *newvalues=RecordValues(static_cast<RecordBacking const *>(backings.GetReadPtr(newvar.backed.bufpos)));
+                VarId const *oldvalues=RecordValues(static_cast<RecordBacking const *>(backings.GetReadPtr(oldvar.backed.bufpos)));
+                CopyFrom(newvalues[newidx++], oldvalues[idx]);
         }
+
+        ++recordclones;
+        recordclonedcells += newnumcells;
 }
 
 void VarMemory::RecordThrowCellNotFound(VarId record_id, std::string const &name)
@@ -903,14 +1135,15 @@ void VarMemory::RecordThrowCellNotFound(VarId record_id, std::string const &name
         if (!(var->numcells & VarRecord::CountMask))
             ThrowVMRuntimeError(Error::UnknownColumn, name.c_str());
 
-        const RecordColumn *column=static_cast<const RecordColumn *>(backings.GetReadPtr(var->backed.bufpos));
+        RecordBacking const *backing=static_cast<RecordBacking const *>(backings.GetReadPtr(var->backed.bufpos));
+        ColumnNameId const *names = RecordColumnNames(backing, var->numcells);
 
         int bestmapping = -1;
         std::string bestname;
 
         for (unsigned i = 0; i < var->numcells; ++i)
         {
-                std::string cellname = columnnamemapper.GetReverseMapping(column[i].nameid).stl_str();
+                std::string cellname = columnnamemapper.GetReverseMapping(names[i]).stl_str();
 
                 int ld = Blex::LevenshteinDistance(name, cellname);
                 if (bestmapping == -1 || ld < bestmapping)
@@ -1004,15 +1237,25 @@ VarMemory::ObjectCell * VarMemory::ObjectFindCellFromBacking(ObjectBacking const
         return 0;
 }
 
-VarMemory::ObjectCell * VarMemory::ObjectFindCell(VarId object, ColumnNameId nameid, bool this_access)
+VarMemory::ObjectCell * VarMemory::ObjectFindCell(VarId object, ColumnNameId nameid, bool this_access, CellLookupCache *cache)
 {
         VarObject *var = &GetVarWritePtr(object)->data.object;
         if (var->backed.bufpos == SharedPool::AllocationUnused)
             ThrowVMRuntimeError(Error::DereferencedDefaultObject);
 
         ObjectBacking *backing=static_cast< ObjectBacking * >(backings.GetWritePtr(var->backed.bufpos));
+        if (!cache)
+            return ObjectFindCellFromBacking(backing, nameid, this_access || var->is_privileged);
+
+        ObjectCell *cell=static_cast< ObjectCell * >(backings.GetWritePtr(backing->cellbufpos));
+        unsigned pos = LookupCellPos(cell, backing->numcells, nameid, reinterpret_cast< uintptr_t >(backing->typedescriptor), cache);
+        if (pos == backing->numcells)
+            return 0;
 
-        return ObjectFindCellFromBacking(backing, nameid, this_access || var->is_privileged);
+        cell += pos;
+        if (cell->is_private && !this_access && !var->is_privileged)
+            ThrowVMRuntimeError(Error::PrivateMemberOnlyThroughThis);
+        return cell;
 }
 
 void VarMemory::ObjectInitializeDefault(VarId id)
@@ -1044,6 +1287,10 @@ void VarMemory::ObjectInitializeEmpty(VarId id)
         backing->contextbufpos = SharedPool::AllocationUnused;
         backing->numcontexts = 0;
         backing->has_deletable_members = 0;
+        // Objects created while sweeping are reachable, but the variables referring to them might not be swept
+        backing->markcycle = gcphase == GCSweeping ? gccycle : 0;
+        backing->nurseryslot = nursery.size();
+        nursery.push_back(var->backed.bufpos);
         ++objectcount;
         //DEBUGPRINT("Init strong ref to " << var->backed.bufpos << ", now " << backing->strongreferences);
 }
@@ -1096,9 +1343,9 @@ VarId VarMemory::ObjectMemberCreate(VarId id, ColumnNameId nameid, bool this_acc
         cell->nameid = nameid;
         cell->is_private = is_private;
         cell->is_deletable = is_deletable;
-        cell->contains_no_objects = false; // ADDME: conditionalize this on the type of the new value
         cell->member_type = type;
         cell->varid = InternalNewHeapVariable();
+        CellWriteBarrier(id, cell); // ADDME: conditionalize this on the type of the new value
         return cell->varid;
 }
 
@@ -1144,9 +1391,9 @@ bool VarMemory::ObjectMemberDelete(VarId id, ColumnNameId nameid, bool this_acce
         return true;
 }
 
-bool VarMemory::ObjectMemberCopy(VarId var, ColumnNameId nameid, bool this_access, VarId storeto)
+bool VarMemory::ObjectMemberCopy(VarId var, ColumnNameId nameid, bool this_access, VarId storeto, CellLookupCache *cache)
 {
-        ObjectCell *member = ObjectFindCell(var, nameid, this_access);
+        ObjectCell *member = ObjectFindCell(var, nameid, this_access, cache);
         if (!member)
             return false;
 
@@ -1154,13 +1401,13 @@ bool VarMemory::ObjectMemberCopy(VarId var, ColumnNameId nameid, bool this_acces
         return true;
 }
 
-bool VarMemory::ObjectMemberSet(VarId var, ColumnNameId nameid, bool this_access, VarId new_value)
+bool VarMemory::ObjectMemberSet(VarId var, ColumnNameId nameid, bool this_access, VarId new_value, CellLookupCache *cache)
 {
-        ObjectCell *member = ObjectFindCell(var, nameid, this_access);
+        ObjectCell *member = ObjectFindCell(var, nameid, this_access, cache);
         if (!member)
             return false;
 
-        member->contains_no_objects = false; // ADDME: conditionalize this on the type of the new value
+        CellWriteBarrier(var, member); // ADDME: conditionalize this on the type of the new value
         CopyFrom(member->varid, new_value); // Invalidates member!
         return true;
 }
@@ -1179,7 +1426,7 @@ VarId VarMemory::ObjectMemberRef(VarId var, ColumnNameId nameid, bool this_acces
         ObjectCell *member = ObjectFindCell(var, nameid, this_access);
         if (!member)
             return 0;
-        member->contains_no_objects = false;
+        CellWriteBarrier(var, member);
         return member->varid;
 }
 
@@ -1227,6 +1474,7 @@ SharedPool::Allocation VarMemory::DestroyObjectElements(VarObject &todestroy)
         todestroy.backed.bufpos = SharedPool::AllocationUnused;
 
         ObjectBacking *backing=static_cast< ObjectBacking * >(backings.GetWritePtr(bufpos));
+        GCForgetYoung(backing);
         if (backing->numcells)
         {
                 // If any cells present, kill em all. Don't use todestoy after this point
@@ -1412,9 +1660,9 @@ ColumnNameId VarMemory::ObjectMemberNameByNr(VarId id, unsigned num)
         return (cell + num)->nameid;
 }
 
-VariableTypes::Type VarMemory::ObjectMemberType(VarId var, ColumnNameId nameid)
+VariableTypes::Type VarMemory::ObjectMemberType(VarId var, ColumnNameId nameid, CellLookupCache *cache)
 {
-        ObjectCell *member = ObjectFindCell(var, nameid, true);
+        ObjectCell *member = ObjectFindCell(var, nameid, true, cache);
         if (!member)
             return VariableTypes::Variant;
         return member->member_type;
@@ -1497,8 +1745,9 @@ bool VarMemory::WeakObjectExists(VarId id)
         if (src->data.object.backed.bufpos == SharedPool::AllocationUnused)
             return false;
 
+        // Objects the running collection has found unreachable may not be resurrected
         ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(src->data.object.backed.bufpos));
-        return backing->strongreferences;
+        return backing->strongreferences && !GCIsUnreachable(backing);
 }
 
 void VarMemory::ConvertObjectToWeakObject(VarId id)
@@ -1537,7 +1786,7 @@ void VarMemory::ConvertWeakObjectToObject(VarId id)
         if (src->data.object.backed.bufpos != SharedPool::AllocationUnused)
         {
                 ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(src->data.object.backed.bufpos));
-                if (backing->strongreferences)
+                if (backing->strongreferences && !GCIsUnreachable(backing))
                 {
                         ++backing->strongreferences;
                         //DEBUGPRINT("Converting " << src->data.object.backed.bufpos << " to strong object by increasing refs to " << backing->strongreferences);
@@ -2218,109 +2467,172 @@ VarMemory::VarStore* VarMemory::RecycleVariableInternal (VarStore *buf,VariableT
         return buf;
 }
 
-void VarMemory::UnmarkUsed(VarStore *buf)
+void VarMemory::GCRememberCell(VarId object, VarId cellvar)
 {
-        if (buf->type == VariableTypes::Object)
-        {
-                if (buf->data.object.backed.bufpos != SharedPool::AllocationUnused)
-                {
-                        ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(buf->data.object.backed.bufpos));
-                        backing->marked = false;
-                }
-        }
+        VarObject const *var = &GetVarReadPtr(object)->data.object;
+        if (var->backed.bufpos == SharedPool::AllocationUnused)
+            return;
+
+        // Unmarked objects will still be scanned, and see the new value
+        ObjectBacking const *backing = static_cast< ObjectBacking const * >(backings.GetReadPtr(var->backed.bufpos));
+        if (backing->markcycle == gccycle)
+            gcdirtycells.push_back(cellvar);
 }
 
-bool VarMemory::RecursiveMarkUsed(VarStore *buf)
+void VarMemory::GCStartCycle(unsigned *work)
 {
-        if (buf->type & VariableTypes::Array)
-        {
-                VarArray *var = &buf->data.array;
-                unsigned length = var->numelements;
-                if (length)
-                {
-                        VarId *array=static_cast<VarId*>(backings.GetWritePtr(var->backed.bufpos));
+        // Every object with another markcycle is unmarked, so there is no need to visit them
+        if (++gccycle == 0)
+            gccycle = 1;
 
-                        bool any_object = false;
-                        for (unsigned i=0; i<length; ++i, ++array)
-                            any_object = RecursiveMarkUsed(GetVarWritePtr(*array)) || any_object;
-                        return any_object;
-                }
-        }
-        else if (buf->type == VariableTypes::Record || buf->type == VariableTypes::FunctionRecord)
-        {
-                VarRecord *var = &buf->data.record;
-                unsigned length = var->numcells & VarRecord::CountMask;
-                if (length)
-                {
-                        RecordColumn *columns=static_cast<RecordColumn *>(backings.GetWritePtr(var->backed.bufpos));
+        gcphase = GCMarking;
+        gcqueue.clear();
+        gcdirtycells.clear();
+        GCQueueRoots(work);
+}
 
-                        bool any_object = false;
-                        for (; length; --length, ++columns)
-                            any_object = RecursiveMarkUsed(GetVarWritePtr(columns->varid)) || any_object;
-                        return any_object;
-                }
+void VarMemory::GCQueueRoots(unsigned *work)
+{
+        // The stack isn't protected by the write barrier, so scan it completely every time
+        for (unsigned i = 0; i < stacksize; ++i)
+            if (!IsPrimitive(stackstore[i]))
+                GCScanVariable(UnmapStackId(i), work);
+
+        for (std::vector< std::pair< HeapId, unsigned > >::iterator it = globalblocks.begin(), end = globalblocks.end(); it != end; ++it)
+        {
+                for (HeapId id = it->first, limit = it->first + it->second; id != limit; ++id)
+                    if (!IsPrimitive(heapstore[id]))
+                        gcqueue.push_back(UnmapHeapId(id));
         }
-        else if (buf->type == VariableTypes::Object)
+        for (std::set< VarId >::iterator it = external_heap_vars.begin(), end = external_heap_vars.end(); it != end; ++it)
+            gcqueue.push_back(*it);
+}
+
+bool VarMemory::GCMarkQueued(unsigned *work, unsigned budget)
+{
+        while (!gcqueue.empty())
         {
-                VarObject *var = &buf->data.object;
-                if (var->backed.bufpos == SharedPool::AllocationUnused)
-                    return false; // default objects don't count
+                if (*work >= budget)
+                    return false;
 
-                ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(var->backed.bufpos));
-                if (backing->marked)
-                    return true; // live object
-                backing->marked = true;
+                VarId id = gcqueue.back();
+                gcqueue.pop_back();
 
-                ObjectCell *cell=static_cast< ObjectCell * >(backings.GetWritePtr(backing->cellbufpos));
-                unsigned length = backing->numcells;
+                /* Queued variables may have been deleted and reused since they were queued. Their
+                   slot still contains a valid (maybe uninitialized) variable, scanning it is safe
+                   and at worst keeps some garbage alive until the next cycle */
+                if (!IsOnHeap(id) || MapHeapId(id) >= heapstore.size())
+                    continue;
 
-                if (length)
+                VarStore const *buf = &heapstore[MapHeapId(id)];
+                if (buf->type == VariableTypes::Object)
                 {
-                        for (; length; --length, ++cell)
-                            if (cell->nameid && !cell->contains_no_objects)
-                                cell->contains_no_objects = !RecursiveMarkUsed(GetVarWritePtr(cell->varid));
+                        ++*work;
+                        if (buf->data.object.backed.bufpos != SharedPool::AllocationUnused)
+                            GCScanObject(buf->data.object.backed.bufpos, work);
                 }
-                return true; // Live object found
+                else if (!IsPrimitive(*buf))
+                    GCScanVariable(id, work);
         }
-        return false;
+        return true;
 }
 
-void VarMemory::CollectObjects()
+void VarMemory::GCFinishMarking(unsigned *work)
 {
-        /* This is tha garbage collector */
+        // Find the objects that have become reachable through the roots and the modified cells
+        GCQueueRoots(work);
+        gcqueue.insert(gcqueue.end(), gcdirtycells.begin(), gcdirtycells.end());
+        gcdirtycells.clear();
+        GCMarkQueued(work, std::numeric_limits< unsigned >::max());
 
-        // Unmark all the arrays, records and objects
-        for (HeapStore::iterator it = heapstore.begin(), end = heapstore.end(); it != end; ++it)
-            if (!IsPrimitive(*it))
-                UnmarkUsed(&*it);
-        for (StackStore::iterator it = stackstore.begin(), end = stackstore.begin() + stacksize; it != end; ++it)
-            if (!IsPrimitive(*it))
-                UnmarkUsed(&*it);
+        // Objects created from now on are marked, the variables they are stored in don't need to be swept
+        gcphase = GCSweeping;
+        gcsweeppos = 0;
+        gcsweepend = heapstore.size();
+}
 
-        // Mark used objects ADDME: rewrite to be non-recursive (at least for objects)
+void VarMemory::GCScanObject(SharedPool::Allocation bufpos, unsigned *work)
+{
+        ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(bufpos));
+        if (backing->markcycle == gccycle)
+            return;
+        backing->markcycle = gccycle;
 
-        // Mark all stack objects
-        for (StackStore::iterator it = stackstore.begin(), end = stackstore.begin() + stacksize; it != end; ++it)
-            if (!IsPrimitive(*it))
-                 RecursiveMarkUsed(&*it);
+        unsigned length = backing->numcells;
+        if (!length)
+            return;
 
-        // Mark all global objects
-        for (std::vector< std::pair< HeapId, unsigned > >::iterator it = globalblocks.begin(), end = globalblocks.end(); it != end; ++it)
-        {
-                for (HeapStore::iterator it2 = heapstore.begin() + it->first, end = heapstore.begin() + it->first + it->second; it2 != end; ++it2)
-                    if (!IsPrimitive(*it2))
-                        RecursiveMarkUsed(&*it2);
-        }
-        for (std::set< VarId >::iterator it = external_heap_vars.begin(), end = external_heap_vars.end(); it != end; ++it)
+        /* GCScanVariable queues the objects it finds instead of scanning them, so it won't
+           modify the backings and the cell pointer stays valid */
+        ObjectCell *cell = static_cast< ObjectCell * >(backings.GetWritePtr(backing->cellbufpos));
+        for (; length; --length, ++cell)
+            if (cell->nameid && !cell->contains_no_objects)
+                cell->contains_no_objects = !GCScanVariable(cell->varid, work);
+}
+
+bool VarMemory::GCScanVariable(VarId id, unsigned *work)
+{
+        // Walk the arrays and records with a work list. Our caller may be using the bottom part of it
+        std::size_t base = gcscanlist.size();
+        gcscanlist.push_back(id);
+
+        bool any_object = false;
+        while (gcscanlist.size() > base)
         {
-                VarStore *store = GetVarWritePtr(*it);
-                if (!IsPrimitive(*store))
-                    RecursiveMarkUsed(store);
+                VarId curid = gcscanlist.back();
+                gcscanlist.pop_back();
+                ++*work;
+
+                VarStore const *buf = GetVarReadPtr(curid);
+                if (buf->type & VariableTypes::Array)
+                {
+                        VarArray const *var = &buf->data.array;
+                        if (var->numelements)
+                        {
+                                VarId const *array = static_cast< VarId const * >(backings.GetReadPtr(var->backed.bufpos));
+                                gcscanlist.insert(gcscanlist.end(), array, array + var->numelements);
+                        }
+                }
+                else if (buf->type == VariableTypes::Record || buf->type == VariableTypes::FunctionRecord)
+                {
+                        VarRecord const *var = &buf->data.record;
+                        unsigned length = var->numcells & VarRecord::CountMask;
+                        if (length)
+                        {
+                                VarId const *values = RecordValues(static_cast< RecordBacking const * >(backings.GetReadPtr(var->backed.bufpos)));
+                                gcscanlist.insert(gcscanlist.end(), values, values + length);
+                        }
+                }
+                else if (buf->type == VariableTypes::Object)
+                {
+                        if (buf->data.object.backed.bufpos == SharedPool::AllocationUnused)
+                            continue; // default objects don't count
+
+                        any_object = true;
+                        ObjectBacking const *backing = static_cast< ObjectBacking const * >(backings.GetReadPtr(buf->data.object.backed.bufpos));
+                        if (backing->markcycle == gccycle)
+                            continue;
+
+                        // Stack variables can be scanned immediately, no object can contain them
+                        if (IsOnHeap(curid))
+                            gcqueue.push_back(curid);
+                        else
+                            GCScanObject(buf->data.object.backed.bufpos, work);
+                }
         }
+        return any_object;
+}
 
+bool VarMemory::GCSweep(unsigned *work, unsigned budget)
+{
         // Recycle heap object that point to non-used objects (stack is root, so no sweep needed there). Refcounting will take care of destruction.
-        for (HeapStore::iterator it = heapstore.begin(), end = heapstore.end(); it != end; ++it)
+        for (; gcsweeppos < gcsweepend; ++gcsweeppos)
         {
+                if (*work >= budget)
+                    return false;
+                ++*work;
+
+                VarStore *it = &heapstore[gcsweeppos];
                 if (it->type == VariableTypes::Object)
                 {
                         VarObject *var = &it->data.object;
@@ -2328,7 +2640,7 @@ void VarMemory::CollectObjects()
                             continue;
 
                         ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(var->backed.bufpos));
-                        if (backing->marked)
+                        if (backing->markcycle == gccycle)
                             continue;
 
                         // Change type to uninitialized to avoid recursive DestroyObjectElements calls
@@ -2336,6 +2648,9 @@ void VarMemory::CollectObjects()
                         backing->strongreferences = 0;
                         SharedPool::Allocation buf;
 
+                        // The backing may be released by a weak reference, without destroying the object
+                        GCForgetYoung(backing);
+
                         if (backings.IsShared(var->backed.bufpos))
                             buf = var->backed.bufpos;
                         else
@@ -2353,7 +2668,7 @@ void VarMemory::CollectObjects()
                             continue;
 
                         ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(var->backed.bufpos));
-                        if (backing->marked && backing->strongreferences != 0)
+                        if (backing->markcycle == gccycle && backing->strongreferences != 0)
                             continue;
 
                         SharedPool::Allocation buf = var->backed.bufpos;
@@ -2379,6 +2694,199 @@ void VarMemory::CollectObjects()
                         backings.ReleaseReference(buf);
               }
         }
+        return true;
+}
+
+void VarMemory::GCFinishCycle()
+{
+        gcphase = GCIdle;
+        ++gccycles;
+
+        // Start the next cycle when the number of objects may have doubled
+        gcpromotions = 0;
+        gcthreshold = std::max< unsigned >(GCMinimumThreshold, objectcount);
+}
+
+uint64_t VarMemory::GCRecordPause(uint64_t startticks)
+{
+        static const uint64_t bucketlimits[GCPauseHistogramBuckets - 1] = { 100, 1000, 10000, 100000 };
+
+        uint64_t usecs = (Blex::GetSystemCurrentTicks() - startticks) / (Blex::GetSystemTickFrequency() / 1000000);
+        ++gcpauses;
+        gctime += usecs;
+        gcmaxpause = std::max(gcmaxpause, usecs);
+
+        unsigned bucket = 0;
+        while (bucket < GCPauseHistogramBuckets - 1 && usecs >= bucketlimits[bucket])
+            ++bucket;
+        ++gcpausehistogram[bucket];
+        return usecs;
+}
+
+void VarMemory::CollectObjects()
+{
+        /* This is tha garbage collector. Restarting an incremental collection is safe, the
+           objects it has marked are unmarked by the new cycle, and the objects it didn't
+           sweep yet are still unreachable */
+        uint64_t startticks = Blex::GetSystemCurrentTicks();
+        unsigned work = 0;
+
+        GCStartCycle(&work);
+        GCFinishMarking(&work);
+        GCSweep(&work, std::numeric_limits< unsigned >::max());
+        GCFinishCycle();
+        gcmajortime += GCRecordPause(startticks);
+}
+
+template < class Func >
+  void VarMemory::GCForEachObjectVar(ObjectBacking const *backing, bool only_private, Func const &func)
+{
+        if (!backing->numcells || (only_private && backings.IsShared(backing->cellbufpos)))
+            return;
+
+        std::size_t base = gcscanlist.size();
+        ObjectCell const *cell = static_cast< ObjectCell const * >(backings.GetReadPtr(backing->cellbufpos));
+        for (unsigned length = backing->numcells; length; --length, ++cell)
+            if (cell->nameid && !cell->contains_no_objects)
+                gcscanlist.push_back(cell->varid);
+
+        while (gcscanlist.size() > base)
+        {
+                VarStore *buf = GetVarWritePtr(gcscanlist.back());
+                gcscanlist.pop_back();
+
+                if (buf->type & VariableTypes::Array)
+                {
+                        VarArray const *var = &buf->data.array;
+                        if (var->numelements && !(only_private && backings.IsShared(var->backed.bufpos)))
+                        {
+                                VarId const *array = static_cast< VarId const * >(backings.GetReadPtr(var->backed.bufpos));
+                                gcscanlist.insert(gcscanlist.end(), array, array + var->numelements);
+                        }
+                }
+                else if (buf->type == VariableTypes::Record || buf->type == VariableTypes::FunctionRecord)
+                {
+                        VarRecord const *var = &buf->data.record;
+                        unsigned length = var->numcells & VarRecord::CountMask;
+                        if (length && !(only_private && backings.IsShared(var->backed.bufpos)))
+                        {
+                                VarId const *values = RecordValues(static_cast< RecordBacking const * >(backings.GetReadPtr(var->backed.bufpos)));
+                                gcscanlist.insert(gcscanlist.end(), values, values + length);
+                        }
+                }
+                else if (buf->type == VariableTypes::Object && buf->data.object.backed.bufpos != SharedPool::AllocationUnused)
+                    func(buf);
+        }
+}
+
+void VarMemory::CollectNursery()
+{
+        uint64_t startticks = Blex::GetSystemCurrentTicks();
+
+        /* A running major collection isn't disturbed, the minor collection doesn't use the
+           markcycle of the objects. Objects are only destroyed when they are unreachable,
+           the major collector ignores the variables it has queued that are deleted. */
+
+        // Count the references from outside the nursery, by subtracting the references within it from the strong references
+        for (std::vector< SharedPool::Allocation >::iterator it = nursery.begin(), end = nursery.end(); it != end; ++it)
+            if (*it != SharedPool::AllocationUnused)
+            {
+                    ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(*it));
+                    backing->nurseryrefs = backing->strongreferences;
+            }
+        for (std::vector< SharedPool::Allocation >::iterator it = nursery.begin(), end = nursery.end(); it != end; ++it)
+            if (*it != SharedPool::AllocationUnused)
+                GCForEachObjectVar(static_cast< ObjectBacking const * >(backings.GetReadPtr(*it)), true, [this](VarStore *var)
+                {
+                        ObjectBacking *target = static_cast< ObjectBacking * >(backings.GetWritePtr(var->data.object.backed.bufpos));
+                        if (target->nurseryslot != OldGeneration)
+                            --target->nurseryrefs;
+                });
+
+        /* Objects referenced from outside the nursery survive, together with the nursery
+           objects reachable from them. Surviving objects get a non-zero nurseryrefs */
+        std::vector< SharedPool::Allocation > survivors;
+        for (std::vector< SharedPool::Allocation >::iterator it = nursery.begin(), end = nursery.end(); it != end; ++it)
+            if (*it != SharedPool::AllocationUnused && static_cast< ObjectBacking const * >(backings.GetReadPtr(*it))->nurseryrefs != 0)
+                survivors.push_back(*it);
+        for (std::size_t i = 0; i < survivors.size(); ++i)
+            GCForEachObjectVar(static_cast< ObjectBacking const * >(backings.GetReadPtr(survivors[i])), false, [this, &survivors](VarStore *var)
+            {
+                    ObjectBacking *target = static_cast< ObjectBacking * >(backings.GetWritePtr(var->data.object.backed.bufpos));
+                    if (target->nurseryslot != OldGeneration && target->nurseryrefs == 0)
+                    {
+                            target->nurseryrefs = 1;
+                            survivors.push_back(var->data.object.backed.bufpos);
+                    }
+            });
+
+        /* All references to the other objects come from the cells of these objects. Drop those
+           references first, so destroying an object won't recursively destroy the others. Keep
+           a reference to the backings until they have been destroyed */
+        std::vector< SharedPool::Allocation > garbage;
+        for (std::vector< SharedPool::Allocation >::iterator it = nursery.begin(), end = nursery.end(); it != end; ++it)
+            if (*it != SharedPool::AllocationUnused && static_cast< ObjectBacking const * >(backings.GetReadPtr(*it))->nurseryrefs == 0)
+            {
+                    backings.DuplicateReference(*it);
+                    garbage.push_back(*it);
+            }
+        for (std::vector< SharedPool::Allocation >::iterator it = garbage.begin(), end = garbage.end(); it != end; ++it)
+            GCForEachObjectVar(static_cast< ObjectBacking const * >(backings.GetReadPtr(*it)), true, [this](VarStore *var)
+            {
+                    SharedPool::Allocation target = var->data.object.backed.bufpos;
+                    ObjectBacking const *backing = static_cast< ObjectBacking const * >(backings.GetReadPtr(target));
+                    if (backing->nurseryslot != OldGeneration && backing->nurseryrefs == 0)
+                    {
+                            var->type = VariableTypes::Uninitialized;
+                            backings.ReleaseReference(target);
+                    }
+            });
+        for (std::vector< SharedPool::Allocation >::iterator it = garbage.begin(), end = garbage.end(); it != end; ++it)
+        {
+                ObjectBacking *backing = static_cast< ObjectBacking * >(backings.GetWritePtr(*it));
+                backing->strongreferences = 0;
+                --objectcount;
+
+                VarObject todestroy;
+                todestroy.backed.bufpos = *it;
+                backings.ReleaseReference(DestroyObjectElements(todestroy));
+        }
+
+        // Move the survivors to the old generation. Destroying the garbage may have destroyed some of them too
+        for (std::vector< SharedPool::Allocation >::iterator it = nursery.begin(), end = nursery.end(); it != end; ++it)
+            if (*it != SharedPool::AllocationUnused)
+            {
+                    static_cast< ObjectBacking * >(backings.GetWritePtr(*it))->nurseryslot = OldGeneration;
+                    ++gcpromotions;
+            }
+        nursery.clear();
+
+        ++gcminorcycles;
+        gcminortime += GCRecordPause(startticks);
+}
+
+bool VarMemory::CollectObjectsStep(unsigned budget)
+{
+        // Most garbage dies young, only start a major collection when the old generation has grown enough
+        if (nursery.size() >= GCNurseryLimit)
+            CollectNursery();
+        if (gcphase == GCIdle && gcpromotions < gcthreshold)
+            return true;
+
+        uint64_t startticks = Blex::GetSystemCurrentTicks();
+        unsigned work = 0;
+
+        if (gcphase == GCIdle)
+            GCStartCycle(&work);
+        if (gcphase == GCMarking && GCMarkQueued(&work, budget))
+            GCFinishMarking(&work);
+
+        bool finished = gcphase == GCSweeping && GCSweep(&work, budget);
+        if (finished)
+            GCFinishCycle();
+
+        gcmajortime += GCRecordPause(startticks);
+        return finished;
 }
 
 std::pair< unsigned, uint64_t > VarMemory::RecursiveGetObjectLinks(ObjectLink &source, VarId varid, std::vector< ObjectLink > *links, std::map< long, ObjectData > &objects, std::set< VarId > *seenvarsptr) const
@@ -2415,11 +2923,11 @@ std::pair< unsigned, uint64_t > VarMemory::RecursiveGetObjectLinks(ObjectLink &s
                 unsigned length = var->numcells & VarRecord::CountMask;
                 if (length)
                 {
-                        RecordColumn const *columns=static_cast< RecordColumn const * >(backings.GetReadPtr(var->backed.bufpos));
+                        VarId const *values=RecordValues(static_cast< RecordBacking const * >(backings.GetReadPtr(var->backed.bufpos)));
 
-                        for (; length; --length, ++columns)
+                        for (; length; --length, ++values)
                         {
-                                std::pair< unsigned, uint64_t > subr = RecursiveGetObjectLinks(source, columns->varid, links, objects, seenvarsptr);
+                                std::pair< unsigned, uint64_t > subr = RecursiveGetObjectLinks(source, *values, links, objects, seenvarsptr);
                                 result.first += subr.first;
                                 result.second += subr.second;
                         }
@@ -2660,10 +3168,12 @@ void VarMemory::RecursiveGetBlobReferences(std::vector< BlobReference > *refs, V
                 unsigned length = var->numcells & VarRecord::CountMask;
                 if (length)
                 {
-                        RecordColumn const *columns=static_cast< RecordColumn const * >(backings.GetReadPtr(var->backed.bufpos));
+                        RecordBacking const *backing=static_cast< RecordBacking const * >(backings.GetReadPtr(var->backed.bufpos));
+                        VarId const *values=RecordValues(backing);
+                        ColumnNameId const *names=RecordColumnNames(backing, length);
 
-                        for (; length; --length, ++columns)
-                            RecursiveGetBlobReferences(refs, columns->varid, path + "." + columnnamemapper.GetReverseMapping(columns->nameid).stl_str(), ref, seenvars, visitedobjects);
+                        for (unsigned i=0; i<length; ++i)
+                            RecursiveGetBlobReferences(refs, values[i], path + "." + columnnamemapper.GetReverseMapping(names[i]).stl_str(), ref, seenvars, visitedobjects);
                 }
         }
         else if (buf->type == VariableTypes::Object || buf->type == VariableTypes::WeakObject)
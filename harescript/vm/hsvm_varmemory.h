@@ -3,6 +3,7 @@
 
 #include <blex/datetime.h>
 #include <blex/unicode.h>
+#include <unordered_map>
 
 #include "hsvm_constants.h"
 #include "errors.h"
@@ -55,6 +56,50 @@ struct AllocStats
         unsigned allocated_heap;
 };
 
+/** Inline cache for the cell lookups done by a single instruction. Remembers the
+    positions at which the cell was found for the last few record layouts (keyed
+    on the record shape) or object types (keyed on the type descriptor), so
+    repeated lookups in records and objects with the same layout skip the linear
+    scan. Cached positions are always verified against the cell name, so a stale
+    entry only costs a miss.
+*/
+struct CellLookupCache
+{
+        static const unsigned Ways = 4;
+
+        struct Way
+        {
+                /// Layout key, 0 for unused ways
+                uintptr_t key;
+                /// Position of the cell within the record or object
+                unsigned pos;
+        };
+
+        /// Instruction owning this cache (tag, only used by the VM)
+        uint8_t const *owner;
+        /// Cell name looked up by the owning instruction (tag, only used by the VM)
+        ColumnNameId nameid;
+        /// Type descriptor for which vtable_entry was resolved
+        void const *vtable_type;
+        /// Cached vtable entry for vtable_type (only used by the VM)
+        void const *vtable_entry;
+        /// Way to overwrite on the next miss
+        unsigned nextway;
+
+        Way ways[Ways];
+
+        void Reset(uint8_t const *_owner, ColumnNameId _nameid)
+        {
+                owner = _owner;
+                nameid = _nameid;
+                vtable_type = nullptr;
+                vtable_entry = nullptr;
+                nextway = 0;
+                for (unsigned i = 0; i < Ways; ++i)
+                    ways[i].key = 0;
+        }
+};
+
 // 0x00000000 - 0x7FFFFFFF: global blocks
 // 0x80000000 - 0x8FFFFFFF: stack
 // 0x90000000 - 0xFFFFFFFE: heap
@@ -83,6 +128,8 @@ class BLEXLIB_PUBLIC VarMemory
     public:
         typedef unsigned StackId;
         typedef unsigned HeapId;
+        /// Id of an interned record shape
+        typedef uint32_t RecordShapeId;
 
     protected:
 
@@ -165,12 +212,34 @@ class BLEXLIB_PUBLIC VarMemory
                 VarBackedType anybackedtype;
         };
 
-        struct RecordColumn
+        /** Record shape: the ordered list of column names of a record. Shapes are
+            interned, all records with the same columns (in the same order) share
+            a single shape and only store their cell values. */
+        struct RecordShape
         {
-                ColumnNameId nameid;
-                VarId varid;
+                /// Column names, in cell order
+                std::vector< ColumnNameId > names;
+        };
+
+        /** Header of the backing of a record with cells. It is followed by the
+            VarIds of the cell values, and for records with an unshared shape by the
+            ColumnNameIds of the cells. */
+        struct RecordBacking
+        {
+                RecordShapeId shape;
         };
 
+        /// Shape of records without cells, root of all shape transitions
+        static const RecordShapeId EmptyRecordShape = 0;
+        /// Shape of records that store their column names themselves
+        static const RecordShapeId UnsharedRecordShape = 0xFFFFFFFF;
+        /// Maximum number of cells in a record with a shared shape
+        static const unsigned MaxRecordShapeCells = 128;
+        /// Maximum number of column names stored in all shared shapes together
+        static const unsigned MaxRecordShapeNames = 256 * 1024;
+        /// Nursery slot of objects that have survived a minor collection
+        static const unsigned OldGeneration = 0xFFFFFFFF;
+
         struct ObjectBacking
         {
                 // Number of strong references
@@ -189,8 +258,14 @@ class BLEXLIB_PUBLIC VarMemory
                 // Object cells
                 SharedPool::Allocation contextbufpos;
 
-                // Is this object marked (reachable through a root) (only valid within GC)
-                bool marked;
+                // Collection cycle in which this object was last found reachable (only valid within GC)
+                unsigned markcycle;
+
+                // Position of this object in the nursery, OldGeneration if it isn't in the nursery
+                unsigned nurseryslot;
+
+                // Number of references from outside the nursery, non-zero if the object survives (only valid within a minor collection)
+                unsigned nurseryrefs;
 
                 // Have deletable members? (can skip extend checks if not)
                 bool has_deletable_members;
@@ -307,9 +382,47 @@ class BLEXLIB_PUBLIC VarMemory
             @param todestroy The record data (as returned by GetVarBuffer) */
         void DestroyRecordElements(const VarRecord &todestroy);
 
-        /** Ensure that an record is writable (clone it if necessary)
-            @param varid Record to make writable */
-        void MakeRecordWritable(VarId record_id, signed newlength = -1);
+        /** Replace a shared record by a private copy, optionally leaving out a cell and
+            appending a new one while copying
+            @param record_id Record to clone. Its backing must be shared
+            @param skippos Position of the cell to leave out, >= number of cells to copy all cells
+            @param appendname Name of the cell to append, 0 to not append a cell */
+        void CloneSharedRecord(VarId record_id, unsigned skippos, ColumnNameId appendname);
+
+        /** Returns the cell values of a record backing */
+        static inline VarId * RecordValues(RecordBacking *backing) { return reinterpret_cast< VarId * >(backing + 1); }
+        static inline VarId const * RecordValues(RecordBacking const *backing) { return reinterpret_cast< VarId const * >(backing + 1); }
+
+        /** Returns the size of the backing of a record
+            @param numcells Number of cells in the record
+            @param shape Shape of the record */
+        static inline unsigned RecordBackingSize(unsigned numcells, RecordShapeId shape)
+        {
+                return sizeof(RecordBacking) + numcells * (shape == UnsharedRecordShape ? sizeof(VarId) + sizeof(ColumnNameId) : sizeof(VarId));
+        }
+
+        /** Returns the column names of a record backing
+            @param backing Record backing
+            @param numcells Number of cells in the record */
+        inline ColumnNameId const * RecordColumnNames(RecordBacking const *backing, unsigned numcells) const
+        {
+                if (backing->shape == UnsharedRecordShape)
+                    return reinterpret_cast< ColumnNameId const * >(RecordValues(backing) + numcells);
+                return recordshapes[backing->shape].names.data();
+        }
+
+        /** Returns the shape a record gets when a column is added to or removed from it
+            @param shape Current shape of the record
+            @param nameid Column to add or remove
+            @param remove True to remove the column (which must be present), false to append it
+            @return New shape, UnsharedRecordShape if the new column list doesn't get a shared shape */
+        RecordShapeId GetRecordShapeTransition(RecordShapeId shape, ColumnNameId nameid, bool remove);
+
+        /** Append a new cell to a record that doesn't share its backing
+            @param record_id Record to expand
+            @param nameid Name of the new cell
+            @return VarId of the new cell */
+        VarId RecordAppendCell(VarId record_id, ColumnNameId nameid);
 
         /** Dereference only the contexts inside an object
             @param todestroy The object data */
@@ -365,7 +478,7 @@ class BLEXLIB_PUBLIC VarMemory
         void InternalDeleteHeapVariable(VarId varid);
 
         /** The Shared Storage used to store every variable */
-        SharedPool backings;
+        BackingPool backings;
 
         /** Mapping mapped VarIDs to the heap */
         std::vector< Mapping > maps;
@@ -402,12 +515,45 @@ class BLEXLIB_PUBLIC VarMemory
         VMProf *prof;
 #endif
 */
-        void InternalSetRecord  (VarId id, unsigned length, VariableTypes::Type type);
-        VarId RecordCellRefByNameCreate (VarId record_id, ColumnNameId num, bool create, bool exclusive);
+        void InternalSetRecord  (VarId id, unsigned length, RecordShapeId shape, VariableTypes::Type type);
+        VarId RecordCellRefByNameCreate (VarId record_id, ColumnNameId num, bool create, bool exclusive, CellLookupCache *cache);
+
+        static inline ColumnNameId GetCellNameId(ColumnNameId nameid) { return nameid; }
+        static inline ColumnNameId GetCellNameId(ObjectCell const &cell) { return cell.nameid; }
+
+        /** Look up the position of a cell in an array of record column names or object cells
+            @param cells Cell array
+            @param numcells Number of cells in the array
+            @param nameid Name of the cell to look up
+            @param key Layout key for the inline cache
+            @param cache Inline cache to use (may be 0)
+            @return Position of the cell, numcells if not found */
+        template < class Cell >
+          unsigned LookupCellPos(Cell const *cells, unsigned numcells, ColumnNameId nameid, uintptr_t key, CellLookupCache *cache);
+
+        /** Look up the position of a cell in a record backing
+            @param backing Record backing
+            @param numcells Number of cells in the record
+            @param nameid Name of the cell to look up
+            @param cache Inline cache to use (may be 0)
+            @return Position of the cell, numcells if not found */
+        unsigned RecordFindCell(RecordBacking const *backing, unsigned numcells, ColumnNameId nameid, CellLookupCache *cache);
 
         ObjectCell * ObjectFindCellFromBacking(ObjectBacking const *backing, ColumnNameId nameid, bool this_access);
         ObjectCell const * ObjectFindCellFromBacking(ObjectBacking const *backing, ColumnNameId nameid, bool this_access) const;
-        ObjectCell * ObjectFindCell(VarId object, ColumnNameId nameid, bool this_access);
+        ObjectCell * ObjectFindCell(VarId object, ColumnNameId nameid, bool this_access, CellLookupCache *cache = 0);
+
+        /** Write barrier, must be called before a cell of an object may be modified. While
+            the collector is marking, the cells of objects it has already scanned are
+            remembered, so they are scanned again before the unreachable objects are released
+            @param object Object the cell belongs to
+            @param cell Cell that may be modified */
+        void CellWriteBarrier(VarId object, ObjectCell *cell)
+        {
+                cell->contains_no_objects = false;
+                if (gcphase == GCMarking)
+                    GCRememberCell(object, cell->varid);
+        }
 
     public:
         VarMemory(ColumnNames::LocalMapper &columnnamemapper);
@@ -525,7 +671,21 @@ class BLEXLIB_PUBLIC VarMemory
         /* Record manipulation */
         void             RecordInitializeNull (VarId id);
         void             RecordInitializeEmpty(VarId id);
-        bool             RecordCellCopyByName (VarId record_id, ColumnNameId nameid, VarId copy);
+
+        /** Returns the shape of records with a specific list of cells, for use with RecordInitializeCells
+            @param numcells Number of cells
+            @param names Names of the cells, in cell order. The names must be unique
+            @return Shape for the list of cells */
+        RecordShapeId    GetRecordShape(unsigned numcells, ColumnNameId const *names);
+
+        /** Initialize a record with all its cells at once, instead of adding them one by one
+            @param id Record to initialize
+            @param numcells Number of cells
+            @param names Names of the cells, in cell order. The names must be unique
+            @param shape Shape for the list of cells, as returned by GetRecordShape
+            @param cells Receives the VarIds of the new cells (numcells entries) */
+        void             RecordInitializeCells(VarId id, unsigned numcells, ColumnNameId const *names, RecordShapeId shape, VarId *cells);
+        bool             RecordCellCopyByName (VarId record_id, ColumnNameId nameid, VarId copy, CellLookupCache *cache = 0);
         VarId            RecordCellGetByName  (VarId record_id, ColumnNameId nameid) const;
         ColumnNameId     RecordCellNameByNr   (VarId record_id, unsigned num) const;
         bool             RecordCellDelete     (VarId record_id, ColumnNameId nameid);
@@ -535,25 +695,28 @@ class BLEXLIB_PUBLIC VarMemory
         /** Look up a cell inside the record. Makes the record writeable
             @param record_id Record ID to look in
             @param nameid Cell to look up
+            @param cache Optional inline cache for this lookup
             @return VarId for the name. 0 if the nameid does not exist */
-        VarId            RecordCellRefByName  (VarId record_id, ColumnNameId nameid)
-        { return RecordCellRefByNameCreate(record_id, nameid, false, false); }
+        VarId            RecordCellRefByName  (VarId record_id, ColumnNameId nameid, CellLookupCache *cache = 0)
+        { return RecordCellRefByNameCreate(record_id, nameid, false, false, cache); }
 
         /** Returns a cell inside the record, creates if not existing
             Makes the record writeable
             @param record_id Record ID to look in
             @param nameid Cell to look up
+            @param cache Optional inline cache for this lookup
             @return VarId for the name. Never 0 */
-        VarId            RecordCellCreate     (VarId record_id, ColumnNameId nameid)
-        { return RecordCellRefByNameCreate(record_id, nameid, true, false); }
+        VarId            RecordCellCreate     (VarId record_id, ColumnNameId nameid, CellLookupCache *cache = 0)
+        { return RecordCellRefByNameCreate(record_id, nameid, true, false, cache); }
 
         /** Creates a cell inside the record, fails if exists
             Makes the record writeable
             @param record_id Record ID to look in
             @param nameid Cell to look up
+            @param cache Optional inline cache for this lookup
             @return VarId for the name. Never 0 */
-        VarId            RecordCellCreateExclusive (VarId record_id, ColumnNameId nameid)
-        { return RecordCellRefByNameCreate(record_id, nameid, true, true); }
+        VarId            RecordCellCreateExclusive (VarId record_id, ColumnNameId nameid, CellLookupCache *cache = 0)
+        { return RecordCellRefByNameCreate(record_id, nameid, true, true, cache); }
 
         /** Is the record NULL? (non-existent)
             @param record_id Record to check
@@ -603,14 +766,14 @@ class BLEXLIB_PUBLIC VarMemory
         bool            ObjectMemberInsertDefault(VarId var, ColumnNameId nameid, bool this_access, bool is_private, bool is_deletable, VariableTypes::Type type);
         bool            ObjectMemberInsert     (VarId var, ColumnNameId nameid, bool this_access, bool is_private, bool is_deletable, VarId new_value);
         bool            ObjectMemberDelete     (VarId var, ColumnNameId nameid, bool this_access);
-        bool            ObjectMemberCopy       (VarId var, ColumnNameId nameid, bool this_access, VarId storeto);
-        bool            ObjectMemberSet        (VarId var, ColumnNameId nameid, bool this_access, VarId new_value);
+        bool            ObjectMemberCopy       (VarId var, ColumnNameId nameid, bool this_access, VarId storeto, CellLookupCache *cache = 0);
+        bool            ObjectMemberSet        (VarId var, ColumnNameId nameid, bool this_access, VarId new_value, CellLookupCache *cache = 0);
         VarId           ObjectMemberRef        (VarId var, ColumnNameId nameid, bool this_access);
         VarId           ObjectMemberGet        (VarId obj, ColumnNameId nameid, bool this_access); // for readonly purposes only, use xxxref for writes.
         bool            ObjectMemberExists     (VarId obj, ColumnNameId nameid);
         bool            ObjectMemberAccessible (VarId var, ColumnNameId nameid, bool this_access);
         ColumnNameId    ObjectMemberNameByNr   (VarId obj, unsigned num);
-        VariableTypes::Type ObjectMemberType (VarId obj, ColumnNameId nameid);
+        VariableTypes::Type ObjectMemberType (VarId obj, ColumnNameId nameid, CellLookupCache *cache = 0);
         unsigned        ObjectSize             (VarId obj);
         bool            ObjectIsPrivilegedReference(VarId obj);
         void            ObjectSetReferencePrivilegeStatus(VarId obj, bool new_state);
@@ -721,8 +884,28 @@ class BLEXLIB_PUBLIC VarMemory
         /// Return the mapping for a variable, 0 if not found (+ the offset within the mapping)
         std::pair< unsigned, unsigned > LookupMapping(VarId var) const;
 
+        /** Collect all unreachable objects at once (a major collection). An incremental
+            collection in progress is restarted */
         void CollectObjects();
 
+        /** Collect the unreachable objects in the nursery (a minor collection), and move
+            the surviving objects to the old generation */
+        void CollectNursery();
+
+        /** Returns whether an incremental collection is in progress, the nursery is full,
+            or the old generation has grown enough to start a new major collection */
+        bool WantsObjectCollectionStep() const
+        {
+                return gcphase != GCIdle || nursery.size() >= GCNurseryLimit || gcpromotions >= gcthreshold;
+        }
+
+        /** Run a slice of an incremental major collection, starting a new one if the old
+            generation has grown enough. A full nursery is collected first, also while a
+            major collection is running. Must only be called between instructions.
+            @param budget Amount of work to do, roughly the number of variables to visit
+            @return True if no collection is in progress anymore */
+        bool CollectObjectsStep(unsigned budget);
+
         void CopySimpleVariableFromOtherVarMem(VarId dest, VarMemory &other, VarId source);
 
         void SetKeepAllocStats(bool allocstats);
@@ -742,13 +925,97 @@ class BLEXLIB_PUBLIC VarMemory
         /** Remove a reference to any external reference counts */
         void Dereference_Externals(VarStore &store);
 
-        void UnmarkUsed(VarStore *buf);
-
-        /** Marks a variable and all objects beneath that variable as used (use
-            preferrably only for arrays, records and objects)
-            @return Returns whether a live object was found (ignoring default objects)
+        /* The object collector is an incremental mark and sweep collector, breaking the
+           reference cycles the reference counting can't release. Marking starts at the
+           stack, the global variables and the external heap variables. Arrays and records
+           are walked with an explicit work list, objects found within them are queued in
+           gcqueue, so the C stack depth doesn't depend on the object graph.
+
+           Between the slices the script may modify the graph. CellWriteBarrier remembers
+           the modified cells of objects that were already marked, and the roots are
+           scanned again when the queue is empty, in a final slice that can't be
+           interrupted. The unreachable objects are then released in slices too. Objects
+           created while sweeping are marked immediately.
+
+           New objects are also added to the nursery. Most objects die young, so a minor
+           collection only looks at the objects in the nursery. The stack, the global
+           variables and the external heap variables aren't protected by a write barrier,
+           so the references from outside the nursery aren't found by scanning them but by
+           comparing the strong reference count of each object with the number of
+           references from within the nursery. Nursery objects with other references, and
+           the nursery objects reachable from them, survive and are moved to the old
+           generation. The old generation is collected by the major collector.
         */
-        bool RecursiveMarkUsed(VarStore *buf);
+        /// Number of objects in the nursery that starts a minor collection
+        static const unsigned GCNurseryLimit = 10000;
+
+        enum GCPhase
+        {
+                GCIdle,         ///< No collection in progress
+                GCMarking,      ///< Marking the reachable objects
+                GCSweeping      ///< Releasing the unreachable objects
+        };
+
+        /// Remember a modified cell of an object, if the object has already been marked
+        void GCRememberCell(VarId object, VarId cellvar);
+
+        /// Start a new collection cycle
+        void GCStartCycle(unsigned *work);
+
+        /// Scan the stack, and queue the other roots for marking
+        void GCQueueRoots(unsigned *work);
+
+        /** Mark queued variables until the budget is used up
+            @return True if the queue is empty */
+        bool GCMarkQueued(unsigned *work, unsigned budget);
+
+        /// Rescan the roots and the modified cells, and mark everything that is still unmarked
+        void GCFinishMarking(unsigned *work);
+
+        /** Mark an object and scan its cells, if it hasn't been marked yet in this cycle
+            @param bufpos Backing of the object */
+        void GCScanObject(SharedPool::Allocation bufpos, unsigned *work);
+
+        /** Scan a variable and the arrays and records within it for objects. Objects in
+            heap variables are queued, objects on the stack are scanned immediately
+            @return Returns whether an object was found (ignoring default objects) */
+        bool GCScanVariable(VarId id, unsigned *work);
+
+        /** Release unreachable objects until the budget is used up
+            @return True if the sweep has finished */
+        bool GCSweep(unsigned *work, unsigned budget);
+
+        /// Finish the current collection cycle
+        void GCFinishCycle();
+
+        /** Add a collection pause to the statistics
+            @return Duration of the pause, in microseconds */
+        uint64_t GCRecordPause(uint64_t startticks);
+
+        /// Remove an object from the nursery, when it is destroyed
+        void GCForgetYoung(ObjectBacking *backing)
+        {
+                if (backing->nurseryslot != OldGeneration)
+                {
+                        nursery[backing->nurseryslot] = SharedPool::AllocationUnused;
+                        backing->nurseryslot = OldGeneration;
+                }
+        }
+
+        /** Call a function for every object variable in the cells of an object, and in
+            the arrays and records within them
+            @param backing Object to scan
+            @param only_private Skip shared array, record and cell backings. The variables
+                within them are also referenced from elsewhere.
+            @param func Function to call with the variable */
+        template < class Func >
+          void GCForEachObjectVar(ObjectBacking const *backing, bool only_private, Func const &func);
+
+        /// Returns whether an object is unreachable but hasn't been released by the running sweep yet
+        bool GCIsUnreachable(ObjectBacking const *backing) const
+        {
+                return gcphase == GCSweeping && backing->markcycle != gccycle;
+        }
 
         struct ObjectData
         {
@@ -765,6 +1032,81 @@ class BLEXLIB_PUBLIC VarMemory
 
         int32_t objectcount;
 
+        /// Number of cell lookups resolved by an inline cache
+        uint64_t cellcache_hits;
+
+        /// Number of cell lookups with an inline cache that needed a full scan
+        uint64_t cellcache_misses;
+
+        /// Number of shared records that were cloned to be modified
+        uint64_t recordclones;
+
+        /// Number of cells allocated for record clones
+        uint64_t recordclonedcells;
+
+        /// Interned record shapes, indexed by RecordShapeId
+        std::vector< RecordShape > recordshapes;
+
+        /// Cached shape transitions, keyed on (shape << 33) | (remove << 32) | nameid
+        std::unordered_map< uint64_t, RecordShapeId > recordshapetransitions;
+
+        /// Total number of column names stored in recordshapes
+        unsigned recordshapenames;
+
+        /// Phase of the object collector
+        GCPhase gcphase;
+
+        /// Current collection cycle, never 0. Objects with this markcycle have been marked in this cycle
+        unsigned gccycle;
+
+        /// Heap variables queued for marking
+        std::vector< VarId > gcqueue;
+
+        /// Work list for GCScanVariable
+        std::vector< VarId > gcscanlist;
+
+        /// Cells of marked objects that have been modified while marking
+        std::vector< VarId > gcdirtycells;
+
+        /// Next heap variable to sweep
+        HeapId gcsweeppos;
+
+        /// Limit of the heap variables to sweep (variables created while sweeping are reachable)
+        HeapId gcsweepend;
+
+        /// Objects created since the last minor collection. Destroyed objects are AllocationUnused
+        std::vector< SharedPool::Allocation > nursery;
+
+        /// Number of objects moved to the old generation since the last major collection
+        unsigned gcpromotions;
+
+        /// Number of promoted objects that starts an incremental major collection
+        unsigned gcthreshold;
+
+        /// Number of finished major collections
+        uint64_t gccycles;
+
+        /// Number of minor collections
+        uint64_t gcminorcycles;
+
+        /// Time spent in minor collections, in microseconds
+        uint64_t gcminortime;
+
+        /// Time spent in major collections, in microseconds
+        uint64_t gcmajortime;
+
+        /// Number of collection pauses (full collections and incremental slices)
+        uint64_t gcpauses;
+
+        /// Total time spent collecting, in microseconds
+        uint64_t gctime;
+
+        /// Longest collection pause, in microseconds
+        uint64_t gcmaxpause;
+
+        /// Number of collection pauses per duration class
+        uint64_t gcpausehistogram[GCPauseHistogramBuckets];
+
         /// Whether to keep alloc stats
         bool keep_allocstats;
 
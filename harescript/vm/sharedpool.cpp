@@ -397,6 +397,217 @@ void SharedPool::CheckIsValidUsedBlock(Allocation buffer_pos)
             throw VMRuntimeError(Error::InternalError, "Illegal buffer position #" + Blex::AnyToString(buffer_pos) + " (block has already been freed)");
 }
 
+SlabSharedPool::Allocation const SlabSharedPool::AllocationUnused;
+unsigned const SlabSharedPool::NoSlot;
+
+// Slot sizes grow by at most 50% per class (25% for the bigger classes), which bounds the slack within a slot
+unsigned const SlabSharedPool::SlotSizes[SlabSharedPool::NumSizeClasses] =
+        { 16, 24, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 640, 768, 1024, 1280, 1536, 2048 };
+
+SlabSharedPool::SlabSharedPool()
+: totalcapacity(0)
+{
+        std::fill(partialslabs, partialslabs + NumSizeClasses, NoSlot);
+        std::fill(numclassslabs, numclassslabs + NumSizeClasses, 0);
+
+        unsigned sizeclass = 0;
+        for (unsigned i = 0; i < MaxSlotSize / sizeof(SlotHeader); ++i)
+        {
+                if ((i + 1) * sizeof(SlotHeader) > SlotSizes[sizeclass])
+                    ++sizeclass;
+                sizeclasses[i] = sizeclass;
+        }
+}
+
+SlabSharedPool::~SlabSharedPool()
+{
+        for (auto &slab: slabs)
+            free(slab.data);
+}
+
+SlabSharedPool::Allocation SlabSharedPool::Allocate(unsigned size, unsigned reserve)
+{
+        if (reserve < size)
+            reserve = size;
+
+        unsigned sizeclass = GetSizeClass(reserve);
+        unsigned slabid;
+        if (sizeclass == LargeSizeClass)
+        {
+                if (reserve > std::numeric_limits< unsigned >::max() - 2 * sizeof(SlotHeader))
+                    throw std::bad_alloc();
+
+                // Round up, so the data of the large allocations has the same alignment as in the normal slots
+                slabid = CreateSlab(LargeSizeClass, (reserve + 2 * sizeof(SlotHeader) - 1) & ~(sizeof(SlotHeader) - 1));
+        }
+        else
+        {
+                slabid = partialslabs[sizeclass];
+                if (slabid == NoSlot)
+                    slabid = CreateSlab(sizeclass, SlotSizes[sizeclass]);
+        }
+
+        Slab &slab = slabs[slabid];
+        unsigned slot;
+        if (slab.firstfree != NoSlot)
+        {
+                slot = slab.firstfree;
+                slab.firstfree = reinterpret_cast< SlotHeader * >(slab.data + slot * slab.slotsize)->size;
+        }
+        else
+            slot = slab.initializedslots++;
+
+        if (++slab.usedslots == slab.numslots && sizeclass != LargeSizeClass)
+            UnlinkPartial(slabid);
+
+        Allocation newpos = (slabid << SlotBits) | slot;
+        SlotHeader *header = GetHeader(newpos);
+        header->refcount = 1;
+        header->size = size;
+        return newpos;
+}
+
+unsigned SlabSharedPool::CreateSlab(unsigned sizeclass, unsigned slotsize)
+{
+        unsigned numslots = 1;
+        if (sizeclass != LargeSizeClass)
+        {
+                unsigned shift = numclassslabs[sizeclass]++;
+                unsigned slabsize = MinSlabSize << (shift < MaxSlabShift ? shift : MaxSlabShift);
+                numslots = std::min(std::max(slabsize / slotsize, 1u), SlotMask + 1);
+        }
+
+        uint8_t *data = static_cast< uint8_t * >(malloc(static_cast< size_t >(numslots) * slotsize));
+        if (!data)
+            throw std::bad_alloc();
+
+        unsigned slabid;
+        if (!releasedslabs.empty())
+        {
+                slabid = releasedslabs.back();
+                releasedslabs.pop_back();
+        }
+        else
+        {
+                slabid = slabs.size();
+                if (slabid >= MaxSlabs)
+                {
+                        free(data);
+                        throw std::bad_alloc();
+                }
+                slabs.push_back(Slab());
+        }
+
+        Slab &slab = slabs[slabid];
+        slab.data = data;
+        slab.sizeclass = sizeclass;
+        slab.slotsize = slotsize;
+        slab.numslots = numslots;
+        slab.usedslots = 0;
+        slab.initializedslots = 0;
+        slab.firstfree = NoSlot;
+        slab.prevpartial = NoSlot;
+        slab.nextpartial = NoSlot;
+        totalcapacity += numslots * slotsize;
+
+        if (sizeclass != LargeSizeClass)
+            LinkPartial(slabid);
+        return slabid;
+}
+
+void SlabSharedPool::FreeSlot(Allocation buffer_pos)
+{
+        unsigned slabid = buffer_pos >> SlotBits;
+        Slab &slab = slabs[slabid];
+        if (slab.sizeclass == LargeSizeClass)
+        {
+                ReleaseSlab(slabid);
+                return;
+        }
+
+        unsigned slot = buffer_pos & SlotMask;
+        GetHeader(buffer_pos)->size = slab.firstfree;
+        slab.firstfree = slot;
+
+        // Full slabs aren't in the partial list
+        if (slab.usedslots-- == slab.numslots)
+            LinkPartial(slabid);
+
+        // Release empty slabs, but keep one around to prevent thrashing when allocating and freeing a single slot
+        if (slab.usedslots == 0 && (partialslabs[slab.sizeclass] != slabid || slab.nextpartial != NoSlot))
+        {
+                UnlinkPartial(slabid);
+                ReleaseSlab(slabid);
+        }
+}
+
+void SlabSharedPool::ReleaseSlab(unsigned slabid)
+{
+        Slab &slab = slabs[slabid];
+        totalcapacity -= slab.numslots * slab.slotsize;
+        if (slab.sizeclass != LargeSizeClass)
+            --numclassslabs[slab.sizeclass];
+        free(slab.data);
+        slab.data = 0;
+        releasedslabs.push_back(slabid);
+}
+
+void SlabSharedPool::LinkPartial(unsigned slabid)
+{
+        Slab &slab = slabs[slabid];
+        unsigned &first = partialslabs[slab.sizeclass];
+
+        slab.prevpartial = NoSlot;
+        slab.nextpartial = first;
+        if (first != NoSlot)
+            slabs[first].prevpartial = slabid;
+        first = slabid;
+}
+
+void SlabSharedPool::UnlinkPartial(unsigned slabid)
+{
+        Slab &slab = slabs[slabid];
+        if (slab.prevpartial != NoSlot)
+            slabs[slab.prevpartial].nextpartial = slab.nextpartial;
+        else
+            partialslabs[slab.sizeclass] = slab.nextpartial;
+        if (slab.nextpartial != NoSlot)
+            slabs[slab.nextpartial].prevpartial = slab.prevpartial;
+}
+
+SlabSharedPool::Allocation SlabSharedPool::MakePrivate(Allocation buffer_pos, unsigned new_size, bool preserve_contents)
+{
+        SlotHeader *header = GetHeader(buffer_pos);
+        if (header->refcount == 1)
+        {
+                unsigned capacity = slabs[buffer_pos >> SlotBits].slotsize - sizeof(SlotHeader);
+
+                // Reuse the slot if the new size fits, and doesn't waste too much space
+                if (new_size <= capacity && (new_size >= capacity / 4 || capacity <= 64))
+                {
+                        header->size = new_size;
+                        return buffer_pos;
+                }
+        }
+
+        //Reallocate..
+        unsigned oldsize = header->size;
+
+        unsigned to_reserve = oldsize * 2;
+        if (to_reserve < new_size)
+            to_reserve = new_size;
+        else if (to_reserve > new_size * 2)
+            to_reserve = new_size * 2;
+
+        // The old slot stays where it is, so the header pointer remains valid
+        Allocation newpos = Allocate(new_size, to_reserve);
+        if (preserve_contents)
+            std::memcpy(GetWritePtr(newpos), header + 1, std::min(oldsize, new_size));
+
+        ReleaseReference(buffer_pos);
+        return newpos;
+}
+
 DebugSharedPool::DebugSharedPool()
 {
         AllocationRec rec;
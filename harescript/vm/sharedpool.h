@@ -7,6 +7,9 @@
 // If enabled, allocations are checked at various points if they still point to valid blocks
 //#define CHECK_ALLOCATION_POINTERS
 
+// If enabled, the VM stores its variable backings in a SlabSharedPool instead of a SharedPool
+//#define USE_SLAB_SHAREDPOOL
+
 // Impl.
 #ifdef CHECK_ALLOCATION_POINTERS
  #define CHECK_AP_ONLY(x) x
@@ -208,6 +211,196 @@ class BLEXLIB_PUBLIC SharedPool
         Allocation freeblocks[TotalStorageGroups];
 };
 
+/** SlabSharedPool, slab allocator for refcounted shared allocations.
+
+This class offers the same interface as SharedPool, but stores the allocations
+in slabs of equally sized slots. Every size class has its own slabs, so freed
+slots are reused by allocations of the same class without having to search or
+merge free blocks. The reference count and size are stored in the 8 bytes just
+before the data.
+
+Slabs are never moved, so unlike SharedPool, pointers to data stay valid until
+the allocation itself is released or reallocated by MakePrivate. Slabs that
+become empty are released, unless they are the last slab with free slots of
+their size class. The slabs of a size class grow as more of them are needed, so
+small pools stay small. Allocations larger than the biggest size class get a
+slab of their own.
+
+It is only multi-thread safe when serialized.
+*/
+class BLEXLIB_PUBLIC SlabSharedPool
+{
+    public:
+        /** Allocation index. The high bits contain the slab, the low bits the slot within the slab */
+        typedef unsigned Allocation;
+
+        /** Allocation index of an unused buffer */
+        static Allocation const AllocationUnused = static_cast<Allocation>(-1);
+
+        /** Construct an empty shared pool*/
+        SlabSharedPool();
+
+        /** Destroy the shared pool*/
+        ~SlabSharedPool();
+
+        /** Allocate a new buffer
+            @param size Requested size
+            @param reserve Size to reserve
+            @return Index to the newly allocated bufer */
+        Allocation Allocate(unsigned size, unsigned reserve);
+
+        /** Duplicate an allocation (increases its reference count)
+            @param buffer_pos    the pos of the Buffer to increase the refcount*/
+        void DuplicateReference (Allocation buffer_pos)
+        {
+                ++GetHeader(buffer_pos)->refcount;
+        }
+
+        /** Decreases the refcount of the block, and free the block if its refcount
+            reaches zero
+            @param buffer_pos    the pos of the Buffer to decrease the refcount*/
+        void ReleaseReference(Allocation buffer_pos)
+        {
+                if (--GetHeader(buffer_pos)->refcount == 0)
+                    FreeSlot(buffer_pos);
+        }
+
+        /** Checks if the allocation has a reference count of 1 */
+        bool IsShared (Allocation buffer_pos) const
+        { return GetHeader(buffer_pos)->refcount > 1; }
+
+        /** GetReadPtr
+            @return A read-only pointer to the requested buffer, aligned on 8 bytes */
+        void const * GetReadPtr (Allocation buffer_pos) const
+        { return GetHeader(buffer_pos) + 1; }
+
+        /** GetWritePtr
+            @return A writable pointer to the requested buffer, aligned on 8 bytes */
+        void * GetWritePtr (Allocation buffer_pos)
+        { return GetHeader(buffer_pos) + 1; }
+
+        /** Returns a buffer with refcount 1. If the current buffer already has refcount 1, it is reused.
+            Optionally copies the contents of the old buffer to the new buffer.
+            @param buffer_id      the pos of the buffer to write to
+            @param size           the size   the buffer should be
+            @param preserve_contents Copy the contents of the old buffer to the new buffer
+            @return               a void-pointer to the writable buffer  */
+        Allocation MakePrivate(Allocation buffer_pos, unsigned size, bool preserve_contents);
+
+        /** Get the size of an allocation
+            @param buffer_pos     the pos of the Buffer to get the length from
+            @return               the size of the specified buffer */
+        unsigned GetBufferSize     (Allocation buffer_pos) const
+        { return GetHeader(buffer_pos)->size; }
+
+        /** Get the total size of all slabs */
+        unsigned GetCapacity() const
+        { return totalcapacity; }
+
+    private:
+        /** Header stored before the data of every slot */
+        struct SlotHeader
+        {
+                /// Reference count, 0 for free slots
+                uint32_t refcount;
+                /// Size of the allocation. Index of the next free slot for free slots
+                uint32_t size;
+        };
+
+        struct Slab
+        {
+                /// Slot storage, NULL for released slabs
+                uint8_t *data;
+                /// Size class, LargeSizeClass for slabs with a single big allocation
+                unsigned sizeclass;
+                /// Distance between the slots, including the header
+                unsigned slotsize;
+                /// Number of slots in the slab
+                unsigned numslots;
+                /// Number of allocated slots
+                unsigned usedslots;
+                /// Number of slots that have ever been handed out, the rest is untouched
+                unsigned initializedslots;
+                /// First slot in the list of freed slots, NoSlot if empty
+                unsigned firstfree;
+                /// Previous and next slab in the list of slabs with free slots of this size class
+                unsigned prevpartial;
+                unsigned nextpartial;
+        };
+
+        /** Number of bits of an allocation index used for the slot within a slab */
+        static unsigned const SlotBits = 12;
+        /** Mask for the slot within a slab */
+        static unsigned const SlotMask = (1 << SlotBits) - 1;
+        /** Maximum number of slabs (the highest slab id would collide with AllocationUnused) */
+        static unsigned const MaxSlabs = (static_cast<Allocation>(-1) >> SlotBits);
+        /** Size of the first slab of a size class. Every extra slab of that class is twice as big, up to 16 times this size */
+        static unsigned const MinSlabSize = 4*1024;
+        /** Log2 of the maximum slab size relative to MinSlabSize */
+        static unsigned const MaxSlabShift = 4;
+        /** Number of size classes */
+        static unsigned const NumSizeClasses = 20;
+        /** Size class of slabs containing a single allocation that is too big for the other classes */
+        static unsigned const LargeSizeClass = NumSizeClasses;
+        /** Marks the end of slot and slab lists */
+        static unsigned const NoSlot = static_cast<unsigned>(-1);
+        /** Slot sizes (including the header) per size class */
+        static unsigned const SlotSizes[NumSizeClasses];
+        /** Slot size of the biggest size class */
+        static unsigned const MaxSlotSize = 2048;
+
+        SlotHeader * GetHeader(Allocation buffer_pos) const
+        {
+                Slab const &slab = slabs[buffer_pos >> SlotBits];
+                return reinterpret_cast< SlotHeader * >(slab.data + (buffer_pos & SlotMask) * slab.slotsize);
+        }
+
+        /** Get the size class for a given capacity */
+        unsigned GetSizeClass(unsigned reserve) const
+        {
+                unsigned slotsize = reserve + sizeof(SlotHeader);
+                if (slotsize < reserve || slotsize > MaxSlotSize)
+                    return LargeSizeClass;
+                return sizeclasses[(slotsize - 1) / sizeof(SlotHeader)];
+        }
+
+        /** Create a new slab with free slots
+            @param sizeclass Size class of the slab
+            @param slotsize Size of the slots (including header)
+            @return Id of the new slab */
+        unsigned CreateSlab(unsigned sizeclass, unsigned slotsize);
+
+        /** Free a slot (used by ReleaseReference when the refcount reaches zero) */
+        void FreeSlot(Allocation buffer_pos);
+
+        /** Release the storage of an empty slab */
+        void ReleaseSlab(unsigned slabid);
+
+        /** Add a slab to the list of slabs with free slots */
+        void LinkPartial(unsigned slabid);
+
+        /** Remove a slab from the list of slabs with free slots */
+        void UnlinkPartial(unsigned slabid);
+
+        /// All slabs, indexed by slab id
+        std::vector< Slab > slabs;
+
+        /// Ids of released slabs, to be reused
+        std::vector< unsigned > releasedslabs;
+
+        /// First slab with free slots per size class, NoSlot if none
+        unsigned partialslabs[NumSizeClasses];
+
+        /// Number of slabs per size class
+        unsigned numclassslabs[NumSizeClasses];
+
+        /// Size class per slot size, in units of sizeof(SlotHeader) (rounded up)
+        uint8_t sizeclasses[MaxSlotSize / sizeof(SlotHeader)];
+
+        /// Total size of all slabs
+        unsigned totalcapacity;
+};
+
 class DebugSharedPool
 {
         struct AllocationRec
@@ -247,5 +440,12 @@ class DebugSharedPool
         void ValidateAllocation(Allocation buffer_pos) const;
 };
 
+/** The pool in which the VM stores its variable backings */
+#ifdef USE_SLAB_SHAREDPOOL
+typedef SlabSharedPool BackingPool;
+#else
+typedef SharedPool BackingPool;
+#endif
+
 } // End of namespace HareScript
 #endif
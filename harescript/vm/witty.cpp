@@ -56,7 +56,7 @@ static const char *WittyMessages[]=
 , "/RAWCOMPONENT must be inside a RAWCOMPONENT-block" // 27
 };
 
-WittyExecutionState::WittyExecutionState(ParsedFile &file, HSVM *hsvm, int32_t scriptid, bool newwitty)
+WittyExecutionState::WittyExecutionState(ParsedFile const &file, HSVM *hsvm, int32_t scriptid, bool newwitty)
 : file(file)
 , hsvm(hsvm)
 , gettidfunc(0)
@@ -235,13 +235,126 @@ ParsedFile::~ParsedFile()
 {
 }
 
+ParsedFileCache::LockedData ParsedFileCache::data;
+
+namespace
+{
+///Maximum total size of the sources of the cached templates
+const uint64_t MaxCachedSourceSize = 64 * 1024 * 1024;
+} // End of anonymous namespace
+
+size_t ParsedFileCache::GetHash(uint64_t columnmapperid, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule)
+{
+        size_t hash = std::hash< std::string_view >()(source.stl_stringview()) ^ std::hash< uint64_t >()(columnmapperid);
+        hash = hash * 31 + std::hash< std::string >()(gettidmodule);
+        return hash * 31 + encoding.style * 2 + encoding.noindent;
+}
+
+std::list< ParsedFileCache::Entry >::iterator ParsedFileCache::Find(Data &data, size_t hash, uint64_t columnmapperid, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule)
+{
+        auto range = data.index.equal_range(hash);
+        for (auto itr = range.first; itr != range.second; ++itr)
+        {
+                Entry const &entry = *itr->second;
+                if (entry.columnmapperid == columnmapperid
+                        && entry.encoding.style == encoding.style
+                        && entry.encoding.noindent == encoding.noindent
+                        && entry.gettidmodule == gettidmodule
+                        && std::string_view(entry.source) == source.stl_stringview())
+                    return itr->second;
+        }
+        return data.entries.end();
+}
+
+ParsedFilePtr ParsedFileCache::Lookup(ColumnNames::GlobalMapper const *columnmapper, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule)
+{
+        uint64_t columnmapperid = columnmapper->GetId();
+        size_t hash = GetHash(columnmapperid, source, encoding, gettidmodule);
+
+        LockedData::WriteRef lock(data);
+        auto itr = Find(*lock, hash, columnmapperid, source, encoding, gettidmodule);
+        if (itr == lock->entries.end())
+        {
+                ++lock->misses;
+                return ParsedFilePtr();
+        }
+
+        ++lock->hits;
+        lock->entries.splice(lock->entries.begin(), lock->entries, itr);
+        return itr->file;
+}
+
+void ParsedFileCache::Insert(ColumnNames::GlobalMapper const *columnmapper, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule, ParsedFilePtr const &file)
+{
+        uint64_t columnmapperid = columnmapper->GetId();
+        size_t hash = GetHash(columnmapperid, source, encoding, gettidmodule);
+
+        LockedData::WriteRef lock(data);
+
+        // Another VM may have parsed the same template in the meantime
+        if (Find(*lock, hash, columnmapperid, source, encoding, gettidmodule) != lock->entries.end())
+            return;
+
+        lock->entries.push_front(Entry{ columnmapperid, hash, source.stl_str(), encoding, gettidmodule, file });
+        lock->index.insert(std::make_pair(hash, lock->entries.begin()));
+        lock->sourcesize += source.size();
+
+        // Evict the least recently used templates, VMs using them keep their own reference
+        while (lock->sourcesize > MaxCachedSourceSize && lock->entries.size() > 1)
+        {
+                auto last = std::prev(lock->entries.end());
+                auto range = lock->index.equal_range(last->hash);
+                for (auto itr = range.first; itr != range.second; ++itr)
+                    if (itr->second == last)
+                    {
+                            lock->index.erase(itr);
+                            break;
+                    }
+
+                lock->sourcesize -= last->source.size();
+                lock->entries.erase(last);
+        }
+}
+
+ParsedFileCache::Statistics ParsedFileCache::GetStatistics()
+{
+        LockedData::ReadRef lock(data);
+
+        Statistics stats;
+        stats.hits = lock->hits;
+        stats.misses = lock->misses;
+        stats.entries = lock->entries.size();
+        stats.sourcesize = lock->sourcesize;
+        return stats;
+}
+
+int32_t Context::ParseXmlTemplate(HSVM *hsvm, char const *data, unsigned datalen, Encoding encoding, std::string const &gettidmodule)
+{
+        ColumnNames::GlobalMapper const *columnmapper = &GetVirtualMachine(hsvm)->GetEnvironment().GetColumnNameMapper();
+        Blex::StringPair source(data, data + datalen);
+        ParsedFilePtr file = ParsedFileCache::Lookup(columnmapper, source, encoding, gettidmodule);
+        if (file)
+            errors.clear();
+        else
+        {
+                file = DoParseXmlTemplate(hsvm, data, datalen, encoding, gettidmodule);
+                if (!file)
+                    return 0;
+
+                ParsedFileCache::Insert(columnmapper, source, encoding, gettidmodule, file);
+        }
+
+        parsedfiles.push_back(file);
+        return parsedfiles.size();
+}
+
 /* A simple stateful template parser, suitable for parsing Text, HTML, XHTML and XML contexts */
-int32_t Context::ParseXmlTemplate(char const *data, unsigned datalen, Encoding encoding, std::string const &gettidmodule)
+std::shared_ptr< ParsedFile > Context::DoParseXmlTemplate(HSVM *hsvm, char const *data, unsigned datalen, Encoding encoding, std::string const &gettidmodule)
 {
         static const char instr_endrawcomponent[]={"/rawcomponent"};
         EncodingStyles encodingstyle = encoding.style;
         bool stripindent = encoding.noindent;
-        ParsedFilePtr newfile(new ParsedFile(gettidmodule, encodingstyle));
+        std::shared_ptr< ParsedFile > newfile(new ParsedFile(gettidmodule, encodingstyle));
         ParserStates state = encodingstyle==ES_Text ? PS_Text : PS_Content;
 
 
@@ -307,7 +420,7 @@ int32_t Context::ParseXmlTemplate(char const *data, unsigned datalen, Encoding e
                                         if (end_instruction == enddata)
                                         {
                                                 AddError(Error(linenum,columnnum,1,""));
-                                                return 0;
+                                                return nullptr;
                                         }
                                         if (*end_instruction == '\n')
                                         {
@@ -430,10 +543,10 @@ int32_t Context::ParseXmlTemplate(char const *data, unsigned datalen, Encoding e
            AddError(Error(linenum, columnnum, 14, ""));
 
         if (!errors.empty())
-            return 0;
+            return nullptr;
 
-        parsedfiles.push_back(newfile);
-        return parsedfiles.size();
+        newfile->ResolveCells(hsvm);
+        return newfile;
 }
 
 bool ParsedFile::ParseParameter(unsigned linenum, unsigned columnnum, const char *last_end, const char *limit, std::string *data, DataType *datatype, const char **param_end, bool stop_at_colon, bool required)
@@ -603,7 +716,7 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
                         }
 
                         Blex::ToUppercase(parts.back().content.begin(), parts.back().content.end());
-                        blockstack.push(&parts.back());
+                        blockstack.push(parts.size() - 1);
 
                         start = param_end;
                 } break;
@@ -611,12 +724,12 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
         case C_ElseIf:
                 //[elseif XXX] = [else][if XXX].....   and an extra endif layer at the end.....
                 {
-                        if (blockstack.empty() || (blockstack.top()->type != ParsedPart::If && blockstack.top()->type != ParsedPart::ElseIf))
+                        if (blockstack.empty() || (parts[blockstack.top()].type != ParsedPart::If && parts[blockstack.top()].type != ParsedPart::ElseIf))
                             throw Error(linenum, columnnum, 6,"");
-                        if (blockstack.top()->cmd_limit != 0)
+                        if (parts[blockstack.top()].cmd_limit != 0)
                             throw Error(linenum, columnnum, 7,"");
 
-                        blockstack.top()->cmd_limit = parts.size();
+                        parts[blockstack.top()].cmd_limit = parts.size();
 
                         parts.push_back(ParsedPart(linenum, columnnum, ParsedPart::ElseIf));
 
@@ -630,19 +743,19 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
                         }
 
                         Blex::ToUppercase(parts.back().content.begin(), parts.back().content.end());
-                        blockstack.push(&parts.back());
+                        blockstack.push(parts.size() - 1);
 
                         start = param_end;
                 } break;
 
         case C_Else:
                 {
-                        if (blockstack.empty() || (blockstack.top()->type != ParsedPart::If && blockstack.top()->type != ParsedPart::ElseIf))
+                        if (blockstack.empty() || (parts[blockstack.top()].type != ParsedPart::If && parts[blockstack.top()].type != ParsedPart::ElseIf))
                             throw Error(linenum, columnnum, 6,"");
-                        if (blockstack.top()->cmd_limit != 0)
+                        if (parts[blockstack.top()].cmd_limit != 0)
                             throw Error(linenum, columnnum, 7,"");
                         //Start a new content block
-                        blockstack.top()->cmd_limit = parts.size();
+                        parts[blockstack.top()].cmd_limit = parts.size();
                         parts.push_back(ParsedPart(linenum, columnnum, ParsedPart::Content));
                         start = command_end;
                 } break;
@@ -654,13 +767,13 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
                                 if (blockstack.empty())
                                     throw Error(linenum, columnnum, 8,"");
 
-                                ParsedPart::Type thistype = blockstack.top()->type;
+                                ParsedPart::Type thistype = parts[blockstack.top()].type;
                                 if(thistype != ParsedPart::If && thistype != ParsedPart::ElseIf)
                                     throw Error(linenum, columnnum, 8,"");
 
-                                if (blockstack.top()->cmd_limit == 0)
-                                    blockstack.top()->cmd_limit = parts.size();
-                                blockstack.top()->else_limit = parts.size();
+                                if (parts[blockstack.top()].cmd_limit == 0)
+                                    parts[blockstack.top()].cmd_limit = parts.size();
+                                parts[blockstack.top()].else_limit = parts.size();
                                 parts.push_back(ParsedPart(linenum, columnnum, ParsedPart::Content));
                                 blockstack.pop();
 
@@ -680,15 +793,15 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
                             throw Error(linenum, columnnum, 11,"");
 
                         Blex::ToUppercase(parts.back().content.begin(), parts.back().content.end());
-                        blockstack.push(&parts.back());
+                        blockstack.push(parts.size() - 1);
                         start = param_end;
                 } break;
 
         case C_EndForevery:
                 {
-                        if (blockstack.empty() || blockstack.top()->type != ParsedPart::Forevery)
+                        if (blockstack.empty() || parts[blockstack.top()].type != ParsedPart::Forevery)
                             throw Error(linenum, columnnum, 12,"");
-                        blockstack.top()->cmd_limit = parts.size();
+                        parts[blockstack.top()].cmd_limit = parts.size();
                         parts.push_back(ParsedPart(linenum, columnnum, ParsedPart::Content));
                         blockstack.pop();
                         start = command_end;
@@ -710,7 +823,7 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
                             throw Error(linenum, columnnum, 9,"");
 
                         start_positions.insert(std::make_pair(parts.back().content, parts.size()));
-                        blockstack.push(&parts.back());
+                        blockstack.push(parts.size() - 1);
                         start = param_end;
 
                         if(cmd == C_RawComponent)
@@ -722,12 +835,12 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
         case C_EndComponent:
         case C_EndRawComponent:
                 {
-                        if (cmd==C_EndComponent && (blockstack.empty() || blockstack.top()->type != ParsedPart::Component || *state==PS_RawComponent))
+                        if (cmd==C_EndComponent && (blockstack.empty() || parts[blockstack.top()].type != ParsedPart::Component || *state==PS_RawComponent))
                             throw Error(linenum, columnnum, 10,"");
-                        if (cmd==C_EndRawComponent && (blockstack.empty() || blockstack.top()->type != ParsedPart::Component || *state!=PS_RawComponent))
+                        if (cmd==C_EndRawComponent && (blockstack.empty() || parts[blockstack.top()].type != ParsedPart::Component || *state!=PS_RawComponent))
                             throw Error(linenum, columnnum, 27,"");
 
-                        blockstack.top()->cmd_limit = parts.size();
+                        parts[blockstack.top()].cmd_limit = parts.size();
                         parts.push_back(ParsedPart(linenum, columnnum, ParsedPart::Content));
                         blockstack.pop();
                         start = command_end;
@@ -802,6 +915,48 @@ void ParsedFile::AddInstruction(unsigned linenum, unsigned columnnum, char const
             throw Error(linenum, columnnum, 3, std::string(start, limit));
 }
 
+CellPath ParsedFile::ResolveCell(HSVM *hsvm, std::string const &name)
+{
+        CellPath cell;
+        cell.pos = cellpaths.size();
+
+        std::string::const_iterator namestart = name.begin();
+        while (true)
+        {
+                std::string::const_iterator dot = std::find(namestart, name.end(), '.');
+                cellpaths.push_back(HSVM_GetColumnIdRange(hsvm, name.data() + (namestart - name.begin()), name.data() + (dot - name.begin())));
+                if (dot == name.end())
+                    break;
+                namestart = dot + 1;
+        }
+
+        cell.len = cellpaths.size() - cell.pos;
+        return cell;
+}
+
+void ParsedFile::ResolveCells(HSVM *hsvm)
+{
+        for (auto &part: parts)
+        {
+                switch (part.type)
+                {
+                case ParsedPart::Data:
+                case ParsedPart::If:
+                case ParsedPart::ElseIf:
+                case ParsedPart::Forevery:
+                        if (part.datatype == DT_Cell)
+                            part.cell = ResolveCell(hsvm, part.content);
+                        break;
+                case ParsedPart::GetTid:
+                case ParsedPart::GetHtmlTid:
+                        for (auto itr = part.parameters.begin() + 1; itr < part.parameters.end(); ++itr)
+                            part.parametercells.push_back(ResolveCell(hsvm, *itr));
+                        break;
+                default: ;
+                }
+        }
+}
+
 void Context::AddError(Error const &err)
 {
         errors.push_back(err);
@@ -821,7 +976,7 @@ void Parse(HSVM *hsvm, HSVM_VariableId id_set)
 
         Blex::StringPair content;
         HSVM_StringGet(hsvm, HSVM_Arg(0), &content.begin, &content.end);
-        HSVM_IntegerSet(hsvm, id_set, context.ParseXmlTemplate(content.begin, content.size(), encoding, gettidmodule));
+        HSVM_IntegerSet(hsvm, id_set, context.ParseXmlTemplate(hsvm, content.begin, content.size(), encoding, gettidmodule));
 }
 
 void ParseBlob(HSVM *hsvm, HSVM_VariableId id_set)
@@ -840,7 +995,7 @@ void ParseBlob(HSVM *hsvm, HSVM_VariableId id_set)
         HSVM_BlobRead(hsvm, handle, content.size(), &content[0]);
         HSVM_BlobClose(hsvm, handle);
 
-        HSVM_IntegerSet(hsvm, id_set, context.ParseXmlTemplate(&content[0], content.size(), encoding, gettidmodule));
+        HSVM_IntegerSet(hsvm, id_set, context.ParseXmlTemplate(hsvm, &content[0], content.size(), encoding, gettidmodule));
 }
 
 void GetWittyMessage(Error const &in, std::string *error)
@@ -918,7 +1073,7 @@ StackElement* FindForeveryInStack(WittyExecutionState *mywes)
              itr != context.sm_witties.rend();
              ++itr)
         {
-                std::list< StackElement >::reverse_iterator it = (*itr)->stack.rbegin();
+                auto it = (*itr)->stack.rbegin();
                 while (it != (*itr)->stack.rend() && it->forevery_elt_limit == -1)
                     ++it;
                 if(it != (*itr)->stack.rend())
@@ -931,13 +1086,11 @@ StackElement* FindForeveryInStack(WittyExecutionState *mywes)
         return 0;
 }
 
-HSVM_VariableId FindCellInStack(WittyExecutionState *wes, std::string const &cellname)
+HSVM_VariableId FindCellInStack(WittyExecutionState *wes, HSVM_ColumnId const *cellpath, unsigned pathlen)
 {
         HSVM *hsvm=wes->hsvm;
         Context &context = *static_cast<Context*>(HSVM_GetContext(hsvm,ContextId, true));
 
-        std::string::const_iterator dot = std::find(cellname.begin(), cellname.end(), '.');
-
         for (Context::SMWitties::reverse_iterator itr = context.sm_witties.rbegin();
              itr != context.sm_witties.rend();
              ++itr)
@@ -945,23 +1098,18 @@ HSVM_VariableId FindCellInStack(WittyExecutionState *wes, std::string const &cel
                 HSVM_VariableId colvar = 0;
 
                 //Look up the first cell name in ALL cells.
-                HSVM_ColumnId colid = HSVM_GetColumnIdRange(hsvm, &cellname[0], &*dot);
                 for (unsigned i=(*itr)->varstack.size();i>0 && colvar == 0;--i)
                 {
                         VarStackElement *elem = &(*itr)->varstack[i-1];
-                        if(dot==cellname.end() && elem->forevery_nonra) //a non-record forevery can never match a name with dots..
+                        if(elem->forevery_nonra) //a non-record forevery can never match a name with dots..
                         {
-                                //Get the last dot in the name
-                                std::string::const_iterator lastdot = std::find(elem->forevery_nonra->content.rbegin(), elem->forevery_nonra->content.rend(),'.').base();
-
-                                if(Blex::StrCaseCompare(lastdot, elem->forevery_nonra->content.end(),cellname.begin(), cellname.end()) == 0)
-                                {
-                                      colvar = elem->var;
-                                }
+                                //Match the last part of the name of the array
+                                if (pathlen == 1 && elem->forevery_nonra == cellpath[0])
+                                    colvar = elem->var;
                         }
                         else
                         {
-                                colvar = HSVM_RecordGetRef(hsvm, elem->var, colid);
+                                colvar = HSVM_RecordGetRef(hsvm, elem->var, cellpath[0]);
                         }
                 }
 
@@ -973,23 +1121,36 @@ HSVM_VariableId FindCellInStack(WittyExecutionState *wes, std::string const &cel
                 }
 
                 //Iteratively find any subcell names
-                while (colvar != 0 && dot != cellname.end())
+                for (unsigned i = 1; colvar != 0 && i < pathlen; ++i)
                 {
-                        std::string::const_iterator namestart = dot+1;
-
                         if (HSVM_GetType(hsvm, colvar) != HSVM_VAR_Record)
                                 return 0;
 
                         //Look up the next cell
-                        dot = std::find(namestart, cellname.end(), '.');
-                        colid = HSVM_GetColumnIdRange(hsvm, &*namestart, &*dot);
-                        colvar = HSVM_RecordGetRef(hsvm, colvar, colid);
+                        colvar = HSVM_RecordGetRef(hsvm, colvar, cellpath[i]);
                 }
                 return colvar;
         }
         return 0;
 }
 
+HSVM_VariableId FindCellInStack(WittyExecutionState *wes, std::string const &cellname)
+{
+        std::vector< HSVM_ColumnId > cellpath;
+
+        std::string::const_iterator namestart = cellname.begin();
+        while (true)
+        {
+                std::string::const_iterator dot = std::find(namestart, cellname.end(), '.');
+                cellpath.push_back(HSVM_GetColumnIdRange(wes->hsvm, cellname.data() + (namestart - cellname.begin()), cellname.data() + (dot - cellname.begin())));
+                if (dot == cellname.end())
+                    break;
+                namestart = dot + 1;
+        }
+
+        return FindCellInStack(wes, cellpath.data(), cellpath.size());
+}
+
 void WittyExecutionState::PrintEncoded(Blex::StringPair data,ContentEncoding encoding)
 {
         if (encoding==CE_None)
@@ -1137,7 +1298,7 @@ void ReturnHSResult(HSVM *hsvm, Error const *error)
 // New state machine
 //
 
-void ParsedFile::SM_Push(WittyExecutionState *wes, bool new_invocation, ParsedFile::PartItr itr, ParsedFile::PartItr limit, HSVM_VariableId var, bool root_invocation, ParsedPart const *forevery_nonra)
+void ParsedFile::SM_Push(WittyExecutionState *wes, bool new_invocation, ParsedFile::PartItr itr, ParsedFile::PartItr limit, HSVM_VariableId var, bool root_invocation, ParsedPart const *forevery_nonra) const
 {
         StackElement elt;
         elt.iv_depth = wes->stack.empty() ? 1 : wes->stack.back().iv_depth + (new_invocation ? 1 : 0);
@@ -1153,13 +1314,13 @@ void ParsedFile::SM_Push(WittyExecutionState *wes, bool new_invocation, ParsedFi
                 elt.var_is_alloced = true;
         }
         if (elt.has_variable)
-                wes->varstack.push_back(VarStackElement(forevery_nonra, var));
+                wes->varstack.push_back(VarStackElement(forevery_nonra ? GetCellPath(forevery_nonra->cell)[forevery_nonra->cell.len - 1] : 0, var));
 
         elt.must_return = root_invocation;
         wes->stack.push_back(elt);
 }
 
-void ParsedFile::SM_PushComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, bool new_invocation, std::string const &componentname)
+void ParsedFile::SM_PushComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, bool new_invocation, std::string const &componentname) const
 {
         Components::const_iterator component = start_positions.find(componentname);
         if (component == start_positions.end())
@@ -1238,15 +1399,15 @@ bool ParsedFile::SM_EvaluateIf(HSVM *hsvm, WittyExecutionState *wes, HSVM_Variab
 
 struct SM_CallFinishGetTidCall : public SM_Continuation
 {
-        ParsedFile *pf;
+        ParsedFile const *pf;
         WittyExecutionState *wes;
         HSVM_VariableId retval;
 
-        SM_CallFinishGetTidCall(ParsedFile *pf, WittyExecutionState *wes, HSVM_VariableId retval);
+        SM_CallFinishGetTidCall(ParsedFile const *pf, WittyExecutionState *wes, HSVM_VariableId retval);
         virtual bool Execute();
 };
 
-SM_CallFinishGetTidCall::SM_CallFinishGetTidCall(ParsedFile *pf, WittyExecutionState *wes, HSVM_VariableId retval)
+SM_CallFinishGetTidCall::SM_CallFinishGetTidCall(ParsedFile const *pf, WittyExecutionState *wes, HSVM_VariableId retval)
 : pf(pf)
 , wes(wes)
 , retval(retval)
@@ -1258,7 +1419,7 @@ bool SM_CallFinishGetTidCall::Execute()
 }
 
 
-bool ParsedFile::SM_FinishGetTidCall(WittyExecutionState *wes, HSVM_VariableId retval)
+bool ParsedFile::SM_FinishGetTidCall(WittyExecutionState *wes, HSVM_VariableId retval) const
 {
         HSVM *hsvm=wes->hsvm;
         StackElement &elt = wes->stack.back();
@@ -1278,7 +1439,7 @@ bool ParsedFile::SM_FinishGetTidCall(WittyExecutionState *wes, HSVM_VariableId r
         return true;
 }
 
-std::pair< bool/*finished*/, bool/*success*/ > ParsedFile::SM_Run(WittyExecutionState *wes, std::function< void(bool) > const &reschedule)
+std::pair< bool/*finished*/, bool/*success*/ > ParsedFile::SM_Run(WittyExecutionState *wes, std::function< void(bool) > const &reschedule) const
 {
         if (wes->stack.empty())
             throw std::runtime_error("Running on empty witty stack!");
@@ -1315,7 +1476,7 @@ std::pair< bool/*finished*/, bool/*success*/ > ParsedFile::SM_Run(WittyExecution
                 bool ishtml = false;
                 if (elt.itr->type != ParsedPart::Content && elt.itr->type != ParsedPart::Component && elt.itr->type != ParsedPart::Embed && elt.itr->type != ParsedPart::GetTid && elt.itr->type != ParsedPart::GetHtmlTid && elt.itr->datatype == DT_Cell)
                 {
-                        varid = FindCellInStack(wes, elt.itr->content);
+                        varid = FindCellInStack(wes, GetCellPath(elt.itr->cell), elt.itr->cell.len);
                         if (!varid)
                             throw Error(elt.itr->linenum, elt.itr->columnnum, 15, elt.itr->content);
                 }
@@ -1336,17 +1497,23 @@ std::pair< bool/*finished*/, bool/*success*/ > ParsedFile::SM_Run(WittyExecution
                         } break;
                 case ParsedPart::If:
                 case ParsedPart::ElseIf:
-                        if (SM_EvaluateIf(hsvm, wes, varid) ^ elt.itr->ifnot)
                         {
-                                HSVM_VariableId recid = varid && HSVM_GetType(hsvm,varid) == HSVM_VAR_Record && !elt.itr->ifnot ? varid : 0;
-                                SM_Push(wes, false, elt.itr+1, parts.begin()+elt.itr->cmd_limit, recid, false, NULL);
-                        }
-                        else
-                        {
-                                SM_Push(wes, false, parts.begin()+elt.itr->cmd_limit, parts.begin()+elt.itr->else_limit, 0, false, NULL);
-                        }
-                        elt.itr = parts.begin()+elt.itr->else_limit;
-                        break;
+                                bool condition = SM_EvaluateIf(hsvm, wes, varid) ^ elt.itr->ifnot;
+
+                                // Pushing invalidates elt, so advance it first
+                                PartItr ifpart = elt.itr;
+                                elt.itr = parts.begin()+ifpart->else_limit;
+
+                                if (condition)
+                                {
+                                        HSVM_VariableId recid = varid && HSVM_GetType(hsvm,varid) == HSVM_VAR_Record && !ifpart->ifnot ? varid : 0;
+                                        SM_Push(wes, false, ifpart+1, parts.begin()+ifpart->cmd_limit, recid, false, NULL);
+                                }
+                                else
+                                {
+                                        SM_Push(wes, false, parts.begin()+ifpart->cmd_limit, parts.begin()+ifpart->else_limit, 0, false, NULL);
+                                }
+                        } break;
                 case ParsedPart::Component: //just skip it
                         elt.itr = parts.begin()+elt.itr->cmd_limit;
                         break;
@@ -1375,17 +1542,17 @@ std::pair< bool/*finished*/, bool/*success*/ > ParsedFile::SM_Run(WittyExecution
 
                                 HSVM_StringSetSTD(hsvm, HSVM_CallParam(hsvm, 0), elt.itr->parameters[0]);
 
-                                unsigned paramnr = 0;
-                                for (std::vector< std::string >::const_iterator it = elt.itr->parameters.begin() + 1; it != elt.itr->parameters.end(); ++it)
+                                for (unsigned paramnr = 1; paramnr < elt.itr->parameters.size(); ++paramnr)
                                 {
-                                        HSVM_VariableId dataid = FindCellInStack(wes, *it);
+                                        CellPath const &cell = elt.itr->parametercells[paramnr - 1];
+                                        HSVM_VariableId dataid = FindCellInStack(wes, GetCellPath(cell), cell.len);
                                         if (!dataid)
                                         {
                                                 HSVM_CancelFunctionCall(hsvm);
-                                                throw Error(elt.itr->linenum, elt.itr->columnnum, 15, *it);
+                                                throw Error(elt.itr->linenum, elt.itr->columnnum, 15, elt.itr->parameters[paramnr]);
                                         }
 
-                                        elt.itr->GetWittyData(HSVM_CallParam(hsvm, ++paramnr), wes, dataid);
+                                        elt.itr->GetWittyData(HSVM_CallParam(hsvm, paramnr), wes, dataid);
                                 }
 
                                 HSVM_ScheduleCallback_cpp(hsvm, reschedule);
@@ -1542,7 +1709,7 @@ std::pair< bool/*finished*/, bool/*success*/ > ParsedPart::SM_PrintCell(WittyExe
 //        return std::make_pair(true, true); //continue
 }
 
-bool ParsedFile::SM_ScheduleRunComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, std::string const &componentname, HSVM_VariableId var)
+bool ParsedFile::SM_ScheduleRunComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, std::string const &componentname, HSVM_VariableId var) const
 {
         Components::const_iterator component = start_positions.find(componentname);
         if (component == start_positions.end())
@@ -1595,7 +1762,7 @@ std::pair< bool/*finished*/, bool/*success*/ > ParsedPart::SM_Embed(WittyExecuti
 // Harescript access functions
 //
 
-void RunContinue(HSVM *hsvm, ParsedFile *parsedfile, bool is_unwinding)
+void RunContinue(HSVM *hsvm, ParsedFile const *parsedfile, bool is_unwinding)
 {
         Context &context = *static_cast<Context*>(HSVM_GetContext(hsvm,ContextId, true));
 
@@ -1697,8 +1864,8 @@ void ExecuteComponent(HSVM *hsvm)
 
         Blex::ToUppercase(component.begin(), component.end());
 
-        ParsedFile &parsedfile = *context.parsedfiles[parsedid-1];
-        std::deque<ParsedPart>::const_iterator itr = parsedfile.parts.begin(), end = parsedfile.parts.end();
+        ParsedFile const &parsedfile = *context.parsedfiles[parsedid-1];
+        ParsedFile::PartItr itr = parsedfile.parts.begin(), end = parsedfile.parts.end();
 
         std::shared_ptr< WittyExecutionState > wes;
         wes.reset(new WittyExecutionState(parsedfile, hsvm, parsedid, newwitty));
@@ -1755,7 +1922,7 @@ void HasWittyComponent(HSVM *hsvm, HSVM_VariableId id_set)
         }
         std::string componentname = HSVM_StringGetSTD(hsvm, HSVM_Arg(1));
 
-        ParsedFile &parsedfile = *context.parsedfiles[parsedid-1];
+        ParsedFile const &parsedfile = *context.parsedfiles[parsedid-1];
         ParsedFile::Components::const_iterator component = parsedfile.start_positions.find(componentname);
         HSVM_BooleanSet(hsvm, id_set, component != parsedfile.start_positions.end());
 
@@ -1822,8 +1989,8 @@ void CallWithWittyContext(HSVM *hsvm, HSVM_VariableId id_set)
 
 //        Blex::ToUppercase(component.begin(), component.end());
 
-        ParsedFile &parsedfile = *context.parsedfiles[parsedid-1];
-        std::deque<ParsedPart>::const_iterator itr = parsedfile.parts.begin();
+        ParsedFile const &parsedfile = *context.parsedfiles[parsedid-1];
+        ParsedFile::PartItr itr = parsedfile.parts.begin();
 
         std::shared_ptr< WittyExecutionState > wes;
         wes.reset(new WittyExecutionState(parsedfile, hsvm, parsedid, newwitty));
@@ -1917,6 +2084,18 @@ void GetWittyTidRawData(HSVM *hsvm, HSVM_VariableId id_set)
         }
 }
 
+//RECORD FUNCTION __GETWITTYCACHESTATISTICS() ATTRIBUTES(EXTERNAL)
+void GetWittyCacheStatistics(HSVM *hsvm, HSVM_VariableId id_set)
+{
+        ParsedFileCache::Statistics stats = ParsedFileCache::GetStatistics();
+
+        HSVM_SetDefault(hsvm, id_set, HSVM_VAR_Record);
+        HSVM_Integer64Set(hsvm, HSVM_RecordCreate(hsvm, id_set, HSVM_GetColumnId(hsvm, "HITS")), stats.hits);
+        HSVM_Integer64Set(hsvm, HSVM_RecordCreate(hsvm, id_set, HSVM_GetColumnId(hsvm, "MISSES")), stats.misses);
+        HSVM_IntegerSet(hsvm, HSVM_RecordCreate(hsvm, id_set, HSVM_GetColumnId(hsvm, "ENTRIES")), stats.entries);
+        HSVM_Integer64Set(hsvm, HSVM_RecordCreate(hsvm, id_set, HSVM_GetColumnId(hsvm, "SOURCESIZE")), stats.sourcesize);
+}
+
 
 } // End of namespace Wte
 } // End of namespace HareScript
@@ -1941,6 +2120,7 @@ BLEXLIB_PUBLIC int WittyEntryPoint(HSVM_RegData *regdata,void*)
         HSVM_RegisterFunction(regdata, "__PARSEWITTY::I:SSS", HareScript::Witty::Parse);
         HSVM_RegisterFunction(regdata, "__PARSEWITTYBLOB::I:XSS", HareScript::Witty::ParseBlob);
         HSVM_RegisterFunction(regdata, "__GETWITTYPARSEERRORS::RA:", HareScript::Witty::GetWittyParseErrors);
+        HSVM_RegisterFunction(regdata, "__GETWITTYCACHESTATISTICS::R:", HareScript::Witty::GetWittyCacheStatistics);
         HSVM_RegisterFunction(regdata, "__HASWITTYCOMPONENT::B:IS", HareScript::Witty::HasWittyComponent);
         HSVM_RegisterFunction(regdata, "GETWITTYVARIABLE::V:S", HareScript::Witty::GetWittyVariable);
         HSVM_RegisterFunction(regdata, "__CALLWITHWITTYCONTEXT::V:IPR", HareScript::Witty::CallWithWittyContext);
@@ -2,11 +2,17 @@
 #define harescript_modules_wte_wte_provider
 
 #include <blex/context.h>
+#include <blex/threads.h>
 #include <harescript/vm/hsvm_dllinterface.h>
 #include <harescript/vm/hsvm_idmapstorage.h>
 
 namespace HareScript
 {
+namespace ColumnNames
+{
+class GlobalMapper;
+}
+
 namespace Witty
 {
 struct Context;
@@ -84,6 +90,15 @@ enum ContentEncoding
 
 struct StackElement;
 
+/// Reference to a (sub)cell, as a range of column ids in ParsedFile::cellpaths
+struct CellPath
+{
+        CellPath() : pos(0), len(0) { }
+
+        unsigned pos;
+        unsigned len;
+};
+
 struct ParsedPart
 {
         enum Type
@@ -124,6 +139,10 @@ struct ParsedPart
         unsigned content_len;
         bool ifnot;
         std::vector< std::string > parameters;
+        ///Resolved cell for cell data, ifs and forevery's
+        CellPath cell;
+        ///Resolved cells for the gettid parameters, excluding the tid
+        std::vector< CellPath > parametercells;
 
 //        bool PrintCell(WittyExecutionState *wes, HSVM_VariableId var) const;
 
@@ -140,7 +159,7 @@ struct ParsedFile
         ParsedFile(std::string const &gettidmodule, EncodingStyles es);
         ~ParsedFile();
 
-        typedef std::deque<ParsedPart> Parts;
+        typedef std::vector<ParsedPart> Parts;
         typedef Parts::const_iterator PartItr;
         typedef std::map<std::string, unsigned> Components;
 
@@ -149,9 +168,12 @@ struct ParsedFile
         Parts parts;
         ///Store global printable data. (ADDME: Performs poorly when resizing, but the original content std::string is even worse)
         std::vector<char> printdata;
-        std::stack<ParsedPart*> blockstack;
+        ///Positions of the parts that started the currently open blocks while parsing
+        std::stack<unsigned> blockstack;
         Components start_positions;
         std::string const gettidmodule;
+        ///Column ids of all resolved cell references
+        std::vector< HSVM_ColumnId > cellpaths;
 
         void AddContentChar(unsigned linenum, unsigned columnnum, uint8_t ch)
         {
@@ -174,16 +196,26 @@ struct ParsedFile
 
         void AddInstruction(unsigned linenum, unsigned columnnum, char const *start, char const *limit, ContentEncoding suggested_encoding, ParserStates *state);
 
+        /** Resolve the names of all referenced cells to column ids, so they don't need to be looked
+            up by name when running */
+        void ResolveCells(HSVM *hsvm);
+        CellPath ResolveCell(HSVM *hsvm, std::string const &name);
+
+        HSVM_ColumnId const * GetCellPath(CellPath const &cell) const
+        {
+                return cellpaths.data() + cell.pos;
+        }
+
         bool Run(WittyExecutionState *wes, PartItr begin, PartItr limit) const;
         bool RunComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, std::string const &component) const;
         bool ExecuteIf(WittyExecutionState *wes, PartItr itr, HSVM_VariableId var) const;
 
-        void SM_Push(WittyExecutionState *wes, bool new_invocation, ParsedFile::PartItr itr, ParsedFile::PartItr limit, HSVM_VariableId var, bool copy_var, ParsedPart const *forevery_nonra);
-        void SM_PushComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, bool new_invocation, std::string const &componentname);
-        bool SM_FinishGetTidCall(WittyExecutionState *wes, HSVM_VariableId retval);
+        void SM_Push(WittyExecutionState *wes, bool new_invocation, ParsedFile::PartItr itr, ParsedFile::PartItr limit, HSVM_VariableId var, bool copy_var, ParsedPart const *forevery_nonra) const;
+        void SM_PushComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, bool new_invocation, std::string const &componentname) const;
+        bool SM_FinishGetTidCall(WittyExecutionState *wes, HSVM_VariableId retval) const;
         bool SM_EvaluateIf(HSVM *hsvm, WittyExecutionState *wes, HSVM_VariableId varid) const;
-        std::pair< bool/*finished*/, bool/*success*/ > SM_Run(WittyExecutionState *wes, std::function< void(bool) > const &reschedule);
-        bool SM_ScheduleRunComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, std::string const &componentname, HSVM_VariableId var);
+        std::pair< bool/*finished*/, bool/*success*/ > SM_Run(WittyExecutionState *wes, std::function< void(bool) > const &reschedule) const;
+        bool SM_ScheduleRunComponent(unsigned linenum, unsigned columnnum, WittyExecutionState *wes, std::string const &componentname, HSVM_VariableId var) const;
 
         void EnumerateCells(HSVM *vm, HSVM_VariableId var);
 };
@@ -217,32 +249,32 @@ struct StackElement
 
 struct VarStackElement
 {
-        VarStackElement() : forevery_nonra(NULL)
+        VarStackElement() : forevery_nonra(0)
         {
         }
-        VarStackElement(ParsedPart const *forevery_nonra, HSVM_VariableId var)
+        VarStackElement(HSVM_ColumnId forevery_nonra, HSVM_VariableId var)
         : forevery_nonra(forevery_nonra)
         , var(var)
         {
 
         }
 
-        ///Element copntaining the name of the non-record forevery array, if any
-        ParsedPart const *forevery_nonra;
-        //Variable id with current value (of type record, if forevery_nonra==NULL)
+        ///Last part of the name of the non-record forevery array, if any
+        HSVM_ColumnId forevery_nonra;
+        //Variable id with current value (of type record, if forevery_nonra==0)
         HSVM_VariableId var;
 };
 
 struct WittyExecutionState
 {
-        WittyExecutionState(ParsedFile &file, HSVM *hsvm, int32_t scriptid, bool newwitty);
+        WittyExecutionState(ParsedFile const &file, HSVM *hsvm, int32_t scriptid, bool newwitty);
 
         void Init(HSVM_VariableId var);
         void SM_Init(HSVM_VariableId var);
         void PrintEncoded(Blex::StringPair data,ContentEncoding encoding);
         void Clear();
 
-        ParsedFile &file;
+        ParsedFile const &file;
         HSVM *const hsvm;
         HSVM_VariableId gettidfunc;
         HSVM_VariableId gethtmltidfunc;
@@ -251,8 +283,8 @@ struct WittyExecutionState
 //        unsigned curforevery_element;
         std::vector< VarStackElement > varstack;
 
-        // List, to get rid of reallocation stuff
-        std::list< StackElement > stack;
+        // Only the last element may be referenced when pushing new elements
+        std::vector< StackElement > stack;
 
         std::vector<char> scratchpad;
         bool newwitty;
@@ -275,7 +307,72 @@ struct Error
         std::string arg2;
 };
 
-typedef std::shared_ptr<ParsedFile> ParsedFilePtr;
+typedef std::shared_ptr<ParsedFile const> ParsedFilePtr;
+
+/** Process-wide cache of parsed templates. Parsed files aren't modified after parsing, so all VMs
+    parsing the same template share a single copy; only the WittyExecutionState is kept per VM.
+    Templates are identified by their source, encoding and gettid module, so a template that has
+    been modified is parsed again. Parsed files contain column ids, so they are only shared between
+    VMs with the same column name mapper. Mappers are identified by their id, which (unlike their
+    address) isn't reused, so a new mapper never gets the templates of a destroyed one.
+
+    Multithreading considerations:
+    All functions are thread-safe
+*/
+class ParsedFileCache
+{
+    public:
+        struct Statistics
+        {
+                ///Number of parses that were answered from the cache
+                uint64_t hits;
+                ///Number of parses of templates that weren't in the cache
+                uint64_t misses;
+                ///Number of cached templates
+                unsigned entries;
+                ///Total size of the sources of the cached templates
+                uint64_t sourcesize;
+        };
+
+        /** Look up a parsed template, counting a hit or a miss
+            @return The parsed template, empty if it isn't cached */
+        static ParsedFilePtr Lookup(ColumnNames::GlobalMapper const *columnmapper, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule);
+
+        /** Add a parsed template. The least recently used templates are removed when the cache grows too large */
+        static void Insert(ColumnNames::GlobalMapper const *columnmapper, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule, ParsedFilePtr const &file);
+
+        static Statistics GetStatistics();
+
+    private:
+        struct Entry
+        {
+                uint64_t columnmapperid;
+                size_t hash;
+                std::string source;
+                Encoding encoding;
+                std::string gettidmodule;
+                ParsedFilePtr file;
+        };
+
+        struct Data
+        {
+                Data() : hits(0), misses(0), sourcesize(0) { }
+
+                ///Cached templates, most recently used first
+                std::list< Entry > entries;
+                std::unordered_multimap< size_t, std::list< Entry >::iterator > index;
+                uint64_t hits;
+                uint64_t misses;
+                uint64_t sourcesize;
+        };
+
+        typedef Blex::InterlockedData< Data, Blex::Mutex > LockedData;
+
+        static size_t GetHash(uint64_t columnmapperid, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule);
+        static std::list< Entry >::iterator Find(Data &data, size_t hash, uint64_t columnmapperid, Blex::StringPair source, Encoding encoding, std::string const &gettidmodule);
+
+        static LockedData data;
+};
 
 struct Context
 {
@@ -291,7 +388,10 @@ struct Context
         HSVM_VariableId globalgethtmltid;
 
         void AddError(Error const &Err);
-        int32_t ParseXmlTemplate(char const *data, unsigned datalen, Encoding encodingstyle, std::string const &gettidmodule);
+        int32_t ParseXmlTemplate(HSVM *hsvm, char const *data, unsigned datalen, Encoding encodingstyle, std::string const &gettidmodule);
+
+    private:
+        std::shared_ptr< ParsedFile > DoParseXmlTemplate(HSVM *hsvm, char const *data, unsigned datalen, Encoding encodingstyle, std::string const &gettidmodule);
 };
 
 } // End of namespace Wte
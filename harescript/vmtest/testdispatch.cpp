@@ -0,0 +1,55 @@
+//---------------------------------------------------------------------------
+#include <harescript/vm/allincludes.h>
+
+
+#include <blex/testing.h>
+#include "vmtest.h"
+
+namespace
+{
+
+// Tight loop exercising jumps, local loads/stores, arithmetic and record cell access
+const char dispatchbench_script[] =
+        "<?wh\n"
+        "INTEGER total;\n"
+        "RECORD rec := [ a := 1, b := 2 ];\n"
+        "FOR (INTEGER i := 0; i < 2000000; i := i + 1)\n"
+        "{\n"
+        "  IF (i % 3 = 0)\n"
+        "    total := total + rec.a;\n"
+        "  ELSE\n"
+        "    total := total - rec.b;\n"
+        "}\n"
+        "IF (total != -1999999)\n"
+        "  ABORT(\"Wrong result\");\n";
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(DispatchBenchmark)
+{
+        /* Measures the raw instruction throughput of the interpreter loop. Compare the
+           numbers of a normal build with a build with -DHSVM_NO_THREADED_DISPATCH to see
+           the effect of threaded dispatch.
+        */
+        if (!VMTest::run_benchmarks)
+            return;
+
+        VMTest::TestScript script("dispatchbench.whscr", dispatchbench_script);
+        script.Compile();
+
+        HareScript::ProfileData profile;
+        uint64_t elapsed = script.Run(&profile);
+
+        uint64_t instructions = profile.instructions_executed;
+        double seconds = static_cast< double >(elapsed) / Blex::GetSystemTickFrequency();
+
+#ifdef HSVM_THREADED_DISPATCH
+        std::cout << "Dispatch: threaded\n";
+#else
+        std::cout << "Dispatch: switch\n";
+#endif
+        std::cout << "Executed " << instructions << " instructions in " << seconds << " s";
+        if (seconds > 0)
+            std::cout << ", " << static_cast< uint64_t >(instructions / seconds) << " instructions/sec";
+        std::cout << std::endl;
+}
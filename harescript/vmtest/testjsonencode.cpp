@@ -0,0 +1,56 @@
+//---------------------------------------------------------------------------
+#include <harescript/vm/allincludes.h>
+
+
+#include <blex/testing.h>
+#include "vmtest.h"
+
+namespace
+{
+
+const unsigned jsonencodebench_records = 10000;
+const unsigned jsonencodebench_rounds = 50;
+
+// Encodes an array of records with mixed column types, like an API response would contain
+const char jsonencodebench_script[] =
+        "<?wh\n"
+        "RECORD ARRAY rows;\n"
+        "FOR (INTEGER i := 0; i < 10000; i := i + 1)\n"
+        "  INSERT [ id := i\n"
+        "         , title := \"Record title \" || i\n"
+        "         , description := \"A somewhat longer description, with \\\"quotes\\\" and </tags> in it, for record \" || i\n"
+        "         , name := \"caf\\u00E9 \" || i\n"
+        "         , size := i * 1024i64\n"
+        "         , published := i % 2 = 0\n"
+        "         , price := i * 0.25m\n"
+        "         , tags := [ \"first\", \"second\", \"third\" ]\n"
+        "         ] INTO rows AT END;\n"
+        "INTEGER total;\n"
+        "FOR (INTEGER round := 0; round < 50; round := round + 1)\n"
+        "  total := total + LENGTH(EncodeJSON(rows));\n"
+        "IF (total != 50 * LENGTH(EncodeJSON(rows)) OR total < 50 * 10000 * 200)\n"
+        "  ABORT(\"Wrong result\");\n";
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(JSONEncodeBenchmark)
+{
+        /* Measures the throughput of EncodeJSON on a large array of records
+        */
+        if (!VMTest::run_benchmarks)
+            return;
+
+        VMTest::TestScript script("jsonencodebench.whscr", jsonencodebench_script);
+        script.Compile();
+
+        uint64_t elapsed = script.Run();
+
+        // Includes building the array, which takes a fraction of the encoding time
+        uint64_t records = uint64_t(jsonencodebench_records) * jsonencodebench_rounds;
+        double seconds = static_cast< double >(elapsed) / Blex::GetSystemTickFrequency();
+
+        std::cout << "Encoded " << records << " records in " << seconds << " s";
+        if (seconds > 0)
+            std::cout << ", " << static_cast< uint64_t >(records / seconds) << " records/sec";
+        std::cout << std::endl;
+}
@@ -0,0 +1,75 @@
+//---------------------------------------------------------------------------
+#include <harescript/vm/allincludes.h>
+
+
+#include <blex/testing.h>
+#include <blex/path.h>
+#include <harescript/vm/hsvm_environment.h>
+#include <harescript/vm/filesystem.h>
+#include <harescript/compiler/diskfilesystem.h>
+#include "vmtest.h"
+
+namespace
+{
+
+void WriteTestLibrary(std::string const &path, std::string const &version, Blex::DateTime modtime)
+{
+        std::unique_ptr< Blex::FileStream > lib(Blex::FileStream::OpenWrite(path, true, false, Blex::FilePermissions::PublicRead));
+        BLEX_TEST_CHECK(lib.get());
+        lib->WriteString("<?wh\nPUBLIC STRING FUNCTION GetVersion() { RETURN \"" + version + "\"; }\n");
+        lib->SetFileLength(lib->GetOffset());
+        lib.reset();
+
+        BLEX_TEST_CHECK(Blex::SetFileModificationDate(path, modtime));
+}
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(LibraryCacheInvalidation)
+{
+        /* Tests that a modified library is reloaded, also after the library has been
+           validated and lookups don't check its files anymore
+        */
+        std::string tempdir = Blex::Test::GetTempDir();
+        std::string libpath = Blex::MergePath(tempdir, "libcachetest.whlib");
+        std::string liburi = "direct::" + libpath;
+
+        Blex::DateTime now = Blex::DateTime::Now();
+        Blex::DateTime modtime = Blex::DateTime(now.GetDays(), (now.GetMsecs() / 1000) * 1000) - Blex::DateTime::Minutes(5);
+        WriteTestLibrary(libpath, "1", modtime);
+
+        //Setup the file system
+        HareScript::DiskFileSystem filesystem(tempdir, tempdir, "", Blex::MergePath(VMTest::srcdir, "whtree/modules/system/whres"));
+        filesystem.SetupNamespace("wh", Blex::MergePath(VMTest::srcdir, "whtree/modules/system/whlibs"));
+        filesystem.SetupDynamicModulePath(VMTest::moduledir);
+
+        HareScript::GlobalBlobManager blobmgr(Blex::GetSystemTempDir());
+        Blex::NotificationEventManager eventmgr;
+        HareScript::Environment environment(eventmgr, filesystem, blobmgr);
+        Blex::ContextKeeper keeper(environment.GetContextReg());
+
+        // The first load compiles the library
+        HareScript::ErrorHandler handler;
+        HareScript::Library const *lib = environment.GetLibRef(keeper, liburi, handler);
+        HareScript::LibraryCompileIds ids = lib->GetLibraryCompileIds();
+        BLEX_TEST_CHECKEQUAL(modtime, ids.sourcetime);
+        environment.ReleaseLibRef(lib);
+
+        // Libraries that were loaded less than a second ago aren't checked. Wait, so the next lookup validates the files
+        Blex::SleepThread(1100);
+        for (unsigned i = 0; i < 3; ++i)
+        {
+                lib = environment.GetLibRef(keeper, liburi, handler);
+                BLEX_TEST_CHECKEQUAL(ids.clib_id, lib->GetLibraryCompileIds().clib_id);
+                environment.ReleaseLibRef(lib);
+        }
+
+        // Modify the library. The next lookup after the check delay must see the new version
+        WriteTestLibrary(libpath, "2", modtime + Blex::DateTime::Minutes(1));
+        Blex::SleepThread(1100);
+
+        lib = environment.GetLibRef(keeper, liburi, handler);
+        BLEX_TEST_CHECKEQUAL(modtime + Blex::DateTime::Minutes(1), lib->GetLibraryCompileIds().sourcetime);
+        BLEX_TEST_CHECK(ids.clib_id != lib->GetLibraryCompileIds().clib_id);
+        environment.ReleaseLibRef(lib);
+}
@@ -59,7 +59,7 @@ BLEX_TEST_FUNCTION(LockWhileWaiting)
         // Setup the script
         HareScript::GlobalBlobManager blobmgr(Blex::GetSystemTempDir());
         Blex::NotificationEventManager eventmgr;
-        HareScript::Environment environment(eventmgr, filesystem, blobmgr, false);
+        HareScript::Environment environment(eventmgr, filesystem, blobmgr);
         HareScript::JobManager jobmgr(environment);
         jobmgr.Start(1, 0);
 
@@ -113,3 +113,80 @@ BLEX_TEST_FUNCTION(LockWhileWaiting)
 
         jobmgr.ReleaseVMGroup(cif);
 }
+
+BLEX_TEST_FUNCTION(SchedulerMixedPriorities)
+{
+        /* Runs a batch of scripts with mixed priorities on more workers than reserved
+           for high-priority groups, which must all finish and be accounted for in the
+           scheduling statistics of their priority class. The low-priority groups may
+           never occupy the reserved worker
+        */
+        const unsigned numgroups = 64;
+
+        std::string tempdir = Blex::Test::GetTempDir();
+        std::string scriptpath = Blex::MergePath(tempdir, "schedulertest.whscr");
+        std::string scripturi = "direct::" + scriptpath;
+
+        {
+                std::unique_ptr< Blex::FileStream > script(Blex::FileStream::OpenWrite(scriptpath, true, false, Blex::FilePermissions::PublicRead));
+                BLEX_TEST_CHECK(script.get());
+                script->WriteString("<?wh\nINTEGER total;\nFOR (INTEGER i := 0; i < 20000; i := i + 1)\n  total := total + i;\nIF (total != 199990000)\n  ABORT(\"Wrong result\");\n");
+                script->SetFileLength(script->GetOffset());
+        }
+
+        //Setup the file system
+        HareScript::DiskFileSystem filesystem(tempdir, tempdir, "", Blex::MergePath(VMTest::srcdir, "whtree/modules/system/whres"));
+        filesystem.SetupNamespace("wh", Blex::MergePath(VMTest::srcdir, "whtree/modules/system/whlibs"));
+        filesystem.SetupDynamicModulePath(VMTest::moduledir);
+
+        HareScript::GlobalBlobManager blobmgr(Blex::GetSystemTempDir());
+        Blex::NotificationEventManager eventmgr;
+        HareScript::Environment environment(eventmgr, filesystem, blobmgr);
+        HareScript::JobManager jobmgr(environment);
+        jobmgr.Start(4, 1);
+
+        std::vector< HareScript::VMGroup * > groups;
+        for (unsigned i = 0; i < numgroups; ++i)
+        {
+                HareScript::VMGroup *cif = jobmgr.CreateVMGroup(i % 2 == 0);
+                HSVM *myvm = cif->CreateVirtualMachine();
+
+                std::vector<std::string> args;
+                cif->SetupConsole(myvm, args);
+
+                bool any_errors = !HSVM_LoadScript(myvm, scripturi.c_str());
+                if (any_errors)
+                    ShowErrors(cif->GetErrorHandler());
+                BLEX_TEST_CHECKEQUAL(false, any_errors);
+
+                groups.push_back(cif);
+        }
+
+        for (auto cif: groups)
+            jobmgr.StartVMGroup(cif);
+
+        for (auto cif: groups)
+        {
+                jobmgr.WaitFinished(cif);
+
+                if (cif->GetErrorHandler().AnyErrors())
+                    ShowErrors(cif->GetErrorHandler());
+                BLEX_TEST_CHECKEQUAL(false, cif->GetErrorHandler().AnyErrors());
+
+                jobmgr.ReleaseVMGroup(cif);
+        }
+
+        HareScript::SchedulingStats highpriority, lowpriority;
+        jobmgr.GetSchedulingStats(&highpriority, &lowpriority);
+        BLEX_TEST_CHECK(highpriority.scheduled >= numgroups / 2);
+        BLEX_TEST_CHECK(lowpriority.scheduled >= numgroups / 2);
+        BLEX_TEST_CHECK(highpriority.maxwait * highpriority.scheduled >= highpriority.totalwait);
+        BLEX_TEST_CHECK(lowpriority.maxwait * lowpriority.scheduled >= lowpriority.totalwait);
+        BLEX_TEST_CHECK(lowpriority.maxrunning >= 1);
+        BLEX_TEST_CHECK(lowpriority.maxrunning <= 3);
+        BLEX_TEST_CHECK(highpriority.maxrunning <= 4);
+
+        if (VMTest::run_benchmarks)
+            std::cout << "Average scheduling latency: high priority " << highpriority.totalwait / highpriority.scheduled << " us (max " << highpriority.maxwait << " us)"
+                      << ", low priority " << lowpriority.totalwait / lowpriority.scheduled << " us (max " << lowpriority.maxwait << " us)" << std::endl;
+}
@@ -4,6 +4,7 @@
 
 #include <blex/testing.h>
 #include <harescript/vm/sharedpool.h>
+#include "vmtest.h"
 
 using HareScript::SharedPool;
 static const char abcdata[13]={"abcdefghijkl"};
@@ -27,3 +28,134 @@ BLEX_TEST_FUNCTION(BasicTest)
         //SharedPool::Allocation bigbuf = shpl.Allocate(SharedPool::PoolMinSize + 1, SharedPool::PoolMinSize + 1);
 }
 
+
+BLEX_TEST_FUNCTION(SlabTest)
+{
+        HareScript::SlabSharedPool shpl;
+
+        HareScript::SlabSharedPool::Allocation buf = shpl.Allocate(13,32);
+        BLEX_TEST_CHECKEQUAL(13, shpl.GetBufferSize(buf));
+        BLEX_TEST_CHECKEQUAL(0, reinterpret_cast< uintptr_t >(shpl.GetReadPtr(buf)) % 8);
+        std::memcpy(shpl.GetWritePtr(buf), abcdata, 13);
+        void const *bufptr = shpl.GetReadPtr(buf);
+
+        //Growing within the reserved size keeps the slot
+        BLEX_TEST_CHECKEQUAL(buf, shpl.MakePrivate(buf, 32, true));
+
+        //Pointers stay valid while other allocations are made and released
+        std::vector< HareScript::SlabSharedPool::Allocation > others;
+        for (unsigned i = 0; i < 20000; ++i)
+            others.push_back(shpl.Allocate(i % 300, i % 300));
+        for (unsigned i = 0; i < others.size(); i += 2)
+            shpl.ReleaseReference(others[i]);
+        BLEX_TEST_CHECK(bufptr == shpl.GetReadPtr(buf));
+        BLEX_TEST_CHECK(std::memcmp(bufptr, abcdata, 13) == 0);
+
+        //Shared buffers are copied when made private
+        shpl.DuplicateReference(buf);
+        BLEX_TEST_CHECK(shpl.IsShared(buf));
+        HareScript::SlabSharedPool::Allocation copy = shpl.MakePrivate(buf, 13, true);
+        BLEX_TEST_CHECK(copy != buf);
+        BLEX_TEST_CHECK(!shpl.IsShared(buf));
+        BLEX_TEST_CHECK(!shpl.IsShared(copy));
+        BLEX_TEST_CHECK(std::memcmp(shpl.GetReadPtr(copy), abcdata, 13) == 0);
+
+        //Buffers bigger than the size classes
+        HareScript::SlabSharedPool::Allocation big = shpl.MakePrivate(copy, 100000, true);
+        BLEX_TEST_CHECKEQUAL(100000, shpl.GetBufferSize(big));
+        BLEX_TEST_CHECK(std::memcmp(shpl.GetReadPtr(big), abcdata, 13) == 0);
+        static_cast< uint8_t * >(shpl.GetWritePtr(big))[99999] = 1;
+
+        //Releasing everything must release the slabs, except one per size class
+        unsigned maxcapacity = shpl.GetCapacity();
+        for (unsigned i = 1; i < others.size(); i += 2)
+            shpl.ReleaseReference(others[i]);
+        shpl.ReleaseReference(big);
+        shpl.ReleaseReference(buf);
+        BLEX_TEST_CHECK(shpl.GetCapacity() < maxcapacity / 2);
+}
+
+namespace
+{
+
+/** Simulates the allocation pattern of a script: mostly small buffers that are
+    duplicated, released and grown, with an occasional big one.
+    @param live Variables, receives the allocations that are still live at the end
+    @return Number of operations executed */
+template < class Pool > unsigned RunSharedPoolBenchmark(Pool &pool, std::vector< typename Pool::Allocation > &live, unsigned rounds)
+{
+        uint32_t seed = 12345;
+        unsigned ops = 0;
+        for (unsigned round = 0; round < rounds; ++round)
+        {
+                for (unsigned i = 0; i < live.size(); ++i, ++ops)
+                {
+                        seed = seed * 1103515245 + 12345;
+                        unsigned rnd = seed >> 8;
+                        typename Pool::Allocation &slot = live[rnd % live.size()];
+                        if (slot == Pool::AllocationUnused)
+                        {
+                                unsigned size = (rnd >> 12) % 64 == 0 ? (rnd >> 4) % 16384 : (rnd >> 4) % 96;
+                                slot = pool.Allocate(size, size);
+                                std::memset(pool.GetWritePtr(slot), 0, size);
+                                continue;
+                        }
+                        switch ((rnd >> 12) % 4)
+                        {
+                        case 0: // Copy the variable to another slot
+                            {
+                                    typename Pool::Allocation &dest = live[(rnd >> 16) % live.size()];
+                                    pool.DuplicateReference(slot);
+                                    if (dest != Pool::AllocationUnused)
+                                        pool.ReleaseReference(dest);
+                                    dest = slot;
+                            } break;
+                        case 1: // Append to it
+                            {
+                                    unsigned oldsize = pool.GetBufferSize(slot);
+                                    slot = pool.MakePrivate(slot, oldsize + 8, true);
+                                    std::memset(static_cast< uint8_t * >(pool.GetWritePtr(slot)) + oldsize, 1, 8);
+                            } break;
+                        default:
+                            pool.ReleaseReference(slot);
+                            slot = Pool::AllocationUnused;
+                        }
+                }
+        }
+        return ops;
+}
+
+template < class Pool > void BenchSharedPool(char const *name)
+{
+        const unsigned rounds = 2000;
+
+        Pool pool;
+        std::vector< typename Pool::Allocation > live(4096, Pool::AllocationUnused);
+        uint64_t start = Blex::GetSystemCurrentTicks();
+        unsigned ops = RunSharedPoolBenchmark(pool, live, rounds);
+        uint64_t elapsed = Blex::GetSystemCurrentTicks() - start;
+        double seconds = static_cast< double >(elapsed) / Blex::GetSystemTickFrequency();
+
+        std::cout << name << ": " << ops << " operations in " << seconds << " s";
+        if (seconds > 0)
+            std::cout << ", " << static_cast< uint64_t >(ops / seconds) << " ops/sec";
+        std::cout << ", capacity " << (pool.GetCapacity() + 1023) / 1024 << " KB" << std::endl;
+
+        for (auto &slot: live)
+            if (slot != Pool::AllocationUnused)
+                pool.ReleaseReference(slot);
+}
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(SharedPoolBenchmark)
+{
+        /* Compares the allocation speed and the memory use of the SharedPool and
+           SlabSharedPool backends
+        */
+        if (!VMTest::run_benchmarks)
+            return;
+
+        BenchSharedPool< SharedPool >("SharedPool");
+        BenchSharedPool< HareScript::SlabSharedPool >("SlabSharedPool");
+}
@@ -0,0 +1,51 @@
+//---------------------------------------------------------------------------
+#include <harescript/vm/allincludes.h>
+
+
+#include <blex/testing.h>
+#include "vmtest.h"
+
+namespace
+{
+
+const unsigned vmstartupbench_runs = 5000;
+
+// Loads a set of libraries with a fair amount of initialization code, does (almost) nothing itself
+const char vmstartupbench_script[] =
+        "<?wh\n"
+        "LOADLIB \"wh::datetime.whlib\";\n"
+        "LOADLIB \"wh::money.whlib\";\n"
+        "LOADLIB \"wh::float.whlib\";\n"
+        "LOADLIB \"wh::regex.whlib\";\n"
+        "IF (GetDayCount(MakeDate(2000, 1, 1)) <= 0)\n"
+        "  ABORT(\"Wrong result\");\n";
+
+} // End of anonymous namespace
+
+BLEX_TEST_FUNCTION(VMStartupBenchmark)
+{
+        /* Measures how many short scripts can be started per second, which is
+           dominated by the creation of the VM and the initialization of its libraries
+        */
+        if (!VMTest::run_benchmarks)
+            return;
+
+        VMTest::TestScript script("vmstartupbench.whscr", vmstartupbench_script);
+
+        uint64_t start = 0;
+        for (unsigned i = 0; i <= vmstartupbench_runs; ++i)
+        {
+                // The first run compiles and links the libraries, don't measure it
+                if (i == 1)
+                    start = Blex::GetSystemCurrentTicks();
+
+                script.Run();
+        }
+        uint64_t elapsed = Blex::GetSystemCurrentTicks() - start;
+        double seconds = static_cast< double >(elapsed) / Blex::GetSystemTickFrequency();
+
+        std::cout << "Started " << vmstartupbench_runs << " scripts in " << seconds << " s";
+        if (seconds > 0)
+            std::cout << ", " << static_cast< uint64_t >(vmstartupbench_runs / seconds) << " scripts/sec";
+        std::cout << std::endl;
+}
@@ -4,12 +4,80 @@
 #include <blex/testing.h>
 #include <blex/utils.h>
 #include <blex/getopt.h>
+#include <harescript/compiler/engine.h>
+#include <harescript/compiler/compilecontrol.h>
 
 namespace VMTest
 {
 
 std::string srcdir;
 std::string moduledir;
+bool run_benchmarks = false;
+
+TestScript::TestScript(std::string const &name, const char *scripttext)
+: scriptpath(Blex::MergePath(Blex::Test::GetTempDir(), name))
+, scripturi("direct::" + scriptpath)
+, filesystem(Blex::Test::GetTempDir(), Blex::Test::GetTempDir(), "", Blex::MergePath(srcdir, "whtree/modules/system/whres"))
+, blobmgr(Blex::GetSystemTempDir())
+, environment(eventmgr, filesystem, blobmgr)
+, jobmgr(environment)
+{
+        std::unique_ptr< Blex::FileStream > script(Blex::FileStream::OpenWrite(scriptpath, true, false, Blex::FilePermissions::PublicRead));
+        BLEX_TEST_CHECK(script.get());
+        script->WriteString(scripttext);
+        script->SetFileLength(script->GetOffset());
+
+        filesystem.SetupNamespace("wh", Blex::MergePath(srcdir, "whtree/modules/system/whlibs"));
+        filesystem.SetupDynamicModulePath(moduledir);
+
+        jobmgr.Start(1, 0);
+}
+
+void TestScript::Compile()
+{
+        HareScript::Compiler::Engine compile_engine(filesystem,"");
+
+        Blex::ContextRegistrator creg;
+        filesystem.Register(creg);
+        Blex::ContextKeeper keeper(creg);
+        HareScript::Compiler::CompileControl control(compile_engine, filesystem);
+
+        control.CompileLibrary(keeper, scripturi);
+
+        if (compile_engine.GetErrorHandler().AnyErrors())
+            ShowErrors(compile_engine.GetErrorHandler());
+
+        BLEX_TEST_CHECKEQUAL(false, compile_engine.GetErrorHandler().AnyErrors());
+}
+
+uint64_t TestScript::Run(HareScript::ProfileData *profile)
+{
+        HareScript::VMGroup *cif = jobmgr.CreateVMGroup(true);
+        HSVM *myvm = cif->CreateVirtualMachine();
+
+        std::vector<std::string> args;
+        cif->SetupConsole(myvm, args);
+
+        bool any_errors = !HSVM_LoadScript(myvm, scripturi.c_str());
+        if (any_errors)
+            ShowErrors(cif->GetErrorHandler());
+        BLEX_TEST_CHECKEQUAL(false, any_errors);
+
+        uint64_t start = Blex::GetSystemCurrentTicks();
+        jobmgr.StartVMGroup(cif);
+        jobmgr.WaitFinished(cif);
+        uint64_t elapsed = Blex::GetSystemCurrentTicks() - start;
+
+        if (cif->GetErrorHandler().AnyErrors())
+            ShowErrors(cif->GetErrorHandler());
+        BLEX_TEST_CHECKEQUAL(false, cif->GetErrorHandler().AnyErrors());
+
+        if (profile)
+            *profile = cif->GetProfileData(myvm);
+
+        jobmgr.ReleaseVMGroup(cif);
+        return elapsed;
+}
 
 } // End of namespace VMTest
 
@@ -18,6 +86,7 @@ void ShowSyntax()
         std::cout << "Syntax: vmtest --srcdir webharesrcdir --moduledir moduledir [options]\n";
         std::cout << " --srcdir: The webhare source directory" << std::endl;
         std::cout << " --moduledir: The harescript modules directory" << std::endl;
+        std::cout << " --benchmarks: Also run the benchmarks" << std::endl;
 }
 
 int UTF8Main(std::vector<std::string> const &args)
@@ -27,6 +96,7 @@ int UTF8Main(std::vector<std::string> const &args)
         Blex::OptionParser::Option optionlist[] = {
                 Blex::OptionParser::Option::StringOpt("srcdir"),
                 Blex::OptionParser::Option::StringOpt("moduledir"),
+                Blex::OptionParser::Option::Switch("benchmarks", false),
                 Blex::OptionParser::Option::Param("options", false),
                 Blex::OptionParser::Option::ListEnd() };
 
@@ -37,6 +107,7 @@ int UTF8Main(std::vector<std::string> const &args)
 
         VMTest::srcdir = Blex::FixupToAbsolutePath(parser.StringOpt("srcdir"));
         VMTest::moduledir = Blex::FixupToAbsolutePath(parser.StringOpt("moduledir"));
+        VMTest::run_benchmarks = parser.Switch("benchmarks");
 
         long options = 0;
         if (parser.Param("options") != "")
@@ -1,6 +1,17 @@
 #ifndef blex_webhare_harescript_vmtest_vmtest
 #define blex_webhare_harescript_vmtest_vmtest
 
+#include <harescript/vm/hsvm_processmgr.h>
+#include <harescript/vm/hsvm_context.h>
+#include <harescript/compiler/diskfilesystem.h>
+
+namespace HareScript
+{
+class ErrorHandler;
+}
+
+/// Print the errors and stack trace from an error handler (defined in testprocessmgr.cpp)
+void ShowErrors(HareScript::ErrorHandler const &handler);
 
 namespace VMTest
 {
@@ -9,6 +20,37 @@ namespace VMTest
 extern std::string srcdir;
 extern std::string moduledir;
 
+/// Whether to run the benchmarks (--benchmarks). They only print timings, so they are skipped by default
+extern bool run_benchmarks;
+
+/** Compiles and runs a script written by a test, in a job manager of its own
+*/
+class TestScript
+{
+    public:
+        /** Writes the script to the temporary directory and starts the job manager
+            @param name Name of the script file
+            @param scripttext Source code of the script */
+        TestScript(std::string const &name, const char *scripttext);
+
+        /// Compiles the script, fails the test on compilation errors
+        void Compile();
+
+        /** Runs the script in a new VM group, fails the test on errors
+            @param profile If not null, receives the profile data of the VM
+            @return Number of ticks between starting the VM group and its finish */
+        uint64_t Run(HareScript::ProfileData *profile = nullptr);
+
+    private:
+        std::string scriptpath;
+        std::string scripturi;
+        HareScript::DiskFileSystem filesystem;
+        HareScript::GlobalBlobManager blobmgr;
+        Blex::NotificationEventManager eventmgr;
+        HareScript::Environment environment;
+        HareScript::JobManager jobmgr;
+};
+
 } // End of namespace VMTest
 
 #endif // sentry: blex_webhare_harescript_vmtest_vmtest